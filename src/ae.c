@@ -78,6 +78,7 @@ aeEventLoop *aeCreateEventLoop(int setsize) {
 	eventLoop->maxfd = -1;
 	eventLoop->beforesleep = NULL;
 	eventLoop->aftersleep = NULL;
+	eventLoop->flags = 0;
 	// 根据引入的文件调用对应函数
 	if (aeApiCreate(eventLoop) == -1) goto err;
 	/* Events with mask == AE_NONE are not set. So let's initialize the
@@ -416,6 +417,12 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
 			}
 		}
 
+		/* beforesleep留下了需要马上处理的工作，只检查已经就绪的事件 */
+		if (eventLoop->flags & AE_DONT_WAIT) {
+			tv.tv_sec = tv.tv_usec = 0;
+			tvp = &tv;
+		}
+
 		/* 调用多路复用API，函数只在超时或者有事件需要执行时返回（底层实现是select） */
 		numevents = aeApiPoll(eventLoop, tvp);
 
@@ -497,3 +504,10 @@ void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep
 void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep) {
 	eventLoop->aftersleep = aftersleep;
 }
+
+void aeSetDontWait(aeEventLoop *eventLoop, int noWait) {
+	if (noWait)
+		eventLoop->flags |= AE_DONT_WAIT;
+	else
+		eventLoop->flags &= ~AE_DONT_WAIT;
+}
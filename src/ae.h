@@ -100,6 +100,7 @@ typedef struct aeEventLoop {
     void *apidata; /* 用于保存轮询API指定数据 */
     aeBeforeSleepProc *beforesleep; // 每次进入select/wait去等待监听事件前调用
     aeBeforeSleepProc *aftersleep; // 每次执行完事件后调用
+    int flags; // AE_DONT_WAIT: 还有不依赖文件事件的工作要做，本轮poll不阻塞
 } aeEventLoop;
 
 /* Prototypes */
@@ -120,6 +121,7 @@ void aeMain(aeEventLoop *eventLoop);
 char *aeGetApiName(void);
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep);
 void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep);
+void aeSetDontWait(aeEventLoop *eventLoop, int noWait);
 int aeGetSetSize(aeEventLoop *eventLoop);
 int aeResizeSetSize(aeEventLoop *eventLoop, int setsize);
 
@@ -140,8 +140,10 @@ static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
 
 			if (e->events & EPOLLIN) mask |= AE_READABLE;
 			if (e->events & EPOLLOUT) mask |= AE_WRITABLE;
-			if (e->events & EPOLLERR) mask |= AE_WRITABLE;
-			if (e->events & EPOLLHUP) mask |= AE_WRITABLE;
+			/* 错误事件同时交给读写两个处理函数，只注册了读事件的fd不会一直被唤醒却没人处理
+			 * （MSG_ZEROCOPY的完成通知也以EPOLLERR的形式报告） */
+			if (e->events & EPOLLERR) mask |= AE_WRITABLE|AE_READABLE;
+			if (e->events & EPOLLHUP) mask |= AE_WRITABLE|AE_READABLE;
 			eventLoop->fired[j].fd = e->data.fd;
 			eventLoop->fired[j].mask = mask;
 		}
@@ -45,8 +45,12 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
 
 #include "anet.h"
+#include "config.h"
 
 static void anetSetError(char *err, const char *fmt, ...)
 {
@@ -246,6 +250,22 @@ static int anetSetReuseAddr(char *err, int fd) {
     return ANET_OK;
 }
 
+/* 同一个地址上的多个监听socket各自有accept队列，由内核分配新连接 */
+static int anetSetReusePort(char *err, int fd) {
+#ifdef SO_REUSEPORT
+    int yes = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1) {
+        anetSetError(err, "setsockopt SO_REUSEPORT: %s", strerror(errno));
+        return ANET_ERR;
+    }
+    return ANET_OK;
+#else
+    ((void) fd);
+    anetSetError(err, "SO_REUSEPORT is not supported on this platform");
+    return ANET_ERR;
+#endif
+}
+
 static int anetCreateSocket(char *err, int domain) {
     int s;
     if ((s = socket(domain, SOCK_STREAM, 0)) == -1) {
@@ -462,7 +482,8 @@ static int anetV6Only(char *err, int s) {
     return ANET_OK;
 }
 
-static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backlog)
+static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backlog,
+                          int flags)
 {
     int s = -1, rv;
     char _port[6];  /* strlen("65535") */
@@ -484,6 +505,8 @@ static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backl
 
         if (af == AF_INET6 && anetV6Only(err,s) == ANET_ERR) goto error;
         if (anetSetReuseAddr(err,s) == ANET_ERR) goto error;
+        if (flags & ANET_REUSEPORT && anetSetReusePort(err,s) == ANET_ERR)
+            goto error;
         if (anetListen(err,s,p->ai_addr,p->ai_addrlen,backlog) == ANET_ERR) goto error;
         goto end;
     }
@@ -502,12 +525,89 @@ end:
 
 int anetTcpServer(char *err, int port, char *bindaddr, int backlog)
 {
-    return _anetTcpServer(err, port, bindaddr, AF_INET, backlog);
+    return _anetTcpServer(err, port, bindaddr, AF_INET, backlog, 0);
 }
 
 int anetTcp6Server(char *err, int port, char *bindaddr, int backlog)
 {
-    return _anetTcpServer(err, port, bindaddr, AF_INET6, backlog);
+    return _anetTcpServer(err, port, bindaddr, AF_INET6, backlog, 0);
+}
+
+int anetTcpReusePortServer(char *err, int port, char *bindaddr, int backlog)
+{
+    return _anetTcpServer(err, port, bindaddr, AF_INET, backlog, ANET_REUSEPORT);
+}
+
+int anetTcp6ReusePortServer(char *err, int port, char *bindaddr, int backlog)
+{
+    return _anetTcpServer(err, port, bindaddr, AF_INET6, backlog, ANET_REUSEPORT);
+}
+
+/*
+ * 给SO_REUSEPORT组挂一个classic BPF程序：处理SYN的CPU对groups取模，
+ * 结果是组内socket的下标（按bind的顺序），同一个CPU收到的连接总是进入同一个监听socket。
+ * fd是组内任意一个socket，程序对整个组生效
+ */
+int anetReusePortSteerByCpu(char *err, int fd, int groups) {
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    struct sock_filter code[] = {
+        /* A = raw_smp_processor_id() */
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+        /* A = A % groups */
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (unsigned int)groups },
+        /* return A */
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog = { sizeof(code)/sizeof(code[0]), code };
+
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                   &prog, sizeof(prog)) == -1)
+    {
+        anetSetError(err, "setsockopt SO_ATTACH_REUSEPORT_CBPF: %s",
+            strerror(errno));
+        return ANET_ERR;
+    }
+    return ANET_OK;
+#else
+    ((void) fd); ((void) groups);
+    anetSetError(err, "SO_ATTACH_REUSEPORT_CBPF is not supported on this platform");
+    return ANET_ERR;
+#endif
+}
+
+/* 没有BPF时的退路：内核查找监听socket时优先选择incoming cpu和当前CPU相同的 */
+int anetSetIncomingCpu(char *err, int fd, int cpu) {
+#if defined(__linux__) && defined(SO_INCOMING_CPU)
+    if (setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == -1) {
+        anetSetError(err, "setsockopt SO_INCOMING_CPU: %s", strerror(errno));
+        return ANET_ERR;
+    }
+    return ANET_OK;
+#else
+    ((void) fd); ((void) cpu);
+    anetSetError(err, "SO_INCOMING_CPU is not supported on this platform");
+    return ANET_ERR;
+#endif
+}
+
+/* 允许在这个socket上使用MSG_ZEROCOPY发送，内核不支持时返回ANET_ERR */
+int anetEnableZeroCopy(char *err, int fd) {
+#ifdef HAVE_MSG_ZEROCOPY
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+    int yes = 1;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &yes, sizeof(yes)) == -1) {
+        anetSetError(err, "setsockopt SO_ZEROCOPY: %s", strerror(errno));
+        return ANET_ERR;
+    }
+    return ANET_OK;
+#else
+    ((void) fd);
+    anetSetError(err, "MSG_ZEROCOPY is not supported on this platform");
+    return ANET_ERR;
+#endif
 }
 
 int anetUnixServer(char *err, char *path, mode_t perm, int backlog)
@@ -529,12 +629,17 @@ int anetUnixServer(char *err, char *path, mode_t perm, int backlog)
 }
 
 /*
- * 封装accept
+ * 封装accept，返回的连接已经是非阻塞的
+ * 有accept4()时一次系统调用同时设置O_NONBLOCK和FD_CLOEXEC，省掉两次fcntl
  */
 static int anetGenericAccept(char *err, int s, struct sockaddr *sa, socklen_t *len) {
     int fd;
     while(1) {
+#ifdef HAVE_ACCEPT4
+        fd = accept4(s,sa,len,SOCK_NONBLOCK|SOCK_CLOEXEC);
+#else
         fd = accept(s,sa,len);
+#endif
         if (fd == -1) {
             if (errno == EINTR)
                 continue;
@@ -545,6 +650,12 @@ static int anetGenericAccept(char *err, int s, struct sockaddr *sa, socklen_t *l
         }
         break;
     }
+#ifndef HAVE_ACCEPT4
+    if (anetNonBlock(err,fd) == ANET_ERR) {
+        close(fd);
+        return ANET_ERR;
+    }
+#endif
     return fd;
 }
 
@@ -570,6 +681,9 @@ int anetTcpAccept(char *err, int s, char *ip, size_t ip_len, int *port) {
     return fd;
 }
 
+/*
+ * 接收Unix域套接字上的连接，对端没有地址可以返回
+ */
 int anetUnixAccept(char *err, int s) {
     int fd;
     struct sockaddr_un sa;
@@ -40,6 +40,7 @@
 /* Flags used with certain functions. */
 #define ANET_NONE 0
 #define ANET_IP_ONLY (1<<0)
+#define ANET_REUSEPORT (1<<1)
 
 #if defined(__sun) || defined(_AIX)
 #define AF_LOCAL AF_UNIX
@@ -60,6 +61,11 @@ int anetResolve(char *err, char *host, char *ipbuf, size_t ipbuf_len);
 int anetResolveIP(char *err, char *host, char *ipbuf, size_t ipbuf_len);
 int anetTcpServer(char *err, int port, char *bindaddr, int backlog);
 int anetTcp6Server(char *err, int port, char *bindaddr, int backlog);
+int anetTcpReusePortServer(char *err, int port, char *bindaddr, int backlog);
+int anetTcp6ReusePortServer(char *err, int port, char *bindaddr, int backlog);
+int anetReusePortSteerByCpu(char *err, int fd, int groups);
+int anetSetIncomingCpu(char *err, int fd, int cpu);
+int anetEnableZeroCopy(char *err, int fd);
 int anetUnixServer(char *err, char *path, mode_t perm, int backlog);
 int anetTcpAccept(char *err, int serversock, char *ip, size_t ip_len, int *port);
 int anetUnixAccept(char *err, int serversock);
@@ -0,0 +1,1581 @@
+/*
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "bio.h"
+#include "rdb.h"
+#include "util.h"
+#include "zmalloc.h"
+#include "atomicvar.h"
+#include "intset.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* redis_fsync is defined as fdatasync() for Linux in order to avoid
+ * flushing metadata. */
+#ifdef __linux__
+#define redis_fsync fdatasync
+#else
+#define redis_fsync fsync
+#endif
+
+/* ----------------------------------------------------------------------------
+ * AOF后台同步
+ * ------------------------------------------------------------------------- */
+
+/* always模式下唤醒事件循环，处理同步完成或者失败 */
+static void aofFsyncNotify(void) {
+	if (server.aof_fsync == AOF_FSYNC_ALWAYS &&
+		write(server.aof_fsync_notify_pipe[1],"x",1) == -1)
+	{
+		/* 管道已满时事件循环一定会被唤醒，忽略错误 */
+	}
+}
+
+/*
+ * 在bio线程中执行，把已经write()到文件的数据同步到磁盘
+ * 开始同步前先读取已写入的偏移量，同步完成后这个偏移量之前的数据都是持久的，
+ * 排队中的多个同步任务会被合并成一次fdatasync（group commit）
+ */
+void aofBackgroundFsync(int fd, int close_fd, long long offset) {
+	long long written, fsynced, start, duration;
+
+	/*
+	 * 切换incr文件时，旧文件的任务带有切换时的写入偏移量，同步后关闭文件，
+	 * 不能使用当前的写入偏移量，因为之后的数据已经写入了新文件
+	 */
+	if (close_fd) {
+		written = offset;
+	} else {
+		atomicGet(server.aof_written_offset,written);
+	}
+	atomicGet(server.aof_fsynced_offset,fsynced);
+	if (written <= fsynced) {
+		if (close_fd) close(fd);
+		return;
+	}
+
+	start = ustime();
+	if (redis_fsync(fd) == -1) {
+		int err = errno, last_status;
+
+		/*
+		 * 记录错误，aof_fsynced_offset保持不变：
+		 * everysec模式下一秒后会重新提交同步任务，always模式由主线程退出
+		 */
+		atomicGet(server.aof_bio_fsync_status,last_status);
+		atomicSet(server.aof_bio_fsync_errno,err);
+		atomicSet(server.aof_bio_fsync_status,C_ERR);
+		if (last_status == C_OK)
+			serverLog(LL_WARNING,"Error syncing the AOF file: %s",strerror(err));
+		if (close_fd) close(fd);
+		aofFsyncNotify();
+		return;
+	}
+	if (close_fd) close(fd);
+	duration = ustime()-start;
+	atomicSet(server.aof_fsynced_offset,written);
+	atomicSet(server.aof_bio_fsync_status,C_OK);
+
+	/* 延迟统计，只有bio线程会写这些字段 */
+	atomicIncr(server.stat_aof_fsync_count,1);
+	atomicIncr(server.stat_aof_fsync_total_us,duration);
+	atomicSet(server.stat_aof_fsync_last_us,duration);
+	if (duration > server.stat_aof_fsync_max_us)
+		atomicSet(server.stat_aof_fsync_max_us,duration);
+	if (duration >= AOF_FSYNC_STALL_US)
+		atomicIncr(server.stat_aof_fsync_stalls,1);
+
+	/* 唤醒事件循环，把等待持久化的回复发送给客户端 */
+	aofFsyncNotify();
+}
+
+/* 事件循环被fsync完成通知唤醒，读空管道即可，回复在beforeSleep中发送 */
+void aofFsyncNotifyHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+	char buf[64];
+	UNUSED(el);
+	UNUSED(privdata);
+	UNUSED(mask);
+
+	while (read(fd,buf,sizeof(buf)) > 0);
+}
+
+/*
+ * appendfsync always模式下，客户端的回复要等到它执行的写命令被同步到磁盘后才能发送
+ */
+int aofClientMustWaitFsync(client *c) {
+	long long fsynced;
+
+	if (server.aof_state != AOF_ON || server.aof_fsync != AOF_FSYNC_ALWAYS)
+		return 0;
+	atomicGet(server.aof_fsynced_offset,fsynced);
+	return c->woff > fsynced;
+}
+
+/* Write the append only file buffer on disk.
+ *
+ * Since we are required to write the AOF before replying to the client,
+ * and the only way the client socket can get a write is entering when the
+ * the event loop, we accumulate all the AOF writes in a memory
+ * buffer and write it on disk using this function just before entering
+ * the event loop again.
+ *
+ * About the 'force' argument:
+ *
+ * When the fsync policy is set to 'everysec' we may delay the flush if there
+ * is still an fsync() going on in the background thread, since for instance
+ * on Linux write(2) will be blocked by the background fsync anyway.
+ * When this happens we remember that there is some aof buffer to be
+ * flushed ASAP, and will try to do that in the serverCron() function.
+ *
+ * However if force is set to 1 we'll write regardless of the background
+ * fsync. */
+/*
+ * 在beforeSleep中调用，每次事件循环只用一次write()写入整个AOF缓冲区，
+ * fdatasync交给bio线程执行：
+ * always   每次写入后提交同步任务，客户端回复等同步完成后才发送
+ * everysec 每秒最多提交一次同步任务
+ * no       不主动同步，由操作系统决定
+ */
+#define AOF_WRITE_LOG_ERROR_RATE 30 /* Seconds between errors logging. */
+void flushAppendOnlyFile(int force) {
+	ssize_t nwritten;
+	int sync_in_progress = 0;
+	long long start, duration;
+
+	if (server.aof_fd == -1) return;
+	if (sdslen(server.aof_buf) == 0) goto try_fsync;
+
+	if (server.aof_fsync == AOF_FSYNC_EVERYSEC)
+		sync_in_progress = bioPendingJobsOfType(BIO_AOF_FSYNC) != 0;
+
+	if (server.aof_fsync == AOF_FSYNC_EVERYSEC && !force) {
+		/* With this append fsync policy we do background fsyncing.
+		 * If the fsync is still in progress we can try to delay
+		 * the write for a couple of seconds. */
+		if (sync_in_progress) {
+			if (server.aof_flush_postponed_start == 0) {
+				/* No previous write postponing, remember that we are
+				 * postponing the flush and return. */
+				server.aof_flush_postponed_start = server.unixtime;
+				return;
+			} else if (server.unixtime - server.aof_flush_postponed_start < 2) {
+				/* We were already waiting for fsync to finish, but for less
+				 * than two seconds this is still ok. Postpone again. */
+				return;
+			}
+			/* Otherwise fall trough, and go write since we can't wait
+			 * over two seconds. */
+			server.aof_delayed_fsync++;
+			printf("Asynchronous AOF fsync is taking too long (disk is busy?). "
+				"Writing the AOF buffer without waiting for fsync to complete, "
+				"this may slow down Redis.\n");
+		}
+	}
+
+	start = ustime();
+	nwritten = write(server.aof_fd,server.aof_buf,sdslen(server.aof_buf));
+	duration = ustime()-start;
+	if (duration > server.stat_aof_write_max_us)
+		server.stat_aof_write_max_us = duration;
+
+	if (nwritten != (ssize_t)sdslen(server.aof_buf)) {
+		static time_t last_write_error_log = 0;
+
+		if (nwritten == -1) {
+			server.aof_last_write_errno = errno;
+			nwritten = 0;
+		} else {
+			server.aof_last_write_errno = ENOSPC;
+		}
+		if ((server.unixtime - last_write_error_log) > AOF_WRITE_LOG_ERROR_RATE) {
+			printf("Error writing to the AOF file: %s\n",
+					strerror(server.aof_last_write_errno));
+			last_write_error_log = server.unixtime;
+		}
+		server.aof_last_write_status = C_ERR;
+
+		/* always模式下无法保证已经回复的写命令被持久化，只能退出 */
+		if (server.aof_fsync == AOF_FSYNC_ALWAYS) {
+			printf("Can't recover from AOF write error when the AOF fsync "
+				"policy is 'always'. Exiting...\n");
+			exit(1);
+		}
+		/* 保留没有写入的部分，下一次事件循环再重试 */
+		sdsrange(server.aof_buf,nwritten,-1);
+	} else {
+		if (server.aof_last_write_status == C_ERR) {
+			printf("AOF write error looks solved, Redis can write again.\n");
+			server.aof_last_write_status = C_OK;
+		}
+		/* Re-use AOF buffer when it is small enough. The maximum comes from the
+		 * arena size of 4k minus some overhead (but is otherwise arbitrary). */
+		if ((sdslen(server.aof_buf)+sdsavail(server.aof_buf)) < 4000) {
+			sdsclear(server.aof_buf);
+		} else {
+			sdsfree(server.aof_buf);
+			server.aof_buf = sdsempty();
+		}
+	}
+	server.aof_current_size += nwritten;
+	server.aof_last_incr_size += nwritten;
+	atomicIncr(server.aof_written_offset,nwritten);
+	server.aof_flush_postponed_start = 0;
+
+try_fsync:
+	if (server.aof_fsync == AOF_FSYNC_ALWAYS) {
+		long long written, fsynced;
+		int status, err;
+
+		/*
+		 * 同步失败后等待中的客户端永远等不到持久化，文件中的数据也不再可信，
+		 * 和写入失败一样只能退出
+		 */
+		atomicGet(server.aof_bio_fsync_status,status);
+		if (status == C_ERR) {
+			atomicGet(server.aof_bio_fsync_errno,err);
+			serverLog(LL_WARNING,"Can't persist AOF for fsync error when the "
+				"AOF fsync policy is 'always': %s. Exiting...",strerror(err));
+			exit(1);
+		}
+
+		/* 已经有排队中的同步任务时不需要再提交，它会覆盖本次写入的数据 */
+		atomicGet(server.aof_written_offset,written);
+		atomicGet(server.aof_fsynced_offset,fsynced);
+		if (written > fsynced && written > server.aof_fsync_requested_offset) {
+			bioCreateBackgroundJob(BIO_AOF_FSYNC,(void*)(long)server.aof_fd,
+					NULL,NULL);
+			server.aof_fsync_requested_offset = written;
+		}
+	} else if (server.aof_fsync == AOF_FSYNC_EVERYSEC &&
+			server.unixtime > server.aof_last_fsync)
+	{
+		if (!sync_in_progress &&
+			bioPendingJobsOfType(BIO_AOF_FSYNC) == 0)
+		{
+			long long written, fsynced;
+
+			atomicGet(server.aof_written_offset,written);
+			atomicGet(server.aof_fsynced_offset,fsynced);
+			if (written > fsynced)
+				bioCreateBackgroundJob(BIO_AOF_FSYNC,
+						(void*)(long)server.aof_fd,NULL,NULL);
+		}
+		server.aof_last_fsync = server.unixtime;
+	}
+}
+
+/* ----------------------------------------------------------------------------
+ * 命令传播
+ * ------------------------------------------------------------------------- */
+
+sds catAppendOnlyGenericCommand(sds dst, int argc, robj **argv) {
+	char buf[32];
+	int len, j;
+	robj *o;
+
+	buf[0] = '*';
+	len = 1+ll2string(buf+1,sizeof(buf)-1,argc);
+	buf[len++] = '\r';
+	buf[len++] = '\n';
+	dst = sdscatlen(dst,buf,len);
+
+	for (j = 0; j < argc; j++) {
+		o = getDecodedObject(argv[j]);
+		buf[0] = '$';
+		len = 1+ll2string(buf+1,sizeof(buf)-1,sdslen(o->ptr));
+		buf[len++] = '\r';
+		buf[len++] = '\n';
+		dst = sdscatlen(dst,buf,len);
+		dst = sdscatlen(dst,o->ptr,sdslen(o->ptr));
+		dst = sdscatlen(dst,"\r\n",2);
+		decrRefCount(o);
+	}
+	return dst;
+}
+
+/*
+ * 把写命令追加到AOF缓冲区，缓冲区在进入下一次事件循环前写入文件
+ * 还没有SELECT命令，AOF中不记录SELECT，加载和重写都只处理0号数据库，
+ * 其他数据库的写入无法正确重放，直接拒绝
+ */
+void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc) {
+	size_t oldlen = sdslen(server.aof_buf);
+	UNUSED(cmd);
+
+	if (server.aof_state != AOF_ON) return;
+	if (dictid != 0)
+		serverPanic("AOF can't persist writes to DB %d, only DB 0 is supported",
+			dictid);
+	server.aof_buf = catAppendOnlyGenericCommand(server.aof_buf,argc,argv);
+	server.aof_fed_offset += sdslen(server.aof_buf)-oldlen;
+}
+
+/* ----------------------------------------------------------------------------
+ * AOF加载
+ * ------------------------------------------------------------------------- */
+
+/* In Redis commands are always executed in the context of a client, so in
+ * order to load the append only file we need to create a fake client. */
+struct client *createFakeClient(void) {
+	struct client *c = createClient(-1);
+
+	c->flags = 0;
+	return c;
+}
+
+void freeFakeClientArgv(struct client *c) {
+	int j;
+
+	for (j = 0; j < c->argc; j++)
+		decrRefCount(c->argv[j]);
+	zfree(c->argv);
+	c->argv = NULL;
+	c->argc = 0;
+}
+
+/* Replay the append log file. On success C_OK is returned. On non fatal
+ * error (the append only file is zero-length) C_ERR is returned. On
+ * fatal error an error message is logged and the program exists. */
+/*
+ * 使用伪客户端逐条执行AOF文件中的命令
+ * 文件末尾不完整的命令会被截断
+ */
+int loadAppendOnlyFile(char *filename) {
+	struct client *fakeClient;
+	FILE *fp = fopen(filename,"r");
+	struct stat sb;
+	off_t valid_up_to = 0; /* Offset of the latest well-formed command loaded. */
+	long long start = ustime(), loaded = 0;
+
+	if (fp == NULL) return C_ERR;
+	if (fstat(fileno(fp),&sb) != -1 && sb.st_size == 0) {
+		fclose(fp);
+		return C_ERR;
+	}
+
+	fakeClient = createFakeClient();
+	server.loading = 1;
+	while(1) {
+		int argc, j;
+		unsigned long len;
+		robj **argv;
+		char buf[128];
+		sds argsds;
+		struct redisCommand *cmd;
+
+		if (fgets(buf,sizeof(buf),fp) == NULL) {
+			if (feof(fp))
+				break;
+			else
+				goto readerr;
+		}
+		if (buf[0] != '*') goto fmterr;
+		if (buf[1] == '\0') goto readerr;
+		argc = atoi(buf+1);
+		if (argc < 1) goto fmterr;
+
+		argv = zmalloc(sizeof(robj*)*argc);
+		fakeClient->argc = argc;
+		fakeClient->argv = argv;
+
+		for (j = 0; j < argc; j++) {
+			if (fgets(buf,sizeof(buf),fp) == NULL) {
+				fakeClient->argc = j; /* Free up to j-1. */
+				freeFakeClientArgv(fakeClient);
+				goto readerr;
+			}
+			if (buf[0] != '$') goto fmterr;
+			len = strtol(buf+1,NULL,10);
+			argsds = sdsnewlen(NULL,len);
+			if (len && fread(argsds,len,1,fp) == 0) {
+				sdsfree(argsds);
+				fakeClient->argc = j; /* Free up to j-1. */
+				freeFakeClientArgv(fakeClient);
+				goto readerr;
+			}
+			argv[j] = createObject(OBJ_STRING,argsds);
+			if (fread(buf,2,1,fp) == 0) {
+				fakeClient->argc = j+1; /* Free up to j. */
+				freeFakeClientArgv(fakeClient);
+				goto readerr; /* discard CRLF */
+			}
+		}
+
+		/* Command lookup */
+		cmd = lookupCommand(argv[0]->ptr);
+		if (!cmd) {
+			printf("Unknown command '%s' reading the append only file\n",
+					(char*)argv[0]->ptr);
+			exit(1);
+		}
+
+		/* Run the command in the context of a fake client */
+		fakeClient->cmd = cmd;
+		cmd->proc(fakeClient);
+
+		/* Clean up. Command code may have changed argv/argc so we use the
+		 * argv/argc of the client instead of the local variables. */
+		freeFakeClientArgv(fakeClient);
+		fakeClient->cmd = NULL;
+		valid_up_to = ftello(fp);
+		loaded++;
+	}
+
+	fclose(fp);
+	freeClient(fakeClient);
+	server.loading = 0;
+	printf("DB loaded from append only file: %.3f seconds (%lld commands)\n",
+			(float)(ustime()-start)/1000000, loaded);
+	return C_OK;
+
+readerr: /* Read error. If feof(fp) is true, fall through to unexpected EOF. */
+	if (!feof(fp)) {
+		printf("Unrecoverable error reading the append only file: %s\n",
+				strerror(errno));
+		exit(1);
+	}
+
+	/* 文件末尾的命令不完整，通常是写入过程中宕机造成的，截断后继续 */
+	if (server.aof_load_truncated) {
+		printf("!!! Warning: short read while loading the AOF file %s!!!\n",
+				filename);
+		printf("AOF loaded anyway because aof-load-truncated is enabled\n");
+		if (truncate(filename,valid_up_to) == -1) {
+			printf("Error truncating the AOF file: %s\n", strerror(errno));
+			exit(1);
+		}
+		fclose(fp);
+		freeClient(fakeClient);
+		server.loading = 0;
+		return C_OK;
+	}
+	printf("Unexpected end of file reading the append only file\n");
+	exit(1);
+
+fmterr: /* Format error. */
+	printf("Bad file format reading the append only file: "
+		"make a backup of your AOF file, then use ./redis-check-aof --fix "
+		"<filename>\n");
+	exit(1);
+}
+
+/* ----------------------------------------------------------------------------
+ * AOF manifest
+ *
+ * AOF由一个base文件和若干个incr文件组成，manifest记录了这些文件及其顺序：
+ *
+ *   file "appendonly.aof.2.base.rdb" seq 2 type b
+ *   file "appendonly.aof.3.incr.aof" seq 3 type i
+ *   file "appendonly.aof.4.incr.aof" seq 4 type i
+ *
+ * type b 是重写生成的base文件，开启aof-use-rdb-preamble时使用RDB编码，否则是命令格式
+ * type i 是追加写命令的incr文件，加载时按照记录的顺序依次重放
+ * type h 是重写完成后不再需要的文件，等待删除
+ * ------------------------------------------------------------------------- */
+
+aofInfo *aofInfoCreate(void) {
+	return zcalloc(sizeof(aofInfo));
+}
+
+void aofInfoFree(aofInfo *ai) {
+	if (ai->file_name) sdsfree(ai->file_name);
+	zfree(ai);
+}
+
+void aofInfoFreeVoid(void *ai) {
+	aofInfoFree(ai);
+}
+
+aofInfo *aofInfoDup(aofInfo *orig) {
+	aofInfo *ai = aofInfoCreate();
+
+	ai->file_name = sdsdup(orig->file_name);
+	ai->file_seq = orig->file_seq;
+	ai->file_type = orig->file_type;
+	return ai;
+}
+
+/* manifest中的一行 */
+sds aofInfoFormat(sds buf, aofInfo *ai) {
+	buf = sdscat(buf,AOF_MANIFEST_KEY_FILE_NAME " ");
+	buf = sdscatrepr(buf,ai->file_name,sdslen(ai->file_name));
+	buf = sdscatprintf(buf," %s %lld %s %c\n",
+			AOF_MANIFEST_KEY_FILE_SEQ, ai->file_seq,
+			AOF_MANIFEST_KEY_FILE_TYPE, ai->file_type);
+	return buf;
+}
+
+aofManifest *aofManifestCreate(void) {
+	aofManifest *am = zcalloc(sizeof(aofManifest));
+
+	am->incr_aof_list = listCreate();
+	am->history_aof_list = listCreate();
+	listSetFreeMethod(am->incr_aof_list,aofInfoFreeVoid);
+	listSetFreeMethod(am->history_aof_list,aofInfoFreeVoid);
+	return am;
+}
+
+void aofManifestFree(aofManifest *am) {
+	if (am->base_aof_info) aofInfoFree(am->base_aof_info);
+	listRelease(am->incr_aof_list);
+	listRelease(am->history_aof_list);
+	zfree(am);
+}
+
+/* 复制一份manifest，修改副本并写入磁盘成功后再替换server.aof_manifest */
+aofManifest *aofManifestDup(aofManifest *orig) {
+	aofManifest *am = aofManifestCreate();
+	listIter li;
+	listNode *ln;
+
+	if (orig->base_aof_info) am->base_aof_info = aofInfoDup(orig->base_aof_info);
+	am->curr_base_file_seq = orig->curr_base_file_seq;
+	am->curr_incr_file_seq = orig->curr_incr_file_seq;
+	am->dirty = orig->dirty;
+
+	listRewind(orig->incr_aof_list,&li);
+	while ((ln = listNext(&li)) != NULL)
+		listAddNodeTail(am->incr_aof_list,aofInfoDup(listNodeValue(ln)));
+	listRewind(orig->history_aof_list,&li);
+	while ((ln = listNext(&li)) != NULL)
+		listAddNodeTail(am->history_aof_list,aofInfoDup(listNodeValue(ln)));
+	return am;
+}
+
+sds getAofManifestFileName(void) {
+	return sdscatprintf(sdsempty(),"%s%s",server.aof_filename,
+			MANIFEST_NAME_SUFFIX);
+}
+
+sds getTempAofManifestFileName(void) {
+	return sdscatprintf(sdsempty(),"%s%s%s",TEMP_FILE_NAME_PREFIX,
+			server.aof_filename,MANIFEST_NAME_SUFFIX);
+}
+
+/* 把manifest序列化成文本 */
+sds getAofManifestAsString(aofManifest *am) {
+	sds buf = sdsempty();
+	listIter li;
+	listNode *ln;
+
+	if (am->base_aof_info) buf = aofInfoFormat(buf,am->base_aof_info);
+
+	listRewind(am->history_aof_list,&li);
+	while ((ln = listNext(&li)) != NULL)
+		buf = aofInfoFormat(buf,listNodeValue(ln));
+
+	listRewind(am->incr_aof_list,&li);
+	while ((ln = listNext(&li)) != NULL)
+		buf = aofInfoFormat(buf,listNodeValue(ln));
+	return buf;
+}
+
+/*
+ * 启动时读取manifest文件，解析出base、incr和history文件
+ * manifest不存在时返回C_ERR并设置errno为ENOENT
+ */
+int aofLoadManifestFromFile(sds am_filepath, aofManifest **result) {
+	const char *err = NULL;
+	aofManifest *am;
+	char buf[AOF_MANIFEST_MAX_LINE+1];
+	long long maxseq = 0;
+	FILE *fp;
+	int linenum = 0;
+	sds *argv = NULL;
+	int argc = 0;
+
+	if ((fp = fopen(am_filepath,"r")) == NULL) return C_ERR;
+
+	am = aofManifestCreate();
+	while (fgets(buf,sizeof(buf),fp) != NULL) {
+		aofInfo *ai;
+		sds line;
+		int j;
+
+		linenum++;
+		line = sdstrim(sdsnew(buf)," \t\r\n");
+		if (line[0] == '#' || line[0] == '\0') {
+			sdsfree(line);
+			continue;
+		}
+		argv = sdssplitargs(line,&argc);
+		sdsfree(line);
+		/* 'file' 'seq' 'type' 三对参数 */
+		if (argv == NULL || argc < 6 || (argc % 2)) {
+			err = "Invalid AOF manifest file format";
+			goto loaded;
+		}
+
+		ai = aofInfoCreate();
+		for (j = 0; j < argc; j += 2) {
+			if (!strcasecmp(argv[j],AOF_MANIFEST_KEY_FILE_NAME)) {
+				ai->file_name = sdsnew(argv[j+1]);
+				if (!pathIsBaseName(ai->file_name)) {
+					aofInfoFree(ai);
+					err = "File can't be a path, just a filename";
+					goto loaded;
+				}
+			} else if (!strcasecmp(argv[j],AOF_MANIFEST_KEY_FILE_SEQ)) {
+				ai->file_seq = atoll(argv[j+1]);
+			} else if (!strcasecmp(argv[j],AOF_MANIFEST_KEY_FILE_TYPE)) {
+				ai->file_type = (argv[j+1])[0];
+			}
+			/* else if (!strcasecmp(argv[j], AOF_MANIFEST_KEY_OTHER)) {} */
+		}
+		sdsfreesplitres(argv,argc);
+		argv = NULL;
+
+		if (!ai->file_name || !ai->file_seq || !ai->file_type) {
+			aofInfoFree(ai);
+			err = "Invalid AOF manifest file format";
+			goto loaded;
+		}
+
+		if (ai->file_type == AOF_FILE_TYPE_BASE) {
+			if (am->base_aof_info) {
+				aofInfoFree(ai);
+				err = "Found duplicate base file information";
+				goto loaded;
+			}
+			am->base_aof_info = ai;
+			am->curr_base_file_seq = ai->file_seq;
+		} else if (ai->file_type == AOF_FILE_TYPE_HIST) {
+			listAddNodeTail(am->history_aof_list,ai);
+		} else if (ai->file_type == AOF_FILE_TYPE_INCR) {
+			if (ai->file_seq <= maxseq) {
+				aofInfoFree(ai);
+				err = "Found a non-monotonic sequence number";
+				goto loaded;
+			}
+			listAddNodeTail(am->incr_aof_list,ai);
+			am->curr_incr_file_seq = ai->file_seq;
+			maxseq = ai->file_seq;
+		} else {
+			aofInfoFree(ai);
+			err = "Unknown AOF file type";
+			goto loaded;
+		}
+	}
+
+loaded:
+	fclose(fp);
+	if (argv) sdsfreesplitres(argv,argc);
+	if (err) {
+		printf("Error reading the AOF manifest %s at line %d: %s\n",
+				am_filepath, linenum, err);
+		exit(1);
+	}
+	*result = am;
+	return C_OK;
+}
+
+/*
+ * 加载manifest，不存在manifest但存在旧的单文件AOF时，把它作为base文件升级到新格式
+ */
+void aofLoadManifestFromDisk(void) {
+	sds am_name = getAofManifestFileName();
+	aofManifest *am = NULL;
+
+	if (aofLoadManifestFromFile(am_name,&am) == C_ERR) {
+		struct stat sb;
+
+		am = aofManifestCreate();
+		if (stat(server.aof_filename,&sb) == 0) {
+			aofInfo *ai = aofInfoCreate();
+
+			ai->file_name = sdsnew(server.aof_filename);
+			ai->file_seq = 1;
+			ai->file_type = AOF_FILE_TYPE_BASE;
+			am->base_aof_info = ai;
+			am->curr_base_file_seq = 1;
+			am->dirty = 1;
+			printf("Found the old single-file AOF %s, it will be used as "
+				"the base of the new multi-part AOF\n", server.aof_filename);
+		}
+	}
+	sdsfree(am_name);
+	server.aof_manifest = am;
+}
+
+/* Writes the content of the manifest to the disk. Write the temp file first,
+ * fsync it and then rename it over the old manifest. */
+int writeAofManifestFile(sds buf) {
+	int ret = C_OK;
+	ssize_t nwritten;
+	int len;
+	sds am_name = getAofManifestFileName();
+	sds tmp_am_name = getTempAofManifestFileName();
+	int fd = open(tmp_am_name,O_WRONLY|O_TRUNC|O_CREAT,0644);
+
+	if (fd == -1) {
+		printf("Can't open the AOF manifest file %s: %s\n",
+				tmp_am_name, strerror(errno));
+		ret = C_ERR;
+		goto cleanup;
+	}
+
+	len = sdslen(buf);
+	while (len) {
+		nwritten = write(fd,buf,len);
+		if (nwritten < 0) {
+			if (errno == EINTR) continue;
+			printf("Error trying to write the temporary AOF manifest file %s: %s\n",
+					tmp_am_name, strerror(errno));
+			ret = C_ERR;
+			goto cleanup;
+		}
+		len -= nwritten;
+		buf += nwritten;
+	}
+
+	if (redis_fsync(fd) == -1) {
+		printf("Fail to fsync the temp AOF file %s: %s.\n",
+				tmp_am_name, strerror(errno));
+		ret = C_ERR;
+		goto cleanup;
+	}
+
+	if (rename(tmp_am_name,am_name) != 0) {
+		printf("Error trying to rename the temporary AOF manifest file %s into %s: %s\n",
+				tmp_am_name, am_name, strerror(errno));
+		ret = C_ERR;
+	}
+
+cleanup:
+	if (fd != -1) close(fd);
+	sdsfree(am_name);
+	sdsfree(tmp_am_name);
+	return ret;
+}
+
+/* manifest有变化时才写入磁盘 */
+int persistAofManifest(aofManifest *am) {
+	int ret;
+	sds amstr;
+
+	if (am->dirty == 0) return C_OK;
+	amstr = getAofManifestAsString(am);
+	ret = writeAofManifestFile(amstr);
+	sdsfree(amstr);
+	if (ret == C_OK) am->dirty = 0;
+	return ret;
+}
+
+/* 新的incr文件名，同时加入manifest的incr列表 */
+sds getNewIncrAofName(aofManifest *am) {
+	aofInfo *ai = aofInfoCreate();
+
+	ai->file_type = AOF_FILE_TYPE_INCR;
+	ai->file_name = sdscatprintf(sdsempty(),"%s.%lld%s%s",server.aof_filename,
+			++am->curr_incr_file_seq,INCR_FILE_SUFFIX,AOF_FORMAT_SUFFIX);
+	ai->file_seq = am->curr_incr_file_seq;
+	listAddNodeTail(am->incr_aof_list,ai);
+	am->dirty = 1;
+	return ai->file_name;
+}
+
+/* 新的base文件名，旧的base文件被移到history列表 */
+sds getNewBaseFileNameAndMarkPreAsHistory(aofManifest *am) {
+	aofInfo *ai = aofInfoCreate();
+
+	if (am->base_aof_info) {
+		am->base_aof_info->file_type = AOF_FILE_TYPE_HIST;
+		listAddNodeHead(am->history_aof_list,am->base_aof_info);
+	}
+	ai->file_type = AOF_FILE_TYPE_BASE;
+	ai->file_name = sdscatprintf(sdsempty(),"%s.%lld%s%s",server.aof_filename,
+			++am->curr_base_file_seq,BASE_FILE_SUFFIX,
+			server.aof_use_rdb_preamble ? RDB_FORMAT_SUFFIX : AOF_FORMAT_SUFFIX);
+	ai->file_seq = am->curr_base_file_seq;
+	am->base_aof_info = ai;
+	am->dirty = 1;
+	return ai->file_name;
+}
+
+/*
+ * 重写成功后，除了最新的incr文件（重写开始时打开的文件）之外，
+ * 其余的incr文件的内容都已经包含在新的base文件中，标记为history
+ */
+void markRewrittenIncrAofAsHistory(aofManifest *am) {
+	listNode *ln;
+	listIter li;
+
+	if (!listLength(am->incr_aof_list)) return;
+
+	listRewindTail(am->incr_aof_list,&li);
+	/* "server.aof_fd != -1" means AOF enabled, then we must skip the
+	 * last AOF, because this file is our currently writing. */
+	if (server.aof_fd != -1) listNext(&li);
+
+	while ((ln = listNext(&li)) != NULL) {
+		aofInfo *ai = listNodeValue(ln);
+		aofInfo *hai = aofInfoDup(ai);
+
+		hai->file_type = AOF_FILE_TYPE_HIST;
+		listAddNodeHead(am->history_aof_list,hai);
+		listDelNode(am->incr_aof_list,ln);
+	}
+	am->dirty = 1;
+}
+
+/*
+ * 在后台删除文件：主线程只unlink，最后一个引用的close交给bio线程，
+ * 这样删除大文件时不会阻塞事件循环
+ */
+int bg_unlink(const char *filename) {
+	int fd = open(filename,O_RDONLY|O_NONBLOCK);
+	if (fd == -1) {
+		/* Can't open the file? Fall back to unlinking in the main thread. */
+		return unlink(filename);
+	} else {
+		/* The following unlink() removes the name but doesn't free the
+		 * file contents because a process still has it open. */
+		int retval = unlink(filename);
+		if (retval == -1) {
+			/* If we got an unlink error, we just return it, closing the
+			 * new reference we have to the file. */
+			int old_errno = errno;
+			close(fd);  /* This would overwrite our errno. So we saved it. */
+			errno = old_errno;
+			return -1;
+		}
+		bioCreateBackgroundJob(BIO_CLOSE_FILE,(void*)(long)fd,NULL,NULL);
+		return 0; /* Success. */
+	}
+}
+
+/* 删除history文件，manifest写入成功之后才能调用 */
+int aofDelHistoryFiles(void) {
+	listNode *ln;
+	listIter li;
+
+	if (server.aof_manifest == NULL ||
+		listLength(server.aof_manifest->history_aof_list) == 0)
+		return C_OK;
+
+	listRewind(server.aof_manifest->history_aof_list,&li);
+	while ((ln = listNext(&li)) != NULL) {
+		aofInfo *ai = listNodeValue(ln);
+
+		printf("Removing the history file %s in the background\n",
+				ai->file_name);
+		bg_unlink(ai->file_name);
+		listDelNode(server.aof_manifest->history_aof_list,ln);
+	}
+	server.aof_manifest->dirty = 1;
+	return persistAofManifest(server.aof_manifest);
+}
+
+/* ----------------------------------------------------------------------------
+ * AOF开启与关闭
+ * ------------------------------------------------------------------------- */
+
+/*
+ * 打开incr文件用于追加写入，同时把当前文件的大小记入aof_last_incr_size
+ */
+static int openIncrAofFile(char *filename) {
+	struct stat sb;
+	int fd = open(filename,O_WRONLY|O_APPEND|O_CREAT,0644);
+
+	if (fd == -1) {
+		printf("Can't open the append-only file %s: %s\n",
+				filename,strerror(errno));
+		return -1;
+	}
+	server.aof_last_incr_size = (fstat(fd,&sb) != -1) ? sb.st_size : 0;
+	return fd;
+}
+
+/*
+ * 启动加载完成后，打开最后一个incr文件继续追加，没有incr文件时创建一个
+ */
+int aofOpenIfNeededOnServerStart(void) {
+	aofManifest *am = server.aof_manifest;
+	aofInfo *ai;
+
+	if (server.aof_state != AOF_ON) return C_OK;
+
+	if (listLength(am->incr_aof_list) == 0) getNewIncrAofName(am);
+	ai = listNodeValue(listLast(am->incr_aof_list));
+	if ((server.aof_fd = openIncrAofFile(ai->file_name)) == -1)
+		return C_ERR;
+	if (persistAofManifest(am) == C_ERR) return C_ERR;
+	/* 上次重写完成后没有来得及删除的history文件 */
+	aofDelHistoryFiles();
+	server.aof_rewrite_base_size = server.aof_current_size;
+	return C_OK;
+}
+
+/*
+ * 关闭服务器前把AOF缓冲区写入文件并同步到磁盘
+ */
+void stopAppendOnly(void) {
+	if (server.aof_fd == -1) return;
+	flushAppendOnlyFile(1);
+	/* 等待后台同步任务完成，再同步一次剩余的数据 */
+	while (bioWaitStepOfType(BIO_AOF_FSYNC));
+	redis_fsync(server.aof_fd);
+	close(server.aof_fd);
+	server.aof_fd = -1;
+}
+
+/* ----------------------------------------------------------------------------
+ * 按照manifest加载
+ * ------------------------------------------------------------------------- */
+
+/* base文件以"REDIS"开头时是RDB编码，否则是命令格式 */
+static int aofFileIsRdbEncoded(char *filename) {
+	char sig[5];
+	FILE *fp = fopen(filename,"r");
+	int rdb = 0;
+
+	if (fp == NULL) return 0;
+	if (fread(sig,sizeof(sig),1,fp) == 1 && memcmp(sig,"REDIS",5) == 0)
+		rdb = 1;
+	fclose(fp);
+	return rdb;
+}
+
+static off_t getAppendOnlyFileSize(char *filename) {
+	struct stat sb;
+
+	if (stat(filename,&sb) == -1) return 0;
+	return sb.st_size;
+}
+
+/*
+ * 按照manifest的顺序加载base文件和所有incr文件
+ */
+int loadAppendOnlyFiles(aofManifest *am) {
+	long long start = ustime();
+	listNode *ln;
+	listIter li;
+	int loaded = 0;
+
+	server.aof_current_size = 0;
+	if (am->base_aof_info) {
+		char *name = am->base_aof_info->file_name;
+
+		if (aofFileIsRdbEncoded(name)) {
+			if (rdbLoad(name) != C_OK) {
+				printf("Fatal error loading the AOF base file %s\n",name);
+				exit(1);
+			}
+		} else {
+			loadAppendOnlyFile(name);
+		}
+		server.aof_current_size += getAppendOnlyFileSize(name);
+		loaded++;
+	}
+
+	listRewind(am->incr_aof_list,&li);
+	while ((ln = listNext(&li)) != NULL) {
+		aofInfo *ai = listNodeValue(ln);
+
+		loadAppendOnlyFile(ai->file_name);
+		server.aof_current_size += getAppendOnlyFileSize(ai->file_name);
+		loaded++;
+	}
+	if (loaded)
+		printf("Multi-part AOF loaded: %.3f seconds (%d files)\n",
+				(float)(ustime()-start)/1000000, loaded);
+	return loaded ? C_OK : C_ERR;
+}
+
+/* ----------------------------------------------------------------------------
+ * AOF rewrite
+ *
+ * 重写开始时主进程切换到一个新的incr文件，然后fork子进程把当前数据写成新的base文件，
+ * 之后的写命令直接追加到新的incr文件，不需要在父子进程之间通过管道传递差异数据。
+ * 子进程成功退出后，更新manifest并删除旧的base和incr文件。
+ * ------------------------------------------------------------------------- */
+
+/* 追加"*<count>\r\n"或"$<len>\r\n"这样的前缀 */
+static sds catAofCount(sds dst, char prefix, long long count) {
+	char buf[32];
+	int len;
+
+	buf[0] = prefix;
+	len = 1+ll2string(buf+1,sizeof(buf)-1,count);
+	buf[len++] = '\r';
+	buf[len++] = '\n';
+	return sdscatlen(dst,buf,len);
+}
+
+static sds catAofBulk(sds dst, const char *p, size_t len) {
+	dst = catAofCount(dst,'$',len);
+	dst = sdscatlen(dst,p,len);
+	return sdscatlen(dst,"\r\n",2);
+}
+
+/*
+ * 列表使用RPUSH重写，每条命令最多AOF_REWRITE_ITEMS_PER_CMD个元素
+ * 直接从快速列表中取出元素写入，不创建中间对象
+ */
+static sds rewriteListObject(sds buf, sds key, robj *o) {
+	long long count = 0, items = listTypeLength(o);
+	quicklistIter *li = quicklistGetIterator(o->ptr,AL_START_HEAD);
+	quicklistEntry entry;
+
+	while (quicklistNext(li,&entry)) {
+		if (count == 0) {
+			int cmd_items = (items > AOF_REWRITE_ITEMS_PER_CMD) ?
+				AOF_REWRITE_ITEMS_PER_CMD : items;
+			buf = catAofCount(buf,'*',2+cmd_items);
+			buf = catAofBulk(buf,"RPUSH",5);
+			buf = catAofBulk(buf,key,sdslen(key));
+		}
+		if (entry.value) {
+			buf = catAofBulk(buf,(char*)entry.value,entry.sz);
+		} else {
+			char lbuf[LONG_STR_SIZE];
+			int len = ll2string(lbuf,sizeof(lbuf),entry.longval);
+			buf = catAofBulk(buf,lbuf,len);
+		}
+		if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
+		items--;
+	}
+	quicklistReleaseIterator(li);
+	return buf;
+}
+
+/*
+ * 集合对象使用SADD重写，每条命令最多AOF_REWRITE_ITEMS_PER_CMD个元素
+ */
+static sds rewriteSetObject(sds buf, sds key, robj *o) {
+	long long count = 0, items = setTypeSize(o);
+	dictIterator *di = NULL;
+	dictEntry *de;
+	uint32_t ii = 0;
+
+	if (o->encoding == OBJ_ENCODING_HT) di = dictGetIterator(o->ptr);
+	while (items) {
+		if (count == 0) {
+			int cmd_items = (items > AOF_REWRITE_ITEMS_PER_CMD) ?
+				AOF_REWRITE_ITEMS_PER_CMD : items;
+			buf = catAofCount(buf,'*',2+cmd_items);
+			buf = catAofBulk(buf,"SADD",4);
+			buf = catAofBulk(buf,key,sdslen(key));
+		}
+		if (di) {
+			sds ele;
+
+			de = dictNext(di);
+			ele = dictGetKey(de);
+			buf = catAofBulk(buf,ele,sdslen(ele));
+		} else {
+			char lbuf[LONG_STR_SIZE];
+			int64_t llval;
+			int len;
+
+			intsetGet(o->ptr,ii++,&llval);
+			len = ll2string(lbuf,sizeof(lbuf),llval);
+			buf = catAofBulk(buf,lbuf,len);
+		}
+		if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
+		items--;
+	}
+	if (di) dictReleaseIterator(di);
+	return buf;
+}
+
+/* listpack中的元素可能是整数编码的 */
+static sds catAofListpackEntry(sds dst, unsigned char *p) {
+	unsigned char *vstr;
+	unsigned int vlen;
+	long long vll;
+
+	if ((vstr = lpGetValue(p,&vlen,&vll)) != NULL)
+		return catAofBulk(dst,(char*)vstr,vlen);
+	else {
+		char lbuf[LONG_STR_SIZE];
+		int len = ll2string(lbuf,sizeof(lbuf),vll);
+		return catAofBulk(dst,lbuf,len);
+	}
+}
+
+/* 哈希对象使用HSET重写，每条命令最多AOF_REWRITE_ITEMS_PER_CMD个field */
+static sds rewriteHashObject(sds buf, sds key, robj *o) {
+	long long count = 0, items = hashTypeLength(o);
+	unsigned char *lp = NULL, *p = NULL;
+	dictIterator *di = NULL;
+	dictEntry *de = NULL;
+
+	if (o->encoding == OBJ_ENCODING_LISTPACK) {
+		lp = o->ptr;
+		p = lpFirst(lp);
+	} else {
+		di = dictGetIterator(o->ptr);
+	}
+	while (items) {
+		if (di && (de = dictNext(di)) == NULL) break;
+		if (count == 0) {
+			int cmd_items = (items > AOF_REWRITE_ITEMS_PER_CMD) ?
+				AOF_REWRITE_ITEMS_PER_CMD : items;
+			buf = catAofCount(buf,'*',2+cmd_items*2);
+			buf = catAofBulk(buf,"HSET",4);
+			buf = catAofBulk(buf,key,sdslen(key));
+		}
+		if (lp) {
+			buf = catAofListpackEntry(buf,p);
+			p = lpNext(lp,p);
+			buf = catAofListpackEntry(buf,p);
+			p = lpNext(lp,p);
+		} else {
+			sds field = dictGetKey(de), value = dictGetVal(de);
+			buf = catAofBulk(buf,field,sdslen(field));
+			buf = catAofBulk(buf,value,sdslen(value));
+		}
+		if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
+		items--;
+	}
+	if (di) dictReleaseIterator(di);
+	return buf;
+}
+
+/*
+ * 有序集合使用ZADD重写，每条命令最多AOF_REWRITE_ITEMS_PER_CMD个元素
+ * listpack中元素在前score在后，ZADD的参数顺序正好相反
+ */
+static sds rewriteZsetObject(sds buf, sds key, robj *o) {
+	long long count = 0, items = zsetLength(o);
+	unsigned char *lp = NULL, *eptr = NULL, *sptr;
+	zskiplistNode *ln = NULL;
+
+	if (o->encoding == OBJ_ENCODING_LISTPACK) {
+		lp = o->ptr;
+		eptr = lpFirst(lp);
+	} else {
+		ln = ((zset*)o->ptr)->zsl->header->level[0].forward;
+	}
+	while (items) {
+		if (count == 0) {
+			int cmd_items = (items > AOF_REWRITE_ITEMS_PER_CMD) ?
+				AOF_REWRITE_ITEMS_PER_CMD : items;
+			buf = catAofCount(buf,'*',2+cmd_items*2);
+			buf = catAofBulk(buf,"ZADD",4);
+			buf = catAofBulk(buf,key,sdslen(key));
+		}
+		if (lp) {
+			sptr = lpNext(lp,eptr);
+			buf = catAofListpackEntry(buf,sptr);
+			buf = catAofListpackEntry(buf,eptr);
+			eptr = lpNext(lp,sptr);
+		} else {
+			char dbuf[MAX_D2STRING_CHARS];
+			int dlen = d2string(dbuf,sizeof(dbuf),ln->score);
+
+			buf = catAofBulk(buf,dbuf,dlen);
+			buf = catAofBulk(buf,ln->ele,sdslen(ln->ele));
+			ln = ln->level[0].forward;
+		}
+		if (++count == AOF_REWRITE_ITEMS_PER_CMD) count = 0;
+		items--;
+	}
+	return buf;
+}
+
+/* 追加一个"<ms>-<seq>"格式的流ID */
+static sds catAofStreamID(sds dst, streamID *id) {
+	char buf[42];
+	int len = ull2string(buf,sizeof(buf),id->ms);
+
+	buf[len++] = '-';
+	len += ull2string(buf+len,sizeof(buf)-len,id->seq);
+	return catAofBulk(dst,buf,len);
+}
+
+/*
+ * 流使用XADD重写，每个元素一条命令，ID使用原来的ID
+ * 空的流用"XADD key MAXLEN 0 <last_id> x y"重建，保留最后的ID
+ */
+static sds rewriteStreamObject(sds buf, sds key, robj *o) {
+	stream *s = o->ptr;
+	streamIterator si;
+	streamID id;
+	int64_t numfields;
+
+	if (s->length == 0) {
+		buf = catAofCount(buf,'*',7);
+		buf = catAofBulk(buf,"XADD",4);
+		buf = catAofBulk(buf,key,sdslen(key));
+		buf = catAofBulk(buf,"MAXLEN",6);
+		buf = catAofBulk(buf,"0",1);
+		buf = catAofStreamID(buf,&s->last_id);
+		buf = catAofBulk(buf,"x",1);
+		return catAofBulk(buf,"y",1);
+	}
+
+	streamIteratorStart(&si,s,NULL,NULL,0);
+	while (streamIteratorGetID(&si,&id,&numfields)) {
+		buf = catAofCount(buf,'*',3+numfields*2);
+		buf = catAofBulk(buf,"XADD",4);
+		buf = catAofBulk(buf,key,sdslen(key));
+		buf = catAofStreamID(buf,&id);
+		while (numfields--) {
+			unsigned char *field, *value;
+			int64_t field_len, value_len;
+
+			streamIteratorGetField(&si,&field,&value,&field_len,&value_len);
+			buf = catAofBulk(buf,(char*)field,field_len);
+			buf = catAofBulk(buf,(char*)value,value_len);
+		}
+	}
+	streamIteratorStop(&si);
+	return buf;
+}
+
+/* 命令格式的重写，字符串生成SET命令，列表、集合、哈希、有序集合和流分别生成RPUSH、SADD、HSET、ZADD和XADD命令 */
+int rewriteAppendOnlyFileCommands(FILE *fp) {
+	robj *setcmd = createStringObject("SET",3);
+	dictIterator *di;
+	dictEntry *de;
+	sds buf = sdsempty();
+	robj *argv[3];
+	redisDb *db = server.db;
+
+	/* 还没有SELECT命令，只有0号数据库会保存数据 */
+	di = dictGetIterator(db->dict);
+	while ((de = dictNext(di)) != NULL) {
+		robj key;
+		robj *o = dictGetVal(de);
+
+		if (o->type == OBJ_STRING) {
+			initStaticStringObject(key,dictGetKey(de));
+			argv[0] = setcmd;
+			argv[1] = &key;
+			argv[2] = o;
+			buf = catAppendOnlyGenericCommand(buf,3,argv);
+		} else if (o->type == OBJ_LIST) {
+			buf = rewriteListObject(buf,dictGetKey(de),o);
+		} else if (o->type == OBJ_SET) {
+			buf = rewriteSetObject(buf,dictGetKey(de),o);
+		} else if (o->type == OBJ_HASH) {
+			buf = rewriteHashObject(buf,dictGetKey(de),o);
+		} else if (o->type == OBJ_ZSET) {
+			buf = rewriteZsetObject(buf,dictGetKey(de),o);
+		} else if (o->type == OBJ_STREAM) {
+			buf = rewriteStreamObject(buf,dictGetKey(de),o);
+		} else {
+			continue;
+		}
+		if (sdslen(buf) >= AOF_REWRITE_BUF_BYTES) {
+			if (fwrite(buf,sdslen(buf),1,fp) == 0) goto werr;
+			sdsclear(buf);
+		}
+	}
+	dictReleaseIterator(di);
+	di = NULL;
+	if (sdslen(buf) && fwrite(buf,sdslen(buf),1,fp) == 0) goto werr;
+	sdsfree(buf);
+	decrRefCount(setcmd);
+	return C_OK;
+
+werr:
+	if (di) dictReleaseIterator(di);
+	sdsfree(buf);
+	decrRefCount(setcmd);
+	return C_ERR;
+}
+
+/* Write a sequence of commands able to fully rebuild the dataset into
+ * "filename". Used both by REWRITEAOF and BGREWRITEAOF.
+ *
+ * In order to minimize the number of commands needed in the rewritten
+ * log Redis uses variadic commands when possible, such as RPUSH, SADD
+ * and ZADD. However at max AOF_REWRITE_ITEMS_PER_CMD items per time
+ * are inserted using a single command. */
+/*
+ * 在子进程中执行，把当前数据写入filename作为新的base文件
+ * 开启aof-use-rdb-preamble时直接使用RDB编码
+ */
+int rewriteAppendOnlyFile(char *filename) {
+	FILE *fp;
+	char tmpfile[256];
+
+	if (server.aof_use_rdb_preamble) return rdbSave(filename);
+
+	/* Note that we have to use a different temp name here compared to the
+	 * one used by rewriteAppendOnlyFileBackground() function. */
+	snprintf(tmpfile,256,"temp-rewriteaof-%d.aof", (int) getpid());
+	fp = fopen(tmpfile,"w");
+	if (!fp) {
+		printf("Opening the temp file for AOF rewrite in rewriteAppendOnlyFile(): %s\n",
+				strerror(errno));
+		return C_ERR;
+	}
+
+	if (rewriteAppendOnlyFileCommands(fp) == C_ERR) goto werr;
+
+	/* Make sure data will not remain on the OS's output buffers */
+	if (fflush(fp) == EOF) goto werr;
+	if (fsync(fileno(fp)) == -1) goto werr;
+	if (fclose(fp) == EOF) { fp = NULL; goto werr; }
+	fp = NULL;
+
+	/* Use RENAME to make sure the DB file is changed atomically only
+	 * if the generate DB file is ok. */
+	if (rename(tmpfile,filename) == -1) {
+		printf("Error moving temp append only file on the final destination: %s\n",
+				strerror(errno));
+		unlink(tmpfile);
+		return C_ERR;
+	}
+	printf("SYNC append only file rewrite performed\n");
+	return C_OK;
+
+werr:
+	printf("Write error writing append only file on disk: %s\n", strerror(errno));
+	if (fp) fclose(fp);
+	unlink(tmpfile);
+	return C_ERR;
+}
+
+/*
+ * 重写开始前切换到新的incr文件：
+ * 旧文件的剩余数据交给bio线程同步并关闭，和之后的同步任务由同一个线程按顺序执行，
+ * 所以always模式下等待同步的客户端不会因为切换文件而提前收到回复
+ */
+int openNewIncrAofForAppend(void) {
+	aofManifest *temp_am;
+	int newfd;
+	sds new_aof_name;
+	long long written;
+
+	/* 先把缓冲区写入旧文件，fork之前的写命令都在旧文件中 */
+	flushAppendOnlyFile(1);
+	if (sdslen(server.aof_buf)) return C_ERR;
+
+	/* Dup a temp aof_manifest to modify. */
+	temp_am = aofManifestDup(server.aof_manifest);
+
+	new_aof_name = getNewIncrAofName(temp_am);
+	newfd = open(new_aof_name,O_WRONLY|O_TRUNC|O_CREAT,0644);
+	if (newfd == -1) {
+		printf("Can't open the append-only file %s: %s\n",
+				new_aof_name,strerror(errno));
+		aofManifestFree(temp_am);
+		return C_ERR;
+	}
+	if (persistAofManifest(temp_am) == C_ERR) {
+		close(newfd);
+		unlink(new_aof_name);
+		aofManifestFree(temp_am);
+		return C_ERR;
+	}
+
+	atomicGet(server.aof_written_offset,written);
+	bioCreateBackgroundJob(BIO_AOF_FSYNC,(void*)(long)server.aof_fd,
+			(void*)1,(void*)(long)written);
+	server.aof_fd = newfd;
+	server.aof_last_incr_size = 0;
+
+	/* Change the AOF manifest in memory. */
+	aofManifestFree(server.aof_manifest);
+	server.aof_manifest = temp_am;
+	return C_OK;
+}
+
+/* This is how rewriting of the append only file in background works:
+ *
+ * 1) The user calls BGREWRITEAOF
+ * 2) Redis calls this function, that forks():
+ *    2a) the child rewrite the append only file in a temp file.
+ *    2b) the parent opens a new INCR AOF file to continue writing.
+ * 3) When the child finished '2a' exists.
+ * 4) The parent will trap the exit code, if it's OK, it will:
+ *    4a) get a new BASE file name and mark the previous (if we have) as the HISTORY type
+ *    4b) rename(2) the temp file in new BASE file name
+ *    4c) mark the rewritten INCR AOFs as history type
+ *    4d) persist AOF manifest file
+ *    4e) Delete the history files use bio
+ */
+int rewriteAppendOnlyFileBackground(void) {
+	pid_t childpid;
+	long long start;
+
+	if (server.aof_child_pid != -1 || rdbSaveInProgress()) return C_ERR;
+	if (openNewIncrAofForAppend() == C_ERR) return C_ERR;
+
+	/* 避免子进程继承还没有输出的日志 */
+	fflush(stdout);
+	start = ustime();
+	if ((childpid = fork()) == 0) {
+		char tmpfile[256];
+
+		/* Child */
+		closeListeningSockets(0);
+		snprintf(tmpfile,256,"temp-rewriteaof-bg-%d.aof", (int) getpid());
+		if (rewriteAppendOnlyFile(tmpfile) == C_OK) {
+			fflush(stdout);
+			_exit(0);
+		} else {
+			fflush(stdout);
+			_exit(1);
+		}
+	} else {
+		/* Parent */
+		server.stat_fork_time = ustime()-start;
+		if (childpid == -1) {
+			printf("Can't rewrite append only file in background: fork: %s\n",
+					strerror(errno));
+			server.aof_lastbgrewrite_status = C_ERR;
+			return C_ERR;
+		}
+		printf("Background append only file rewriting started by pid %d "
+			"(fork took %.3f ms)\n", childpid,
+			(double)server.stat_fork_time/1000);
+		server.aof_rewrite_scheduled = 0;
+		server.aof_rewrite_time_start = time(NULL);
+		server.aof_child_pid = childpid;
+		return C_OK;
+	}
+	return C_OK; /* unreached */
+}
+
+void bgrewriteaofCommand(client *c) {
+	if (server.aof_child_pid != -1) {
+		addReplyError(c,"Background append only file rewriting already in progress");
+	} else if (server.aof_state != AOF_ON) {
+		addReplyError(c,"Append only file is not enabled");
+	} else if (rdbSaveInProgress()) {
+		server.aof_rewrite_scheduled = 1;
+		addReplyStatus(c,"Background append only file rewriting scheduled");
+	} else if (rewriteAppendOnlyFileBackground() == C_OK) {
+		addReplyStatus(c,"Background append only file rewriting started");
+	} else {
+		addReplyError(c,"Can't execute an AOF background rewriting. "
+				"Please check the server logs for more information.");
+	}
+}
+
+void aofRemoveTempFile(pid_t childpid) {
+	char tmpfile[256];
+
+	snprintf(tmpfile,256,"temp-rewriteaof-bg-%d.aof", (int) childpid);
+	unlink(tmpfile);
+	snprintf(tmpfile,256,"temp-%d.rdb", (int) childpid);
+	unlink(tmpfile);
+}
+
+/* A background append only file rewriting (BGREWRITEAOF) terminated its work.
+ * Handle this. */
+void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
+	if (!bysignal && exitcode == 0) {
+		char tmpfile[256];
+		long long now = ustime();
+		sds new_base_filename;
+		aofManifest *temp_am;
+		off_t base_size;
+
+		printf("Background AOF rewrite terminated with success\n");
+		snprintf(tmpfile,256,"temp-rewriteaof-bg-%d.aof",
+				(int)server.aof_child_pid);
+
+		/* 在manifest的副本上修改，写入磁盘成功后再替换 */
+		temp_am = aofManifestDup(server.aof_manifest);
+
+		/* Get a new BASE file name and mark the previous (if we have)
+		 * as the HISTORY type. */
+		new_base_filename = getNewBaseFileNameAndMarkPreAsHistory(temp_am);
+		if (rename(tmpfile,new_base_filename) == -1) {
+			printf("Error trying to rename the temporary AOF file %s into %s: %s\n",
+					tmpfile, new_base_filename, strerror(errno));
+			aofManifestFree(temp_am);
+			goto cleanup;
+		}
+		base_size = getAppendOnlyFileSize(new_base_filename);
+
+		/* Change the AOF file type in 'incr_aof_list' from AOF_FILE_TYPE_INCR
+		 * to AOF_FILE_TYPE_HIST, and move them to the 'history_aof_list'. */
+		markRewrittenIncrAofAsHistory(temp_am);
+
+		/* Persist our modifications. */
+		if (persistAofManifest(temp_am) == C_ERR) {
+			bg_unlink(new_base_filename);
+			aofManifestFree(temp_am);
+			goto cleanup;
+		}
+
+		/* We can safely let `server.aof_manifest` point to 'temp_am' and free the previous one. */
+		aofManifestFree(server.aof_manifest);
+		server.aof_manifest = temp_am;
+
+		/* AOF的大小从新的base加上重写期间追加的incr重新计算 */
+		server.aof_current_size = base_size+server.aof_last_incr_size;
+		server.aof_rewrite_base_size = server.aof_current_size;
+
+		/* We don't care about the return value of `aofDelHistoryFiles`, because the history
+		 * deletion failure will not cause any problems. */
+		aofDelHistoryFiles();
+
+		server.aof_lastbgrewrite_status = C_OK;
+		printf("Background AOF rewrite finished successfully (%.3f ms to swap files)\n",
+				(double)(ustime()-now)/1000);
+	} else if (!bysignal && exitcode != 0) {
+		server.aof_lastbgrewrite_status = C_ERR;
+		printf("Background AOF rewrite terminated with error\n");
+	} else {
+		server.aof_lastbgrewrite_status = C_ERR;
+		printf("Background AOF rewrite terminated by signal %d\n", bysignal);
+	}
+
+cleanup:
+	aofRemoveTempFile(server.aof_child_pid);
+	server.aof_rewrite_time_last = time(NULL)-server.aof_rewrite_time_start;
+	server.aof_rewrite_time_start = -1;
+	server.aof_child_pid = -1;
+}
+
+/* 关闭服务器时终止正在进行的重写 */
+void killAppendOnlyChild(void) {
+	int statloc;
+
+	if (server.aof_child_pid == -1) return;
+	printf("Killing running AOF rewrite child: %ld\n",
+			(long) server.aof_child_pid);
+	if (kill(server.aof_child_pid,SIGUSR1) != -1) {
+		while(wait3(&statloc,0,NULL) != server.aof_child_pid);
+	}
+	aofRemoveTempFile(server.aof_child_pid);
+	server.aof_child_pid = -1;
+	server.aof_rewrite_time_start = -1;
+}
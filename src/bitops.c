@@ -0,0 +1,1266 @@
+/* Bit operations.
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "zmalloc.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/*
+ * x86-64上用gcc的target属性编译POPCNT和AVX2版本的计算函数，
+ * 运行时根据CPU支持的指令集选择，其他平台只使用标量版本
+ */
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define BITOPS_USE_X86_KERNELS 1
+#endif
+
+/* -----------------------------------------------------------------------------
+ * Helpers and low level bit functions.
+ * -------------------------------------------------------------------------- */
+
+#define BITOP_AND   0
+#define BITOP_OR    1
+#define BITOP_XOR   2
+#define BITOP_NOT   3
+
+static const unsigned char bitsinbyte[256] = {0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,4,5,5,6,5,6,6,7,5,6,6,7,6,7,7,8};
+
+/* Count number of bits set in the binary array pointed by 's' and long
+ * 'count' bytes. 8字节一组用SWAR计数，剩余的字节查表 */
+static long long popcountScalar(const void *s, long count) {
+	const unsigned char *p = s;
+	long long bits = 0;
+	uint64_t v;
+
+	while (count >= 8) {
+		memcpy(&v,p,sizeof(v));
+		v = v - ((v >> 1) & 0x5555555555555555ULL);
+		v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+		v = (v + (v >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+		bits += (v * 0x0101010101010101ULL) >> 56;
+		p += 8;
+		count -= 8;
+	}
+	while (count--) bits += bitsinbyte[*p++];
+	return bits;
+}
+
+/*
+ * 返回从p开始第一个不等于跳过值的字节的偏移量，查找1时跳过0x00，查找0时跳过0xff
+ * 所有字节都被跳过时返回count
+ */
+static long bitposSkipScalar(const unsigned char *p, long count, int bit) {
+	uint64_t skipword = bit ? 0 : UINT64_MAX, w;
+	unsigned char skipbyte = bit ? 0 : 0xff;
+	long off = 0;
+
+	while (count-off >= 8) {
+		memcpy(&w,p+off,sizeof(w));
+		if (w != skipword) break;
+		off += 8;
+	}
+	while (off < count && p[off] == skipbyte) off++;
+	return off;
+}
+
+/*
+ * 对numkeys个源的前len个字节做位运算，结果写入dst，len必须是32的倍数
+ * 每次迭代处理32字节，依次和所有源的对应位置做运算
+ */
+static void bitopScalar(int op, unsigned char *dst, unsigned char **src,
+		unsigned long numkeys, unsigned long len)
+{
+	unsigned long i, j;
+	uint64_t w[4], s[4];
+
+	for (j = 0; j < len; j += 32) {
+		memcpy(w,src[0]+j,sizeof(w));
+		switch (op) {
+		case BITOP_AND:
+			for (i = 1; i < numkeys; i++) {
+				memcpy(s,src[i]+j,sizeof(s));
+				w[0] &= s[0]; w[1] &= s[1]; w[2] &= s[2]; w[3] &= s[3];
+			}
+			break;
+		case BITOP_OR:
+			for (i = 1; i < numkeys; i++) {
+				memcpy(s,src[i]+j,sizeof(s));
+				w[0] |= s[0]; w[1] |= s[1]; w[2] |= s[2]; w[3] |= s[3];
+			}
+			break;
+		case BITOP_XOR:
+			for (i = 1; i < numkeys; i++) {
+				memcpy(s,src[i]+j,sizeof(s));
+				w[0] ^= s[0]; w[1] ^= s[1]; w[2] ^= s[2]; w[3] ^= s[3];
+			}
+			break;
+		case BITOP_NOT:
+			w[0] = ~w[0]; w[1] = ~w[1]; w[2] = ~w[2]; w[3] = ~w[3];
+			break;
+		}
+		memcpy(dst+j,w,sizeof(w));
+	}
+}
+
+#ifdef BITOPS_USE_X86_KERNELS
+/* 每次处理32字节，4个64位字分别累加，减少指令间的依赖 */
+__attribute__((target("popcnt")))
+static long long popcountPOPCNT(const void *s, long count) {
+	const unsigned char *p = s;
+	long long bits0 = 0, bits1 = 0, bits2 = 0, bits3 = 0;
+	uint64_t v[4];
+
+	while (count >= 32) {
+		memcpy(v,p,sizeof(v));
+		bits0 += __builtin_popcountll(v[0]);
+		bits1 += __builtin_popcountll(v[1]);
+		bits2 += __builtin_popcountll(v[2]);
+		bits3 += __builtin_popcountll(v[3]);
+		p += 32;
+		count -= 32;
+	}
+	while (count >= 8) {
+		memcpy(v,p,sizeof(v[0]));
+		bits0 += __builtin_popcountll(v[0]);
+		p += 8;
+		count -= 8;
+	}
+	while (count--) bits0 += bitsinbyte[*p++];
+	return bits0+bits1+bits2+bits3;
+}
+
+/*
+ * 使用4位查找表的AVX2计数：每个字节的高低4位分别通过vpshufb查表，
+ * 每个字节的计数在8位累加器中最多累加31轮（31*8<256），然后用vpsadbw横向求和到64位
+ */
+__attribute__((target("avx2,popcnt")))
+static long long popcountAVX2(const void *s, long count) {
+	const unsigned char *p = s;
+	const __m256i lut = _mm256_setr_epi8(
+		0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+		0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+	const __m256i low_mask = _mm256_set1_epi8(0x0f);
+	__m256i total = _mm256_setzero_si256();
+	long long bits;
+	uint64_t v;
+
+	while (count >= 32) {
+		__m256i acc = _mm256_setzero_si256();
+		int rounds = 0;
+
+		while (count >= 32 && rounds < 31) {
+			__m256i x = _mm256_loadu_si256((const __m256i*)p);
+			__m256i lo = _mm256_and_si256(x,low_mask);
+			__m256i hi = _mm256_and_si256(_mm256_srli_epi16(x,4),low_mask);
+
+			acc = _mm256_add_epi8(acc,_mm256_shuffle_epi8(lut,lo));
+			acc = _mm256_add_epi8(acc,_mm256_shuffle_epi8(lut,hi));
+			p += 32;
+			count -= 32;
+			rounds++;
+		}
+		total = _mm256_add_epi64(total,
+			_mm256_sad_epu8(acc,_mm256_setzero_si256()));
+	}
+	bits = _mm256_extract_epi64(total,0)+_mm256_extract_epi64(total,1)+
+		_mm256_extract_epi64(total,2)+_mm256_extract_epi64(total,3);
+
+	while (count >= 8) {
+		memcpy(&v,p,sizeof(v));
+		bits += __builtin_popcountll(v);
+		p += 8;
+		count -= 8;
+	}
+	while (count--) bits += bitsinbyte[*p++];
+	return bits;
+}
+
+/* 每次比较32字节，movemask中第一个为0的位就是第一个不等于跳过值的字节 */
+__attribute__((target("avx2")))
+static long bitposSkipAVX2(const unsigned char *p, long count, int bit) {
+	const __m256i skip = _mm256_set1_epi8(bit ? 0 : (char)0xff);
+	long off = 0;
+
+	while (count-off >= 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(p+off));
+		unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x,skip));
+
+		if (mask != 0xffffffff) return off+__builtin_ctz(~mask);
+		off += 32;
+	}
+	return off+bitposSkipScalar(p+off,count-off,bit);
+}
+
+/* 和bitopScalar相同，每次迭代用一个256位寄存器处理32字节 */
+__attribute__((target("avx2")))
+static void bitopAVX2(int op, unsigned char *dst, unsigned char **src,
+		unsigned long numkeys, unsigned long len)
+{
+	unsigned long i, j;
+
+	for (j = 0; j < len; j += 32) {
+		__m256i w = _mm256_loadu_si256((const __m256i*)(src[0]+j));
+
+		switch (op) {
+		case BITOP_AND:
+			for (i = 1; i < numkeys; i++)
+				w = _mm256_and_si256(w,
+					_mm256_loadu_si256((const __m256i*)(src[i]+j)));
+			break;
+		case BITOP_OR:
+			for (i = 1; i < numkeys; i++)
+				w = _mm256_or_si256(w,
+					_mm256_loadu_si256((const __m256i*)(src[i]+j)));
+			break;
+		case BITOP_XOR:
+			for (i = 1; i < numkeys; i++)
+				w = _mm256_xor_si256(w,
+					_mm256_loadu_si256((const __m256i*)(src[i]+j)));
+			break;
+		case BITOP_NOT:
+			w = _mm256_xor_si256(w,_mm256_set1_epi8((char)0xff));
+			break;
+		}
+		_mm256_storeu_si256((__m256i*)(dst+j),w);
+	}
+}
+#endif
+
+/* 一组位运算的实现，启动后第一次使用时根据CPU支持的指令集选择 */
+typedef struct bitopsKernels {
+	const char *name;
+	long long (*popcount)(const void *s, long count);
+	long (*bitposSkip)(const unsigned char *p, long count, int bit);
+	void (*bitop)(int op, unsigned char *dst, unsigned char **src,
+			unsigned long numkeys, unsigned long len);
+} bitopsKernels;
+
+static bitopsKernels scalarKernels = {
+	"scalar", popcountScalar, bitposSkipScalar, bitopScalar
+};
+#ifdef BITOPS_USE_X86_KERNELS
+static bitopsKernels popcntKernels = {
+	"popcnt", popcountPOPCNT, bitposSkipScalar, bitopScalar
+};
+static bitopsKernels avx2Kernels = {
+	"avx2", popcountAVX2, bitposSkipAVX2, bitopAVX2
+};
+#endif
+static bitopsKernels *kernels = NULL;
+
+static bitopsKernels *bitopsGetKernels(void) {
+	if (kernels == NULL) {
+		kernels = &scalarKernels;
+#ifdef BITOPS_USE_X86_KERNELS
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+			kernels = &avx2Kernels;
+		else if (__builtin_cpu_supports("popcnt"))
+			kernels = &popcntKernels;
+#endif
+	}
+	return kernels;
+}
+
+/* Count number of bits set in the binary array pointed by 's' and long
+ * 'count' bytes. */
+long long redisPopcount(void *s, long count) {
+	return bitopsGetKernels()->popcount(s,count);
+}
+
+/* Return the position of the first bit set to one (if 'bit' is 1) or
+ * zero (if 'bit' is 0) in the bitmap starting at 's' and long 'count' bytes.
+ *
+ * The function is guaranteed to return a value >= 0 if 'bit' is 0 since if
+ * no zero bit is found, it returns count*8 assuming the string is zero
+ * padded on the right. However if 'bit' is 1 it is possible that there is
+ * not a single set bit in the bitmap. In this special case -1 is returned. */
+long long redisBitpos(void *s, unsigned long count, int bit) {
+	unsigned char *p = s;
+	long off = bitopsGetKernels()->bitposSkip(p,count,bit);
+	long long pos;
+	int j;
+
+	if ((unsigned long)off == count) return bit ? -1 : (long long)count<<3;
+
+	/* 在找到的字节中从最高位开始查找，bit 0是第一个字节的最高位 */
+	pos = (long long)off<<3;
+	for (j = 7; j >= 0; j--, pos++) {
+		if (((p[off] >> j) & 1) == bit) break;
+	}
+	return pos;
+}
+
+/* The following set.*Bitfield and get.*Bitfield functions implement setting
+ * and getting arbitrary size (up to 64 bits) signed and unsigned integers
+ * at the specified bit offset. The offset is considered as the first bit
+ * of the integer, and the integer is stored most significant bit first. */
+static void setUnsignedBitfield(unsigned char *p, uint64_t offset, uint64_t bits, uint64_t value) {
+	uint64_t byte, bit, byteval, bitval, j;
+
+	for (j = 0; j < bits; j++) {
+		bitval = (value & ((uint64_t)1<<(bits-1-j))) != 0;
+		byte = offset >> 3;
+		bit = 7 - (offset & 0x7);
+		byteval = p[byte];
+		byteval &= ~(1 << bit);
+		byteval |= bitval << bit;
+		p[byte] = byteval & 0xff;
+		offset++;
+	}
+}
+
+static void setSignedBitfield(unsigned char *p, uint64_t offset, uint64_t bits, int64_t value) {
+	uint64_t uv = value; /* Casting will add UINT64_MAX + 1 if v is negative. */
+	setUnsignedBitfield(p,offset,bits,uv);
+}
+
+static uint64_t getUnsignedBitfield(unsigned char *p, uint64_t offset, uint64_t bits) {
+	uint64_t byte, bit, byteval, bitval, j, value = 0;
+
+	for (j = 0; j < bits; j++) {
+		byte = offset >> 3;
+		bit = 7 - (offset & 0x7);
+		byteval = p[byte];
+		bitval = (byteval >> bit) & 1;
+		value = (value<<1) | bitval;
+		offset++;
+	}
+	return value;
+}
+
+static int64_t getSignedBitfield(unsigned char *p, uint64_t offset, uint64_t bits) {
+	int64_t value;
+	union {uint64_t u; int64_t i;} conv;
+
+	/* Converting from unsigned to signed is undefined when the value does
+	 * not fit, however here we assume two's complement and the original value
+	 * was obtained from signed -> unsigned conversion, so we'll find the
+	 * most significant bit set if the original value was negative.
+	 *
+	 * Note that when bits == 64 the conversion does not require sign
+	 * extension. */
+	conv.u = getUnsignedBitfield(p,offset,bits);
+	value = conv.i;
+
+	/* If the top significant bit is 1, propagate it to all the
+	 * higher bits for two's complement representation of signed
+	 * integers. */
+	if (bits < 64 && (value & ((uint64_t)1 << (bits-1))))
+		value |= ((uint64_t)-1) << bits;
+	return value;
+}
+
+/* The following two functions detect overflow of a value in the context
+ * of storing it as an unsigned or signed integer with the specified
+ * number of bits. The functions both take the value and a possible increment.
+ * If no overflow could happen and the value+increment fit inside the limits,
+ * then zero is returned, otherwise in case of overflow, 1 is returned,
+ * otherwise in case of underflow, -1 is returned.
+ *
+ * When non-zero is returned (overflow or underflow), if not NULL, *limit is
+ * set to the value the operation should result when an overflow happens,
+ * depending on the specified overflow semantics:
+ *
+ * For BFOVERFLOW_SAT if 1 is returned, *limit it is set maximum value that
+ * you can store in that integer. when -1 is returned, *limit is set to the
+ * minimum value that an integer of that size can represent.
+ *
+ * For BFOVERFLOW_WRAP *limit is set by performing the operation in order to
+ * "wrap" around towards zero for unsigned integers, or towards the most
+ * negative number that is possible to represent for signed integers. */
+
+#define BFOVERFLOW_WRAP 0
+#define BFOVERFLOW_SAT 1
+#define BFOVERFLOW_FAIL 2 /* Used by the BITFIELD command implementation. */
+
+static int checkUnsignedBitfieldOverflow(uint64_t value, int64_t incr, uint64_t bits, int owtype, uint64_t *limit) {
+	uint64_t max = (bits == 64) ? UINT64_MAX : (((uint64_t)1<<bits)-1);
+	int64_t maxincr = max-value;
+	int64_t minincr = -value;
+
+	if (value > max || (incr > 0 && incr > maxincr)) {
+		if (limit) {
+			if (owtype == BFOVERFLOW_WRAP) {
+				goto handle_wrap;
+			} else if (owtype == BFOVERFLOW_SAT) {
+				*limit = max;
+			}
+		}
+		return 1;
+	} else if (incr < 0 && incr < minincr) {
+		if (limit) {
+			if (owtype == BFOVERFLOW_WRAP) {
+				goto handle_wrap;
+			} else if (owtype == BFOVERFLOW_SAT) {
+				*limit = 0;
+			}
+		}
+		return -1;
+	}
+	return 0;
+
+handle_wrap:
+	{
+		uint64_t mask = ((uint64_t)-1) << bits;
+		uint64_t res = value+incr;
+
+		res &= ~mask;
+		*limit = res;
+	}
+	return 1;
+}
+
+static int checkSignedBitfieldOverflow(int64_t value, int64_t incr, uint64_t bits, int owtype, int64_t *limit) {
+	int64_t max = (bits == 64) ? INT64_MAX : (((int64_t)1<<(bits-1))-1);
+	int64_t min = (-max)-1;
+
+	/* Note that maxincr and minincr could overflow, but we use the values
+	 * only after checking 'value' range, so when we use it no overflow
+	 * happens. 'uint64_t' cast is there just to prevent undefined behavior on
+	 * overflow */
+	int64_t maxincr = (uint64_t)max-value;
+	int64_t minincr = min-value;
+
+	if (value > max || (bits != 64 && incr > maxincr) ||
+		(value >= 0 && incr > 0 && incr > maxincr))
+	{
+		if (limit) {
+			if (owtype == BFOVERFLOW_WRAP) {
+				goto handle_wrap;
+			} else if (owtype == BFOVERFLOW_SAT) {
+				*limit = max;
+			}
+		}
+		return 1;
+	} else if (value < min || (bits != 64 && incr < minincr) ||
+			   (value < 0 && incr < 0 && incr < minincr))
+	{
+		if (limit) {
+			if (owtype == BFOVERFLOW_WRAP) {
+				goto handle_wrap;
+			} else if (owtype == BFOVERFLOW_SAT) {
+				*limit = min;
+			}
+		}
+		return -1;
+	}
+	return 0;
+
+handle_wrap:
+	{
+		uint64_t msb = (uint64_t)1 << (bits-1);
+		uint64_t a = value, b = incr, c;
+		c = a+b; /* Perform addition as unsigned so that's defined. */
+
+		/* If the sign bit is set, propagate to all the higher order
+		 * bits, to cap the negative value. If it's clear, mask to
+		 * the positive integer limit. */
+		if (bits < 64) {
+			uint64_t mask = ((uint64_t)-1) << bits;
+			if (c & msb) {
+				c |= mask;
+			} else {
+				c &= ~mask;
+			}
+		}
+		*limit = c;
+	}
+	return 1;
+}
+
+/* -----------------------------------------------------------------------------
+ * Bits related string commands: GETBIT, SETBIT, BITCOUNT, BITOP.
+ * -------------------------------------------------------------------------- */
+
+/* This helper function used by GETBIT / SETBIT parses the bit offset argument
+ * making sure an error is returned if it is negative or if it overflows
+ * Redis 512 MB limit for the string value.
+ *
+ * If the 'hash' argument is true, and 'bits is positive, then the command
+ * will also parse bit offsets prefixed by "#". In such a case the offset
+ * is multiplied by 'bits'. This is useful for the BITFIELD command. */
+static int getBitOffsetFromArgument(client *c, robj *o, uint64_t *offset, int hash, int bits) {
+	long long loffset;
+	char *err = "bit offset is not an integer or out of range";
+	char *p = o->ptr;
+	size_t plen = sdslen(p);
+	int usehash = 0;
+
+	/* Handle #<offset> form. */
+	if (p[0] == '#' && hash && bits > 0) usehash = 1;
+
+	if (string2ll(p+usehash,plen-usehash,&loffset) == 0) {
+		addReplyError(c,err);
+		return C_ERR;
+	}
+
+	/* Adjust the offset by 'bits' for #<offset> form. */
+	if (usehash) loffset *= bits;
+
+	/* Limit offset to 512MB in bytes */
+	if ((loffset < 0) || (loffset >> 3) >= PROTO_MAX_BULK_LEN) {
+		addReplyError(c,err);
+		return C_ERR;
+	}
+
+	*offset = loffset;
+	return C_OK;
+}
+
+/* This helper function for BITFIELD parses a bitfield type in the form
+ * <sign><bits> where sign is 'u' or 'i' for unsigned and signed, and
+ * the bits is a value between 1 and 64. However 64 bits unsigned integers
+ * are reported as an error because of current limitations of Redis protocol
+ * to return unsigned integer values greater than INT64_MAX.
+ *
+ * On error C_ERR is returned and an error is sent to the client. */
+static int getBitfieldTypeFromArgument(client *c, robj *o, int *sign, int *bits) {
+	char *p = o->ptr;
+	char *err = "Invalid bitfield type. Use something like i16 u8. Note that u64 is not supported but i64 is.";
+	long long llbits;
+
+	if (p[0] == 'i') {
+		*sign = 1;
+	} else if (p[0] == 'u') {
+		*sign = 0;
+	} else {
+		addReplyError(c,err);
+		return C_ERR;
+	}
+
+	if ((string2ll(p+1,strlen(p+1),&llbits)) == 0 ||
+		llbits < 1 ||
+		(*sign == 1 && llbits > 64) ||
+		(*sign == 0 && llbits > 63))
+	{
+		addReplyError(c,err);
+		return C_ERR;
+	}
+	*bits = llbits;
+	return C_OK;
+}
+
+/* This is a helper function for commands implementations that need to write
+ * bits to a string object. The command creates or pad with zeroes the string
+ * so that the 'maxbit' bit can be addressed. The object is finally
+ * returned. Otherwise if the key holds a wrong type NULL is returned and
+ * an error is sent to the client. */
+/*
+ * 字符串不存在时创建一个全0的字符串，存在时先取消共享，再用sdsgrowzero扩展到能容纳maxbit
+ */
+static robj *lookupStringForBitCommand(client *c, uint64_t maxbit) {
+	size_t byte = maxbit >> 3;
+	robj *o = lookupKey(c->db,c->argv[1]);
+
+	if (o == NULL) {
+		o = createObject(OBJ_STRING,sdsnewlen(NULL, byte+1));
+		dbAdd(c->db,c->argv[1],o);
+	} else {
+		if (checkType(c,o,OBJ_STRING)) return NULL;
+		o = dbUnshareStringValue(c->db,c->argv[1],o);
+		o->ptr = sdsgrowzero(o->ptr,byte+1);
+	}
+	return o;
+}
+
+/* Return a pointer to the string object content, and stores its length
+ * in 'len'. The user is required to pass (likely stack allocated) buffer
+ * 'llbuf' of at least LONG_STR_SIZE bytes. Such a buffer is used in the case
+ * the object is integer encoded in order to provide the representation
+ * without using heap allocation.
+ *
+ * The function returns the pointer to the object array of bytes representing
+ * the string it contains, that may be a pointer to 'llbuf' or to the
+ * internal object representation. As a side effect 'len' is filled with
+ * the length of such buffer.
+ *
+ * If the source object is NULL the function is guaranteed to return NULL
+ * and set 'len' to 0. */
+static unsigned char *getObjectReadOnlyString(robj *o, long *len, char *llbuf) {
+	unsigned char *p = NULL;
+
+	/* Set the 'p' pointer to the string, that can be just a stack allocated
+	 * array if our string was integer encoded. */
+	if (o && o->encoding == OBJ_ENCODING_INT) {
+		p = (unsigned char*) llbuf;
+		if (len) *len = ll2string(llbuf,32,(long)o->ptr);
+	} else if (o) {
+		p = (unsigned char*) o->ptr;
+		if (len) *len = sdslen(o->ptr);
+	} else {
+		if (len) *len = 0;
+	}
+	return p;
+}
+
+/* SETBIT key offset bitvalue */
+void setbitCommand(client *c) {
+	robj *o;
+	char *err = "bit is not an integer or out of range";
+	uint64_t bitoffset;
+	ssize_t byte, bit;
+	int byteval, bitval;
+	long on;
+
+	if (getBitOffsetFromArgument(c,c->argv[2],&bitoffset,0,0) != C_OK)
+		return;
+
+	if (getLongFromObjectOrReply(c,c->argv[3],&on,err) != C_OK)
+		return;
+
+	/* Bits can only be set or cleared... */
+	if (on & ~1) {
+		addReplyError(c,err);
+		return;
+	}
+
+	if ((o = lookupStringForBitCommand(c,bitoffset)) == NULL) return;
+
+	/* Get current values */
+	byte = bitoffset >> 3;
+	byteval = ((uint8_t*)o->ptr)[byte];
+	bit = 7 - (bitoffset & 0x7);
+	bitval = byteval & (1 << bit);
+
+	/* Update byte with new bit value and return original value */
+	byteval &= ~(1 << bit);
+	byteval |= ((on & 0x1) << bit);
+	((uint8_t*)o->ptr)[byte] = byteval;
+	server.dirty++;
+	addReply(c, bitval ? shared.cone : shared.czero);
+}
+
+/* GETBIT key offset */
+void getbitCommand(client *c) {
+	robj *o;
+	char llbuf[32];
+	uint64_t bitoffset;
+	size_t byte, bit;
+	size_t bitval = 0;
+
+	if (getBitOffsetFromArgument(c,c->argv[2],&bitoffset,0,0) != C_OK)
+		return;
+
+	if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.czero)) == NULL ||
+		checkType(c,o,OBJ_STRING)) return;
+
+	byte = bitoffset >> 3;
+	bit = 7 - (bitoffset & 0x7);
+	if (sdsEncodedObject(o)) {
+		if (byte < sdslen(o->ptr))
+			bitval = ((uint8_t*)o->ptr)[byte] & (1 << bit);
+	} else {
+		if (byte < (size_t)ll2string(llbuf,sizeof(llbuf),(long)o->ptr))
+			bitval = llbuf[byte] & (1 << bit);
+	}
+
+	addReply(c, bitval ? shared.cone : shared.czero);
+}
+
+/*
+ * BITOP op_name target_key src_key1 src_key2 src_key3 ... src_keyN
+ * 所有源都有数据的前缀部分（按32字节对齐）交给选定的实现处理，剩余部分逐字节计算，
+ * 较短的源在末尾视为用0填充
+ */
+void bitopCommand(client *c) {
+	char *opname = c->argv[1]->ptr;
+	robj *o, *targetkey = c->argv[2];
+	unsigned long op, j, numkeys;
+	robj **objects;      /* Array of source objects. */
+	unsigned char **src; /* Array of source strings pointers. */
+	unsigned long *len, maxlen = 0; /* Array of length of src strings,
+									   and max len. */
+	unsigned long minlen = 0;    /* Min len among the input keys. */
+	unsigned char *res = NULL; /* Resulting string. */
+
+	/* Parse the operation name. */
+	if ((opname[0] == 'a' || opname[0] == 'A') && !strcasecmp(opname,"and"))
+		op = BITOP_AND;
+	else if((opname[0] == 'o' || opname[0] == 'O') && !strcasecmp(opname,"or"))
+		op = BITOP_OR;
+	else if((opname[0] == 'x' || opname[0] == 'X') && !strcasecmp(opname,"xor"))
+		op = BITOP_XOR;
+	else if((opname[0] == 'n' || opname[0] == 'N') && !strcasecmp(opname,"not"))
+		op = BITOP_NOT;
+	else {
+		addReply(c,shared.syntaxerr);
+		return;
+	}
+
+	/* Sanity check: NOT accepts only a single key argument. */
+	if (op == BITOP_NOT && c->argc != 4) {
+		addReplyError(c,"BITOP NOT must be called with a single source key.");
+		return;
+	}
+
+	/* Lookup keys, and store pointers to the string objects into an array. */
+	numkeys = c->argc - 3;
+	src = zmalloc(sizeof(unsigned char*) * numkeys);
+	len = zmalloc(sizeof(long) * numkeys);
+	objects = zmalloc(sizeof(robj*) * numkeys);
+	for (j = 0; j < numkeys; j++) {
+		o = lookupKey(c->db,c->argv[j+3]);
+		/* Handle non-existing keys as empty strings. */
+		if (o == NULL) {
+			objects[j] = NULL;
+			src[j] = NULL;
+			len[j] = 0;
+			minlen = 0;
+			continue;
+		}
+		/* Return an error if one of the keys is not a string. */
+		if (checkType(c,o,OBJ_STRING)) {
+			unsigned long i;
+			for (i = 0; i < j; i++) {
+				if (objects[i])
+					decrRefCount(objects[i]);
+			}
+			zfree(src);
+			zfree(len);
+			zfree(objects);
+			return;
+		}
+		objects[j] = getDecodedObject(o);
+		src[j] = objects[j]->ptr;
+		len[j] = sdslen(objects[j]->ptr);
+		if (len[j] > maxlen) maxlen = len[j];
+		if (j == 0 || len[j] < minlen) minlen = len[j];
+	}
+
+	/* Compute the bit operation, if at least one string is not empty. */
+	if (maxlen) {
+		res = (unsigned char*) sdsnewlen(NULL,maxlen);
+		unsigned char output, byte;
+		unsigned long i;
+
+		/* 所有源都有数据的部分走快速路径，每次处理32字节 */
+		j = minlen & ~31UL;
+		if (j) bitopsGetKernels()->bitop(op,res,src,numkeys,j);
+
+		/* j is set to the next byte to process by the previous loop. */
+		for (; j < maxlen; j++) {
+			output = (len[0] <= j) ? 0 : src[0][j];
+			if (op == BITOP_NOT) output = ~output;
+			for (i = 1; i < numkeys; i++) {
+				byte = (len[i] <= j) ? 0 : src[i][j];
+				switch(op) {
+				case BITOP_AND: output &= byte; break;
+				case BITOP_OR:  output |= byte; break;
+				case BITOP_XOR: output ^= byte; break;
+				}
+			}
+			res[j] = output;
+		}
+	}
+	for (j = 0; j < numkeys; j++) {
+		if (objects[j])
+			decrRefCount(objects[j]);
+	}
+	zfree(src);
+	zfree(len);
+	zfree(objects);
+
+	/* Store the computed value into the target key */
+	if (maxlen) {
+		o = createObject(OBJ_STRING,res);
+		setKey(c->db,targetkey,o);
+		decrRefCount(o);
+	} else if (lookupKey(c->db,targetkey) != NULL) {
+		dbDelete(c->db,targetkey);
+	}
+	server.dirty++;
+	addReplyLongLong(c,maxlen); /* Return the output string length in bytes. */
+}
+
+/* BITCOUNT key [start end] */
+void bitcountCommand(client *c) {
+	robj *o;
+	long start, end, strlen;
+	unsigned char *p;
+	char llbuf[32];
+
+	/* Lookup, check for type, and return 0 for non existing keys. */
+	if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.czero)) == NULL ||
+		checkType(c,o,OBJ_STRING)) return;
+	p = getObjectReadOnlyString(o,&strlen,llbuf);
+
+	/* Parse start/end range if any. */
+	if (c->argc == 4) {
+		if (getLongFromObjectOrReply(c,c->argv[2],&start,NULL) != C_OK)
+			return;
+		if (getLongFromObjectOrReply(c,c->argv[3],&end,NULL) != C_OK)
+			return;
+		/* Convert negative indexes */
+		if (start < 0 && end < 0 && start > end) {
+			addReply(c,shared.czero);
+			return;
+		}
+		if (start < 0) start = strlen+start;
+		if (end < 0) end = strlen+end;
+		if (start < 0) start = 0;
+		if (end < 0) end = 0;
+		if (end >= strlen) end = strlen-1;
+	} else if (c->argc == 2) {
+		/* The whole string. */
+		start = 0;
+		end = strlen-1;
+	} else {
+		/* Syntax error. */
+		addReply(c,shared.syntaxerr);
+		return;
+	}
+
+	/* Precondition: end >= 0 && end < strlen, so the only condition where
+	 * zero can be returned is: start > end. */
+	if (start > end) {
+		addReply(c,shared.czero);
+	} else {
+		long bytes = end-start+1;
+
+		addReplyLongLong(c,redisPopcount(p+start,bytes));
+	}
+}
+
+/* BITPOS key bit [start [end]] */
+void bitposCommand(client *c) {
+	robj *o;
+	long bit, start, end, strlen;
+	unsigned char *p;
+	char llbuf[32];
+	int end_given = 0;
+
+	/* Parse the bit argument to understand what we are looking for, set
+	 * or clear bits. */
+	if (getLongFromObjectOrReply(c,c->argv[2],&bit,NULL) != C_OK)
+		return;
+	if (bit != 0 && bit != 1) {
+		addReplyError(c, "The bit argument must be 1 or 0.");
+		return;
+	}
+
+	/* If the key does not exist, from our point of view it is an infinite
+	 * array of 0 bits. If the user is looking for the fist clear bit return 0,
+	 * If the user is looking for the first set bit, return -1. */
+	if ((o = lookupKey(c->db,c->argv[1])) == NULL) {
+		addReplyLongLong(c, bit ? -1 : 0);
+		return;
+	}
+	if (checkType(c,o,OBJ_STRING)) return;
+	p = getObjectReadOnlyString(o,&strlen,llbuf);
+
+	/* Parse start/end range if any. */
+	if (c->argc == 4 || c->argc == 5) {
+		if (getLongFromObjectOrReply(c,c->argv[3],&start,NULL) != C_OK)
+			return;
+		if (c->argc == 5) {
+			if (getLongFromObjectOrReply(c,c->argv[4],&end,NULL) != C_OK)
+				return;
+			end_given = 1;
+		} else {
+			end = strlen-1;
+		}
+		/* Convert negative indexes */
+		if (start < 0) start = strlen+start;
+		if (end < 0) end = strlen+end;
+		if (start < 0) start = 0;
+		if (end < 0) end = 0;
+		if (end >= strlen) end = strlen-1;
+	} else if (c->argc == 3) {
+		/* The whole string. */
+		start = 0;
+		end = strlen-1;
+	} else {
+		/* Syntax error. */
+		addReply(c,shared.syntaxerr);
+		return;
+	}
+
+	/* For empty ranges (start > end) we return -1 as an empty range does
+	 * not contain a 0 nor a 1. */
+	if (start > end) {
+		addReplyLongLong(c, -1);
+	} else {
+		long bytes = end-start+1;
+		long long pos = redisBitpos(p+start,bytes,bit);
+
+		/* If we are looking for clear bits, and the user specified an exact
+		 * range with start-end, we can't consider the right of the range as
+		 * zero padded (as we do when no explicit end is given).
+		 *
+		 * So if redisBitpos() returns the first bit outside the range,
+		 * we return -1 to the caller, to mean, in the specified range there
+		 * is not a single "0" bit. */
+		if (end_given && bit == 0 && pos == (long long)bytes<<3) {
+			addReplyLongLong(c,-1);
+			return;
+		}
+		if (pos != -1) pos += (long long)start<<3; /* Adjust for the bytes we skipped. */
+		addReplyLongLong(c,pos);
+	}
+}
+
+/* BITFIELD key subcommmand-1 arg ... subcommand-2 arg ... subcommand-N ...
+ *
+ * Supported subcommands:
+ *
+ * GET <type> <offset>
+ * SET <type> <offset> <value>
+ * INCRBY <type> <offset> <increment>
+ * OVERFLOW [WRAP|SAT|FAIL]
+ */
+
+#define BITFIELDOP_GET 0
+#define BITFIELDOP_SET 1
+#define BITFIELDOP_INCRBY 2
+
+struct bitfieldOp {
+	uint64_t offset;    /* Bitfield offset. */
+	int64_t i64;        /* Increment amount (INCRBY) or SET value */
+	int opcode;         /* Operation id. */
+	int owtype;         /* Overflow type to use. */
+	int bits;           /* Integer bitfield bits width. */
+	int sign;           /* True if signed, otherwise unsigned op. */
+};
+
+void bitfieldCommand(client *c) {
+	robj *o;
+	uint64_t bitoffset;
+	int j, numops = 0, changes = 0;
+	struct bitfieldOp *ops = NULL; /* Array of ops to execute at end. */
+	int owtype = BFOVERFLOW_WRAP; /* Overflow type. */
+	int readonly = 1;
+	uint64_t highest_write_offset = 0;
+
+	for (j = 2; j < c->argc; j++) {
+		int remargs = c->argc-j-1; /* Remaining args other than current. */
+		char *subcmd = c->argv[j]->ptr; /* Current command name. */
+		int opcode; /* Current operation code. */
+		long long i64 = 0;  /* Signed SET value. */
+		int sign = 0; /* Signed or unsigned type? */
+		int bits = 0; /* Bitfield width in bits. */
+
+		if (!strcasecmp(subcmd,"get") && remargs >= 2)
+			opcode = BITFIELDOP_GET;
+		else if (!strcasecmp(subcmd,"set") && remargs >= 3)
+			opcode = BITFIELDOP_SET;
+		else if (!strcasecmp(subcmd,"incrby") && remargs >= 3)
+			opcode = BITFIELDOP_INCRBY;
+		else if (!strcasecmp(subcmd,"overflow") && remargs >= 1) {
+			char *owtypename = c->argv[j+1]->ptr;
+			j++;
+			if (!strcasecmp(owtypename,"wrap"))
+				owtype = BFOVERFLOW_WRAP;
+			else if (!strcasecmp(owtypename,"sat"))
+				owtype = BFOVERFLOW_SAT;
+			else if (!strcasecmp(owtypename,"fail"))
+				owtype = BFOVERFLOW_FAIL;
+			else {
+				addReplyError(c,"Invalid OVERFLOW type specified");
+				zfree(ops);
+				return;
+			}
+			continue;
+		} else {
+			addReply(c,shared.syntaxerr);
+			zfree(ops);
+			return;
+		}
+
+		/* Get the type and offset arguments, common to all the ops. */
+		if (getBitfieldTypeFromArgument(c,c->argv[j+1],&sign,&bits) != C_OK) {
+			zfree(ops);
+			return;
+		}
+
+		if (getBitOffsetFromArgument(c,c->argv[j+2],&bitoffset,1,bits) != C_OK){
+			zfree(ops);
+			return;
+		}
+
+		if (opcode != BITFIELDOP_GET) {
+			readonly = 0;
+			if (highest_write_offset < bitoffset + bits - 1)
+				highest_write_offset = bitoffset + bits - 1;
+			/* INCRBY and SET require another argument. */
+			if (getLongLongFromObjectOrReply(c,c->argv[j+3],&i64,NULL) != C_OK){
+				zfree(ops);
+				return;
+			}
+		}
+
+		/* Populate the array of operations we'll process. */
+		ops = zrealloc(ops,sizeof(*ops)*(numops+1));
+		ops[numops].offset = bitoffset;
+		ops[numops].i64 = i64;
+		ops[numops].opcode = opcode;
+		ops[numops].owtype = owtype;
+		ops[numops].bits = bits;
+		ops[numops].sign = sign;
+		numops++;
+
+		j += 3 - (opcode == BITFIELDOP_GET);
+	}
+
+	if (readonly) {
+		/* Lookup for read is ok if key doesn't exit, but errors
+		 * if it's not a string. */
+		o = lookupKey(c->db,c->argv[1]);
+		if (o != NULL && checkType(c,o,OBJ_STRING)) {
+			zfree(ops);
+			return;
+		}
+	} else {
+		/* Lookup by making room up to the farest bit reached by
+		 * this operation. */
+		if ((o = lookupStringForBitCommand(c,
+			highest_write_offset)) == NULL) {
+			zfree(ops);
+			return;
+		}
+	}
+
+	addReplyMultiBulkLen(c,numops);
+
+	/* Actually process the operations. */
+	for (j = 0; j < numops; j++) {
+		struct bitfieldOp *thisop = ops+j;
+
+		/* Execute the operation. */
+		if (thisop->opcode == BITFIELDOP_SET ||
+			thisop->opcode == BITFIELDOP_INCRBY)
+		{
+			/* SET and INCRBY: We handle both with the same code path
+			 * for simplicity. SET return value is the previous value so
+			 * we need fetch & store as well. */
+
+			/* We need two different but very similar code paths for signed
+			 * and unsigned operations, since the set of functions to get/set
+			 * the integers and the used variables types are different. */
+			if (thisop->sign) {
+				int64_t oldval, newval, wrapped, retval;
+				int overflow;
+
+				oldval = getSignedBitfield(o->ptr,thisop->offset,
+						thisop->bits);
+
+				if (thisop->opcode == BITFIELDOP_INCRBY) {
+					overflow = checkSignedBitfieldOverflow(oldval,
+							thisop->i64,thisop->bits,thisop->owtype,&wrapped);
+					newval = overflow ? wrapped : oldval + thisop->i64;
+					retval = newval;
+				} else {
+					newval = thisop->i64;
+					overflow = checkSignedBitfieldOverflow(newval,
+							0,thisop->bits,thisop->owtype,&wrapped);
+					if (overflow) newval = wrapped;
+					retval = oldval;
+				}
+
+				/* On overflow of type is "FAIL", don't write and return
+				 * NULL to signal the condition. */
+				if (!(overflow && thisop->owtype == BFOVERFLOW_FAIL)) {
+					addReplyLongLong(c,retval);
+					setSignedBitfield(o->ptr,thisop->offset,
+							thisop->bits,newval);
+				} else {
+					addReply(c,shared.nullbulk);
+				}
+			} else {
+				uint64_t oldval, newval, wrapped, retval;
+				int overflow;
+
+				oldval = getUnsignedBitfield(o->ptr,thisop->offset,
+						thisop->bits);
+
+				if (thisop->opcode == BITFIELDOP_INCRBY) {
+					newval = oldval + thisop->i64;
+					overflow = checkUnsignedBitfieldOverflow(oldval,
+							thisop->i64,thisop->bits,thisop->owtype,&wrapped);
+					if (overflow) newval = wrapped;
+					retval = newval;
+				} else {
+					newval = thisop->i64;
+					overflow = checkUnsignedBitfieldOverflow(newval,
+							0,thisop->bits,thisop->owtype,&wrapped);
+					if (overflow) newval = wrapped;
+					retval = oldval;
+				}
+				/* On overflow of type is "FAIL", don't write and return
+				 * NULL to signal the condition. */
+				if (!(overflow && thisop->owtype == BFOVERFLOW_FAIL)) {
+					addReplyLongLong(c,retval);
+					setUnsignedBitfield(o->ptr,thisop->offset,
+							thisop->bits,newval);
+				} else {
+					addReply(c,shared.nullbulk);
+				}
+			}
+			changes++;
+		} else {
+			/* GET */
+			unsigned char buf[9];
+			long strlen = 0;
+			unsigned char *src = NULL;
+			char llbuf[32];
+
+			if (o != NULL)
+				src = getObjectReadOnlyString(o,&strlen,llbuf);
+
+			/* For GET we use a trick: before executing the operation
+			 * copy up to 9 bytes to a local buffer, so that we can easily
+			 * execute up to 64 bit operations that are at actual string
+			 * object boundaries. */
+			memset(buf,0,9);
+			int i;
+			uint64_t byte = thisop->offset >> 3;
+			for (i = 0; i < 9; i++) {
+				if (src == NULL || i+byte >= (uint64_t)strlen) break;
+				buf[i] = src[i+byte];
+			}
+
+			/* Now operate on the copied buffer which is guaranteed
+			 * to be zero-padded. */
+			if (thisop->sign) {
+				int64_t val = getSignedBitfield(buf,thisop->offset-(byte*8),
+											thisop->bits);
+				addReplyLongLong(c,val);
+			} else {
+				uint64_t val = getUnsignedBitfield(buf,thisop->offset-(byte*8),
+											thisop->bits);
+				addReplyLongLong(c,val);
+			}
+		}
+	}
+
+	if (changes) server.dirty += changes;
+	zfree(ops);
+}
+
+#ifdef BITOPS_BENCHMARK_MAIN
+/*
+ * 位运算实现的基准测试，比较标量、POPCNT和AVX2版本：
+ * make bitops-benchmark && ./bitops-benchmark
+ * 使用512MB的位图（2^32位），每种实现的结果都和标量版本对比
+ */
+#define BITOPS_BENCH_BYTES (512L*1024*1024)
+
+static void benchReport(const char *kernel, const char *test, long long us, long bytes) {
+	printf("%-7s %-22s %8.1f ms  %6.2f GB/s\n", kernel, test, us/1000.0,
+		(double)bytes/us/1000.0);
+}
+
+int main(void) {
+	bitopsKernels *all[3];
+	int nkernels = 0, k;
+	unsigned char *a, *b, *dst, *expected, *src[2];
+	uint64_t x = 0x9E3779B97F4A7C15ULL;
+	long long start, count = 0, pos, refcount = -1;
+	long j;
+
+	all[nkernels++] = &scalarKernels;
+#ifdef BITOPS_USE_X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("popcnt")) all[nkernels++] = &popcntKernels;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+		all[nkernels++] = &avx2Kernels;
+#endif
+
+	a = zmalloc(BITOPS_BENCH_BYTES);
+	b = zmalloc(BITOPS_BENCH_BYTES);
+	dst = zmalloc(BITOPS_BENCH_BYTES);
+	expected = zmalloc(BITOPS_BENCH_BYTES);
+	for (j = 0; j < BITOPS_BENCH_BYTES; j += 8) {
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		memcpy(a+j,&x,8);
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		memcpy(b+j,&x,8);
+	}
+	src[0] = a;
+	src[1] = b;
+
+	for (k = 0; k < nkernels; k++) {
+		bitopsKernels *kn = all[k];
+
+		start = ustime();
+		count = kn->popcount(a,BITOPS_BENCH_BYTES);
+		benchReport(kn->name,"BITCOUNT",ustime()-start,BITOPS_BENCH_BYTES);
+		if (refcount == -1) refcount = count;
+		if (count != refcount) printf("  BITCOUNT mismatch: %lld != %lld\n",count,refcount);
+
+		/* 只有最后一位是1，BITPOS需要扫描整个位图 */
+		memset(dst,0,BITOPS_BENCH_BYTES);
+		dst[BITOPS_BENCH_BYTES-1] = 1;
+		start = ustime();
+		j = kn->bitposSkip(dst,BITOPS_BENCH_BYTES,1);
+		benchReport(kn->name,"BITPOS 1 (last bit)",ustime()-start,BITOPS_BENCH_BYTES);
+		if (j != BITOPS_BENCH_BYTES-1) printf("  BITPOS mismatch: %ld\n",j);
+
+		memset(dst,0xff,BITOPS_BENCH_BYTES);
+		dst[BITOPS_BENCH_BYTES-1] = 0xfe;
+		start = ustime();
+		j = kn->bitposSkip(dst,BITOPS_BENCH_BYTES,0);
+		benchReport(kn->name,"BITPOS 0 (last bit)",ustime()-start,BITOPS_BENCH_BYTES);
+		if (j != BITOPS_BENCH_BYTES-1) printf("  BITPOS mismatch: %ld\n",j);
+
+		for (int op = BITOP_AND; op <= BITOP_NOT; op++) {
+			static const char *names[] = {"BITOP AND (2 keys)","BITOP OR (2 keys)",
+				"BITOP XOR (2 keys)","BITOP NOT"};
+			unsigned long numkeys = (op == BITOP_NOT) ? 1 : 2;
+
+			start = ustime();
+			kn->bitop(op,dst,src,numkeys,BITOPS_BENCH_BYTES);
+			benchReport(kn->name,names[op],ustime()-start,
+				BITOPS_BENCH_BYTES*(numkeys+1));
+			if (k == 0 && op == BITOP_XOR)
+				memcpy(expected,dst,BITOPS_BENCH_BYTES);
+			if (op == BITOP_XOR && memcmp(expected,dst,BITOPS_BENCH_BYTES))
+				printf("  BITOP XOR mismatch\n");
+		}
+	}
+
+	/* redisBitpos()在找到的字节内部定位 */
+	memset(dst,0,64);
+	dst[37] = 0x10;
+	pos = redisBitpos(dst,64,1);
+	if (pos != 37*8+3) printf("redisBitpos mismatch: %lld\n",pos);
+	printf("selected kernels: %s\n",bitopsGetKernels()->name);
+
+	zfree(a);
+	zfree(b);
+	zfree(dst);
+	zfree(expected);
+	return 0;
+}
+#endif
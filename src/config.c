@@ -0,0 +1,332 @@
+/* Configuration file parsing.
+ * 配置文件及启动参数解析
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "rdb.h"
+#include "zmalloc.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+clientBufferLimitsConfig clientBufferLimitsDefaults[CLIENT_TYPE_OBUF_COUNT] = {
+	{0, 0, 0}, /* normal */
+	{1024*1024*256, 1024*1024*64, 60}, /* slave */
+	{1024*1024*32, 1024*1024*8, 60}  /* pubsub */
+};
+
+/*-----------------------------------------------------------------------------
+ * Config file parsing
+ *----------------------------------------------------------------------------*/
+
+int yesnotoi(char *s) {
+	if (!strcasecmp(s,"yes")) return 1;
+	else if (!strcasecmp(s,"no")) return 0;
+	else return -1;
+}
+
+/*
+ * 逐行解析配置，每行的格式是 "name arg1 arg2 ..."
+ * 出错时打印出错的行并退出
+ */
+void loadServerConfigFromString(char *config) {
+	char *err = NULL;
+	int linenum = 0, totlines, i;
+	sds *lines;
+
+	lines = sdssplitlen(config,strlen(config),"\n",1,&totlines);
+
+	for (i = 0; i < totlines; i++) {
+		sds *argv;
+		int argc;
+
+		linenum = i+1;
+		lines[i] = sdstrim(lines[i]," \t\r\n");
+
+		/* Skip comments and blank lines */
+		if (lines[i][0] == '#' || lines[i][0] == '\0') continue;
+
+		/* Split into arguments */
+		argv = sdssplitargs(lines[i],&argc);
+		if (argv == NULL) {
+			err = "Unbalanced quotes in configuration line";
+			goto loaderr;
+		}
+
+		/* Skip this line if the resulting command vector is empty. */
+		if (argc == 0) {
+			sdsfreesplitres(argv,argc);
+			continue;
+		}
+		sdstolower(argv[0]);
+
+		/* Execute config directives */
+		if (!strcasecmp(argv[0],"port") && argc == 2) {
+			server.port = atoi(argv[1]);
+			if (server.port < 0 || server.port > 65535) {
+				err = "Invalid port"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"maxclients") && argc == 2) {
+			server.maxclients = atoi(argv[1]);
+			if (server.maxclients < 1) {
+				err = "Invalid max clients limit"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"maxmemory") && argc == 2) {
+			server.maxmemory = memtoll(argv[1],NULL);
+		} else if (!strcasecmp(argv[0],"client-read-pause-watermark") &&
+				argc == 3)
+		{
+			/* client-read-pause-watermark <high> <low>，high为0时不暂停读取 */
+			server.client_read_pause_high = memtoll(argv[1],NULL);
+			server.client_read_pause_low = memtoll(argv[2],NULL);
+			if (server.client_read_pause_high &&
+				server.client_read_pause_low > server.client_read_pause_high)
+			{
+				err = "Low watermark can't be greater than the high watermark";
+				goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"client-max-commands-per-event") &&
+				argc == 2)
+		{
+			server.client_cmds_per_event = atoi(argv[1]);
+			if (server.client_cmds_per_event < 0) {
+				err = "Invalid commands per event value"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"reply-ref-threshold") && argc == 2) {
+			server.reply_ref_threshold = memtoll(argv[1],NULL);
+		} else if (!strcasecmp(argv[0],"reply-zerocopy") && argc == 2) {
+			if ((server.reply_zerocopy = yesnotoi(argv[1])) == -1) {
+				err = "argument must be 'yes' or 'no'"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"client-output-buffer-limit") &&
+				argc == 5)
+		{
+			int class = getClientTypeByName(argv[1]);
+			unsigned long long hard, soft;
+			int soft_seconds;
+
+			if (class == -1 || class == CLIENT_TYPE_MASTER) {
+				err = "Unrecognized client limit class: the user specified "
+				"an invalid one, or 'master' which has no buffer limits.";
+				goto loaderr;
+			}
+			hard = memtoll(argv[2],NULL);
+			soft = memtoll(argv[3],NULL);
+			soft_seconds = atoi(argv[4]);
+			if (soft_seconds < 0) {
+				err = "Negative number of seconds in soft limit is invalid";
+				goto loaderr;
+			}
+			server.client_obuf_limits[class].hard_limit_bytes = hard;
+			server.client_obuf_limits[class].soft_limit_bytes = soft;
+			server.client_obuf_limits[class].soft_limit_seconds = soft_seconds;
+		} else if (!strcasecmp(argv[0],"timeout") && argc == 2) {
+			server.maxidletime = atoi(argv[1]);
+			if (server.maxidletime < 0) {
+				err = "Invalid timeout value"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"tcp-keepalive") && argc == 2) {
+			server.tcpkeepalive = atoi(argv[1]);
+			if (server.tcpkeepalive < 0) {
+				err = "Invalid tcp-keepalive value"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"tcp-reuseport-listeners") && argc == 2) {
+			server.reuseport_listeners = atoi(argv[1]);
+			if (server.reuseport_listeners < 1 ||
+				server.reuseport_listeners > CONFIG_REUSEPORT_MAX)
+			{
+				err = "Invalid number of reuseport listeners"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"tcp-reuseport-cpu-steering") && argc == 2) {
+			if ((server.reuseport_cpu_steering = yesnotoi(argv[1])) == -1) {
+				err = "argument must be 'yes' or 'no'"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"unixsocket") && argc == 2) {
+			zfree(server.unixsocket);
+			server.unixsocket = zstrdup(argv[1]);
+		} else if (!strcasecmp(argv[0],"unixsocketperm") && argc == 2) {
+			errno = 0;
+			server.unixsocketperm = (mode_t)strtol(argv[1], NULL, 8);
+			if (errno || server.unixsocketperm > 0777) {
+				err = "Invalid socket file permissions"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"dbfilename") && argc == 2) {
+			zfree(server.rdb_filename);
+			server.rdb_filename = zstrdup(argv[1]);
+		} else if (!strcasecmp(argv[0],"rdb-load-threads") && argc == 2) {
+			server.rdb_load_threads = atoi(argv[1]);
+			if (server.rdb_load_threads < 1 ||
+				server.rdb_load_threads > RDB_LOAD_MAX_THREADS)
+			{
+				err = "Invalid number of RDB load threads"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"rdb-lazy-load") && argc == 2) {
+			if ((server.rdb_lazy_load = yesnotoi(argv[1])) == -1) {
+				err = "argument must be 'yes' or 'no'"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"rdb-bgsave-mode") && argc == 2) {
+			if (!strcasecmp(argv[1],"fork")) {
+				server.rdb_bgsave_forkless = 0;
+			} else if (!strcasecmp(argv[1],"forkless")) {
+				server.rdb_bgsave_forkless = 1;
+			} else {
+				err = "argument must be 'fork' or 'forkless'"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"set-max-intset-entries") && argc == 2) {
+			server.set_max_intset_entries = memtoll(argv[1], NULL);
+		} else if (!strcasecmp(argv[0],"zset-max-ziplist-entries") && argc == 2) {
+			server.zset_max_ziplist_entries = memtoll(argv[1], NULL);
+		} else if (!strcasecmp(argv[0],"zset-max-ziplist-value") && argc == 2) {
+			server.zset_max_ziplist_value = memtoll(argv[1], NULL);
+		} else if (!strcasecmp(argv[0],"hll-sparse-max-bytes") && argc == 2) {
+			server.hll_sparse_max_bytes = memtoll(argv[1], NULL);
+		} else if (!strcasecmp(argv[0],"stream-node-max-bytes") && argc == 2) {
+			server.stream_node_max_bytes = memtoll(argv[1], NULL);
+		} else if (!strcasecmp(argv[0],"stream-node-max-entries") && argc == 2) {
+			server.stream_node_max_entries = atoi(argv[1]);
+		} else if (!strcasecmp(argv[0],"hash-max-ziplist-entries") && argc == 2) {
+			server.hash_max_ziplist_entries = memtoll(argv[1], NULL);
+		} else if (!strcasecmp(argv[0],"hash-max-ziplist-value") && argc == 2) {
+			server.hash_max_ziplist_value = memtoll(argv[1], NULL);
+		} else if (!strcasecmp(argv[0],"list-max-ziplist-size") && argc == 2) {
+			server.list_max_ziplist_size = atoi(argv[1]);
+			if (server.list_max_ziplist_size == 0 ||
+				server.list_max_ziplist_size < -5 ||
+				server.list_max_ziplist_size > QL_MAX_FILL)
+			{
+				err = "Invalid list-max-ziplist-size"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"list-compress-depth") && argc == 2) {
+			server.list_compress_depth = atoi(argv[1]);
+			if (server.list_compress_depth < 0 ||
+				server.list_compress_depth > QL_MAX_COMPRESS)
+			{
+				err = "Invalid list-compress-depth"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"appendonly") && argc == 2) {
+			int yes;
+
+			if ((yes = yesnotoi(argv[1])) == -1) {
+				err = "argument must be 'yes' or 'no'"; goto loaderr;
+			}
+			server.aof_state = yes ? AOF_ON : AOF_OFF;
+		} else if (!strcasecmp(argv[0],"appendfilename") && argc == 2) {
+			if (strchr(argv[1],'/') != NULL) {
+				err = "appendfilename can't be a path, just a filename";
+				goto loaderr;
+			}
+			zfree(server.aof_filename);
+			server.aof_filename = zstrdup(argv[1]);
+		} else if (!strcasecmp(argv[0],"appendfsync") && argc == 2) {
+			if (!strcasecmp(argv[1],"no")) {
+				server.aof_fsync = AOF_FSYNC_NO;
+			} else if (!strcasecmp(argv[1],"always")) {
+				server.aof_fsync = AOF_FSYNC_ALWAYS;
+			} else if (!strcasecmp(argv[1],"everysec")) {
+				server.aof_fsync = AOF_FSYNC_EVERYSEC;
+			} else {
+				err = "argument must be 'no', 'always' or 'everysec'";
+				goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"auto-aof-rewrite-percentage") &&
+				argc == 2)
+		{
+			server.aof_rewrite_perc = atoi(argv[1]);
+			if (server.aof_rewrite_perc < 0) {
+				err = "Invalid negative percentage for AOF auto rewrite";
+				goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"auto-aof-rewrite-min-size") &&
+				argc == 2)
+		{
+			server.aof_rewrite_min_size = memtoll(argv[1],NULL);
+		} else if (!strcasecmp(argv[0],"aof-use-rdb-preamble") && argc == 2) {
+			if ((server.aof_use_rdb_preamble = yesnotoi(argv[1])) == -1) {
+				err = "argument must be 'yes' or 'no'"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"aof-load-truncated") && argc == 2) {
+			if ((server.aof_load_truncated = yesnotoi(argv[1])) == -1) {
+				err = "argument must be 'yes' or 'no'"; goto loaderr;
+			}
+		} else {
+			err = "Bad directive or wrong number of arguments"; goto loaderr;
+		}
+		sdsfreesplitres(argv,argc);
+	}
+	sdsfreesplitres(lines,totlines);
+	return;
+
+loaderr:
+	fprintf(stderr, "\n*** FATAL CONFIG FILE ERROR ***\n");
+	fprintf(stderr, "Reading the configuration file, at line %d\n", linenum);
+	fprintf(stderr, ">>> '%s'\n", lines[i]);
+	fprintf(stderr, "%s\n", err);
+	exit(1);
+}
+
+/* Load the server configuration from the specified filename.
+ * The function appends the additional configuration directives stored
+ * in the 'options' string to the config file before loading.
+ *
+ * Both filename and options can be NULL, in such a case are considered
+ * empty. This way loadServerConfig can be used to just load a file or
+ * just load a string. */
+/*
+ * 先读取配置文件，再追加命令行中的参数，命令行参数会覆盖配置文件中的同名配置
+ */
+void loadServerConfig(char *filename, char *options) {
+	sds config = sdsempty();
+	char buf[CONFIG_MAX_LINE+1];
+
+	/* Load the file content */
+	if (filename) {
+		FILE *fp;
+
+		if ((fp = fopen(filename,"r")) == NULL) {
+			fprintf(stderr, "Fatal error, can't open config file '%s': %s\n",
+					filename, strerror(errno));
+			exit(1);
+		}
+		while(fgets(buf,CONFIG_MAX_LINE+1,fp) != NULL)
+			config = sdscat(config,buf);
+		fclose(fp);
+	}
+	/* Append the additional options */
+	if (options) {
+		config = sdscat(config,"\n");
+		config = sdscat(config,options);
+	}
+	loadServerConfigFromString(config);
+	sdsfree(config);
+}
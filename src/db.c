@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "rdb.h"
+#include "zmalloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*-----------------------------------------------------------------------------
+ * C-level DB API
+ * 键空间操作接口
+ *----------------------------------------------------------------------------*/
+
+/*
+ * 在数据库中查找key对应的值对象，找不到返回NULL
+ * 懒加载的值在第一次被访问时解码
+ */
+robj *lookupKey(redisDb *db, robj *key) {
+	dictEntry *de = dictFind(db->dict,key->ptr);
+	if (de) {
+		robj *val = dictGetVal(de);
+
+		if (val->encoding == OBJ_ENCODING_DISKREF) rdbMaterializeObject(val);
+		return val;
+	} else {
+		return NULL;
+	}
+}
+
+/*
+ * 查找key，找不到时回复reply
+ */
+robj *lookupKeyReadOrReply(client *c, robj *key, robj *reply) {
+	robj *o = lookupKey(c->db, key);
+	if (!o) addReply(c,reply);
+	return o;
+}
+
+robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply) {
+	robj *o = lookupKey(c->db, key);
+	if (!o) addReply(c,reply);
+	return o;
+}
+
+/* Add the key to the DB. It's up to the caller to increment the reference
+ * counter of the value if needed.
+ *
+ * The program is aborted if the key already exists. */
+/*
+ * 添加键值对到数据库，key会被复制一份
+ * 值对象的引用计数由调用者负责增加
+ */
+void dbAdd(redisDb *db, robj *key, robj *val) {
+	sds copy = sdsdup(key->ptr);
+	int retval = dictAdd(db->dict, copy, val);
+
+	if (retval != DICT_OK) {
+		printf("dbAdd: key %s already exists\n", (char*)key->ptr);
+		exit(1);
+	}
+}
+
+/* Overwrite an existing key with a new value. Incrementing the reference
+ * count of the new value is up to the caller. */
+/*
+ * 使用新值覆盖一个已存在的键，旧值由字典的值析构函数释放
+ */
+void dbOverwrite(redisDb *db, robj *key, robj *val) {
+	dictReplace(db->dict, key->ptr, val);
+}
+
+/* High level Set operation. This function can be used in order to set
+ * a key, whatever it was existing or not, to a new object.
+ *
+ * 1) The ref count of the value object is incremented.
+ * 2) clients WATCHing for the destination key notified. */
+/*
+ * 高层次的SET操作，不管键是否存在都设置为新值
+ * 值对象的引用计数会加1
+ */
+void setKey(redisDb *db, robj *key, robj *val) {
+	if (lookupKey(db,key) == NULL) {
+		dbAdd(db,key,val);
+	} else {
+		dbOverwrite(db,key,val);
+	}
+	incrRefCount(val);
+}
+
+/* Prepare the string object stored at 'key' to be modified destructively
+ * to implement commands like SETRANGE or APPEND.
+ *
+ * An object is usually ready to be modified unless one of the two conditions
+ * are true:
+ *
+ * 1) The object 'o' is shared (refcount > 1), we don't want to affect
+ *    other users.
+ * 2) The object encoding is not "RAW".
+ *
+ * If the object is found in one of the above conditions (or both) by the
+ * function, an unshared / not-encoded copy of the string object is stored
+ * at 'key' in the specified 'db'. Otherwise the object 'o' itself is
+ * returned.
+ *
+ * USAGE:
+ *
+ * The object 'o' is what the caller already obtained by looking up
+ * the key 'key' in 'db', the usage pattern looks like this:
+ *
+ * o = lookupKeyWrite(db,key);
+ * if (checkType(c,o,OBJ_STRING)) return;
+ * o = dbUnshareStringValue(db,key,o);
+ *
+ * At this point the caller is ready to modify the object, for example
+ * using an sdscat() call to append some data, or anything else.
+ */
+/*
+ * 共享的、INT编码或者EMBSTR编码的字符串先复制一份RAW编码的对象替换原来的值，
+ * 之后调用者可以直接修改返回对象的sds
+ */
+robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o) {
+	if (o->refcount != 1 || o->encoding != OBJ_ENCODING_RAW) {
+		robj *decoded = getDecodedObject(o);
+		o = createRawStringObject(decoded->ptr, sdslen(decoded->ptr));
+		decrRefCount(decoded);
+		dbOverwrite(db,key,o);
+	}
+	return o;
+}
+
+/*
+ * 清空指定的数据库，dbnum为-1时清空所有数据库，返回删除的键数量
+ */
+long long emptyDb(int dbnum) {
+	int startdb, enddb, j;
+	long long removed = 0;
+
+	if (dbnum < -1 || dbnum >= server.dbnum) return -1;
+	if (dbnum == -1) {
+		startdb = 0;
+		enddb = server.dbnum-1;
+	} else {
+		startdb = enddb = dbnum;
+	}
+	for (j = startdb; j <= enddb; j++) {
+		removed += dictSize(server.db[j].dict);
+		dictEmpty(server.db[j].dict,NULL);
+		if (server.db[j].expires) dictEmpty(server.db[j].expires,NULL);
+	}
+	return removed;
+}
+
+/*
+ * 从数据库中删除键，删除成功返回1，键不存在返回0
+ */
+int dbDelete(redisDb *db, robj *key) {
+	if (dictDelete(db->dict,key->ptr) == DICT_OK) {
+		return 1;
+	} else {
+		return 0;
+	}
+}
@@ -846,6 +846,16 @@ static unsigned long rev(unsigned long v) {
 	return v;
 }
 
+/*
+ * 判断key是否已经被一次从0开始、当前游标为v的dictScan遍历过
+ * 游标按照反转后的二进制位递增，反转后的哈希值小于反转后的游标的key都已经被访问过，
+ * 这个顺序和哈希表的大小无关，所以扩容、缩容和渐进式rehash都不影响判断结果
+ * 游标回到0表示遍历结束，需要调用者自己区分
+ */
+int dictScanVisited(dict *d, const void *key, unsigned long v) {
+	return rev((unsigned long)dictHashKey(d,key)) < rev(v);
+}
+
 /* dictScan() is used to iterate over the elements of a dictionary.
  *
  * Iterating works the following way:
@@ -0,0 +1,996 @@
+/*
+ * Copyright (c) 2014, Matt Stancliff <matt@genges.com>.
+ * Copyright (c) 2015-2016, Salvatore Sanfilippo <antirez@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "zmalloc.h"
+#include "geohash.h"
+#include "geohash_helper.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/*
+ * 坐标按GEO_STEP_MAX精度编码成52位的geohash，作为score保存在有序集合中，
+ * 范围查询时把覆盖查询区域的9个格子换算成score区间做区间扫描
+ * x86-64上候选点的粗筛有AVX2版本，运行时根据CPU支持的指令集选择
+ */
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define GEO_USE_X86_KERNELS 1
+#endif
+
+#define D_R (M_PI / 180.0)
+
+/* 区间扫描得到的候选点攒够一批再统一过滤 */
+#define GEO_BATCH_SIZE 256
+
+/* 扫描前把每个格子再细分的层数，每层把格子分成4个 */
+#define GEO_REFINE_STEPS 3
+
+/* 粗筛的相对误差余量，粗筛只能多留不能漏掉，最终结果由精确计算决定 */
+#define GEO_FILTER_MARGIN 1e-6
+
+#define SORT_NONE 0
+#define SORT_ASC 1
+#define SORT_DESC 2
+
+/* 查询结果中的一个点 */
+typedef struct geoPoint {
+	double longitude;
+	double latitude;
+	double dist;
+	double score;
+	sds member;
+} geoPoint;
+
+typedef struct geoArray {
+	geoPoint *array;
+	size_t buckets;
+	size_t used;
+	int borrowed;       /* member借用的是跳跃表节点中的sds，不需要释放 */
+} geoArray;
+
+/* ====================================================================
+ * Helpers
+ * ==================================================================== */
+
+static geoPoint *geoArrayAppend(geoArray *ga) {
+	if (ga->used == ga->buckets) {
+		ga->buckets = (ga->buckets == 0) ? 8 : ga->buckets*2;
+		ga->array = zrealloc(ga->array,sizeof(geoPoint)*ga->buckets);
+	}
+	return ga->array+ga->used++;
+}
+
+static void geoArrayFree(geoArray *ga) {
+	size_t i;
+
+	if (!ga->borrowed) {
+		for (i = 0; i < ga->used; i++) sdsfree(ga->array[i].member);
+	}
+	zfree(ga->array);
+}
+
+/* Decode the 52 bits score of a sorted set member into longitude/latitude. */
+static int decodeGeohash(uint64_t bits, double *xy) {
+	GeoHashBits hash = { .bits = bits, .step = GEO_STEP_MAX };
+	return geohashDecodeToLongLatWGS84(hash, xy);
+}
+
+/* Input Argument Helper
+ * Take a pointer to the latitude arg then use the next arg for longitude.
+ * On parse error C_ERR is returned, otherwise C_OK. */
+static int extractLongLatOrReply(client *c, robj **argv, double *xy) {
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (getDoubleFromObjectOrReply(c, argv[i], xy + i, NULL) != C_OK)
+			return C_ERR;
+	}
+	if (xy[0] < GEO_LONG_MIN || xy[0] > GEO_LONG_MAX ||
+		xy[1] < GEO_LAT_MIN  || xy[1] > GEO_LAT_MAX) {
+		addReplyErrorFormat(c,"invalid longitude,latitude pair %f,%f",xy[0],xy[1]);
+		return C_ERR;
+	}
+	return C_OK;
+}
+
+/* The default unit is meters, this function returns the number of meters
+ * of the unit, or -1 if the unit is not supported, in that case an error
+ * is already emitted. */
+static double extractUnitOrReply(client *c, robj *unit) {
+	char *u = unit->ptr;
+
+	if (!strcasecmp(u, "m")) {
+		return 1;
+	} else if (!strcasecmp(u, "km")) {
+		return 1000;
+	} else if (!strcasecmp(u, "ft")) {
+		return 0.3048;
+	} else if (!strcasecmp(u, "mi")) {
+		return 1609.34;
+	} else {
+		addReplyError(c,
+			"unsupported unit provided. please use M, KM, FT, MI");
+		return -1;
+	}
+}
+
+/* The GEODIST command (and others) reply distances with 4 decimal
+ * digits of precision. */
+static void addReplyDoubleDistance(client *c, double d) {
+	char dbuf[128];
+	int dlen = snprintf(dbuf, sizeof(dbuf), "%.4f", d);
+	addReplyBulkCBuffer(c, dbuf, dlen);
+}
+
+/* Helper function for geoGetPointsInRange(): given a sorted set score
+ * representing a point, and a GeoShape, checks if the point is within the
+ * search area.
+ *
+ * The exact distance is returned in '*distance', the decoded coordinates
+ * in 'xy'. Returns C_OK if the point is included, or C_ERR if it is outside. */
+static int geoWithinShape(GeoShape *shape, uint64_t bits, double *xy, double *distance) {
+	if (!decodeGeohash(bits,xy)) return C_ERR; /* Can't decode. */
+	/* Note that geohashGetDistanceIfInRadiusWGS84() takes arguments in
+	 * reverse order: longitude first, latitude later. */
+	if (shape->type == CIRCULAR_TYPE) {
+		if (!geohashGetDistanceIfInRadiusWGS84(shape->xy[0], shape->xy[1], xy[0], xy[1],
+				shape->t.radius*shape->conversion, distance))
+			return C_ERR;
+	} else if (shape->type == RECTANGLE_TYPE) {
+		if (!geohashGetDistanceIfInRectangle(shape->t.r.width * shape->conversion,
+				shape->t.r.height * shape->conversion,
+				shape->xy[0], shape->xy[1], xy[0], xy[1], distance))
+			return C_ERR;
+	}
+	return C_OK;
+}
+
+/* ====================================================================
+ * Candidate filtering kernels
+ * ==================================================================== */
+
+/*
+ * 粗筛需要的查询参数，由查询形状预先算好
+ * 圆形: haversine公式中 a = sin²(Δlat/2) + cos(lat1)cos(lat2)sin²(Δlon/2)，
+ *       距离不超过r等价于 a <= sin²(r/2R)
+ * 矩形: 纬度差不超过高度的一半，并且在点所在纬度上和中心的经度距离不超过宽度的一半，
+ *       即 cos²(lat2)sin²(Δlon/2) <= sin²(w/4R)
+ */
+typedef struct geoFilter {
+	int type;
+	double lon1r;       /* 中心点经度(弧度) */
+	double lat1r;       /* 中心点纬度(弧度) */
+	double cos_lat1;
+	double limit;       /* 上面不等式右边的值，已经加上了余量 */
+	double dlat;        /* 矩形: 纬度差(弧度)的上限 */
+} geoFilter;
+
+static void geoFilterInit(geoFilter *f, GeoShape *shape) {
+	double half;
+
+	f->type = shape->type;
+	f->lon1r = shape->xy[0] * D_R;
+	f->lat1r = shape->xy[1] * D_R;
+	f->cos_lat1 = cos(f->lat1r);
+	if (shape->type == CIRCULAR_TYPE) {
+		half = shape->t.radius * shape->conversion / (2 * EARTH_RADIUS_IN_METERS);
+		f->dlat = 0;
+	} else {
+		half = shape->t.r.width * shape->conversion / (4 * EARTH_RADIUS_IN_METERS);
+		f->dlat = shape->t.r.height * shape->conversion / 2 / EARTH_RADIUS_IN_METERS *
+			(1 + GEO_FILTER_MARGIN);
+	}
+	if (half > M_PI/2) half = M_PI/2;
+	f->limit = sin(half) * sin(half) * (1 + GEO_FILTER_MARGIN) + 1e-24;
+}
+
+/* 标量版本不做粗筛，所有候选点都交给geoWithinShape()精确判断 */
+static void geoFilterScalar(const geoFilter *f, const uint64_t *bits, int count,
+		unsigned char *maybe) {
+	UNUSED(f);
+	UNUSED(bits);
+	memset(maybe,1,count);
+}
+
+#ifdef GEO_USE_X86_KERNELS
+/* sin(x)和cos(x)的泰勒展开系数，从最高次项开始 */
+static const double geoSinCoeffs[] = {
+	1.0/51090942171709440000.0, -1.0/121645100408832000.0,
+	1.0/355687428096000.0, -1.0/1307674368000.0, 1.0/6227020800.0,
+	-1.0/39916800.0, 1.0/362880.0, -1.0/5040.0, 1.0/120.0, -1.0/6.0, 1.0
+};
+static const double geoCosCoeffs[] = {
+	1.0/2432902008176640000.0, -1.0/6402373705728000.0,
+	1.0/20922789888000.0, -1.0/87178291200.0, 1.0/479001600.0,
+	-1.0/3628800.0, 1.0/40320.0, -1.0/720.0, 1.0/24.0, -1.0/2.0, 1.0
+};
+
+/*
+ * sin²(x)，x在[-π, π]之间
+ * 先利用sin²(x) = sin²(|x|) = sin²(π-|x|)把参数折到[0, π/2]，再用泰勒展开计算
+ */
+__attribute__((target("avx2")))
+static inline __m256d geoSinSquaredAVX2(__m256d x) {
+	const __m256d signmask = _mm256_set1_pd(-0.0);
+	const __m256d halfpi = _mm256_set1_pd(M_PI/2);
+	__m256d t, s, p;
+	int j;
+
+	t = _mm256_andnot_pd(signmask,x);
+	t = _mm256_blendv_pd(t,_mm256_sub_pd(_mm256_set1_pd(M_PI),t),
+		_mm256_cmp_pd(t,halfpi,_CMP_GT_OQ));
+	s = _mm256_mul_pd(t,t);
+	p = _mm256_set1_pd(geoSinCoeffs[0]);
+	for (j = 1; j < (int)(sizeof(geoSinCoeffs)/sizeof(double)); j++)
+		p = _mm256_add_pd(_mm256_mul_pd(p,s),_mm256_set1_pd(geoSinCoeffs[j]));
+	p = _mm256_mul_pd(p,t);
+	return _mm256_mul_pd(p,p);
+}
+
+/* cos(x)，x是纬度的弧度，绝对值不超过GEO_LAT_MAX */
+__attribute__((target("avx2")))
+static inline __m256d geoCosAVX2(__m256d x) {
+	__m256d s, p;
+	int j;
+
+	s = _mm256_mul_pd(x,x);
+	p = _mm256_set1_pd(geoCosCoeffs[0]);
+	for (j = 1; j < (int)(sizeof(geoCosCoeffs)/sizeof(double)); j++)
+		p = _mm256_add_pd(_mm256_mul_pd(p,s),_mm256_set1_pd(geoCosCoeffs[j]));
+	return p;
+}
+
+/*
+ * 把反交错得到的格子编号还原成格子中心的坐标，运算顺序和geohashDecode()、
+ * geohashDecodeAreaToLongLat()相同
+ * 格子编号小于2^52，和2^52的位模式按位或之后减去2^52就精确地转换成了double
+ */
+__attribute__((target("avx2")))
+static inline __m256d geoDecodeAxisAVX2(__m256i cell, double min, double max) {
+	const __m256d two52 = _mm256_set1_pd(4503599627370496.0);
+	const __m256d inv = _mm256_set1_pd(1.0 / (1ULL << GEO_STEP_MAX));
+	const __m256d scale = _mm256_set1_pd(max - min);
+	const __m256d vmin = _mm256_set1_pd(min);
+	const __m256d vmax = _mm256_set1_pd(max);
+	__m256d c, lo, hi, v;
+
+	c = _mm256_castsi256_pd(_mm256_or_si256(cell,
+		_mm256_castpd_si256(two52)));
+	c = _mm256_sub_pd(c,two52);
+	lo = _mm256_add_pd(vmin,_mm256_mul_pd(_mm256_mul_pd(c,inv),scale));
+	hi = _mm256_add_pd(vmin,_mm256_mul_pd(_mm256_mul_pd(
+		_mm256_add_pd(c,_mm256_set1_pd(1.0)),inv),scale));
+	v = _mm256_mul_pd(_mm256_add_pd(lo,hi),_mm256_set1_pd(0.5));
+	v = _mm256_min_pd(v,vmax);
+	return _mm256_max_pd(v,vmin);
+}
+
+/*
+ * 每次处理4个候选点：反交错、还原坐标，用多项式近似的sin/cos计算
+ * 上面的不等式，满足的点标记为可能命中
+ * 不足4个的尾部直接标记为可能命中
+ */
+__attribute__((target("avx2")))
+static void geoFilterAVX2(const geoFilter *f, const uint64_t *bits, int count,
+		unsigned char *maybe) {
+	const __m256i b0 = _mm256_set1_epi64x(0x5555555555555555LL);
+	const __m256i b1 = _mm256_set1_epi64x(0x3333333333333333LL);
+	const __m256i b2 = _mm256_set1_epi64x(0x0F0F0F0F0F0F0F0FLL);
+	const __m256i b3 = _mm256_set1_epi64x(0x00FF00FF00FF00FFLL);
+	const __m256i b4 = _mm256_set1_epi64x(0x0000FFFF0000FFFFLL);
+	const __m256i b5 = _mm256_set1_epi64x(0x00000000FFFFFFFFLL);
+	const __m256d signmask = _mm256_set1_pd(-0.0);
+	const __m256d half = _mm256_set1_pd(0.5);
+	const __m256d dr = _mm256_set1_pd(D_R);
+	const __m256d lon1r = _mm256_set1_pd(f->lon1r);
+	const __m256d lat1r = _mm256_set1_pd(f->lat1r);
+	const __m256d cos_lat1 = _mm256_set1_pd(f->cos_lat1);
+	const __m256d limit = _mm256_set1_pd(f->limit);
+	const __m256d dlatmax = _mm256_set1_pd(f->dlat);
+	int j, mask;
+
+	for (j = 0; j+4 <= count; j += 4) {
+		__m256i h = _mm256_loadu_si256((const __m256i*)(bits+j));
+		__m256i x = _mm256_and_si256(h,b0);
+		__m256i y = _mm256_and_si256(_mm256_srli_epi64(h,1),b0);
+		__m256d lat2r, lon2r, a, c, m;
+
+		/* 纬度在偶数位，经度在奇数位 */
+		x = _mm256_and_si256(_mm256_or_si256(x,_mm256_srli_epi64(x,1)),b1);
+		y = _mm256_and_si256(_mm256_or_si256(y,_mm256_srli_epi64(y,1)),b1);
+		x = _mm256_and_si256(_mm256_or_si256(x,_mm256_srli_epi64(x,2)),b2);
+		y = _mm256_and_si256(_mm256_or_si256(y,_mm256_srli_epi64(y,2)),b2);
+		x = _mm256_and_si256(_mm256_or_si256(x,_mm256_srli_epi64(x,4)),b3);
+		y = _mm256_and_si256(_mm256_or_si256(y,_mm256_srli_epi64(y,4)),b3);
+		x = _mm256_and_si256(_mm256_or_si256(x,_mm256_srli_epi64(x,8)),b4);
+		y = _mm256_and_si256(_mm256_or_si256(y,_mm256_srli_epi64(y,8)),b4);
+		x = _mm256_and_si256(_mm256_or_si256(x,_mm256_srli_epi64(x,16)),b5);
+		y = _mm256_and_si256(_mm256_or_si256(y,_mm256_srli_epi64(y,16)),b5);
+
+		lat2r = _mm256_mul_pd(geoDecodeAxisAVX2(x,GEO_LAT_MIN,GEO_LAT_MAX),dr);
+		lon2r = _mm256_mul_pd(geoDecodeAxisAVX2(y,GEO_LONG_MIN,GEO_LONG_MAX),dr);
+		c = geoCosAVX2(lat2r);
+		if (f->type == CIRCULAR_TYPE) {
+			a = _mm256_mul_pd(_mm256_mul_pd(cos_lat1,c),
+				geoSinSquaredAVX2(_mm256_mul_pd(_mm256_sub_pd(lon2r,lon1r),half)));
+			a = _mm256_add_pd(a,
+				geoSinSquaredAVX2(_mm256_mul_pd(_mm256_sub_pd(lat2r,lat1r),half)));
+			m = _mm256_cmp_pd(a,limit,_CMP_LE_OQ);
+		} else {
+			a = _mm256_mul_pd(_mm256_mul_pd(c,c),
+				geoSinSquaredAVX2(_mm256_mul_pd(_mm256_sub_pd(lon1r,lon2r),half)));
+			m = _mm256_cmp_pd(a,limit,_CMP_LE_OQ);
+			a = _mm256_andnot_pd(signmask,_mm256_sub_pd(lat1r,lat2r));
+			m = _mm256_and_pd(m,_mm256_cmp_pd(a,dlatmax,_CMP_LE_OQ));
+		}
+		mask = _mm256_movemask_pd(m);
+		maybe[j] = mask & 1;
+		maybe[j+1] = (mask >> 1) & 1;
+		maybe[j+2] = (mask >> 2) & 1;
+		maybe[j+3] = (mask >> 3) & 1;
+	}
+	for (; j < count; j++) maybe[j] = 1;
+}
+#endif
+
+/* 候选点粗筛的实现，启动后第一次使用时根据CPU支持的指令集选择 */
+typedef struct geoKernels {
+	const char *name;
+	void (*filter)(const geoFilter *f, const uint64_t *bits, int count,
+			unsigned char *maybe);
+} geoKernels;
+
+static geoKernels scalarKernels = { "scalar", geoFilterScalar };
+#ifdef GEO_USE_X86_KERNELS
+static geoKernels avx2Kernels = { "avx2", geoFilterAVX2 };
+#endif
+static geoKernels *kernels = NULL;
+
+static geoKernels *geoGetKernels(void) {
+	if (kernels == NULL) {
+		kernels = &scalarKernels;
+#ifdef GEO_USE_X86_KERNELS
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			kernels = &avx2Kernels;
+#endif
+	}
+	return kernels;
+}
+
+/* ====================================================================
+ * Range search
+ * ==================================================================== */
+
+/*
+ * 区间扫描时只记录score和元素的位置，放在连续的数组里，
+ * 攒满一批之后先粗筛，再对可能命中的点做精确计算，
+ * listpack编码时命中的点才会创建member字符串
+ */
+typedef struct geoBatch {
+	int count;
+	uint64_t bits[GEO_BATCH_SIZE];
+	void *ref[GEO_BATCH_SIZE];      /* listpack中元素的位置或者跳跃表节点 */
+	unsigned char maybe[GEO_BATCH_SIZE];
+} geoBatch;
+
+typedef struct geoSearchState {
+	robj *zobj;
+	GeoShape *shape;
+	geoFilter filter;
+	geoKernels *kernels;
+	geoArray *ga;
+	unsigned long limit;            /* 找到这么多个点就停止，0表示不限制 */
+	geoBatch batch;
+} geoSearchState;
+
+/* 处理攒下的候选点，达到limit时返回1 */
+static int geoBatchFlush(geoSearchState *gs) {
+	geoBatch *b = &gs->batch;
+	double xy[2], distance;
+	geoPoint *gp;
+	int j;
+
+	gs->kernels->filter(&gs->filter,b->bits,b->count,b->maybe);
+	for (j = 0; j < b->count; j++) {
+		if (!b->maybe[j]) continue;
+		if (geoWithinShape(gs->shape,b->bits[j],xy,&distance) != C_OK) continue;
+
+		gp = geoArrayAppend(gs->ga);
+		gp->longitude = xy[0];
+		gp->latitude = xy[1];
+		gp->dist = distance;
+		gp->score = (double)b->bits[j];
+		if (gs->zobj->encoding == OBJ_ENCODING_LISTPACK)
+			gp->member = lpGetObject(b->ref[j]);
+		else
+			gp->member = ((zskiplistNode*)b->ref[j])->ele;
+		if (gs->limit && gs->ga->used >= gs->limit) {
+			b->count = 0;
+			return 1;
+		}
+	}
+	b->count = 0;
+	return 0;
+}
+
+static inline int geoBatchAdd(geoSearchState *gs, double score, void *ref) {
+	geoBatch *b = &gs->batch;
+
+	b->bits[b->count] = (uint64_t)score;
+	b->ref[b->count] = ref;
+	if (++b->count == GEO_BATCH_SIZE) return geoBatchFlush(gs);
+	return 0;
+}
+
+/* 扫描score在[min, max)之间的元素，达到limit时返回1 */
+static int geoScanRange(geoSearchState *gs, double min, double max) {
+	/* We need the zrangespec for range queries: min is included, max
+	 * is excluded since it is the first score of the next cell. */
+	zrangespec range = { .min = min, .max = max, .minex = 0, .maxex = 1 };
+	robj *zobj = gs->zobj;
+
+	if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
+		unsigned char *zl = zobj->ptr;
+		unsigned char *eptr, *sptr;
+		double score;
+
+		if ((eptr = zzlFirstInRange(zl,&range)) == NULL) return 0;
+		sptr = lpNext(zl,eptr);
+		while (eptr) {
+			score = zzlGetScore(sptr);
+			if (!zslValueLteMax(score,&range)) break;
+			if (geoBatchAdd(gs,score,eptr)) return 1;
+			zzlNext(zl,&eptr,&sptr);
+		}
+	} else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+		zset *zs = zobj->ptr;
+		zskiplistNode *ln;
+
+		ln = zslFirstInRange(zs->zsl,&range);
+		while (ln && zslValueLteMax(ln->score,&range)) {
+			if (geoBatchAdd(gs,ln->score,ln)) return 1;
+			ln = ln->level[0].forward;
+		}
+	}
+	return 0;
+}
+
+typedef struct geoScoreRange {
+	GeoHashFix52Bits min;
+	GeoHashFix52Bits max;
+} geoScoreRange;
+
+static int geoScoreRangeCompare(const void *a, const void *b) {
+	const geoScoreRange *ra = a, *rb = b;
+
+	if (ra->min == rb->min) return 0;
+	return ra->min > rb->min ? 1 : -1;
+}
+
+/*
+ * 计算查询区域的经纬度范围，保存到bounds中，顺序和GeoShape.bounds相同
+ * 和geohashBoundingBox()不同，这里的范围一定覆盖查询区域(加上了余量)，
+ * 可以用来跳过格子中和查询区域不相交的部分；查询区域包含极点或者跨过
+ * ±180经线时返回0，这时只能扫描整个格子
+ */
+static int geoShapeBounds(GeoShape *shape, double *bounds) {
+	double latr = shape->xy[1] * D_R, dlat, dlon, edge, x, s;
+
+	if (shape->type == CIRCULAR_TYPE)
+		dlat = shape->t.radius * shape->conversion / EARTH_RADIUS_IN_METERS;
+	else
+		dlat = shape->t.r.height * shape->conversion / 2 / EARTH_RADIUS_IN_METERS;
+	dlat = dlat * (1 + GEO_FILTER_MARGIN) + 1e-12;
+	edge = fabs(latr) + dlat;
+	if (edge >= M_PI/2) return 0;
+
+	if (shape->type == CIRCULAR_TYPE) {
+		/* 球冠在经度方向上最宽的地方满足 sin(Δlon) = sin(r/R)/cos(lat) */
+		s = sin(shape->t.radius * shape->conversion / EARTH_RADIUS_IN_METERS) / cos(latr);
+		if (s >= 1) return 0;
+		dlon = asin(s);
+	} else {
+		/* 矩形靠近极点的一边上经度方向的跨度最大 */
+		x = shape->t.r.width * shape->conversion / (4 * EARTH_RADIUS_IN_METERS);
+		if (x >= M_PI/2) return 0;
+		s = sin(x) / cos(edge);
+		if (s >= 1) return 0;
+		dlon = 2 * asin(s);
+	}
+	dlon = dlon * (1 + GEO_FILTER_MARGIN) + 1e-12;
+
+	bounds[0] = shape->xy[0] - dlon / D_R;
+	bounds[1] = shape->xy[1] - dlat / D_R;
+	bounds[2] = shape->xy[0] + dlon / D_R;
+	bounds[3] = shape->xy[1] + dlat / D_R;
+	if (bounds[0] < GEO_LONG_MIN || bounds[2] > GEO_LONG_MAX) return 0;
+	return 1;
+}
+
+/*
+ * 查找落在shape中的点，保存到ga中，limit不为0时找到limit个点就停止
+ * 9个格子各自再细分成4^GEO_REFINE_STEPS个小格子，只保留和查询区域的
+ * 经纬度范围相交的部分，换算成score区间后按起点排序，重复、重叠和首尾
+ * 相接的区间合并成一个，这样每个区间只需要在有序集合中定位一次
+ */
+static void geoSearchShape(robj *zobj, GeoShape *shape, geoArray *ga,
+		unsigned long limit, geoKernels *k) {
+	GeoHashRadius n = geohashCalculateAreasByShapeWGS84(shape);
+	GeoHashBits neighbors[9], sub;
+	GeoHashArea area;
+	geoScoreRange ranges[9 << (2*GEO_REFINE_STEPS)], cur;
+	geoSearchState *gs;
+	double bounds[4];
+	int i, j, refine, count = 0;
+
+	neighbors[0] = n.hash;
+	neighbors[1] = n.neighbors.north;
+	neighbors[2] = n.neighbors.south;
+	neighbors[3] = n.neighbors.east;
+	neighbors[4] = n.neighbors.west;
+	neighbors[5] = n.neighbors.north_east;
+	neighbors[6] = n.neighbors.north_west;
+	neighbors[7] = n.neighbors.south_east;
+	neighbors[8] = n.neighbors.south_west;
+
+	refine = geoShapeBounds(shape,bounds);
+	for (i = 0; i < 9; i++) {
+		if (HASHISZERO(neighbors[i])) continue;
+		if (!refine || neighbors[i].step + GEO_REFINE_STEPS > GEO_STEP_MAX) {
+			ranges[count].min = geohashAlign52Bits(neighbors[i]);
+			neighbors[i].bits++;
+			ranges[count].max = geohashAlign52Bits(neighbors[i]);
+			count++;
+			continue;
+		}
+		for (j = 0; j < (1 << (2*GEO_REFINE_STEPS)); j++) {
+			sub.bits = (neighbors[i].bits << (2*GEO_REFINE_STEPS)) | j;
+			sub.step = neighbors[i].step + GEO_REFINE_STEPS;
+			geohashDecodeWGS84(sub,&area);
+			if (area.longitude.max < bounds[0] || area.longitude.min > bounds[2] ||
+				area.latitude.max < bounds[1] || area.latitude.min > bounds[3])
+				continue;
+			ranges[count].min = geohashAlign52Bits(sub);
+			sub.bits++;
+			ranges[count].max = geohashAlign52Bits(sub);
+			count++;
+		}
+	}
+	qsort(ranges,count,sizeof(geoScoreRange),geoScoreRangeCompare);
+
+	gs = zmalloc(sizeof(*gs));
+	gs->zobj = zobj;
+	gs->shape = shape;
+	geoFilterInit(&gs->filter,shape);
+	gs->kernels = k;
+	gs->ga = ga;
+	gs->limit = limit;
+	gs->batch.count = 0;
+
+	for (i = 0; i < count; i++) {
+		cur = ranges[i];
+		while (i+1 < count && ranges[i+1].min <= cur.max) {
+			if (ranges[i+1].max > cur.max) cur.max = ranges[i+1].max;
+			i++;
+		}
+		if (geoScanRange(gs,(double)cur.min,(double)cur.max)) break;
+	}
+	if (i == count && gs->batch.count) geoBatchFlush(gs);
+	zfree(gs);
+}
+
+/* Sort comparators for qsort() */
+static int sort_gp_asc(const void *a, const void *b) {
+	const struct geoPoint *gpa = a, *gpb = b;
+	/* We can't do adist - bdist because they are doubles and
+	 * the comparator returns an int. */
+	if (gpa->dist == gpb->dist)
+		return 0;
+	else if (gpa->dist > gpb->dist)
+		return 1;
+	else
+		return -1;
+}
+
+static int sort_gp_desc(const void *a, const void *b) {
+	return -sort_gp_asc(a, b);
+}
+
+/* ====================================================================
+ * Commands
+ * ==================================================================== */
+
+/* GEOADD key [NX|XX] [CH] long lat name [long2 lat2 name2 ... longN latN nameN] */
+void geoaddCommand(client *c) {
+	robj *key = c->argv[1];
+	robj *zobj, *eleobj;
+	int xx = 0, nx = 0, ch = 0, flags = ZADD_IN_NONE;
+	int longidx = 2, elements, i, retflags;
+	long added = 0, updated = 0;
+	double *scores, xy[2];
+	GeoHashBits hash;
+
+	/* Parse options. At the end 'longidx' is set to the argument position
+	 * of the longitude of the first element. */
+	while (longidx < c->argc) {
+		char *opt = c->argv[longidx]->ptr;
+		if (!strcasecmp(opt,"nx")) nx = 1;
+		else if (!strcasecmp(opt,"xx")) xx = 1;
+		else if (!strcasecmp(opt,"ch")) ch = 1;
+		else break;
+		longidx++;
+	}
+
+	if ((c->argc - longidx) % 3 || (xx && nx)) {
+		/* Need an odd number of args and both NX and XX can't be set. */
+		addReply(c,shared.syntaxerr);
+		return;
+	}
+	elements = (c->argc - longidx) / 3;
+	if (elements == 0) {
+		addReply(c,shared.syntaxerr);
+		return;
+	}
+	if (nx) flags |= ZADD_IN_NX;
+	if (xx) flags |= ZADD_IN_XX;
+
+	/* 先检查所有的坐标，出错时不修改有序集合 */
+	scores = zmalloc(sizeof(double)*elements);
+	for (i = 0; i < elements; i++) {
+		if (extractLongLatOrReply(c,(c->argv+longidx)+(i*3),xy) == C_ERR)
+			goto cleanup;
+		/* Turn the coordinates into the score of the element. */
+		geohashEncodeWGS84(xy[0],xy[1],GEO_STEP_MAX,&hash);
+		scores[i] = (double)geohashAlign52Bits(hash);
+	}
+
+	zobj = lookupKey(c->db,key);
+	if (zobj == NULL) {
+		if (xx) goto reply_to_client;
+		if (server.zset_max_ziplist_entries == 0 ||
+			server.zset_max_ziplist_value < sdslen(c->argv[longidx+2]->ptr))
+		{
+			zobj = createZsetObject();
+		} else {
+			zobj = createZsetListpackObject();
+		}
+		dbAdd(c->db,key,zobj);
+	} else if (zobj->type != OBJ_ZSET) {
+		addReply(c,shared.wrongtypeerr);
+		goto cleanup;
+	}
+
+	for (i = 0; i < elements; i++) {
+		retflags = 0;
+		eleobj = getDecodedObject(c->argv[longidx+i*3+2]);
+		zsetAdd(zobj,scores[i],eleobj->ptr,flags,&retflags,NULL);
+		decrRefCount(eleobj);
+		if (retflags & ZADD_OUT_ADDED) added++;
+		if (retflags & ZADD_OUT_UPDATED) updated++;
+	}
+	server.dirty += added+updated;
+
+reply_to_client:
+	addReplyLongLong(c,ch ? added+updated : added);
+
+cleanup:
+	zfree(scores);
+}
+
+/* GEOSEARCH key [FROMMEMBER member] [FROMLONLAT long lat] [BYRADIUS radius unit]
+ *           [BYBOX width height unit] [WITHCOORD] [WITHDIST] [WITHHASH]
+ *           [ASC|DESC] [COUNT count [ANY]] */
+void geosearchCommand(client *c) {
+	robj *zobj, *member = NULL;
+	GeoShape shape = {0};
+	geoArray ga = {NULL, 0, 0, 0};
+	int frommember = 0, fromloc = 0, byradius = 0, bybox = 0;
+	int withdist = 0, withhash = 0, withcoords = 0;
+	int sort = SORT_NONE, any = 0, option_length, i, remaining;
+	long long count = 0;
+	size_t returned_items, j;
+	double score;
+
+	for (i = 2; i < c->argc; i++) {
+		char *arg = c->argv[i]->ptr;
+
+		remaining = c->argc - i - 1;
+		if (!strcasecmp(arg, "withdist")) {
+			withdist = 1;
+		} else if (!strcasecmp(arg, "withhash")) {
+			withhash = 1;
+		} else if (!strcasecmp(arg, "withcoord")) {
+			withcoords = 1;
+		} else if (!strcasecmp(arg, "any")) {
+			any = 1;
+		} else if (!strcasecmp(arg, "asc")) {
+			sort = SORT_ASC;
+		} else if (!strcasecmp(arg, "desc")) {
+			sort = SORT_DESC;
+		} else if (!strcasecmp(arg, "count") && remaining >= 1) {
+			if (getLongLongFromObjectOrReply(c, c->argv[i+1], &count, NULL) != C_OK)
+				return;
+			if (count <= 0) {
+				addReplyError(c,"COUNT must be > 0");
+				return;
+			}
+			i++;
+		} else if (!strcasecmp(arg, "frommember") && remaining >= 1) {
+			member = c->argv[i+1];
+			frommember++;
+			i++;
+		} else if (!strcasecmp(arg, "fromlonlat") && remaining >= 2) {
+			if (extractLongLatOrReply(c, c->argv+i+1, shape.xy) == C_ERR) return;
+			fromloc++;
+			i += 2;
+		} else if (!strcasecmp(arg, "byradius") && remaining >= 2) {
+			if (getDoubleFromObjectOrReply(c, c->argv[i+1], &shape.t.radius, NULL) != C_OK)
+				return;
+			if (shape.t.radius < 0) {
+				addReplyError(c,"radius cannot be negative");
+				return;
+			}
+			if ((shape.conversion = extractUnitOrReply(c,c->argv[i+2])) < 0) return;
+			shape.type = CIRCULAR_TYPE;
+			byradius++;
+			i += 2;
+		} else if (!strcasecmp(arg, "bybox") && remaining >= 3) {
+			if (getDoubleFromObjectOrReply(c, c->argv[i+1], &shape.t.r.width, NULL) != C_OK ||
+				getDoubleFromObjectOrReply(c, c->argv[i+2], &shape.t.r.height, NULL) != C_OK)
+				return;
+			if (shape.t.r.height < 0 || shape.t.r.width < 0) {
+				addReplyError(c,"height or width cannot be negative");
+				return;
+			}
+			if ((shape.conversion = extractUnitOrReply(c,c->argv[i+3])) < 0) return;
+			shape.type = RECTANGLE_TYPE;
+			bybox++;
+			i += 3;
+		} else {
+			addReply(c,shared.syntaxerr);
+			return;
+		}
+	}
+
+	/* Trap options not compatible with each other. */
+	if (frommember + fromloc != 1) {
+		addReplyError(c,
+			"exactly one of FROMMEMBER or FROMLONLAT can be specified for GEOSEARCH");
+		return;
+	}
+	if (byradius + bybox != 1) {
+		addReplyError(c,
+			"exactly one of BYRADIUS and BYBOX can be specified for GEOSEARCH");
+		return;
+	}
+	if (any && !count) {
+		addReplyError(c,"the ANY argument requires COUNT argument");
+		return;
+	}
+
+	/* Look up the requested zset */
+	if ((zobj = lookupKeyReadOrReply(c,c->argv[1],shared.emptymultibulk)) == NULL ||
+		checkType(c,zobj,OBJ_ZSET)) return;
+
+	if (frommember) {
+		robj *ele = getDecodedObject(member);
+		int found = zsetScore(zobj,ele->ptr,&score);
+
+		decrRefCount(ele);
+		if (found == C_ERR || !decodeGeohash((uint64_t)score,shape.xy)) {
+			addReplyError(c,"could not decode requested zset member");
+			return;
+		}
+	}
+
+	/* COUNT without ordering does not make much sense (we need to
+	 * sort in order to return the closest N entries),
+	 * force ASC ordering if COUNT was specified but no sorting was
+	 * requested. Note that this is not needed for ANY option. */
+	if (count != 0 && sort == SORT_NONE && !any) sort = SORT_ASC;
+
+	ga.borrowed = (zobj->encoding == OBJ_ENCODING_SKIPLIST);
+	geoSearchShape(zobj,&shape,&ga,any ? (unsigned long)count : 0,geoGetKernels());
+
+	/* Process [optional] requested sorting */
+	if (sort == SORT_ASC) {
+		qsort(ga.array, ga.used, sizeof(geoPoint), sort_gp_asc);
+	} else if (sort == SORT_DESC) {
+		qsort(ga.array, ga.used, sizeof(geoPoint), sort_gp_desc);
+	}
+
+	returned_items = (count == 0 || ga.used < (size_t)count) ?
+		ga.used : (size_t)count;
+	option_length = withdist + withhash + withcoords;
+	addReplyMultiBulkLen(c,returned_items);
+	for (j = 0; j < returned_items; j++) {
+		geoPoint *gp = ga.array+j;
+
+		/* If we have options in option_length, return each sub-result
+		 * as a nested multi-bulk. Add 1 to account for result value
+		 * itself. */
+		if (option_length) addReplyMultiBulkLen(c,option_length+1);
+		addReplyBulkCBuffer(c,gp->member,sdslen(gp->member));
+		if (withdist) addReplyDoubleDistance(c,gp->dist/shape.conversion);
+		if (withhash) addReplyLongLong(c,(long long)gp->score);
+		if (withcoords) {
+			addReplyMultiBulkLen(c,2);
+			addReplyDouble(c,gp->longitude);
+			addReplyDouble(c,gp->latitude);
+		}
+	}
+	geoArrayFree(&ga);
+}
+
+/* GEODIST key ele1 ele2 [unit]
+ *
+ * Return the distance, in meters by default, otherwise according to "unit",
+ * between points ele1 and ele2. If one or more elements are missing NULL
+ * is returned. */
+void geodistCommand(client *c) {
+	double to_meter = 1;
+	double score1, score2, xyxy[4];
+	robj *zobj, *ele;
+	int found;
+
+	/* Check if there is the unit to extract, otherwise assume meters. */
+	if (c->argc == 5) {
+		to_meter = extractUnitOrReply(c,c->argv[4]);
+		if (to_meter < 0) return;
+	} else if (c->argc > 5) {
+		addReply(c,shared.syntaxerr);
+		return;
+	}
+
+	/* Look up the requested zset */
+	if ((zobj = lookupKeyReadOrReply(c,c->argv[1],shared.nullbulk)) == NULL ||
+		checkType(c,zobj,OBJ_ZSET)) return;
+
+	/* Get the scores. We need both otherwise NULL is returned. */
+	ele = getDecodedObject(c->argv[2]);
+	found = zsetScore(zobj,ele->ptr,&score1);
+	decrRefCount(ele);
+	if (found == C_OK) {
+		ele = getDecodedObject(c->argv[3]);
+		found = zsetScore(zobj,ele->ptr,&score2);
+		decrRefCount(ele);
+	}
+	if (found == C_ERR) {
+		addReply(c,shared.nullbulk);
+		return;
+	}
+
+	/* Decode & compute the distance. */
+	if (!decodeGeohash((uint64_t)score1,xyxy) ||
+		!decodeGeohash((uint64_t)score2,xyxy+2))
+		addReply(c,shared.nullbulk);
+	else
+		addReplyDoubleDistance(c,
+			geohashGetDistance(xyxy[0],xyxy[1],xyxy[2],xyxy[3]) / to_meter);
+}
+
+#ifdef GEO_BENCHMARK_MAIN
+/*
+ * 在约85km x 111km的区域内随机生成GEO_BENCH_POINTS个点，
+ * 分别用每组粗筛函数做半径查询和矩形查询，比较结果是否一致
+ * make geo-benchmark && ./geo-benchmark
+ */
+#define GEO_BENCH_POINTS 2000000
+#define GEO_BENCH_QUERIES 2000
+
+static uint64_t geoBenchRand(uint64_t *x) {
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+static double geoBenchRand01(uint64_t *x) {
+	return (geoBenchRand(x) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int main(void) {
+	geoKernels *all[2];
+	int nkernels = 0, k, j, type, flags;
+	robj *zobj;
+	uint64_t x = 0x9E3779B97F4A7C15ULL;
+	GeoHashBits hash;
+	long long start, us;
+	double refsum[2] = {0, 0};
+	size_t refhits[2] = {0, 0};
+	sds ele;
+
+	initServerConfig();
+	zobj = createZsetObject();
+
+	all[nkernels++] = &scalarKernels;
+#ifdef GEO_USE_X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) all[nkernels++] = &avx2Kernels;
+#endif
+
+	for (j = 0; j < GEO_BENCH_POINTS; j++) {
+		double lon = 116.0 + geoBenchRand01(&x);
+		double lat = 39.5 + geoBenchRand01(&x);
+
+		geohashEncodeWGS84(lon,lat,GEO_STEP_MAX,&hash);
+		ele = sdsfromlonglong(j);
+		zsetAdd(zobj,(double)geohashAlign52Bits(hash),ele,ZADD_IN_NONE,&flags,NULL);
+		sdsfree(ele);
+	}
+
+	for (type = CIRCULAR_TYPE; type <= RECTANGLE_TYPE; type++) {
+		for (k = 0; k < nkernels; k++) {
+			size_t hits = 0;
+			double sum = 0;
+			uint64_t qx = 0x2545F4914F6CDD1DULL;
+
+			start = ustime();
+			for (j = 0; j < GEO_BENCH_QUERIES; j++) {
+				GeoShape shape = {0};
+				geoArray ga = {NULL, 0, 0, 1};
+
+				shape.type = type;
+				shape.xy[0] = 116.0 + geoBenchRand01(&qx);
+				shape.xy[1] = 39.5 + geoBenchRand01(&qx);
+				shape.conversion = 1;
+				if (type == CIRCULAR_TYPE) {
+					shape.t.radius = 1000;
+				} else {
+					shape.t.r.width = 2000;
+					shape.t.r.height = 1500;
+				}
+				geoSearchShape(zobj,&shape,&ga,0,all[k]);
+				hits += ga.used;
+				for (size_t i = 0; i < ga.used; i++) sum += ga.array[i].dist;
+				geoArrayFree(&ga);
+			}
+			us = ustime()-start;
+			printf("%-7s %-10s %8.1f ms  %8.0f queries/s  %zu hits\n",
+				all[k]->name, type == CIRCULAR_TYPE ? "BYRADIUS" : "BYBOX",
+				us/1000.0, GEO_BENCH_QUERIES*1000000.0/us, hits);
+			if (k == 0) {
+				refhits[type-1] = hits;
+				refsum[type-1] = sum;
+			} else if (hits != refhits[type-1] || sum != refsum[type-1]) {
+				printf("  result mismatch: %zu hits, expected %zu\n",
+					hits, refhits[type-1]);
+			}
+		}
+	}
+	printf("selected kernels: %s\n",geoGetKernels()->name);
+	decrRefCount(zobj);
+	return 0;
+}
+#endif
@@ -0,0 +1,503 @@
+#include "server.h"
+#include "zmalloc.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*-----------------------------------------------------------------------------
+ * Hash type API
+ *
+ * 小的哈希对象使用listpack编码，field和value依次相邻保存在同一块内存中，
+ * field的数量超过hash-max-ziplist-entries，或者任意field/value的长度超过
+ * hash-max-ziplist-value时转换成字典编码，转换是单向的
+ *----------------------------------------------------------------------------*/
+
+/* Check the length of a number of objects to see if we need to convert a
+ * listpack to a real hash. Note that we only check string encoded objects
+ * as their string length can be queried in constant time. */
+/*
+ * 写入之前检查参数的长度，超过限制就提前转换成字典编码
+ */
+void hashTypeTryConversion(robj *o, robj **argv, int start, int end) {
+	int i;
+	size_t sum = 0;
+
+	if (o->encoding != OBJ_ENCODING_LISTPACK) return;
+
+	for (i = start; i <= end; i++) {
+		if (!sdsEncodedObject(argv[i])) continue;
+		size_t len = sdslen(argv[i]->ptr);
+		if (len > server.hash_max_ziplist_value) {
+			hashTypeConvert(o, OBJ_ENCODING_HT);
+			return;
+		}
+		sum += len;
+	}
+	/* listpack的总长度不能超过4GB */
+	if (sum + lpBytes(o->ptr) >= UINT32_MAX)
+		hashTypeConvert(o, OBJ_ENCODING_HT);
+}
+
+/* Get the value from a listpack encoded hash, identified by field.
+ * Returns -1 when the field cannot be found. */
+static int hashTypeGetFromListpack(robj *o, sds field,
+		unsigned char **vstr, unsigned int *vlen, long long *vll)
+{
+	unsigned char *lp = o->ptr, *fptr, *vptr = NULL;
+
+	fptr = lpFirst(lp);
+	if (fptr != NULL) {
+		/* 只和field比较，跳过中间的value */
+		fptr = lpFind(lp, fptr, (unsigned char*)field, sdslen(field), 1);
+		if (fptr != NULL) {
+			/* Grab pointer to the value (fptr points to the field) */
+			vptr = lpNext(lp, fptr);
+		}
+	}
+
+	if (vptr != NULL) {
+		*vstr = lpGetValue(vptr, vlen, vll);
+		return 0;
+	}
+	return -1;
+}
+
+/* Get the value from a hash table encoded hash, identified by field.
+ * Returns NULL when the field cannot be found, otherwise the SDS value
+ * is returned. */
+static sds hashTypeGetFromHashTable(robj *o, sds field) {
+	dictEntry *de = dictFind(o->ptr, field);
+	if (de == NULL) return NULL;
+	return dictGetVal(de);
+}
+
+/* Higher level function of hashTypeGet*() that returns the hash value
+ * associated with the specified field. If the field is found C_OK
+ * is returned, otherwise C_ERR. The returned object is returned by
+ * reference in either *vstr and *vlen if it's returned in string form,
+ * or stored in *vll if it's returned as a number.
+ *
+ * If *vll is populated *vstr is set to NULL, so the caller
+ * can always check the function return by checking the return value
+ * for C_OK and checking if vll (or vstr) is NULL. */
+static int hashTypeGetValue(robj *o, sds field, unsigned char **vstr,
+		unsigned int *vlen, long long *vll)
+{
+	if (o->encoding == OBJ_ENCODING_LISTPACK) {
+		*vstr = NULL;
+		if (hashTypeGetFromListpack(o, field, vstr, vlen, vll) == 0)
+			return C_OK;
+	} else if (o->encoding == OBJ_ENCODING_HT) {
+		sds value;
+		if ((value = hashTypeGetFromHashTable(o, field)) != NULL) {
+			*vstr = (unsigned char*) value;
+			*vlen = sdslen(value);
+			return C_OK;
+		}
+	} else {
+		printf("Unknown hash encoding\n");
+		exit(1);
+	}
+	return C_ERR;
+}
+
+/* Test if the specified field exists in the given hash. Returns 1 if the field
+ * exists, and 0 when it doesn't. */
+int hashTypeExists(robj *o, sds field) {
+	unsigned char *vstr = NULL;
+	unsigned int vlen = UINT_MAX;
+	long long vll = LLONG_MAX;
+
+	return hashTypeGetValue(o, field, &vstr, &vlen, &vll) == C_OK;
+}
+
+/* Add a new field, overwrite the old with the new value if it already exists.
+ * Return 0 on insert and 1 on update.
+ *
+ * By default, the key and value SDS strings are copied if needed, so the
+ * caller retains ownership of the strings passed. However this behavior
+ * can be effected by passing appropriate flags (possibly bitwise OR-ed):
+ *
+ * HASH_SET_TAKE_FIELD -- The SDS field ownership passes to the function.
+ * HASH_SET_TAKE_VALUE -- The SDS value ownership passes to the function.
+ *
+ * When the flags are used the caller does not need to release the passed
+ * SDS string(s). It's up to the function to use the string to create a new
+ * entry or to free the SDS string before returning to the caller.
+ *
+ * HASH_SET_COPY corresponds to no flags passed, and means the default
+ * semantics of copying the values if needed.
+ */
+int hashTypeSet(robj *o, sds field, sds value, int flags) {
+	int update = 0;
+
+	if (o->encoding == OBJ_ENCODING_LISTPACK) {
+		unsigned char *lp, *fptr, *vptr;
+
+		lp = o->ptr;
+		fptr = lpFirst(lp);
+		if (fptr != NULL) {
+			fptr = lpFind(lp, fptr, (unsigned char*)field, sdslen(field), 1);
+			if (fptr != NULL) {
+				/* Grab pointer to the value (fptr points to the field) */
+				vptr = lpNext(lp, fptr);
+				update = 1;
+
+				/* Replace value */
+				lp = lpInsert(lp, (unsigned char*)value, sdslen(value), vptr,
+						LP_REPLACE, NULL);
+			}
+		}
+
+		if (!update) {
+			/* Push new field/value pair onto the tail of the listpack */
+			lp = lpAppend(lp, (unsigned char*)field, sdslen(field));
+			lp = lpAppend(lp, (unsigned char*)value, sdslen(value));
+		}
+		o->ptr = lp;
+
+		/* Check if the listpack needs to be converted to a hash table */
+		if (hashTypeLength(o) > server.hash_max_ziplist_entries)
+			hashTypeConvert(o, OBJ_ENCODING_HT);
+	} else if (o->encoding == OBJ_ENCODING_HT) {
+		dictEntry *de = dictFind(o->ptr,field);
+		if (de) {
+			sdsfree(dictGetVal(de));
+			if (flags & HASH_SET_TAKE_VALUE) {
+				dictGetVal(de) = value;
+				value = NULL;
+			} else {
+				dictGetVal(de) = sdsdup(value);
+			}
+			update = 1;
+		} else {
+			sds f,v;
+			if (flags & HASH_SET_TAKE_FIELD) {
+				f = field;
+				field = NULL;
+			} else {
+				f = sdsdup(field);
+			}
+			if (flags & HASH_SET_TAKE_VALUE) {
+				v = value;
+				value = NULL;
+			} else {
+				v = sdsdup(value);
+			}
+			dictAdd(o->ptr,f,v);
+		}
+	} else {
+		printf("Unknown hash encoding\n");
+		exit(1);
+	}
+
+	/* Free SDS strings we did not referenced elsewhere if the flags
+	 * want this function to be responsible. */
+	if (flags & HASH_SET_TAKE_FIELD && field) sdsfree(field);
+	if (flags & HASH_SET_TAKE_VALUE && value) sdsfree(value);
+	return update;
+}
+
+/* Delete an element from a hash.
+ * Return 1 on deleted and 0 on not found. */
+int hashTypeDelete(robj *o, sds field) {
+	int deleted = 0;
+
+	if (o->encoding == OBJ_ENCODING_LISTPACK) {
+		unsigned char *lp, *fptr;
+
+		lp = o->ptr;
+		fptr = lpFirst(lp);
+		if (fptr != NULL) {
+			fptr = lpFind(lp, fptr, (unsigned char*)field, sdslen(field), 1);
+			if (fptr != NULL) {
+				/* field和value是相邻的两个元素，一次删除 */
+				lp = lpDelete(lp,fptr,&fptr);
+				lp = lpDelete(lp,fptr,&fptr);
+				o->ptr = lp;
+				deleted = 1;
+			}
+		}
+	} else if (o->encoding == OBJ_ENCODING_HT) {
+		if (dictDelete((dict*)o->ptr, field) == DICT_OK) {
+			deleted = 1;
+		}
+	} else {
+		printf("Unknown hash encoding\n");
+		exit(1);
+	}
+	return deleted;
+}
+
+/* Return the number of elements in a hash. */
+unsigned long hashTypeLength(const robj *o) {
+	unsigned long length = ULONG_MAX;
+
+	if (o->encoding == OBJ_ENCODING_LISTPACK) {
+		length = lpLength(o->ptr) / 2;
+	} else if (o->encoding == OBJ_ENCODING_HT) {
+		length = dictSize((const dict*)o->ptr);
+	} else {
+		printf("Unknown hash encoding\n");
+		exit(1);
+	}
+	return length;
+}
+
+/*
+ * 把listpack编码的哈希对象转换成字典编码
+ */
+static void hashTypeConvertListpack(robj *o, int enc) {
+	if (enc == OBJ_ENCODING_LISTPACK) {
+		/* Nothing to do... */
+	} else if (enc == OBJ_ENCODING_HT) {
+		unsigned char *lp = o->ptr, *fptr, *vptr;
+		unsigned char *vstr;
+		unsigned int vlen;
+		long long vll;
+		dict *d = dictCreate(&hashDictType, NULL);
+
+		dictExpand(d,lpLength(lp)/2);
+		fptr = lpFirst(lp);
+		while (fptr) {
+			sds field, value;
+
+			vptr = lpNext(lp,fptr);
+			vstr = lpGetValue(fptr,&vlen,&vll);
+			field = vstr ? sdsnewlen(vstr,vlen) : sdsfromlonglong(vll);
+			vstr = lpGetValue(vptr,&vlen,&vll);
+			value = vstr ? sdsnewlen(vstr,vlen) : sdsfromlonglong(vll);
+			if (dictAdd(d, field, value) != DICT_OK) {
+				printf("Listpack corruption detected: duplicate hash field\n");
+				exit(1);
+			}
+			fptr = lpNext(lp,vptr);
+		}
+		lpFree(lp);
+		o->encoding = OBJ_ENCODING_HT;
+		o->ptr = d;
+	} else {
+		printf("Unknown hash encoding\n");
+		exit(1);
+	}
+}
+
+void hashTypeConvert(robj *o, int enc) {
+	if (o->encoding == OBJ_ENCODING_LISTPACK) {
+		hashTypeConvertListpack(o, enc);
+	} else if (o->encoding == OBJ_ENCODING_HT) {
+		printf("Not implemented\n");
+		exit(1);
+	} else {
+		printf("Unknown hash encoding\n");
+		exit(1);
+	}
+}
+
+/* 按照类型查找哈希对象，不存在时创建一个新的 */
+static robj *hashTypeLookupWriteOrCreate(client *c, robj *key) {
+	robj *o = lookupKey(c->db,key);
+
+	if (o == NULL) {
+		o = createHashObject();
+		dbAdd(c->db,key,o);
+	} else {
+		if (o->type != OBJ_HASH) {
+			addReply(c,shared.wrongtypeerr);
+			return NULL;
+		}
+	}
+	return o;
+}
+
+/* 把哈希表中field对应的值作为bulk回复，不存在时回复nil */
+static void addHashFieldToReply(client *c, robj *o, sds field) {
+	unsigned char *vstr = NULL;
+	unsigned int vlen = UINT_MAX;
+	long long vll = LLONG_MAX;
+
+	if (o == NULL || hashTypeGetValue(o,field,&vstr,&vlen,&vll) == C_ERR) {
+		addReply(c, shared.nullbulk);
+	} else if (vstr) {
+		addReplyBulkCBuffer(c, vstr, vlen);
+	} else {
+		addReplyBulkLongLong(c, vll);
+	}
+}
+
+/*-----------------------------------------------------------------------------
+ * Hash type commands
+ *----------------------------------------------------------------------------*/
+
+/* HSET key field value [field value ...] */
+void hsetCommand(client *c) {
+	int i, created = 0;
+	robj *o;
+
+	if ((c->argc % 2) == 1) {
+		addReplyError(c,"wrong number of arguments for 'hset' command");
+		return;
+	}
+
+	if ((o = hashTypeLookupWriteOrCreate(c,c->argv[1])) == NULL) return;
+	hashTypeTryConversion(o,c->argv,2,c->argc-1);
+
+	for (i = 2; i < c->argc; i += 2) {
+		robj *field = getDecodedObject(c->argv[i]);
+		robj *value = getDecodedObject(c->argv[i+1]);
+
+		created += !hashTypeSet(o,field->ptr,value->ptr,HASH_SET_COPY);
+		decrRefCount(field);
+		decrRefCount(value);
+	}
+	addReplyLongLong(c, created);
+	server.dirty += (c->argc - 2)/2;
+}
+
+/* HINCRBY key field increment */
+void hincrbyCommand(client *c) {
+	long long value, incr, oldvalue;
+	robj *o, *field;
+	sds new;
+	unsigned char *vstr;
+	unsigned int vlen;
+
+	if (getLongLongFromObjectOrReply(c,c->argv[3],&incr,NULL) != C_OK) return;
+	if ((o = hashTypeLookupWriteOrCreate(c,c->argv[1])) == NULL) return;
+	field = getDecodedObject(c->argv[2]);
+	if (hashTypeGetValue(o,field->ptr,&vstr,&vlen,&value) == C_OK) {
+		if (vstr) {
+			if (string2ll((char*)vstr,vlen,&value) == 0) {
+				addReplyError(c,"hash value is not an integer");
+				decrRefCount(field);
+				return;
+			}
+		} /* Else hashTypeGetValue() already stored it into &value */
+	} else {
+		value = 0;
+	}
+
+	oldvalue = value;
+	if ((incr < 0 && oldvalue < 0 && incr < (LLONG_MIN-oldvalue)) ||
+		(incr > 0 && oldvalue > 0 && incr > (LLONG_MAX-oldvalue))) {
+		addReplyError(c,"increment or decrement would overflow");
+		decrRefCount(field);
+		return;
+	}
+	value += incr;
+	new = sdsfromlonglong(value);
+	hashTypeSet(o,field->ptr,new,HASH_SET_TAKE_VALUE);
+	decrRefCount(field);
+	addReplyLongLong(c,value);
+	server.dirty++;
+}
+
+/* HGET key field */
+void hgetCommand(client *c) {
+	robj *o, *field;
+
+	if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.nullbulk)) == NULL ||
+		checkType(c,o,OBJ_HASH)) return;
+
+	field = getDecodedObject(c->argv[2]);
+	addHashFieldToReply(c, o, field->ptr);
+	decrRefCount(field);
+}
+
+/* HMGET key field [field ...] */
+void hmgetCommand(client *c) {
+	robj *o;
+	int i;
+
+	/* Don't abort when the key cannot be found. Non-existing keys are empty
+	 * hashes, where HMGET should respond with a series of null bulks. */
+	o = lookupKey(c->db, c->argv[1]);
+	if (o != NULL && o->type != OBJ_HASH) {
+		addReply(c, shared.wrongtypeerr);
+		return;
+	}
+
+	addReplyMultiBulkLen(c, c->argc-2);
+	for (i = 2; i < c->argc; i++) {
+		robj *field = getDecodedObject(c->argv[i]);
+		addHashFieldToReply(c, o, field->ptr);
+		decrRefCount(field);
+	}
+}
+
+/* HDEL key field [field ...] */
+void hdelCommand(client *c) {
+	robj *o;
+	int j, deleted = 0;
+
+	if ((o = lookupKeyWriteOrReply(c,c->argv[1],shared.czero)) == NULL ||
+		checkType(c,o,OBJ_HASH)) return;
+
+	for (j = 2; j < c->argc; j++) {
+		robj *field = getDecodedObject(c->argv[j]);
+		int ok = hashTypeDelete(o,field->ptr);
+
+		decrRefCount(field);
+		if (ok) {
+			deleted++;
+			// 哈希表为空时删除这个键
+			if (hashTypeLength(o) == 0) {
+				dbDelete(c->db,c->argv[1]);
+				break;
+			}
+		}
+	}
+	server.dirty += deleted;
+	addReplyLongLong(c,deleted);
+}
+
+/* HLEN key */
+void hlenCommand(client *c) {
+	robj *o;
+
+	if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.czero)) == NULL ||
+		checkType(c,o,OBJ_HASH)) return;
+
+	addReplyLongLong(c,hashTypeLength(o));
+}
+
+/* HGETALL key */
+void hgetallCommand(client *c) {
+	robj *o;
+
+	if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.emptymultibulk)) == NULL
+		|| checkType(c,o,OBJ_HASH)) return;
+
+	addReplyMultiBulkLen(c, hashTypeLength(o)*2);
+	if (o->encoding == OBJ_ENCODING_LISTPACK) {
+		/* listpack中field和value本来就是交替保存的，顺序遍历即可 */
+		unsigned char *lp = o->ptr, *p = lpFirst(lp);
+		unsigned char *vstr;
+		unsigned int vlen;
+		long long vll;
+
+		while (p) {
+			vstr = lpGetValue(p,&vlen,&vll);
+			if (vstr) {
+				addReplyBulkCBuffer(c, vstr, vlen);
+			} else {
+				addReplyBulkLongLong(c, vll);
+			}
+			p = lpNext(lp,p);
+		}
+	} else if (o->encoding == OBJ_ENCODING_HT) {
+		dictIterator *di = dictGetIterator(o->ptr);
+		dictEntry *de;
+
+		while ((de = dictNext(di)) != NULL) {
+			sds field = dictGetKey(de), value = dictGetVal(de);
+			addReplyBulkCBuffer(c, field, sdslen(field));
+			addReplyBulkCBuffer(c, value, sdslen(value));
+		}
+		dictReleaseIterator(di);
+	} else {
+		printf("Unknown hash encoding\n");
+		exit(1);
+	}
+}
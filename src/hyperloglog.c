@@ -0,0 +1,1502 @@
+/* hyperloglog.c - Redis HyperLogLog probabilistic cardinality approximation.
+ * This file implements the algorithm and the exported Redis commands.
+ *
+ * Copyright (c) 2014, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "zmalloc.h"
+#include "endianconv.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define HLL_USE_X86_KERNELS 1
+#endif
+
+/* The Redis HyperLogLog implementation is based on the following ideas:
+ *
+ * * The use of a 64 bit hash function as proposed in [1], in order to estimate
+ *   cardinalities larger than 10^9, at the cost of just 1 additional bit per
+ *   register.
+ * * The use of 16384 6-bit registers for a great level of accuracy, using
+ *   a total of 12k per key.
+ * * The use of the Redis string data type. No new type is introduced.
+ * * No attempt is made to compress the data structure as in [1]. Also the
+ *   algorithm used is the original HyperLogLog Algorithm as in [2], with
+ *   the only difference that a 64 bit hash function is used, so no correction
+ *   is performed for values near 2^32 as in [1].
+ *
+ * [1] Heule, Nunkesser, Hall: HyperLogLog in Practice: Algorithmic
+ *     Engineering of a State of The Art Cardinality Estimation Algorithm.
+ *
+ * [2] P. Flajolet, Éric Fusy, O. Gandouet, and F. Meunier. Hyperloglog: The
+ *     analysis of a near-optimal cardinality estimation algorithm.
+ *
+ * Redis uses two representations:
+ *
+ * 1) A "dense" representation where every entry is represented by
+ *    a 6-bit integer.
+ * 2) A "sparse" representation using run length compression suitable
+ *    for representing HyperLogLogs with many registers set to 0 in
+ *    a memory efficient way.
+ *
+ *
+ * HLL header
+ * ===
+ *
+ * Both the dense and sparse representation have a 16 byte header as follows:
+ *
+ * +------+---+-----+----------+
+ * | HYLL | E | N/U | Cardin.  |
+ * +------+---+-----+----------+
+ *
+ * The first 4 bytes are a magic string set to the bytes "HYLL".
+ * "E" is one byte encoding, currently set to HLL_DENSE or
+ * HLL_SPARSE. N/U are three not used bytes.
+ *
+ * The "Cardin." field is a 64 bit integer stored in little endian format
+ * with the latest cardinality computed that can be reused if the data
+ * structure was not modified since the last computation (this is useful
+ * because there are high probabilities that HLLADD operations don't
+ * modify the actual data structure and hence the approximated cardinality).
+ *
+ * When the most significant bit in the most significant byte of the cached
+ * cardinality is set, it means that the data structure was modified and
+ * we can't reuse the cached value that must be recomputed.
+ *
+ * Dense representation
+ * ===
+ *
+ * The dense representation used by Redis is the following:
+ *
+ * +--------+--------+--------+------//      //--+
+ * |11000000|22221111|33333322|55444444 ....     |
+ * +--------+--------+--------+------//      //--+
+ *
+ * The 6 bits counters are encoded one after the other starting from the
+ * LSB to the MSB, and using the next bytes as needed.
+ *
+ * Sparse representation
+ * ===
+ *
+ * The sparse representation encodes registers using a run length
+ * encoding composed of three opcodes, two using one byte, and one using
+ * of two bytes. The opcodes are called ZERO, XZERO and VAL.
+ *
+ * ZERO opcode is represented as 00xxxxxx. The 6-bit integer represented
+ * by the six bits 'xxxxxx', plus 1, means that there are N registers set
+ * to 0. This opcode can represent from 1 to 64 contiguous registers set
+ * to the value of 0.
+ *
+ * XZERO opcode is represented by two bytes 01xxxxxx yyyyyyyy. The 14-bit
+ * integer represented by the bits 'xxxxxx' as most significant bits and
+ * 'yyyyyyyy' as least significant bits, plus 1, means that there are N
+ * registers set to 0. This opcode can represent from 0 to 16384 contiguous
+ * registers set to the value of 0.
+ *
+ * VAL opcode is represented as 1vvvvvxx. It contains a 5-bit integer
+ * representing the value of a register, and a 2-bit integer representing
+ * the number of contiguous registers set to that value 'vvvvv'.
+ * To obtain the value and run length, the integers vvvvv and xx must be
+ * incremented by one. This opcode can represent values from 1 to 32,
+ * repeated from 1 to 4 times.
+ *
+ * The sparse representation can't represent registers with a value greater
+ * than 32, however it is very unlikely that we find such a register in an
+ * HLL with a cardinality where the sparse representation is still more
+ * memory efficient than the dense representation. When this happens the
+ * HLL is converted to the dense representation.
+ *
+ * The sparse representation is purely positional. For example a sparse
+ * representation of an empty HLL is just: XZERO:16384.
+ *
+ * An HLL having only 3 non-zero registers at position 1000, 1020, 1021
+ * respectively set to 2, 3, 3, is represented by the following three
+ * opcodes:
+ *
+ * XZERO:1000 (Registers 0-999 are set to 0)
+ * VAL:2,1    (1 register set to value 2, that is register 1000)
+ * ZERO:19    (Registers 1001-1019 set to 0)
+ * VAL:3,2    (2 registers set to value 3, that is registers 1020,1021)
+ * XZERO:15362 (Registers 1022-16383 set to 0)
+ *
+ * In the example the sparse representation used just 7 bytes instead
+ * of 12k in order to represent the HLL registers. In general for low
+ * cardinality there is a big win in terms of space efficiency, traded
+ * with CPU time since the sparse representation is slower to access.
+ *
+ * The sparse representation is promoted to dense once it is longer than
+ * the server.hll_sparse_max_bytes limit (hll-sparse-max-bytes).
+ */
+
+/*
+ * 合并多个HLL和计算基数时先把寄存器展开成每个寄存器一个字节的RAW数组，
+ * 展开、按字节取最大值和估算基数的求和都有AVX2版本，运行时根据CPU选择
+ */
+
+struct hllhdr {
+	char magic[4];      /* "HYLL" */
+	uint8_t encoding;   /* HLL_DENSE or HLL_SPARSE. */
+	uint8_t notused[3]; /* Reserved for future use, must be zero. */
+	uint8_t card[8];    /* Cached cardinality, little endian. */
+	uint8_t registers[]; /* Data bytes. */
+};
+
+/* The cached cardinality MSB is used to signal validity of the cached value. */
+#define HLL_INVALIDATE_CACHE(hdr) (hdr)->card[7] |= (1<<7)
+#define HLL_VALID_CACHE(hdr) (((hdr)->card[7] & (1<<7)) == 0)
+
+#define HLL_P 14 /* The greater is P, the smaller the error. */
+#define HLL_Q (64-HLL_P) /* The number of bits of the hash value used for
+							determining the number of leading zeros. */
+#define HLL_REGISTERS (1<<HLL_P) /* With P=14, 16384 registers. */
+#define HLL_P_MASK (HLL_REGISTERS-1) /* Mask to index register. */
+#define HLL_BITS 6 /* Enough to count up to 63 leading zeroes. */
+#define HLL_REGISTER_MAX ((1<<HLL_BITS)-1)
+#define HLL_HDR_SIZE sizeof(struct hllhdr)
+#define HLL_DENSE_SIZE (HLL_HDR_SIZE+((HLL_REGISTERS*HLL_BITS+7)/8))
+#define HLL_DENSE 0 /* Dense encoding. */
+#define HLL_SPARSE 1 /* Sparse encoding. */
+#define HLL_RAW 255 /* Only used internally, never exposed. */
+#define HLL_MAX_ENCODING 1
+
+static char *invalid_hll_err = "-INVALIDOBJ Corrupted HLL object detected\r\n";
+
+/* =========================== Low level bit macros ========================= */
+
+/* Macros to access the dense representation.
+ *
+ * We need to get and set 6 bit counters in an array of 8 bit bytes.
+ * We use macros to make sure the code is inlined since speed is critical
+ * especially in order to compute the approximated cardinality in
+ * HLLCOUNT where we need to access all the registers at once.
+ * For the same reason we also want to avoid conditionals in this code path.
+ *
+ * +--------+--------+--------+------//
+ * |11000000|22221111|33333322|55444444
+ * +--------+--------+--------+------//
+ *
+ * Note: in the above representation the most significant bit (MSB)
+ * of every byte is on the left. We start using bits from the LSB to MSB,
+ * and so forth passing to the next byte.
+ *
+ * Example, we want to access to counter at pos = 1 ("111111" in the
+ * illustration above).
+ *
+ * The index of the first byte b0 containing our data is:
+ *
+ *  b0 = 6 * pos / 8 = 0
+ *
+ *   +--------+
+ *   |11000000|  <- Our byte at b0
+ *   +--------+
+ *
+ * The position of the first bit (counting from the LSB = 0) in the byte
+ * is given by:
+ *
+ *  fb = 6 * pos % 8 -> 6
+ *
+ * Right shift b0 of 'fb' bits.
+ *
+ *   +--------+
+ *   |11000000|  <- Initial value of b0
+ *   |00000011|  <- After right shift of 6 pos.
+ *   +--------+
+ *
+ * Left shift b1 of bits 8-fb bits (2 bits)
+ *
+ *   +--------+
+ *   |22221111|  <- Initial value of b1
+ *   |22111100|  <- After left shift of 2 bits.
+ *   +--------+
+ *
+ * OR the two bits, and finally AND with 111111 (63 in decimal) to
+ * clean the higher order bits we are not interested in:
+ *
+ *   +--------+
+ *   |00000011|  <- b0 right shifted
+ *   |22111100|  <- b1 left shifted
+ *   |22111111|  <- b0 OR b1
+ *   |  111111|  <- (b0 OR b1) AND 63, our value.
+ *   +--------+
+ *
+ * Setting the register is a bit more complex, but the idea is the same
+ * and the macro is simply the reverse. */
+
+#define HLL_DENSE_GET_REGISTER(target,p,regnum) do { \
+	uint8_t *_p = (uint8_t*) p; \
+	unsigned long _byte = regnum*HLL_BITS/8; \
+	unsigned long _fb = regnum*HLL_BITS&7; \
+	unsigned long _fb8 = 8 - _fb; \
+	unsigned long b0 = _p[_byte]; \
+	unsigned long b1 = _p[_byte+1]; \
+	target = ((b0 >> _fb) | (b1 << _fb8)) & HLL_REGISTER_MAX; \
+} while(0)
+
+/* Set the value of the register at position 'regnum' to 'val'.
+ * 'p' is an array of unsigned bytes. */
+#define HLL_DENSE_SET_REGISTER(p,regnum,val) do { \
+	uint8_t *_p = (uint8_t*) p; \
+	unsigned long _byte = regnum*HLL_BITS/8; \
+	unsigned long _fb = regnum*HLL_BITS&7; \
+	unsigned long _fb8 = 8 - _fb; \
+	unsigned long _v = val; \
+	_p[_byte] &= ~(HLL_REGISTER_MAX << _fb); \
+	_p[_byte] |= _v << _fb; \
+	_p[_byte+1] &= ~(HLL_REGISTER_MAX >> _fb8); \
+	_p[_byte+1] |= _v >> _fb8; \
+} while(0)
+
+/* Macros to access the sparse representation.
+ * The macros parameter is expected to be an uint8_t pointer. */
+#define HLL_SPARSE_XZERO_BIT 0x40 /* 01xxxxxx */
+#define HLL_SPARSE_VAL_BIT 0x80 /* 1vvvvvxx */
+#define HLL_SPARSE_IS_ZERO(p) (((*(p)) & 0xc0) == 0) /* 00xxxxxx */
+#define HLL_SPARSE_IS_XZERO(p) (((*(p)) & 0xc0) == HLL_SPARSE_XZERO_BIT)
+#define HLL_SPARSE_IS_VAL(p) ((*(p)) & HLL_SPARSE_VAL_BIT)
+#define HLL_SPARSE_ZERO_LEN(p) (((*(p)) & 0x3f)+1)
+#define HLL_SPARSE_XZERO_LEN(p) (((((*(p)) & 0x3f) << 8) | (*((p)+1)))+1)
+#define HLL_SPARSE_VAL_VALUE(p) ((((*(p)) >> 2) & 0x1f)+1)
+#define HLL_SPARSE_VAL_LEN(p) (((*(p)) & 0x3)+1)
+#define HLL_SPARSE_VAL_MAX_VALUE 32
+#define HLL_SPARSE_VAL_MAX_LEN 4
+#define HLL_SPARSE_ZERO_MAX_LEN 64
+#define HLL_SPARSE_XZERO_MAX_LEN 16384
+#define HLL_SPARSE_VAL_SET(p,val,len) do { \
+	*(p) = (((val)-1)<<2|((len)-1))|HLL_SPARSE_VAL_BIT; \
+} while(0)
+#define HLL_SPARSE_ZERO_SET(p,len) do { \
+	*(p) = (len)-1; \
+} while(0)
+#define HLL_SPARSE_XZERO_SET(p,len) do { \
+	int _l = (len)-1; \
+	*(p) = (_l>>8) | HLL_SPARSE_XZERO_BIT; \
+	*((p)+1) = (_l&0xff); \
+} while(0)
+#define HLL_ALPHA_INF 0.721347520444481703680 /* constant for 0.5/ln(2) */
+
+/* ========================= HyperLogLog algorithm  ========================= */
+
+/* Our hash function is MurmurHash2, 64 bit version.
+ * It was modified for Redis in order to provide the same result in
+ * big and little endian archs (endian neutral). */
+static uint64_t MurmurHash64A(const void *key, int len, unsigned int seed) {
+	const uint64_t m = 0xc6a4a7935bd1e995;
+	const int r = 47;
+	uint64_t h = seed ^ (len * m);
+	const uint8_t *data = (const uint8_t *)key;
+	const uint8_t *end = data + (len-(len&7));
+
+	while(data != end) {
+		uint64_t k;
+
+		memcpy(&k,data,sizeof(k));
+		memrev64ifbe(&k);
+
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		h ^= k;
+		h *= m;
+
+		data += 8;
+	}
+
+	switch(len & 7) {
+	case 7: h ^= (uint64_t)data[6] << 48; /* fall-thru */
+	case 6: h ^= (uint64_t)data[5] << 40; /* fall-thru */
+	case 5: h ^= (uint64_t)data[4] << 32; /* fall-thru */
+	case 4: h ^= (uint64_t)data[3] << 24; /* fall-thru */
+	case 3: h ^= (uint64_t)data[2] << 16; /* fall-thru */
+	case 2: h ^= (uint64_t)data[1] << 8; /* fall-thru */
+	case 1: h ^= (uint64_t)data[0];
+			h *= m;
+	};
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
+/* Given a string element to add to the HyperLogLog, returns the length
+ * of the pattern 000..1 of the element hash. As a side effect 'regp' is
+ * set to the register index this element hashes to. */
+/*
+ * 哈希值的低14位是寄存器下标，剩下的50位中从低位开始连续0的个数加1就是模式长度，
+ * 第50位强制置1，所以结果最大是HLL_Q+1
+ */
+static int hllPatLen(unsigned char *ele, size_t elesize, long *regp) {
+	uint64_t hash;
+
+	hash = MurmurHash64A(ele,elesize,0xadc83b19ULL);
+	*regp = (long)(hash & HLL_P_MASK);
+	hash >>= HLL_P;
+	hash |= ((uint64_t)1<<HLL_Q);
+	return __builtin_ctzll(hash)+1;
+}
+
+/* ================== Dense representation implementation  ================== */
+
+/* Low level function to set the dense HLL register at 'index' to the
+ * specified value if the current value is smaller than 'count'.
+ *
+ * 'registers' is expected to have room for HLL_REGISTERS plus an
+ * additional byte on the right. This requirement is met by sds strings
+ * automatically since they are implicitly null terminated.
+ *
+ * The function always succeed, however if as a result of the operation
+ * the approximated cardinality changed, 1 is returned. Otherwise 0
+ * is returned. */
+static int hllDenseSet(uint8_t *registers, long index, uint8_t count) {
+	uint8_t oldcount;
+
+	HLL_DENSE_GET_REGISTER(oldcount,registers,index);
+	if (count > oldcount) {
+		HLL_DENSE_SET_REGISTER(registers,index,count);
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+/* "Add" the element in the dense hyperloglog data structure.
+ * Actually nothing is added, but the max 0 pattern counter of the subset
+ * the element belongs to is incremented if needed.
+ *
+ * This is just a wrapper to hllDenseSet(), performing the hashing of the
+ * element in order to retrieve the index and zero-run count. */
+static int hllDenseAdd(uint8_t *registers, unsigned char *ele, size_t elesize) {
+	long index;
+	uint8_t count = hllPatLen(ele,elesize,&index);
+	/* Update the register if this element produced a longer run of zeroes. */
+	return hllDenseSet(registers,index,count);
+}
+
+/* 把RAW数组写回紧凑格式，每4个寄存器占3个字节 */
+static void hllDensePack(uint8_t *registers, const uint8_t *raw) {
+	uint8_t *p = registers;
+	uint32_t v;
+	long j;
+
+	for (j = 0; j < HLL_REGISTERS; j += 4, p += 3) {
+		v = (uint32_t)(raw[j] & HLL_REGISTER_MAX) |
+			(uint32_t)(raw[j+1] & HLL_REGISTER_MAX) << 6 |
+			(uint32_t)(raw[j+2] & HLL_REGISTER_MAX) << 12 |
+			(uint32_t)(raw[j+3] & HLL_REGISTER_MAX) << 18;
+		p[0] = v & 0xff;
+		p[1] = (v >> 8) & 0xff;
+		p[2] = (v >> 16) & 0xff;
+	}
+}
+
+/* ======================= RAW registers: the kernels ======================= */
+
+/*
+ * 展开紧凑格式中从p开始的count个寄存器，count必须是4的倍数
+ */
+static void hllDenseUnpackScalar(uint8_t *raw, const uint8_t *p, long count) {
+	uint32_t v;
+	long j;
+
+	for (j = 0; j < count; j += 4, p += 3) {
+		v = p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+		raw[j] = v & HLL_REGISTER_MAX;
+		raw[j+1] = (v >> 6) & HLL_REGISTER_MAX;
+		raw[j+2] = (v >> 12) & HLL_REGISTER_MAX;
+		raw[j+3] = (v >> 18) & HLL_REGISTER_MAX;
+	}
+}
+
+static void hllDenseUnpackAll(uint8_t *raw, const uint8_t *registers) {
+	hllDenseUnpackScalar(raw,registers,HLL_REGISTERS);
+}
+
+static void hllRawMaxScalar(uint8_t *max, const uint8_t *raw) {
+	long j;
+
+	/* 不用分支，寄存器的值是随机的，分支预测基本都会失败 */
+	for (j = 0; j < HLL_REGISTERS; j++)
+		max[j] = raw[j] > max[j] ? raw[j] : max[j];
+}
+
+/*
+ * 由寄存器值的直方图得到估算需要的三个量：值为0的寄存器数、值为HLL_Q+1的寄存器数、
+ * 其余寄存器的sum(2^-reg)
+ */
+static double hllHistoSum(int *reghisto, int *ezp, int *esatp) {
+	double sum = 0;
+	int j;
+
+	for (j = 1; j <= HLL_Q; j++) sum += ldexp(reghisto[j],-j);
+	*ezp = reghisto[0];
+	*esatp = reghisto[HLL_Q+1];
+	return sum;
+}
+
+static double hllRawSumScalar(const uint8_t *raw, int *ezp, int *esatp) {
+	int reghisto[HLL_REGISTER_MAX+1] = {0};
+	long j;
+
+	for (j = 0; j < HLL_REGISTERS; j++) reghisto[raw[j]]++;
+	return hllHistoSum(reghisto,ezp,esatp);
+}
+
+#ifdef HLL_USE_X86_KERNELS
+/*
+ * 每次读24字节展开成32个寄存器：pshufb把每3个字节放到一个32位整数中，
+ * 再把4个6位的字段移到各自的字节里。两个128位通道各读16字节，
+ * 最后一组会越界读4字节，所以最后64个寄存器用标量展开
+ */
+__attribute__((target("avx2")))
+static void hllDenseUnpackAVX2(uint8_t *raw, const uint8_t *registers) {
+	const __m256i shuf = _mm256_setr_epi8(
+		0,1,2,-1,3,4,5,-1,6,7,8,-1,9,10,11,-1,
+		0,1,2,-1,3,4,5,-1,6,7,8,-1,9,10,11,-1);
+	const __m256i m0 = _mm256_set1_epi32(0x3f);
+	const __m256i m1 = _mm256_set1_epi32(0x3f00);
+	const __m256i m2 = _mm256_set1_epi32(0x3f0000);
+	const __m256i m3 = _mm256_set1_epi32(0x3f000000);
+	const uint8_t *p = registers;
+	long j;
+
+	for (j = 0; j+32 < HLL_REGISTERS; j += 32, p += 24) {
+		__m256i x = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)p)),
+			_mm_loadu_si128((const __m128i*)(p+12)),1);
+		__m256i r;
+
+		x = _mm256_shuffle_epi8(x,shuf);
+		r = _mm256_or_si256(
+			_mm256_or_si256(_mm256_and_si256(x,m0),
+				_mm256_and_si256(_mm256_slli_epi32(x,2),m1)),
+			_mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(x,4),m2),
+				_mm256_and_si256(_mm256_slli_epi32(x,6),m3)));
+		_mm256_storeu_si256((__m256i*)(raw+j),r);
+	}
+	hllDenseUnpackScalar(raw+j,p,HLL_REGISTERS-j);
+}
+
+__attribute__((target("avx2")))
+static void hllRawMaxAVX2(uint8_t *max, const uint8_t *raw) {
+	long j;
+
+	for (j = 0; j < HLL_REGISTERS; j += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i*)(max+j));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(raw+j));
+		_mm256_storeu_si256((__m256i*)(max+j),_mm256_max_epu8(a,b));
+	}
+}
+
+/*
+ * 2^-reg直接构造double的位模式得到：指数字段为1023-reg，尾数为0。
+ * 值为0和HLL_Q+1的寄存器在估算中单独处理，对应的通道清零，
+ * 数量通过比较和movemask统计
+ */
+__attribute__((target("avx2,popcnt")))
+static double hllRawSumAVX2(const uint8_t *raw, int *ezp, int *esatp) {
+	const __m256i zero8 = _mm256_setzero_si256();
+	const __m256i sat8 = _mm256_set1_epi8(HLL_Q+1);
+	const __m256i zero64 = _mm256_setzero_si256();
+	const __m256i sat64 = _mm256_set1_epi64x(HLL_Q+1);
+	const __m256i bias = _mm256_set1_epi64x(1023);
+	__m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+	__m256d acc2 = _mm256_setzero_pd(), acc3 = _mm256_setzero_pd();
+	double lanes[4];
+	int ez = 0, esat = 0;
+	long j;
+
+#define HLL_RAW_SUM_STEP(acc,bytes) do { \
+	__m256i _v = _mm256_cvtepu8_epi64(bytes); \
+	__m256i _skip = _mm256_or_si256(_mm256_cmpeq_epi64(_v,zero64), \
+		_mm256_cmpeq_epi64(_v,sat64)); \
+	__m256i _bits = _mm256_slli_epi64(_mm256_sub_epi64(bias,_v),52); \
+	acc = _mm256_add_pd(acc,_mm256_castsi256_pd(_mm256_andnot_si256(_skip,_bits))); \
+} while(0)
+
+	for (j = 0; j < HLL_REGISTERS; j += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(raw+j));
+		__m128i lo = _mm256_castsi256_si128(x);
+		__m128i hi = _mm256_extracti128_si256(x,1);
+
+		ez += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x,zero8)));
+		esat += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x,sat8)));
+
+		HLL_RAW_SUM_STEP(acc0,lo);
+		HLL_RAW_SUM_STEP(acc1,_mm_srli_si128(lo,4));
+		HLL_RAW_SUM_STEP(acc2,_mm_srli_si128(lo,8));
+		HLL_RAW_SUM_STEP(acc3,_mm_srli_si128(lo,12));
+		HLL_RAW_SUM_STEP(acc0,hi);
+		HLL_RAW_SUM_STEP(acc1,_mm_srli_si128(hi,4));
+		HLL_RAW_SUM_STEP(acc2,_mm_srli_si128(hi,8));
+		HLL_RAW_SUM_STEP(acc3,_mm_srli_si128(hi,12));
+	}
+#undef HLL_RAW_SUM_STEP
+
+	_mm256_storeu_pd(lanes,_mm256_add_pd(_mm256_add_pd(acc0,acc1),
+		_mm256_add_pd(acc2,acc3)));
+	*ezp = ez;
+	*esatp = esat;
+	return lanes[0]+lanes[1]+lanes[2]+lanes[3];
+}
+#endif
+
+/* 处理RAW寄存器的一组实现，第一次使用时根据CPU支持的指令集选择 */
+typedef struct hllKernels {
+	const char *name;
+	void (*unpack)(uint8_t *raw, const uint8_t *registers);
+	void (*max)(uint8_t *max, const uint8_t *raw);
+	double (*sum)(const uint8_t *raw, int *ezp, int *esatp);
+} hllKernels;
+
+static hllKernels scalarKernels = {
+	"scalar", hllDenseUnpackAll, hllRawMaxScalar, hllRawSumScalar
+};
+#ifdef HLL_USE_X86_KERNELS
+static hllKernels avx2Kernels = {
+	"avx2", hllDenseUnpackAVX2, hllRawMaxAVX2, hllRawSumAVX2
+};
+#endif
+static hllKernels *kernels = NULL;
+
+static hllKernels *hllGetKernels(void) {
+	if (kernels == NULL) {
+		kernels = &scalarKernels;
+#ifdef HLL_USE_X86_KERNELS
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+			kernels = &avx2Kernels;
+#endif
+	}
+	return kernels;
+}
+
+/* ================== Sparse representation implementation  ================= */
+
+/* Convert the HLL with sparse representation given as input in its dense
+ * representation. Both representations are represented by SDS strings, and
+ * the input representation is freed as a side effect.
+ *
+ * The function returns C_OK if the sparse representation was valid,
+ * otherwise C_ERR is returned if the representation was corrupted. */
+static int hllSparseToDense(robj *o) {
+	sds sparse = o->ptr, dense;
+	struct hllhdr *hdr, *oldhdr = (struct hllhdr*)sparse;
+	int idx = 0, runlen, regval;
+	uint8_t *p = (uint8_t*)sparse, *end = p+sdslen(sparse);
+
+	/* If the representation is already the right one return ASAP. */
+	hdr = (struct hllhdr*) sparse;
+	if (hdr->encoding == HLL_DENSE) return C_OK;
+
+	/* Create a string of the right size filled with zero bytes.
+	 * Note that the cached cardinality is set to 0 as a side effect
+	 * that is exactly the cardinality of an empty HLL. */
+	dense = sdsnewlen(NULL,HLL_DENSE_SIZE);
+	hdr = (struct hllhdr*) dense;
+	*hdr = *oldhdr; /* This will copy the magic and cached cardinality. */
+	hdr->encoding = HLL_DENSE;
+
+	/* Now read the sparse representation and set non-zero registers
+	 * accordingly. */
+	p += HLL_HDR_SIZE;
+	while(p < end) {
+		if (HLL_SPARSE_IS_ZERO(p)) {
+			runlen = HLL_SPARSE_ZERO_LEN(p);
+			idx += runlen;
+			p++;
+		} else if (HLL_SPARSE_IS_XZERO(p)) {
+			runlen = HLL_SPARSE_XZERO_LEN(p);
+			idx += runlen;
+			p += 2;
+		} else {
+			runlen = HLL_SPARSE_VAL_LEN(p);
+			regval = HLL_SPARSE_VAL_VALUE(p);
+			if ((runlen + idx) > HLL_REGISTERS) break; /* Overflow. */
+			while(runlen--) {
+				HLL_DENSE_SET_REGISTER(hdr->registers,idx,regval);
+				idx++;
+			}
+			p++;
+		}
+	}
+
+	/* If the sparse representation was valid, we expect to find idx
+	 * set to HLL_REGISTERS. */
+	if (idx != HLL_REGISTERS) {
+		sdsfree(dense);
+		return C_ERR;
+	}
+
+	/* Free the old representation and set the new one. */
+	sdsfree(o->ptr);
+	o->ptr = dense;
+	return C_OK;
+}
+
+/* Low level function to set the sparse HLL register at 'index' to the
+ * specified value if the current value is smaller than 'count'.
+ *
+ * The object 'o' is the String object holding the HLL. The function requires
+ * a reference to the object in order to be able to enlarge the string if
+ * needed.
+ *
+ * On success, the function returns 1 if the cardinality changed, or 0
+ * if the register for this element was not updated.
+ * On error (if the representation is invalid) -1 is returned.
+ *
+ * As a side effect the function may promote the HLL representation from
+ * sparse to dense: this happens when a register requires to be set to a value
+ * not representable with the sparse representation, or when the resulting
+ * size would be greater than server.hll_sparse_max_bytes. */
+static int hllSparseSet(robj *o, long index, uint8_t count) {
+	struct hllhdr *hdr;
+	uint8_t oldcount, *sparse, *end, *p, *prev, *next;
+	long first, span;
+	long is_zero = 0, is_xzero = 0, is_val = 0, runlen = 0;
+	uint8_t seq[5], *n;
+	int last, len, seqlen, oldlen, deltalen, scanlen;
+
+	/* If the count is too big to be representable by the sparse
+	 * representation, switch to dense representation. */
+	if (count > HLL_SPARSE_VAL_MAX_VALUE) goto promote;
+
+	/* When updating a sparse representation, sometimes we may need to
+	 * enlarge the buffer for up to 3 bytes in the worst case (XZERO split
+	 * into XZERO-VAL-XZERO). Make sure there is enough space right now
+	 * so that the pointers we take during the execution of the function
+	 * will be valid all the time. */
+	o->ptr = sdsMakeRoomFor(o->ptr,3);
+
+	/* Step 1: we need to locate the opcode we need to modify to check
+	 * if a value update is actually needed. */
+	sparse = p = ((uint8_t*)o->ptr) + HLL_HDR_SIZE;
+	end = p + sdslen(o->ptr) - HLL_HDR_SIZE;
+
+	first = 0;
+	prev = NULL; /* Points to previous opcode at the end of the loop. */
+	next = NULL; /* Points to the next opcode at the end of the loop. */
+	span = 0;
+	while(p < end) {
+		long oplen;
+
+		/* Set span to the number of registers covered by this opcode.
+		 *
+		 * This is the most performance critical loop of the sparse
+		 * representation. Sorting the conditionals from the most to the
+		 * least frequent opcode in many-bytes sparse HLLs is faster. */
+		oplen = 1;
+		if (HLL_SPARSE_IS_ZERO(p)) {
+			span = HLL_SPARSE_ZERO_LEN(p);
+		} else if (HLL_SPARSE_IS_VAL(p)) {
+			span = HLL_SPARSE_VAL_LEN(p);
+		} else { /* XZERO. */
+			span = HLL_SPARSE_XZERO_LEN(p);
+			oplen = 2;
+		}
+		/* Break if this opcode covers the register as 'index'. */
+		if (index <= first+span-1) break;
+		prev = p;
+		p += oplen;
+		first += span;
+	}
+	if (span == 0 || p >= end) return -1; /* Invalid format. */
+
+	next = HLL_SPARSE_IS_XZERO(p) ? p+2 : p+1;
+	if (next >= end) next = NULL;
+
+	/* Cache current opcode type to avoid using the macro again and
+	 * again for something that will not change.
+	 * Also cache the run-length of the opcode. */
+	if (HLL_SPARSE_IS_ZERO(p)) {
+		is_zero = 1;
+		runlen = HLL_SPARSE_ZERO_LEN(p);
+	} else if (HLL_SPARSE_IS_XZERO(p)) {
+		is_xzero = 1;
+		runlen = HLL_SPARSE_XZERO_LEN(p);
+	} else {
+		is_val = 1;
+		runlen = HLL_SPARSE_VAL_LEN(p);
+	}
+
+	/* Step 2: After the loop:
+	 *
+	 * 'first' stores to the index of the first register covered
+	 *  by the current opcode, which is pointed by 'p'.
+	 *
+	 * 'next' ad 'prev' store respectively the next and previous opcode,
+	 *  or NULL if the opcode at 'p' is respectively the last or first.
+	 *
+	 * 'span' is set to the number of registers covered by the current
+	 *  opcode.
+	 *
+	 * There are different cases in order to update the data structure
+	 * in place without generating it from scratch:
+	 *
+	 * A) If it is a VAL opcode already set to a value >= our 'count'
+	 *    no update is needed, regardless of the VAL run-length field.
+	 *    In this case PFADD returns 0 since no changes are performed.
+	 *
+	 * B) If it is a VAL opcode with len = 1 (representing only our
+	 *    register) and the value is less than 'count', we just update it
+	 *    since this is a trivial case. */
+	if (is_val) {
+		oldcount = HLL_SPARSE_VAL_VALUE(p);
+		/* Case A. */
+		if (oldcount >= count) return 0;
+
+		/* Case B. */
+		if (runlen == 1) {
+			HLL_SPARSE_VAL_SET(p,count,1);
+			goto updated;
+		}
+	}
+
+	/* C) Another trivial to handle case is a ZERO opcode with a len of 1.
+	 * We can just replace it with a VAL opcode with our value and len of 1. */
+	if (is_zero && runlen == 1) {
+		HLL_SPARSE_VAL_SET(p,count,1);
+		goto updated;
+	}
+
+	/* D) General case.
+	 *
+	 * The other cases are more complex: our register requires to be updated
+	 * and is either currently represented by a VAL opcode with len > 1,
+	 * by a ZERO opcode with len > 1, or by an XZERO opcode.
+	 *
+	 * In those cases the original opcode must be split into multiple
+	 * opcodes. The worst case is an XZERO split in the middle resuling into
+	 * XZERO - VAL - XZERO, so the resulting sequence max length is
+	 * 5 bytes.
+	 *
+	 * We perform the split writing the new sequence into the 'new' buffer
+	 * with 'newlen' as length. Later the new sequence is inserted in place
+	 * of the old one, possibly moving what is on the right a few bytes
+	 * if the new sequence is longer than the older one. */
+	n = seq;
+	last = first+span-1; /* Last register covered by the sequence. */
+
+	if (is_zero || is_xzero) {
+		/* Handle splitting of ZERO / XZERO. */
+		if (index != first) {
+			len = index-first;
+			if (len > HLL_SPARSE_ZERO_MAX_LEN) {
+				HLL_SPARSE_XZERO_SET(n,len);
+				n += 2;
+			} else {
+				HLL_SPARSE_ZERO_SET(n,len);
+				n++;
+			}
+		}
+		HLL_SPARSE_VAL_SET(n,count,1);
+		n++;
+		if (index != last) {
+			len = last-index;
+			if (len > HLL_SPARSE_ZERO_MAX_LEN) {
+				HLL_SPARSE_XZERO_SET(n,len);
+				n += 2;
+			} else {
+				HLL_SPARSE_ZERO_SET(n,len);
+				n++;
+			}
+		}
+	} else {
+		/* Handle splitting of VAL. */
+		int curval = HLL_SPARSE_VAL_VALUE(p);
+
+		if (index != first) {
+			len = index-first;
+			HLL_SPARSE_VAL_SET(n,curval,len);
+			n++;
+		}
+		HLL_SPARSE_VAL_SET(n,count,1);
+		n++;
+		if (index != last) {
+			len = last-index;
+			HLL_SPARSE_VAL_SET(n,curval,len);
+			n++;
+		}
+	}
+
+	/* Step 3: substitute the new sequence with the old one.
+	 *
+	 * Note that we already allocated space on the sds string
+	 * calling sdsMakeRoomFor(). */
+	seqlen = n-seq;
+	oldlen = is_xzero ? 2 : 1;
+	deltalen = seqlen-oldlen;
+
+	if (deltalen > 0 &&
+		sdslen(o->ptr)+deltalen > server.hll_sparse_max_bytes) goto promote;
+	if (deltalen && next) memmove(next+deltalen,next,end-next);
+	sdsIncrLen(o->ptr,deltalen);
+	memcpy(p,seq,seqlen);
+	end += deltalen;
+
+updated:
+	/* Step 4: Merge adjacent values if possible.
+	 *
+	 * The representation was updated, however the resulting representation
+	 * may not be optimal: adjacent VAL opcodes can sometimes be merged into
+	 * a single one. */
+	p = prev ? prev : sparse;
+	scanlen = 5; /* Scan up to 5 upcodes starting from prev. */
+	while (p < end && scanlen--) {
+		if (HLL_SPARSE_IS_XZERO(p)) {
+			p += 2;
+			continue;
+		} else if (HLL_SPARSE_IS_ZERO(p)) {
+			p++;
+			continue;
+		}
+		/* We need two adjacent VAL opcodes to try a merge, having
+		 * the same value, and a len that fits the VAL opcode max len. */
+		if (p+1 < end && HLL_SPARSE_IS_VAL(p+1)) {
+			int v1 = HLL_SPARSE_VAL_VALUE(p);
+			int v2 = HLL_SPARSE_VAL_VALUE(p+1);
+			if (v1 == v2) {
+				len = HLL_SPARSE_VAL_LEN(p)+HLL_SPARSE_VAL_LEN(p+1);
+				if (len <= HLL_SPARSE_VAL_MAX_LEN) {
+					HLL_SPARSE_VAL_SET(p+1,v1,len);
+					memmove(p,p+1,end-p);
+					sdsIncrLen(o->ptr,-1);
+					end--;
+					/* After a merge we reiterate without incrementing 'p'
+					 * in order to try to merge the just merged value with
+					 * a value on its right. */
+					continue;
+				}
+			}
+		}
+		p++;
+	}
+
+	/* Invalidate the cached cardinality. */
+	hdr = o->ptr;
+	HLL_INVALIDATE_CACHE(hdr);
+	return 1;
+
+promote: /* Promote to dense representation. */
+	if (hllSparseToDense(o) == C_ERR) return -1; /* Corrupted HLL. */
+	hdr = o->ptr;
+
+	/* We need to call hllDenseAdd() to perform the operation after the
+	 * conversion. However the result must be 1, since if we need to
+	 * convert from sparse to dense a register requires to be updated.
+	 *
+	 * Note that this in turn means that PFADD will make sure the command
+	 * is propagated to the AOF, so if there is a sparse -> dense
+	 * conversion, it will be performed again when the AOF is loaded. */
+	return hllDenseSet(hdr->registers,index,count);
+}
+
+/* "Add" the element in the sparse hyperloglog data structure.
+ * Actually nothing is added, but the max 0 pattern counter of the subset
+ * the element belongs to is incremented if needed.
+ *
+ * This function is actually a wrapper for hllSparseSet(), it only performs
+ * the hashing of the element to obtain the index and zeros run length. */
+static int hllSparseAdd(robj *o, unsigned char *ele, size_t elesize) {
+	long index;
+	uint8_t count = hllPatLen(ele,elesize,&index);
+	/* Update the register if this element produced a longer run of zeroes. */
+	return hllSparseSet(o,index,count);
+}
+
+/* Compute the register histogram in the sparse representation. */
+static void hllSparseRegHisto(uint8_t *sparse, int sparselen, int *invalid, int *reghisto) {
+	int idx = 0, runlen, regval;
+	uint8_t *end = sparse+sparselen, *p = sparse;
+
+	while(p < end) {
+		if (HLL_SPARSE_IS_ZERO(p)) {
+			runlen = HLL_SPARSE_ZERO_LEN(p);
+			idx += runlen;
+			reghisto[0] += runlen;
+			p++;
+		} else if (HLL_SPARSE_IS_XZERO(p)) {
+			runlen = HLL_SPARSE_XZERO_LEN(p);
+			idx += runlen;
+			reghisto[0] += runlen;
+			p += 2;
+		} else {
+			runlen = HLL_SPARSE_VAL_LEN(p);
+			regval = HLL_SPARSE_VAL_VALUE(p);
+			idx += runlen;
+			reghisto[regval] += runlen;
+			p++;
+		}
+	}
+	if (idx != HLL_REGISTERS && invalid) *invalid = 1;
+}
+
+/* ========================= HyperLogLog Count ==============================
+ * This is the core of the algorithm where the approximated count is computed.
+ * The function uses the lower level hllDenseRegHisto() and hllSparseRegHisto()
+ * functions as helpers to compute histogram of register values part of the
+ * computation, which is representation-specific, while all the rest is common. */
+
+/* Helper function sigma as defined in
+ * "New cardinality estimation algorithms for HyperLogLog sketches"
+ * Otmar Ertl, arXiv:1702.01284 */
+static double hllSigma(double x) {
+	if (x == 1.) return INFINITY;
+	double zPrime;
+	double y = 1;
+	double z = x;
+	do {
+		x *= x;
+		zPrime = z;
+		z += x * y;
+		y += y;
+	} while(zPrime != z);
+	return z;
+}
+
+/* Helper function tau as defined in
+ * "New cardinality estimation algorithms for HyperLogLog sketches"
+ * Otmar Ertl, arXiv:1702.01284 */
+static double hllTau(double x) {
+	if (x == 0. || x == 1.) return 0.;
+	double zPrime;
+	double y = 1.0;
+	double z = 1 - x;
+	do {
+		x = sqrt(x);
+		zPrime = z;
+		y *= 0.5;
+		z -= pow(1 - x, 2)*y;
+	} while(zPrime != z);
+	return z / 3;
+}
+
+/*
+ * Ertl的估算公式按直方图从高到低迭代：z = m*tau(...)，然后对k = q..1执行z = (z+C[k])/2。
+ * 展开后中间部分就是sum(2^-reg)，由hllRawSum*()一次遍历计算，
+ * 只有值为0和q+1的寄存器需要用sigma和tau修正
+ */
+static uint64_t hllEstimate(int ez, int esat, double sum) {
+	double m = HLL_REGISTERS;
+	double z;
+
+	z = m * hllTau((m-esat)/m) * ldexp(1.0,-HLL_Q);
+	z += sum;
+	z += m * hllSigma(ez/m);
+	return (uint64_t) llroundl(HLL_ALPHA_INF*m*m/z);
+}
+
+/* Return the approximated cardinality of the set based on the harmonic
+ * mean of the registers values. 'hdr' points to the start of the SDS
+ * representing the String object holding the HLL representation.
+ *
+ * If the sparse representation of the HLL object is not valid, the integer
+ * pointed by 'invalid' is set to non-zero, otherwise it is left untouched.
+ *
+ * hllCount() supports a special internal-only encoding of HLL_RAW, that
+ * is, hdr->registers will point to an uint8_t array of HLL_REGISTERS element.
+ * This is useful in order to speedup PFCOUNT when called against multiple
+ * keys (no need to work with 6-bit integers encoding). */
+static uint64_t hllCount(struct hllhdr *hdr, int *invalid) {
+	hllKernels *k = hllGetKernels();
+	int ez, esat;
+	double sum;
+
+	if (hdr->encoding == HLL_DENSE) {
+		uint8_t raw[HLL_REGISTERS];
+
+		k->unpack(raw,hdr->registers);
+		sum = k->sum(raw,&ez,&esat);
+	} else if (hdr->encoding == HLL_SPARSE) {
+		int reghisto[64] = {0};
+
+		hllSparseRegHisto(hdr->registers,
+			sdslen((sds)hdr)-HLL_HDR_SIZE,invalid,reghisto);
+		sum = hllHistoSum(reghisto,&ez,&esat);
+	} else if (hdr->encoding == HLL_RAW) {
+		sum = k->sum(hdr->registers,&ez,&esat);
+	} else {
+		printf("Unknown HyperLogLog encoding in hllCount()\n");
+		exit(1);
+	}
+	return hllEstimate(ez,esat,sum);
+}
+
+/* Call hllDenseAdd() or hllSparseAdd() according to the HLL encoding. */
+static int hllAdd(robj *o, unsigned char *ele, size_t elesize) {
+	struct hllhdr *hdr = o->ptr;
+	switch(hdr->encoding) {
+	case HLL_DENSE: return hllDenseAdd(hdr->registers,ele,elesize);
+	case HLL_SPARSE: return hllSparseAdd(o,ele,elesize);
+	default: return -1; /* Invalid representation. */
+	}
+}
+
+/* Merge by computing MAX(registers[i],hll[i]) the HyperLogLog 'hll'
+ * with an array of uint8_t HLL_REGISTERS registers pointed by 'max'.
+ *
+ * The hll object must be already validated via isHLLObjectOrReply()
+ * or in some other way.
+ *
+ * If the HyperLogLog is sparse and is found to be invalid, C_ERR
+ * is returned, otherwise the function always succeeds. */
+static int hllMerge(uint8_t *max, robj *hll) {
+	struct hllhdr *hdr = hll->ptr;
+	int i;
+
+	if (hdr->encoding == HLL_DENSE) {
+		hllKernels *k = hllGetKernels();
+		uint8_t raw[HLL_REGISTERS];
+
+		k->unpack(raw,hdr->registers);
+		k->max(max,raw);
+	} else {
+		uint8_t *p = hll->ptr, *end = p + sdslen(hll->ptr);
+		long runlen, regval;
+
+		p += HLL_HDR_SIZE;
+		i = 0;
+		while(p < end) {
+			if (HLL_SPARSE_IS_ZERO(p)) {
+				runlen = HLL_SPARSE_ZERO_LEN(p);
+				i += runlen;
+				p++;
+			} else if (HLL_SPARSE_IS_XZERO(p)) {
+				runlen = HLL_SPARSE_XZERO_LEN(p);
+				i += runlen;
+				p += 2;
+			} else {
+				runlen = HLL_SPARSE_VAL_LEN(p);
+				regval = HLL_SPARSE_VAL_VALUE(p);
+				if ((runlen + i) > HLL_REGISTERS) break; /* Overflow. */
+				while(runlen--) {
+					if (regval > max[i]) max[i] = regval;
+					i++;
+				}
+				p++;
+			}
+		}
+		if (i != HLL_REGISTERS) return C_ERR;
+	}
+	return C_OK;
+}
+
+/* ========================== HyperLogLog commands ========================== */
+
+/* Create an HLL object. We always create the HLL using sparse encoding.
+ * This will be upgraded to the dense representation as needed. */
+static robj *createHLLObject(void) {
+	robj *o;
+	struct hllhdr *hdr;
+	sds s;
+	uint8_t *p;
+	int sparselen = HLL_HDR_SIZE +
+					(((HLL_REGISTERS+(HLL_SPARSE_XZERO_MAX_LEN-1)) /
+					 HLL_SPARSE_XZERO_MAX_LEN)*2);
+	int aux;
+
+	/* Populate the sparse representation with as many XZERO opcodes as
+	 * needed to represent all the registers. */
+	aux = HLL_REGISTERS;
+	s = sdsnewlen(NULL,sparselen);
+	p = (uint8_t*)s + HLL_HDR_SIZE;
+	while(aux) {
+		int xzero = HLL_SPARSE_XZERO_MAX_LEN;
+		if (xzero > aux) xzero = aux;
+		HLL_SPARSE_XZERO_SET(p,xzero);
+		p += 2;
+		aux -= xzero;
+	}
+
+	/* Create the actual object. */
+	o = createObject(OBJ_STRING,s);
+	hdr = o->ptr;
+	memcpy(hdr->magic,"HYLL",4);
+	hdr->encoding = HLL_SPARSE;
+	return o;
+}
+
+/* Check if the object is a String with a valid HLL representation.
+ * Return C_OK if this is true, otherwise reply to the client
+ * with an error and return C_ERR. */
+static int isHLLObjectOrReply(client *c, robj *o) {
+	struct hllhdr *hdr;
+
+	/* Key exists, check type */
+	if (checkType(c,o,OBJ_STRING))
+		return C_ERR; /* Error already sent. */
+
+	if (!sdsEncodedObject(o)) goto invalid;
+	if (stringObjectLen(o) < sizeof(*hdr)) goto invalid;
+	hdr = o->ptr;
+
+	/* Magic should be "HYLL". */
+	if (hdr->magic[0] != 'H' || hdr->magic[1] != 'Y' ||
+		hdr->magic[2] != 'L' || hdr->magic[3] != 'L') goto invalid;
+
+	if (hdr->encoding > HLL_MAX_ENCODING) goto invalid;
+
+	/* Dense representation string length should match exactly. */
+	if (hdr->encoding == HLL_DENSE &&
+		stringObjectLen(o) != HLL_DENSE_SIZE) goto invalid;
+
+	/* All tests passed. */
+	return C_OK;
+
+invalid:
+	addReplySds(c,
+		sdsnew("-WRONGTYPE Key is not a valid "
+			   "HyperLogLog string value.\r\n"));
+	return C_ERR;
+}
+
+/* 读取和保存头部缓存的基数，小端字节序 */
+static uint64_t hllGetCachedCard(struct hllhdr *hdr) {
+	uint64_t card = 0;
+	int j;
+
+	for (j = 7; j >= 0; j--) card = (card << 8) | hdr->card[j];
+	return card;
+}
+
+static void hllSetCachedCard(struct hllhdr *hdr, uint64_t card) {
+	int j;
+
+	for (j = 0; j < 8; j++) {
+		hdr->card[j] = card & 0xff;
+		card >>= 8;
+	}
+}
+
+/* PFADD var ele ele ele ... ele => :0 or :1 */
+void pfaddCommand(client *c) {
+	robj *o = lookupKey(c->db,c->argv[1]);
+	struct hllhdr *hdr;
+	int updated = 0, j;
+
+	if (o == NULL) {
+		/* Create the key with a string value of the exact length to
+		 * hold our HLL data structure. sdsnewlen() when NULL is passed
+		 * is guaranteed to return bytes initialized to zero. */
+		o = createHLLObject();
+		dbAdd(c->db,c->argv[1],o);
+		updated++;
+	} else {
+		if (isHLLObjectOrReply(c,o) != C_OK) return;
+		o = dbUnshareStringValue(c->db,c->argv[1],o);
+	}
+	/* Perform the low level ADD operation for every element. */
+	for (j = 2; j < c->argc; j++) {
+		robj *ele = getDecodedObject(c->argv[j]);
+		int retval = hllAdd(o, (unsigned char*)ele->ptr, sdslen(ele->ptr));
+
+		decrRefCount(ele);
+		switch(retval) {
+		case 1:
+			updated++;
+			break;
+		case -1:
+			addReplySds(c,sdsnew(invalid_hll_err));
+			return;
+		}
+	}
+	hdr = o->ptr;
+	if (updated) {
+		server.dirty++;
+		HLL_INVALIDATE_CACHE(hdr);
+	}
+	addReply(c, updated ? shared.cone : shared.czero);
+}
+
+/* PFCOUNT var -> approximated cardinality of set. */
+/*
+ * 单个key时优先使用头部缓存的基数，缓存失效才重新计算并写回缓存。
+ * 缓存只是加速，不改变HLL的内容，所以不增加dirty，命令仍然是只读的
+ */
+void pfcountCommand(client *c) {
+	robj *o;
+	struct hllhdr *hdr;
+	uint64_t card;
+
+	/* Case 1: multi-key keys, cardinality of the union.
+	 *
+	 * When multiple keys are specified, PFCOUNT actually computes
+	 * the cardinality of the merge of the N HLLs specified. */
+	if (c->argc > 2) {
+		uint8_t max[HLL_HDR_SIZE+HLL_REGISTERS], *registers;
+		int j;
+
+		/* Compute an HLL with M[i] = MAX(M[i]_j). */
+		memset(max,0,sizeof(max));
+		hdr = (struct hllhdr*) max;
+		hdr->encoding = HLL_RAW; /* Special internal-only encoding. */
+		registers = max + HLL_HDR_SIZE;
+		for (j = 1; j < c->argc; j++) {
+			/* Check type and size. */
+			robj *o = lookupKey(c->db,c->argv[j]);
+			if (o == NULL) continue; /* Assume empty HLL for non existing var.*/
+			if (isHLLObjectOrReply(c,o) != C_OK) return;
+
+			/* Merge with this HLL with our 'max' HHL by setting max[i]
+			 * to MAX(max[i],hll[i]). */
+			if (hllMerge(registers,o) == C_ERR) {
+				addReplySds(c,sdsnew(invalid_hll_err));
+				return;
+			}
+		}
+
+		/* Compute cardinality of the resulting set. */
+		addReplyLongLong(c,hllCount(hdr,NULL));
+		return;
+	}
+
+	/* Case 2: cardinality of the single HLL.
+	 *
+	 * The user specified a single key. Either return the cached value
+	 * or compute one and update the cache. */
+	o = lookupKey(c->db,c->argv[1]);
+	if (o == NULL) {
+		/* No key? Cardinality is zero since no element was added, otherwise
+		 * we would have a key as HLLADD creates it as a side effect. */
+		addReply(c,shared.czero);
+		return;
+	}
+	if (isHLLObjectOrReply(c,o) != C_OK) return;
+
+	hdr = o->ptr;
+	if (HLL_VALID_CACHE(hdr)) {
+		/* Just return the cached value. */
+		card = hllGetCachedCard(hdr);
+	} else {
+		int invalid = 0;
+
+		/* Recompute it and update the cached value. */
+		card = hllCount(hdr,&invalid);
+		if (invalid) {
+			addReplySds(c,sdsnew(invalid_hll_err));
+			return;
+		}
+		o = dbUnshareStringValue(c->db,c->argv[1],o);
+		hllSetCachedCard(o->ptr,card);
+	}
+	addReplyLongLong(c,card);
+}
+
+/* PFMERGE dest src1 src2 src3 ... srcN => OK */
+/*
+ * 所有源先合并到RAW数组中，目标是紧凑格式时直接整体写回，
+ * 并用合并结果计算基数写入缓存，之后的PFCOUNT不需要再计算
+ */
+void pfmergeCommand(client *c) {
+	uint8_t max[HLL_REGISTERS];
+	struct hllhdr *hdr;
+	int j;
+	int use_dense = 0; /* Use dense representation as target? */
+	robj *o;
+
+	/* Compute an HLL with M[i] = MAX(M[i]_j).
+	 * We store the maximum into the max array of registers. We'll write
+	 * it to the target variable later. */
+	memset(max,0,sizeof(max));
+	for (j = 1; j < c->argc; j++) {
+		/* Check type and size. */
+		robj *o = lookupKey(c->db,c->argv[j]);
+		if (o == NULL) continue; /* Assume empty HLL for non existing var. */
+		if (isHLLObjectOrReply(c,o) != C_OK) return;
+
+		/* If at least one involved HLL is dense, use the dense representation
+		 * as target ASAP to save time and avoid the conversion step. */
+		hdr = o->ptr;
+		if (hdr->encoding == HLL_DENSE) use_dense = 1;
+
+		/* Merge with this HLL with our 'max' HHL by setting max[i]
+		 * to MAX(max[i],hll[i]). */
+		if (hllMerge(max,o) == C_ERR) {
+			addReplySds(c,sdsnew(invalid_hll_err));
+			return;
+		}
+	}
+
+	/* Create / unshare the destination key's value if needed. */
+	o = lookupKey(c->db,c->argv[1]);
+	if (o == NULL) {
+		/* Create the key with a string value of the exact length to
+		 * hold our HLL data structure. sdsnewlen() when NULL is passed
+		 * is guaranteed to return bytes initialized to zero. */
+		o = createHLLObject();
+		dbAdd(c->db,c->argv[1],o);
+	} else {
+		/* If key exists we are sure it's of the right type/size
+		 * since we checked when merging the different HLLs, so we
+		 * don't check again. */
+		o = dbUnshareStringValue(c->db,c->argv[1],o);
+	}
+
+	/* Convert the destination object to dense representation if at least
+	 * one of the inputs was dense. */
+	if (use_dense && hllSparseToDense(o) == C_ERR) {
+		addReplySds(c,sdsnew(invalid_hll_err));
+		return;
+	}
+
+	/* Write the resulting HLL to the destination HLL registers and
+	 * invalidate the cached value. */
+	hdr = o->ptr;
+	if (hdr->encoding == HLL_DENSE) {
+		int ez, esat;
+		double sum;
+
+		hllDensePack(hdr->registers,max);
+		sum = hllGetKernels()->sum(max,&ez,&esat);
+		hllSetCachedCard(hdr,hllEstimate(ez,esat,sum));
+	} else {
+		for (j = 0; j < HLL_REGISTERS; j++) {
+			if (max[j] == 0) continue;
+			if (hllSparseSet(o,j,max[j]) == -1) {
+				addReplySds(c,sdsnew(invalid_hll_err));
+				return;
+			}
+		}
+		hdr = o->ptr; /* The sparse set may have promoted or reallocated. */
+		HLL_INVALIDATE_CACHE(hdr);
+	}
+
+	server.dirty++;
+	addReply(c,shared.ok);
+}
+
+#ifdef HLL_BENCHMARK_MAIN
+/*
+ * HLL基准测试，比较标量和AVX2版本的展开、合并和估算：
+ * make hll-benchmark && ./hll-benchmark
+ * 最后检查不同基数下的估算误差
+ */
+#define HLL_BENCH_LOOPS 20000
+
+int main(void) {
+	hllKernels *all[2];
+	int nkernels = 0, k, ez, esat, ref_ez = 0, ref_esat = 0;
+	uint8_t *raw, *max;
+	robj *a, *b;
+	long long start, j, cards[] = {100, 1000, 10000, 100000, 1000000, 10000000};
+	uint64_t x = 0x9E3779B97F4A7C15ULL;
+	double sum = 0, ref_sum = 0;
+	char buf[32];
+
+	initServerConfig();
+
+	all[nkernels++] = &scalarKernels;
+#ifdef HLL_USE_X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+		all[nkernels++] = &avx2Kernels;
+#endif
+
+	/* 两个紧凑格式的HLL，每个加入一百万个不同的元素 */
+	a = createHLLObject();
+	b = createHLLObject();
+	hllSparseToDense(a);
+	hllSparseToDense(b);
+	for (j = 0; j < 1000000; j++) {
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		hllAdd(a,(unsigned char*)&x,sizeof(x));
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		hllAdd(b,(unsigned char*)&x,sizeof(x));
+	}
+	raw = zmalloc(HLL_REGISTERS);
+	max = zmalloc(HLL_REGISTERS);
+
+	for (k = 0; k < nkernels; k++) {
+		hllKernels *kn = all[k];
+		struct hllhdr *ha = a->ptr;
+
+		kernels = kn; /* hllMerge()使用当前选择的实现 */
+
+		start = ustime();
+		for (j = 0; j < HLL_BENCH_LOOPS; j++) kn->unpack(raw,ha->registers);
+		printf("%-7s unpack dense        %7.2f us\n", kn->name,
+			(double)(ustime()-start)/HLL_BENCH_LOOPS);
+
+		start = ustime();
+		for (j = 0; j < HLL_BENCH_LOOPS; j++) sum = kn->sum(raw,&ez,&esat);
+		printf("%-7s estimate sum        %7.2f us\n", kn->name,
+			(double)(ustime()-start)/HLL_BENCH_LOOPS);
+		if (k == 0) {
+			ref_sum = sum;
+			ref_ez = ez;
+			ref_esat = esat;
+		} else if (fabs(sum-ref_sum) > ref_sum*1e-12 || ez != ref_ez ||
+			esat != ref_esat)
+		{
+			printf("  estimate mismatch: %.17g/%d/%d != %.17g/%d/%d\n",
+				sum,ez,esat,ref_sum,ref_ez,ref_esat);
+		}
+
+		start = ustime();
+		for (j = 0; j < HLL_BENCH_LOOPS; j++) {
+			memset(max,0,HLL_REGISTERS);
+			hllMerge(max,a);
+			hllMerge(max,b);
+		}
+		printf("%-7s merge 2 dense keys  %7.2f us (%llu)\n", kn->name,
+			(double)(ustime()-start)/HLL_BENCH_LOOPS,
+			(unsigned long long)hllEstimate(ez,esat,sum));
+	}
+	kernels = NULL;
+
+	for (k = 0; k < (int)(sizeof(cards)/sizeof(cards[0])); k++) {
+		robj *o = createHLLObject();
+		uint64_t card;
+
+		for (j = 0; j < cards[k]; j++) {
+			int len = ll2string(buf,sizeof(buf),j);
+			hllAdd(o,(unsigned char*)buf,len);
+		}
+		card = hllCount(o->ptr,NULL);
+		printf("card %9lld -> %9llu (%+.3f%%, %s, %zu bytes)\n", cards[k],
+			(unsigned long long)card, ((double)card-cards[k])*100/cards[k],
+			((struct hllhdr*)o->ptr)->encoding == HLL_DENSE ? "dense" : "sparse",
+			sdslen(o->ptr));
+		decrRefCount(o);
+	}
+	printf("selected kernels: %s\n",hllGetKernels()->name);
+
+	decrRefCount(a);
+	decrRefCount(b);
+	zfree(raw);
+	zfree(max);
+	return 0;
+}
+#endif
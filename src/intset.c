@@ -0,0 +1,440 @@
+/*
+ * Copyright (c) 2009-2012, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "intset.h"
+#include "zmalloc.h"
+#include "endianconv.h"
+
+#if defined(__SSE2__) && (BYTE_ORDER == LITTLE_ENDIAN)
+#include <emmintrin.h>
+#define INTSET_USE_SSE2 1
+#endif
+
+/* Note that these encodings are ordered, so:
+ * INTSET_ENC_INT16 < INTSET_ENC_INT32 < INTSET_ENC_INT64. */
+#define INTSET_ENC_INT16 (sizeof(int16_t))
+#define INTSET_ENC_INT32 (sizeof(int32_t))
+#define INTSET_ENC_INT64 (sizeof(int64_t))
+
+/* 二分查找的区间缩小到这个字节数之后，改用SIMD顺序比较剩下的元素 */
+#define INTSET_SIMD_WINDOW_BYTES 64
+
+/* Return the required encoding for the provided value. */
+static uint8_t _intsetValueEncoding(int64_t v) {
+	if (v < INT32_MIN || v > INT32_MAX)
+		return INTSET_ENC_INT64;
+	else if (v < INT16_MIN || v > INT16_MAX)
+		return INTSET_ENC_INT32;
+	else
+		return INTSET_ENC_INT16;
+}
+
+/* Return the value at pos, given an encoding. */
+static int64_t _intsetGetEncoded(intset *is, int pos, uint8_t enc) {
+	int64_t v64;
+	int32_t v32;
+	int16_t v16;
+
+	if (enc == INTSET_ENC_INT64) {
+		memcpy(&v64,((int64_t*)is->contents)+pos,sizeof(v64));
+		memrev64ifbe(&v64);
+		return v64;
+	} else if (enc == INTSET_ENC_INT32) {
+		memcpy(&v32,((int32_t*)is->contents)+pos,sizeof(v32));
+		memrev32ifbe(&v32);
+		return v32;
+	} else {
+		memcpy(&v16,((int16_t*)is->contents)+pos,sizeof(v16));
+		memrev16ifbe(&v16);
+		return v16;
+	}
+}
+
+/* Return the value at pos, using the configured encoding. */
+static int64_t _intsetGet(intset *is, int pos) {
+	return _intsetGetEncoded(is,pos,intrev32ifbe(is->encoding));
+}
+
+/* Set the value at pos, using the configured encoding. */
+static void _intsetSet(intset *is, int pos, int64_t value) {
+	uint32_t encoding = intrev32ifbe(is->encoding);
+
+	if (encoding == INTSET_ENC_INT64) {
+		((int64_t*)is->contents)[pos] = value;
+		memrev64ifbe(((int64_t*)is->contents)+pos);
+	} else if (encoding == INTSET_ENC_INT32) {
+		((int32_t*)is->contents)[pos] = value;
+		memrev32ifbe(((int32_t*)is->contents)+pos);
+	} else {
+		((int16_t*)is->contents)[pos] = value;
+		memrev16ifbe(((int16_t*)is->contents)+pos);
+	}
+}
+
+/* Create an empty intset. */
+intset *intsetNew(void) {
+	intset *is = zmalloc(sizeof(intset));
+	is->encoding = intrev32ifbe(INTSET_ENC_INT16);
+	is->length = 0;
+	return is;
+}
+
+/* Resize the intset */
+static intset *intsetResize(intset *is, uint32_t len) {
+	uint64_t size = (uint64_t)len*intrev32ifbe(is->encoding);
+	is = zrealloc(is,sizeof(intset)+size);
+	return is;
+}
+
+/* Search for the position of "value". Return 1 when the value was found and
+ * sets "pos" to the position of the value within the intset. Return 0 when
+ * the value is not present in the intset and sets "pos" to the position
+ * where "value" can be inserted. */
+static uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos) {
+	int min = 0, max = intrev32ifbe(is->length)-1, mid = -1;
+	int64_t cur = -1;
+
+	/* The value can never be found when the set is empty */
+	if (intrev32ifbe(is->length) == 0) {
+		if (pos) *pos = 0;
+		return 0;
+	} else {
+		/* Check for the case where we know we cannot find the value,
+		 * but do know the insert position. */
+		if (value > _intsetGet(is,max)) {
+			if (pos) *pos = intrev32ifbe(is->length);
+			return 0;
+		} else if (value < _intsetGet(is,0)) {
+			if (pos) *pos = 0;
+			return 0;
+		}
+	}
+
+	while(max >= min) {
+		mid = ((unsigned int)min + (unsigned int)max) >> 1;
+		cur = _intsetGet(is,mid);
+		if (value > cur) {
+			min = mid+1;
+		} else if (value < cur) {
+			max = mid-1;
+		} else {
+			break;
+		}
+	}
+
+	if (value == cur) {
+		if (pos) *pos = mid;
+		return 1;
+	} else {
+		if (pos) *pos = min;
+		return 0;
+	}
+}
+
+#ifdef INTSET_USE_SSE2
+/*
+ * 在[from,to)区间内用SSE2一次比较16字节，返回是否存在value
+ * 区间的元素个数不一定是16字节的整数倍，剩余的元素逐个比较
+ */
+static uint8_t intsetScanSSE2(intset *is, uint32_t from, uint32_t to,
+		int64_t value, uint8_t enc)
+{
+	const char *base = (const char*)is->contents;
+	uint32_t per = 16/enc, i = from;
+	__m128i needle, cmp;
+
+	if (enc == INTSET_ENC_INT16) needle = _mm_set1_epi16((int16_t)value);
+	else if (enc == INTSET_ENC_INT32) needle = _mm_set1_epi32((int32_t)value);
+	else needle = _mm_set1_epi64x(value);
+
+	for (; i+per <= to; i += per) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(base+(size_t)i*enc));
+
+		if (enc == INTSET_ENC_INT16) {
+			cmp = _mm_cmpeq_epi16(v,needle);
+		} else {
+			cmp = _mm_cmpeq_epi32(v,needle);
+			if (enc == INTSET_ENC_INT64) {
+				/* SSE2没有64位比较，高低两个32位都相等才算相等 */
+				cmp = _mm_and_si128(cmp,
+						_mm_shuffle_epi32(cmp,_MM_SHUFFLE(2,3,0,1)));
+			}
+		}
+		if (_mm_movemask_epi8(cmp)) return 1;
+	}
+	for (; i < to; i++)
+		if (_intsetGetEncoded(is,i,enc) == value) return 1;
+	return 0;
+}
+#endif
+
+/*
+ * 只判断value是否存在，不需要插入位置
+ * 先用二分查找把区间缩小到INTSET_SIMD_WINDOW_BYTES，再用SIMD比较整个区间，
+ * 最后几轮分支预测失败率最高的二分查找被一次顺序比较代替
+ */
+static uint8_t intsetSearchMember(intset *is, int64_t value) {
+#ifdef INTSET_USE_SSE2
+	uint8_t enc = intrev32ifbe(is->encoding);
+	uint32_t min = 0, max = intrev32ifbe(is->length);
+	uint32_t window = INTSET_SIMD_WINDOW_BYTES/enc;
+
+	/* 在[min,max)中查找 */
+	while (max-min > window) {
+		uint32_t mid = min+((max-min)>>1);
+		int64_t cur = _intsetGetEncoded(is,mid,enc);
+
+		if (value < cur) max = mid;
+		else if (value > cur) min = mid+1;
+		else return 1;
+	}
+	return intsetScanSSE2(is,min,max,value,enc);
+#else
+	return intsetSearch(is,value,NULL);
+#endif
+}
+
+/* Upgrades the intset to a larger encoding and inserts the given integer. */
+static intset *intsetUpgradeAndAdd(intset *is, int64_t value) {
+	uint8_t curenc = intrev32ifbe(is->encoding);
+	uint8_t newenc = _intsetValueEncoding(value);
+	int length = intrev32ifbe(is->length);
+	int prepend = value < 0 ? 1 : 0;
+
+	/* First set new encoding and resize */
+	is->encoding = intrev32ifbe(newenc);
+	is = intsetResize(is,intrev32ifbe(is->length)+1);
+
+	/* Upgrade back-to-front so we don't overwrite values.
+	 * Note that the "prepend" variable is used to make sure we have an empty
+	 * space at either the beginning or the end of the intset. */
+	while(length--)
+		_intsetSet(is,length+prepend,_intsetGetEncoded(is,length,curenc));
+
+	/* Set the value at the beginning or the end. */
+	if (prepend)
+		_intsetSet(is,0,value);
+	else
+		_intsetSet(is,intrev32ifbe(is->length),value);
+	is->length = intrev32ifbe(intrev32ifbe(is->length)+1);
+	return is;
+}
+
+static void intsetMoveTail(intset *is, uint32_t from, uint32_t to) {
+	void *src, *dst;
+	uint32_t bytes = intrev32ifbe(is->length)-from;
+	uint32_t encoding = intrev32ifbe(is->encoding);
+
+	if (encoding == INTSET_ENC_INT64) {
+		src = (int64_t*)is->contents+from;
+		dst = (int64_t*)is->contents+to;
+		bytes *= sizeof(int64_t);
+	} else if (encoding == INTSET_ENC_INT32) {
+		src = (int32_t*)is->contents+from;
+		dst = (int32_t*)is->contents+to;
+		bytes *= sizeof(int32_t);
+	} else {
+		src = (int16_t*)is->contents+from;
+		dst = (int16_t*)is->contents+to;
+		bytes *= sizeof(int16_t);
+	}
+	memmove(dst,src,bytes);
+}
+
+/* Insert an integer in the intset */
+intset *intsetAdd(intset *is, int64_t value, uint8_t *success) {
+	uint8_t valenc = _intsetValueEncoding(value);
+	uint32_t pos;
+	if (success) *success = 1;
+
+	/* Upgrade encoding if necessary. If we need to upgrade, we know that
+	 * this value should be either appended (if > 0) or prepended (if < 0),
+	 * because it lies outside the range of existing values. */
+	if (valenc > intrev32ifbe(is->encoding)) {
+		/* This always succeeds, so we don't need to curry *success. */
+		return intsetUpgradeAndAdd(is,value);
+	} else {
+		/* Abort if the value is already present in the set.
+		 * This call will populate "pos" with the right position to insert
+		 * the value when it cannot be found. */
+		if (intsetSearch(is,value,&pos)) {
+			if (success) *success = 0;
+			return is;
+		}
+
+		is = intsetResize(is,intrev32ifbe(is->length)+1);
+		if (pos < intrev32ifbe(is->length)) intsetMoveTail(is,pos,pos+1);
+	}
+
+	_intsetSet(is,pos,value);
+	is->length = intrev32ifbe(intrev32ifbe(is->length)+1);
+	return is;
+}
+
+/* Delete integer from intset */
+intset *intsetRemove(intset *is, int64_t value, int *success) {
+	uint8_t valenc = _intsetValueEncoding(value);
+	uint32_t pos;
+	if (success) *success = 0;
+
+	if (valenc <= intrev32ifbe(is->encoding) && intsetSearch(is,value,&pos)) {
+		uint32_t len = intrev32ifbe(is->length);
+
+		/* We know we can delete */
+		if (success) *success = 1;
+
+		/* Overwrite value with tail and update length */
+		if (pos < (len-1)) intsetMoveTail(is,pos+1,pos);
+		is = intsetResize(is,len-1);
+		is->length = intrev32ifbe(len-1);
+	}
+	return is;
+}
+
+/* Determine whether a value belongs to this set */
+uint8_t intsetFind(intset *is, int64_t value) {
+	uint8_t valenc = _intsetValueEncoding(value);
+	return valenc <= intrev32ifbe(is->encoding) && intsetSearchMember(is,value);
+}
+
+/* Return random member */
+int64_t intsetRandom(intset *is) {
+	uint32_t len = intrev32ifbe(is->length);
+	return _intsetGet(is,rand()%len);
+}
+
+/* Get the value at the given position. When this position is
+ * out of range the function returns 0, when in range it returns 1. */
+uint8_t intsetGet(intset *is, uint32_t pos, int64_t *value) {
+	if (pos < intrev32ifbe(is->length)) {
+		*value = _intsetGet(is,pos);
+		return 1;
+	}
+	return 0;
+}
+
+/* Return intset length */
+uint32_t intsetLen(const intset *is) {
+	return intrev32ifbe(is->length);
+}
+
+/* Return intset blob size in bytes. */
+size_t intsetBlobLen(intset *is) {
+	return sizeof(intset)+(size_t)intrev32ifbe(is->length)*intrev32ifbe(is->encoding);
+}
+
+/* Validate the integrity of the data structure.
+ * Returns 1 if the intset is valid, 0 otherwise. */
+/*
+ * 检查从RDB文件中读取的整数集合：编码合法，长度和大小一致，元素严格递增
+ */
+int intsetValidateIntegrity(const unsigned char *p, size_t size) {
+	intset *is = (intset *)p;
+	uint32_t encoding, count, i;
+	size_t records_size;
+	int64_t prev;
+
+	/* check that we can actually read the header. */
+	if (size < sizeof(*is)) return 0;
+
+	encoding = intrev32ifbe(is->encoding);
+	if (encoding != INTSET_ENC_INT64 && encoding != INTSET_ENC_INT32 &&
+		encoding != INTSET_ENC_INT16) return 0;
+
+	/* check that the size matches (all records are inside the buffer). */
+	count = intrev32ifbe(is->length);
+	records_size = (size_t)encoding*count;
+	if (sizeof(*is) + records_size != size) return 0;
+
+	/* check that the set is not empty. */
+	if (count == 0) return 0;
+
+	/* check that the set is sorted and unique. */
+	prev = _intsetGet(is,0);
+	for (i = 1; i < count; i++) {
+		int64_t cur = _intsetGet(is,i);
+		if (cur <= prev) return 0;
+		prev = cur;
+	}
+	return 1;
+}
+
+#ifdef INTSET_BENCHMARK_MAIN
+#include <sys/time.h>
+
+static long long usec(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+/*
+ * gcc -O2 -DINTSET_BENCHMARK_MAIN intset.c zmalloc.c endianconv.c
+ * 比较纯二分查找和SIMD辅助查找的成员测试速度
+ */
+int main(void) {
+	int sizes[] = {16, 128, 512, 4096};
+	int64_t bases[] = {0, 100000, 10000000000LL};
+	const int lookups = 10000000;
+	unsigned int i, j, k;
+
+	for (k = 0; k < sizeof(bases)/sizeof(bases[0]); k++) {
+		for (j = 0; j < sizeof(sizes)/sizeof(sizes[0]); j++) {
+			intset *is = intsetNew();
+			long long start, found = 0;
+			int n = sizes[j];
+
+			/* 偶数入集合，查找时一半命中一半不命中 */
+			for (i = 0; i < (unsigned)n; i++)
+				is = intsetAdd(is,bases[k]+i*2,NULL);
+
+			start = usec();
+			for (i = 0; i < (unsigned)lookups; i++)
+				found += intsetSearch(is,bases[k]+(i*7919)%(n*2),NULL);
+			long long bin = usec()-start;
+
+			start = usec();
+			for (i = 0; i < (unsigned)lookups; i++)
+				found -= intsetFind(is,bases[k]+(i*7919)%(n*2));
+			long long simd = usec()-start;
+
+			printf("enc=%u len=%d binary: %.2f ns/op, find: %.2f ns/op%s\n",
+					intrev32ifbe(is->encoding),n,
+					(double)bin*1000/lookups,(double)simd*1000/lookups,
+					found ? " MISMATCH" : "");
+			zfree(is);
+		}
+	}
+	return 0;
+}
+#endif
@@ -0,0 +1,251 @@
+#include "server.h"
+#include "zmalloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*-----------------------------------------------------------------------------
+ * List API
+ * 列表对象都使用快速列表编码
+ *----------------------------------------------------------------------------*/
+
+/* The function pushes an element to the specified list object 'subject',
+ * at head or tail position as specified by 'where'.
+ *
+ * There is no need for the caller to increment the refcount of 'value' as
+ * the function takes care of it if needed. */
+/*
+ * 把value加入列表的头部或尾部，value的内容被拷贝到快速列表中
+ */
+void listTypePush(robj *subject, robj *value, int where) {
+	if (subject->encoding == OBJ_ENCODING_QUICKLIST) {
+		int pos = (where == LIST_HEAD) ? QUICKLIST_HEAD : QUICKLIST_TAIL;
+		value = getDecodedObject(value);
+		size_t len = sdslen(value->ptr);
+		quicklistPush(subject->ptr, value->ptr, len, pos);
+		decrRefCount(value);
+	} else {
+		printf("Unknown list encoding\n");
+		exit(1);
+	}
+}
+
+/* 弹出的元素直接创建成字符串对象，避免再拷贝一次 */
+static void *listPopSaver(unsigned char *data, size_t sz) {
+	return createStringObject((char*)data,sz);
+}
+
+robj *listTypePop(robj *subject, int where) {
+	long long vlong;
+	robj *value = NULL;
+
+	int ql_where = where == LIST_HEAD ? QUICKLIST_HEAD : QUICKLIST_TAIL;
+	if (subject->encoding == OBJ_ENCODING_QUICKLIST) {
+		if (quicklistPopCustom(subject->ptr, ql_where, (unsigned char **)&value,
+							   NULL, &vlong, listPopSaver)) {
+			if (!value)
+				value = createStringObjectFromLongLong(vlong);
+		}
+	} else {
+		printf("Unknown list encoding\n");
+		exit(1);
+	}
+	return value;
+}
+
+unsigned long listTypeLength(const robj *subject) {
+	if (subject->encoding == OBJ_ENCODING_QUICKLIST) {
+		return quicklistCount(subject->ptr);
+	} else {
+		printf("Unknown list encoding\n");
+		exit(1);
+	}
+}
+
+/* 把快速列表迭代器当前位置的元素作为bulk回复 */
+static void addReplyQuicklistEntry(client *c, quicklistEntry *entry) {
+	if (entry->value) {
+		addReplyBulkCBuffer(c,entry->value,entry->sz);
+	} else {
+		addReplyBulkLongLong(c,entry->longval);
+	}
+}
+
+/*-----------------------------------------------------------------------------
+ * List Commands
+ *----------------------------------------------------------------------------*/
+
+void pushGenericCommand(client *c, int where) {
+	int j, pushed = 0;
+	robj *lobj = lookupKey(c->db,c->argv[1]);
+
+	if (lobj && lobj->type != OBJ_LIST) {
+		addReply(c,shared.wrongtypeerr);
+		return;
+	}
+
+	for (j = 2; j < c->argc; j++) {
+		if (!lobj) {
+			lobj = createQuicklistObject();
+			quicklistSetOptions(lobj->ptr, server.list_max_ziplist_size,
+								server.list_compress_depth);
+			dbAdd(c->db,c->argv[1],lobj);
+		}
+		listTypePush(lobj,c->argv[j],where);
+		pushed++;
+	}
+	addReplyLongLong(c, (lobj ? listTypeLength(lobj) : 0));
+	server.dirty += pushed;
+}
+
+/* LPUSH key value [value ...] */
+void lpushCommand(client *c) {
+	pushGenericCommand(c,LIST_HEAD);
+}
+
+/* RPUSH key value [value ...] */
+void rpushCommand(client *c) {
+	pushGenericCommand(c,LIST_TAIL);
+}
+
+/* LLEN key */
+void llenCommand(client *c) {
+	robj *o = lookupKeyReadOrReply(c,c->argv[1],shared.czero);
+	if (o == NULL || checkType(c,o,OBJ_LIST)) return;
+	addReplyLongLong(c,listTypeLength(o));
+}
+
+/* LINDEX key index */
+void lindexCommand(client *c) {
+	robj *o = lookupKeyReadOrReply(c,c->argv[1],shared.nullbulk);
+	quicklistEntry entry;
+	quicklistIter *iter;
+	long index;
+
+	if (o == NULL || checkType(c,o,OBJ_LIST)) return;
+	if ((getLongFromObjectOrReply(c, c->argv[2], &index, NULL) != C_OK))
+		return;
+
+	iter = quicklistGetIteratorAtIdx(o->ptr, AL_START_TAIL, index);
+	if (quicklistNext(iter, &entry)) {
+		addReplyQuicklistEntry(c,&entry);
+	} else {
+		addReply(c,shared.nullbulk);
+	}
+	quicklistReleaseIterator(iter);
+}
+
+void popGenericCommand(client *c, int where) {
+	robj *o = lookupKeyWriteOrReply(c,c->argv[1],shared.nullbulk);
+	robj *value;
+
+	if (o == NULL || checkType(c,o,OBJ_LIST)) return;
+
+	value = listTypePop(o,where);
+	if (value == NULL) {
+		addReply(c,shared.nullbulk);
+	} else {
+		addReplyBulk(c,value);
+		decrRefCount(value);
+		// 列表为空时删除这个键
+		if (listTypeLength(o) == 0) dbDelete(c->db,c->argv[1]);
+		server.dirty++;
+	}
+}
+
+/* LPOP key */
+void lpopCommand(client *c) {
+	popGenericCommand(c,LIST_HEAD);
+}
+
+/* RPOP key */
+void rpopCommand(client *c) {
+	popGenericCommand(c,LIST_TAIL);
+}
+
+/* LRANGE key start stop */
+void lrangeCommand(client *c) {
+	robj *o;
+	long start, end, llen, rangelen;
+
+	if ((getLongFromObjectOrReply(c, c->argv[2], &start, NULL) != C_OK) ||
+		(getLongFromObjectOrReply(c, c->argv[3], &end, NULL) != C_OK)) return;
+
+	if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.emptymultibulk)) == NULL
+		 || checkType(c,o,OBJ_LIST)) return;
+	llen = listTypeLength(o);
+
+	/* convert negative indexes */
+	if (start < 0) start = llen+start;
+	if (end < 0) end = llen+end;
+	if (start < 0) start = 0;
+
+	/* Invariant: start >= 0, so this test will be true when end < 0.
+	 * The range is empty when start > end or start >= length. */
+	if (start > end || start >= llen) {
+		addReply(c,shared.emptymultibulk);
+		return;
+	}
+	if (end >= llen) end = llen-1;
+	rangelen = (end-start)+1;
+
+	/* Return the result in form of a multi-bulk reply */
+	addReplyMultiBulkLen(c,rangelen);
+	if (o->encoding == OBJ_ENCODING_QUICKLIST) {
+		/* 从离start较近的一端定位，之后顺序遍历，压缩节点只在经过时解压一次 */
+		quicklistIter *iter = quicklistGetIteratorAtIdx(o->ptr,
+				AL_START_HEAD, start);
+		quicklistEntry entry;
+
+		while(rangelen--) {
+			quicklistNext(iter, &entry);
+			addReplyQuicklistEntry(c,&entry);
+		}
+		quicklistReleaseIterator(iter);
+	} else {
+		printf("List encoding is not QUICKLIST!\n");
+		exit(1);
+	}
+}
+
+/* LTRIM key start stop */
+void ltrimCommand(client *c) {
+	robj *o;
+	long start, end, llen, ltrim, rtrim;
+
+	if ((getLongFromObjectOrReply(c, c->argv[2], &start, NULL) != C_OK) ||
+		(getLongFromObjectOrReply(c, c->argv[3], &end, NULL) != C_OK)) return;
+
+	if ((o = lookupKeyWriteOrReply(c,c->argv[1],shared.ok)) == NULL ||
+		checkType(c,o,OBJ_LIST)) return;
+	llen = listTypeLength(o);
+
+	/* convert negative indexes */
+	if (start < 0) start = llen+start;
+	if (end < 0) end = llen+end;
+	if (start < 0) start = 0;
+
+	/* Invariant: start >= 0, so this test will be true when end < 0.
+	 * The range is empty when start > end or start >= length. */
+	if (start > end || start >= llen) {
+		/* Out of range start or start > end result in empty list */
+		ltrim = llen;
+		rtrim = 0;
+	} else {
+		if (end >= llen) end = llen-1;
+		ltrim = start;
+		rtrim = llen-end-1;
+	}
+
+	/* Remove list elements to perform the trim */
+	if (o->encoding == OBJ_ENCODING_QUICKLIST) {
+		quicklistDelRange(o->ptr,0,ltrim);
+		quicklistDelRange(o->ptr,-rtrim,rtrim);
+	} else {
+		printf("Unknown list encoding\n");
+		exit(1);
+	}
+
+	if (listTypeLength(o) == 0) dbDelete(c->db,c->argv[1]);
+	server.dirty += (ltrim + rtrim);
+	addReply(c,shared.ok);
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2000-2010 Marc Alexander Lehmann <schmorp@schmorp.de>
+ *
+ * Redistribution and use in source and binary forms, with or without modifica-
+ * tion, are permitted provided that the following conditions are met:
+ *
+ *   1.  Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *
+ *   2.  Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MER-
+ * CHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPE-
+ * CIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTH-
+ * ERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lzfP.h"
+
+#define HSIZE (1 << (HLOG))
+
+/*
+ * don't play with this unless you benchmark!
+ * the data format is not dependent on the hash function.
+ * the hash function might seem strange, just believe me,
+ * it works ;)
+ */
+#define FRST(p) (((p[0]) << 8) | p[1])
+#define NEXT(v,p) (((v) << 8) | p[2])
+#define IDX(h) ((( h >> (3*8 - HLOG)) - h  ) & (HSIZE - 1))
+
+#define        MAX_LIT        (1 <<  5)
+#define        MAX_OFF        (1 << 13)
+#define        MAX_REF        ((1 << 8) + (1 << 3))
+
+/*
+ * compressed format
+ *
+ * 000LLLLL <L+1>    ; literal, L+1=1..33 octets
+ * LLLooooo oooooooo ; backref L+1=1..7 octets, o+1=1..4096 offset
+ * 111ooooo LLLLLLLL oooooooo ; backref L+8 octets, o+1=1..4096 offset
+ *
+ */
+
+unsigned int
+lzf_compress (const void *const in_data, unsigned int in_len,
+              void *out_data, unsigned int out_len)
+{
+  LZF_STATE htab;
+  const u8 *ip = (const u8 *)in_data;
+        u8 *op = (u8 *)out_data;
+  const u8 *in_end  = ip + in_len;
+        u8 *out_end = op + out_len;
+  const u8 *ref;
+
+  unsigned long off;
+  unsigned int hval;
+  int lit;
+
+  if (!in_len || !out_len)
+    return 0;
+
+  memset (htab, 0, sizeof (htab));
+
+  lit = 0; op++; /* start run */
+
+  if (in_len > 2)
+    {
+      hval = FRST (ip);
+      while (ip < in_end - 2)
+        {
+          LZF_HSLOT *hslot;
+
+          hval = NEXT (hval, ip);
+          hslot = htab + IDX (hval);
+          ref = (const u8 *)in_data + *hslot;
+          *hslot = ip - (const u8 *)in_data;
+
+          if (1
+              && (off = ip - ref - 1) < MAX_OFF
+              && ref > (const u8 *)in_data
+              && ref[2] == ip[2]
+              && ((ref[1] << 8) | ref[0]) == ((ip[1] << 8) | ip[0])
+            )
+            {
+              /* match found at *ref++ */
+              unsigned int len = 2;
+              unsigned int maxlen = in_end - ip - len;
+              maxlen = maxlen > MAX_REF ? MAX_REF : maxlen;
+
+              if (expect_false (op + 3 + 1 >= out_end)) /* first a faster conservative test */
+                if (op - !lit + 3 + 1 >= out_end) /* second the exact but rare test */
+                  return 0;
+
+              op [- lit - 1] = lit - 1; /* stop run */
+              op -= !lit; /* undo run if length is zero */
+
+              do
+                len++;
+              while (len < maxlen && ref[len] == ip[len]);
+
+              len -= 2; /* len is now #octets - 1 */
+              ip++;
+
+              if (len < 7)
+                {
+                  *op++ = (off >> 8) + (len << 5);
+                }
+              else
+                {
+                  *op++ = (off >> 8) + (  7 << 5);
+                  *op++ = len - 7;
+                }
+
+              *op++ = off;
+
+              lit = 0; op++; /* start run */
+
+              ip += len + 1;
+
+              if (expect_false (ip >= in_end - 2))
+                break;
+
+              /* 把匹配串末尾的两个位置也加入哈希表 */
+              --ip;
+              --ip;
+              hval = FRST (ip);
+
+              hval = NEXT (hval, ip);
+              htab[IDX (hval)] = ip - (const u8 *)in_data;
+              ip++;
+
+              hval = NEXT (hval, ip);
+              htab[IDX (hval)] = ip - (const u8 *)in_data;
+              ip++;
+            }
+          else
+            {
+              /* one more literal byte we must copy */
+              if (expect_false (op >= out_end))
+                return 0;
+
+              lit++; *op++ = *ip++;
+
+              if (expect_false (lit == MAX_LIT))
+                {
+                  op [- lit - 1] = lit - 1; /* stop run */
+                  lit = 0; op++; /* start run */
+                }
+            }
+        }
+    }
+
+  if (op + 3 > out_end) /* at most 3 bytes can be missing here */
+    return 0;
+
+  while (ip < in_end)
+    {
+      lit++; *op++ = *ip++;
+
+      if (expect_false (lit == MAX_LIT))
+        {
+          op [- lit - 1] = lit - 1; /* stop run */
+          lit = 0; op++; /* start run */
+        }
+    }
+
+  op [- lit - 1] = lit - 1; /* end run */
+  op -= !lit; /* undo run if length is zero */
+
+  return op - (u8 *)out_data;
+}
@@ -33,17 +33,34 @@
 #include "zmalloc.h"
 #include <unistd.h>
 #include <sys/uio.h>
+#include <sys/socket.h>
 #include <math.h>
 #include <ctype.h>
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#ifdef HAVE_MSG_ZEROCOPY
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#endif
 
 extern struct redisServer server;
 void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask);
 void decrRefCountVoid(void *o);
 
 static void setProtocolError(const char *errstr, client *c, int pos);
+static void pauseClientReads(client *c);
+static void resumeClientReads(client *c);
+static void queueClientPendingRead(client *c);
+
+/*
+ * 共享的读缓冲区，没有未处理数据的客户端读取时使用它，
+ * 整个请求在一次read中读完的常见情况下客户端不需要自己的查询缓冲区
+ */
+static __thread sds thread_shared_qb = NULL;
+static void asyncCloseClientOnOutputBufferLimitReached(client *c);
 
 /* Return the size consumed from the allocator, for the specified SDS string,
  * including internal fragmentation. This function is used in order to compute
@@ -65,11 +82,24 @@ size_t getStringObjectSdsUsedMemory(robj *o) {
 
 /* Client.reply list dup and free methods. */
 void *dupClientReplyValue(void *o) {
-	return sdsdup(o);
+	clientReplyBlock *old = o;
+	size_t datalen = old->obj ? 0 : old->size;
+	clientReplyBlock *buf = zmalloc(sizeof(clientReplyBlock) + datalen);
+	memcpy(buf, o, sizeof(clientReplyBlock) + datalen);
+	if (buf->obj) incrRefCount(buf->obj);
+	return buf;
 }
 
 void freeClientReplyValue(void *o) {
-	sdsfree(o);
+	clientReplyBlock *blk = o;
+
+	if (blk->obj) decrRefCount(blk->obj);
+	zfree(o);
+}
+
+/* 块中待发送的数据，引用对象的块指向对象的sds */
+static inline char *replyBlockData(clientReplyBlock *o) {
+	return o->obj ? o->obj->ptr : o->buf;
 }
 
 /*
@@ -84,10 +114,13 @@ client *createClient(int fd) {
 	 * in the context of a client. When commands are executed in other
 	 * contexts (for instance a Lua script) we need a non connected client. */
 	if (fd != -1) {
-		anetNonBlock(NULL,fd);
+		/* anetTcpAccept()返回的fd已经是非阻塞的，
+		 * Linux上TCP选项从监听socket继承，见listenToPort() */
+#ifndef HAVE_ACCEPT_INHERIT_SOCKOPT
 		anetEnableTcpNoDelay(NULL,fd);
 		if (server.tcpkeepalive)
 			anetKeepAlive(NULL,fd,server.tcpkeepalive);
+#endif
 		// 注册readQueryFromClient回调函数
 		if (aeCreateFileEvent(server.el,fd,AE_READABLE,
 					readQueryFromClient, c) == AE_ERR)
@@ -99,32 +132,511 @@ client *createClient(int fd) {
 	}
 
 	c->fd = fd;
+	c->flags = 0;
+	c->db = server.db; // 默认使用0号数据库
+	c->dictid = 0;
 	c->name = NULL;
 	c->bufpos = 0;
-	c->querybuf = sdsempty();
+	c->querybuf = NULL; // 第一次读取时使用共享读缓冲区
 	c->querybuf_peak = 0;
 	c->reqtype = 0;
 	c->argc = 0;
+	c->argv_len = 0;
 	c->argv = NULL;
 	c->cmd = c->lastcmd = NULL;
 	c->multibulklen = 0;
 	c->bulklen = -1;
 	c->reply = listCreate();
 	c->reply_bytes = 0;
+	c->obuf_soft_limit_reached_time = 0;
+	c->sentlen = 0;
+	c->woff = 0;
+	c->ctime = c->lastinteraction = server.unixtime;
+	c->zc_pending = NULL;
+	c->zc_next_id = c->zc_completed = 0;
 	listSetFreeMethod(c->reply,freeClientReplyValue);
 	listSetDupMethod(c->reply,dupClientReplyValue);
-	if (fd != -1) listAddNodeTail(server.clients,c); // 添加成功创建的客户端对象到服务器
+	c->client_list_node = NULL;
+	if (fd != -1) {
+		listAddNodeTail(server.clients,c); // 添加成功创建的客户端对象到服务器
+		c->client_list_node = listLast(server.clients);
+	}
 	return c;
 }
 
+/* This function is called every time we are going to transmit new data
+ * to the client. The behavior is the following:
+ *
+ * If the client should receive new data (normal clients will) the function
+ * returns C_OK, and make sure to install the write handler in our event
+ * loop so that when the socket is writable new data gets written.
+ *
+ * If the client should not receive new data, because it is a fake client
+ * (used to load AOF in memory), a master or because the setup of the write
+ * handler failed, the function returns C_ERR.
+ *
+ * The function may return C_OK without actually installing the write
+ * event handler in the following cases:
+ *
+ * 1) The event handler should already be installed since the output buffer
+ *    already contains something.
+ * 2) The client is a slave but not yet online, so we want to just accumulate
+ *    writes in the buffer but not actually sending them yet.
+ *
+ * Typically gets called every time a reply is built, before adding more
+ * data to the clients output buffers. If the function returns C_ERR no
+ * data should be appended to the output buffers. */
+/*
+ * 准备向客户端写入回复，返回C_ERR表示不需要回复（比如加载AOF的伪客户端）
+ * 客户端被放入clients_pending_write，在beforeSleep中统一发送
+ */
+int prepareClientToWrite(client *c) {
+	if (c->fd <= 0) return C_ERR; /* Fake client for AOF loading. */
+
+	/* 即将关闭的客户端不再接收新的回复 */
+	if (c->flags & (CLIENT_CLOSE_AFTER_REPLY|CLIENT_CLOSE_ASAP)) return C_ERR;
+
+	/* Schedule the client to write the output buffers to the socket only
+	 * if not already done (there were no pending writes already and the client
+	 * was yet not flagged). */
+	if (!clientHasPendingReplies(c) && !(c->flags & CLIENT_PENDING_WRITE)) {
+		/* Here instead of installing the write handler, we just flag the
+		 * client and put it into a list of clients that have something
+		 * to write to the socket. This way before re-entering the event
+		 * loop, we can try to directly write to the client sockets avoiding
+		 * a system call. We'll only really install the write handler if
+		 * we'll not be able to write the whole reply at once. */
+		c->flags |= CLIENT_PENDING_WRITE;
+		listAddNodeHead(server.clients_pending_write,c);
+	}
+
+	/* Authorize the caller to queue in the output buffer of this client. */
+	return C_OK;
+}
+
+/* -----------------------------------------------------------------------------
+ * Low level functions to add more data to output buffers.
+ * 把回复写入固定缓冲区或者回复链表
+ * -------------------------------------------------------------------------- */
+
+int _addReplyToBuffer(client *c, const char *s, size_t len) {
+	size_t available = sizeof(c->buf)-c->bufpos;
+
+	/* If there already are entries in the reply list, we cannot
+	 * add anything more to the static buffer. */
+	if (listLength(c->reply) > 0) return C_ERR;
+
+	/* Check that the buffer has enough space available for this string. */
+	if (len > available) return C_ERR;
+
+	memcpy(c->buf+c->bufpos,s,len);
+	c->bufpos+=len;
+	return C_OK;
+}
+
+/*
+ * 先填满尾部块的剩余空间，剩下的部分放进一个新块，
+ * 新块至少PROTO_REPLY_CHUNK_BYTES，大回复则按实际长度分配
+ */
+void _addReplyStringToList(client *c, const char *s, size_t len) {
+	listNode *ln = listLast(c->reply);
+	clientReplyBlock *tail = ln ? listNodeValue(ln) : NULL;
+
+	if (tail && !tail->obj) {
+		/* Copy the part we can fit into the tail, and leave the rest for a
+		 * new node */
+		size_t avail = tail->size - tail->used;
+		size_t copy = avail >= len ? len : avail;
+		memcpy(tail->buf + tail->used, s, copy);
+		tail->used += copy;
+		s += copy;
+		len -= copy;
+	}
+	if (len) {
+		/* Create a new node, make sure it is allocated to at
+		 * least PROTO_REPLY_CHUNK_BYTES */
+		size_t size = len < PROTO_REPLY_CHUNK_BYTES ? PROTO_REPLY_CHUNK_BYTES : len;
+		tail = zmalloc(size + sizeof(clientReplyBlock));
+		tail->size = size;
+		tail->used = len;
+		tail->obj = NULL;
+		memcpy(tail->buf, s, len);
+		listAddNodeTail(c->reply, tail);
+		c->reply_bytes += tail->size;
+	}
+	asyncCloseClientOnOutputBufferLimitReached(c);
+}
+
+/* -----------------------------------------------------------------------------
+ * Higher level functions to queue data on the client output buffer.
+ * The following functions are the ones that commands implementations will call.
+ * -------------------------------------------------------------------------- */
+
+/*
+ * 在回复链表中添加一个引用obj的块，发送时直接写出obj的sds，不拷贝
+ * obj的引用计数加1，修改字符串的命令看到引用计数大于1时会先复制一份（dbUnshareStringValue）
+ */
+static void _addReplyObjectToList(client *c, robj *obj) {
+	clientReplyBlock *blk = zmalloc(sizeof(clientReplyBlock));
+
+	blk->size = blk->used = sdslen(obj->ptr);
+	blk->obj = obj;
+	incrRefCount(obj);
+	listAddNodeTail(c->reply,blk);
+	c->reply_bytes += blk->size;
+	server.stat_reply_obj_refs++;
+	asyncCloseClientOnOutputBufferLimitReached(c);
+}
+
+void addReply(client *c, robj *obj) {
+	if (prepareClientToWrite(c) != C_OK) return;
+
+	if (obj->encoding == OBJ_ENCODING_RAW && server.reply_ref_threshold &&
+		sdslen(obj->ptr) >= server.reply_ref_threshold)
+	{
+		_addReplyObjectToList(c,obj);
+	} else if (sdsEncodedObject(obj)) {
+		if (_addReplyToBuffer(c,obj->ptr,sdslen(obj->ptr)) != C_OK)
+			_addReplyStringToList(c,obj->ptr,sdslen(obj->ptr));
+	} else if (obj->encoding == OBJ_ENCODING_INT) {
+		/* For integer encoded strings we just convert it into a string
+		 * using our optimized function, and attach the resulting string
+		 * to the output buffer. */
+		char buf[32];
+		size_t len = ll2string(buf,sizeof(buf),(long)obj->ptr);
+		if (_addReplyToBuffer(c,buf,len) != C_OK)
+			_addReplyStringToList(c,buf,len);
+	} else {
+		printf("Wrong obj->encoding in addReply()\n");
+		exit(1);
+	}
+}
+
+void addReplySds(client *c, sds s) {
+	if (prepareClientToWrite(c) != C_OK) {
+		/* The caller expects the sds to be free'd. */
+		sdsfree(s);
+		return;
+	}
+	if (_addReplyToBuffer(c,s,sdslen(s)) != C_OK)
+		_addReplyStringToList(c,s,sdslen(s));
+	sdsfree(s);
+}
+
+/*
+ * 添加一段已经格式化好的协议，接管s的所有权
+ * 用于MGET这类预先计算好总长度、一次生成整个回复的命令，
+ * 整段回复只做一次拷贝，不再逐个元素调用addReply
+ */
+void addReplyProtoSds(client *c, sds s) {
+	size_t len = sdslen(s);
+
+	if (prepareClientToWrite(c) != C_OK) {
+		sdsfree(s);
+		return;
+	}
+	if (_addReplyToBuffer(c,s,len) != C_OK)
+		_addReplyStringToList(c,s,len);
+	sdsfree(s);
+}
+
+/* This low level function just adds whatever protocol you send it to the
+ * client buffer, trying the static buffer initially, and using the string
+ * of objects if not possible. */
+void addReplyString(client *c, const char *s, size_t len) {
+	if (prepareClientToWrite(c) != C_OK) return;
+	if (_addReplyToBuffer(c,s,len) != C_OK)
+		_addReplyStringToList(c,s,len);
+}
+
+void addReplyErrorLength(client *c, const char *s, size_t len) {
+	addReplyString(c,"-ERR ",5);
+	addReplyString(c,s,len);
+	addReplyString(c,"\r\n",2);
+}
+
+void addReplyError(client *c, const char *err) {
+	addReplyErrorLength(c,err,strlen(err));
+}
+
+void addReplyErrorFormat(client *c, const char *fmt, ...) {
+	size_t l, j;
+	va_list ap;
+	va_start(ap,fmt);
+	sds s = sdscatvprintf(sdsempty(),fmt,ap);
+	va_end(ap);
+	/* Make sure there are no newlines in the string, otherwise invalid protocol
+	 * is emitted. */
+	l = sdslen(s);
+	for (j = 0; j < l; j++) {
+		if (s[j] == '\r' || s[j] == '\n') s[j] = ' ';
+	}
+	addReplyErrorLength(c,s,sdslen(s));
+	sdsfree(s);
+}
+
+void addReplyStatusLength(client *c, const char *s, size_t len) {
+	addReplyString(c,"+",1);
+	addReplyString(c,s,len);
+	addReplyString(c,"\r\n",2);
+}
+
+void addReplyStatus(client *c, const char *status) {
+	addReplyStatusLength(c,status,strlen(status));
+}
+
+/* Add a long long as integer reply or bulk len / multi bulk count.
+ * Basically this is used to output <prefix><long long><crlf>. */
+void addReplyLongLongWithPrefix(client *c, long long ll, char prefix) {
+	char buf[128];
+	int len;
+
+	/* Things like $3\r\n or *2\r\n are emitted very often by the protocol
+	 * so we have a few shared objects to use if the integer is small
+	 * like it is most of the times. */
+	if (prefix == '*' && ll < OBJ_SHARED_BULKHDR_LEN && ll >= 0) {
+		addReply(c,shared.mbulkhdr[ll]);
+		return;
+	} else if (prefix == '$' && ll < OBJ_SHARED_BULKHDR_LEN && ll >= 0) {
+		addReply(c,shared.bulkhdr[ll]);
+		return;
+	}
+
+	buf[0] = prefix;
+	len = ll2string(buf+1,sizeof(buf)-1,ll);
+	buf[len+1] = '\r';
+	buf[len+2] = '\n';
+	addReplyString(c,buf,len+3);
+}
+
+void addReplyLongLong(client *c, long long ll) {
+	if (ll == 0)
+		addReply(c,shared.czero);
+	else if (ll == 1)
+		addReply(c,shared.cone);
+	else
+		addReplyLongLongWithPrefix(c,ll,':');
+}
+
+void addReplyMultiBulkLen(client *c, long length) {
+	if (length < OBJ_SHARED_BULKHDR_LEN)
+		addReply(c,shared.mbulkhdr[length]);
+	else
+		addReplyLongLongWithPrefix(c,length,'*');
+}
+
+/* Create the length prefix of a bulk reply, example: $2234 */
+void addReplyBulkLen(client *c, robj *obj) {
+	size_t len = stringObjectLen(obj);
+
+	if (len < OBJ_SHARED_BULKHDR_LEN)
+		addReply(c,shared.bulkhdr[len]);
+	else
+		addReplyLongLongWithPrefix(c,len,'$');
+}
+
+/* Add a Redis Object as a bulk reply */
+void addReplyBulk(client *c, robj *obj) {
+	addReplyBulkLen(c,obj);
+	addReply(c,obj);
+	addReply(c,shared.crlf);
+}
+
+/* Add a C buffer as bulk reply */
+void addReplyBulkCBuffer(client *c, const void *p, size_t len) {
+	addReplyLongLongWithPrefix(c,len,'$');
+	addReplyString(c,p,len);
+	addReply(c,shared.crlf);
+}
+
+/* Add sds to reply (takes ownership of sds and frees it) */
+void addReplyBulkSds(client *c, sds s)  {
+	addReplyLongLongWithPrefix(c,sdslen(s),'$');
+	addReplySds(c,s);
+	addReply(c,shared.crlf);
+}
+
+/* Add a C null term string as bulk reply */
+void addReplyBulkCString(client *c, const char *s) {
+	if (s == NULL) {
+		addReply(c,shared.nullbulk);
+	} else {
+		addReplyBulkCBuffer(c,s,strlen(s));
+	}
+}
+
+/* Add a double as a bulk reply */
+void addReplyDouble(client *c, double d) {
+	char dbuf[MAX_D2STRING_CHARS];
+	int dlen;
+
+	if (isinf(d)) {
+		/* Libc in odd systems (Hi Solaris!) will format infinite in a
+		 * different way, so better to handle it in an explicit way. */
+		addReplyBulkCString(c, d > 0 ? "inf" : "-inf");
+	} else {
+		dlen = d2string(dbuf,sizeof(dbuf),d);
+		addReplyBulkCBuffer(c,dbuf,dlen);
+	}
+}
+
+/* Add a long long as a bulk reply */
+void addReplyBulkLongLong(client *c, long long ll) {
+	char buf[64];
+	int len;
+
+	len = ll2string(buf,64,ll);
+	addReplyBulkCBuffer(c,buf,len);
+}
+
+/* Return true if the specified client has pending reply buffers to write to
+ * the socket. */
+int clientHasPendingReplies(client *c) {
+	return c->bufpos || listLength(c->reply);
+}
+
+/* 输出缓冲区占用的内存：所有块的分配大小加上链表节点和块头 */
+unsigned long getClientOutputBufferMemoryUsage(client *c) {
+	unsigned long list_item_size = sizeof(listNode) + sizeof(clientReplyBlock);
+	return c->reply_bytes + (list_item_size*listLength(c->reply));
+}
+
+/* Get the class of a client, used in order to enforce limits to different
+ * classes of clients.
+ *
+ * The function will return one of the following:
+ * CLIENT_TYPE_NORMAL -> Normal client
+ * CLIENT_TYPE_SLAVE  -> Slave or client executing MONITOR command
+ * CLIENT_TYPE_PUBSUB -> Client subscribed to Pub/Sub channels
+ * CLIENT_TYPE_MASTER -> The client representing our replication master.
+ */
+int getClientType(client *c) {
+	if (c->flags & CLIENT_MASTER) return CLIENT_TYPE_MASTER;
+	if ((c->flags & CLIENT_SLAVE) && !(c->flags & CLIENT_MONITOR))
+		return CLIENT_TYPE_SLAVE;
+	if (c->flags & CLIENT_PUBSUB) return CLIENT_TYPE_PUBSUB;
+	return CLIENT_TYPE_NORMAL;
+}
+
+int getClientTypeByName(char *name) {
+	if (!strcasecmp(name,"normal")) return CLIENT_TYPE_NORMAL;
+	else if (!strcasecmp(name,"slave")) return CLIENT_TYPE_SLAVE;
+	else if (!strcasecmp(name,"pubsub")) return CLIENT_TYPE_PUBSUB;
+	else if (!strcasecmp(name,"master")) return CLIENT_TYPE_MASTER;
+	else return -1;
+}
+
+char *getClientTypeName(int class) {
+	switch(class) {
+		case CLIENT_TYPE_NORMAL: return "normal";
+		case CLIENT_TYPE_SLAVE:  return "slave";
+		case CLIENT_TYPE_PUBSUB: return "pubsub";
+		case CLIENT_TYPE_MASTER: return "master";
+		default:                 return NULL;
+	}
+}
+
+/* The function checks if the client reached output buffer soft or hard
+ * limit, and also update the state needed to check the soft limit as
+ * a side effect.
+ *
+ * Return value: non-zero if the client reached the soft or the hard limit.
+ *               Otherwise zero is returned. */
+static int checkClientOutputBufferLimits(client *c) {
+	int soft = 0, hard = 0, class;
+	unsigned long used_mem = getClientOutputBufferMemoryUsage(c);
+
+	class = getClientType(c);
+	/* For the purpose of output buffer limiting, masters are handled
+	 * like normal clients. */
+	if (class == CLIENT_TYPE_MASTER) class = CLIENT_TYPE_NORMAL;
+
+	if (server.client_obuf_limits[class].hard_limit_bytes &&
+		used_mem >= server.client_obuf_limits[class].hard_limit_bytes)
+		hard = 1;
+	if (server.client_obuf_limits[class].soft_limit_bytes &&
+		used_mem >= server.client_obuf_limits[class].soft_limit_bytes)
+		soft = 1;
+
+	/* We need to check if the soft limit is reached continuously for the
+	 * specified amount of seconds. */
+	if (soft) {
+		if (c->obuf_soft_limit_reached_time == 0) {
+			c->obuf_soft_limit_reached_time = server.unixtime;
+			soft = 0; /* First time we see the soft limit reached */
+		} else {
+			time_t elapsed = server.unixtime - c->obuf_soft_limit_reached_time;
+
+			if (elapsed <=
+				server.client_obuf_limits[class].soft_limit_seconds) {
+				soft = 0; /* The client still did not reached the max number of
+							 seconds for the soft limit to be considered
+							 reached. */
+			}
+		}
+	} else {
+		c->obuf_soft_limit_reached_time = 0;
+	}
+	return soft || hard;
+}
+
+/* Asynchronously close a client if soft or hard limit is reached on the
+ * output buffer size. The caller can check if the client will be closed
+ * checking if the client CLIENT_CLOSE_ASAP flag is set.
+ *
+ * Note: we need to close the client asynchronously because this function is
+ * called from contexts where the client can't be freed safely, i.e. from the
+ * lower level functions pushing data inside the client output buffers. */
+/*
+ * 回复堆积超过限制的慢客户端会被异步关闭，释放已经堆积的回复
+ */
+static void asyncCloseClientOnOutputBufferLimitReached(client *c) {
+	if (c->fd == -1) return;
+	if (c->reply_bytes == 0 || c->flags & CLIENT_CLOSE_ASAP) return;
+	if (checkClientOutputBufferLimits(c)) {
+		freeClientAsync(c);
+		printf("Client fd=%d scheduled to be closed ASAP for overcoming of "
+			"output buffer limits (%s class, %lu bytes).\n",
+			c->fd, getClientTypeName(getClientType(c)),
+			getClientOutputBufferMemoryUsage(c));
+	}
+}
+
 #define MAX_ACCEPTS_PER_CALL 1000
 static void acceptCommonHandler(int fd, int flags, char *ip) {
 	client *c;
+	UNUSED(ip);
+
+	/* 连接数达到maxclients时直接写回预先构造好的错误并关闭，
+	 * 不创建客户端对象，重连风暴时拒绝一个连接的代价只有write+close */
+	if (listLength(server.clients) >= server.maxclients) {
+		static const char err[] = "-ERR max number of clients reached\r\n";
+
+		/* That's a best effort error message, don't check write errors */
+		if (write(fd,err,sizeof(err)-1) == -1) {
+			/* Nothing to do, Just to avoid the warning... */
+		}
+		server.stat_rejected_conn++;
+		close(fd);
+		return;
+	}
+
 	// 创建一个客户端
 	if ((c = createClient(fd)) == NULL) {
 		close(fd); /* May be already closed, just ignore errors */
 		return;
 	}
+	server.stat_numconnections++;
+	c->flags |= flags;
+
+	/* Unix socket不支持MSG_ZEROCOPY */
+	if (server.reply_zerocopy && server.reply_ref_threshold &&
+		!(c->flags & CLIENT_UNIX_SOCKET) &&
+		anetEnableZeroCopy(NULL,fd) == ANET_OK)
+	{
+		c->flags |= CLIENT_ZEROCOPY;
+		c->zc_pending = listCreate();
+	}
 }
 
 /*
@@ -147,6 +659,467 @@ void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
 	}
 }
 
+/*
+ * 接收Unix域套接字上的新连接
+ */
+void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+	int cfd, max = MAX_ACCEPTS_PER_CALL;
+	UNUSED(el);
+	UNUSED(mask);
+	UNUSED(privdata);
+
+	while(max--) {
+		cfd = anetUnixAccept(server.neterr, fd);
+		if (cfd == ANET_ERR) {
+			return;
+		}
+		acceptCommonHandler(cfd,CLIENT_UNIX_SOCKET,NULL);
+	}
+}
+
+/* 释放命令参数，argv数组本身留给下一条命令使用 */
+static void freeClientArgv(client *c) {
+	int j;
+
+	for (j = 0; j < c->argc; j++)
+		decrRefCount(c->argv[j]);
+	c->argc = 0;
+	c->cmd = NULL;
+}
+
+/* This function is called when we want to remove the client from the
+ * server data structures: it closes the socket, removes the I/O handlers
+ * and the references of the client from the lists where active clients
+ * may be referenced. */
+static void unlinkClient(client *c) {
+	listNode *ln;
+
+	/* Certain operations must be done only if the client has an active socket.
+	 * If the client was already unlinked or if it's a "fake client" the
+	 * fd is already set to -1. */
+	if (c->fd != -1) {
+		/* Remove from the list of active clients. */
+		if (c->client_list_node) {
+			listDelNode(server.clients,c->client_list_node);
+			c->client_list_node = NULL;
+		}
+
+		/* Unregister async I/O handlers and close the socket. */
+		aeDeleteFileEvent(server.el,c->fd,AE_READABLE);
+		aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
+		close(c->fd);
+		c->fd = -1;
+	}
+
+	/* Remove from the list of pending writes if needed. */
+	if (c->flags & CLIENT_PENDING_WRITE) {
+		ln = listSearchKey(server.clients_pending_write,c);
+		if (ln) listDelNode(server.clients_pending_write,ln);
+		c->flags &= ~CLIENT_PENDING_WRITE;
+	}
+
+	if (c->flags & CLIENT_PENDING_READ) {
+		ln = listSearchKey(server.clients_pending_read,c);
+		if (ln) listDelNode(server.clients_pending_read,ln);
+		c->flags &= ~CLIENT_PENDING_READ;
+	}
+}
+
+/*
+ * 关闭连接并释放客户端
+ * 调用之后c不能再使用，正在处理这个客户端的函数不能直接调用，
+ * 应该使用freeClientAsync()
+ */
+void freeClient(client *c) {
+	listNode *ln;
+
+	/* Free the query buffer */
+	if (c->querybuf != thread_shared_qb) sdsfree(c->querybuf);
+	c->querybuf = NULL;
+
+	/* Free data structures. */
+	listRelease(c->reply);
+	freeClientArgv(c);
+	if (c->zc_pending) {
+		/* 先收一次完成通知，关闭之后内核可能还没有发送完剩下的部分 */
+		clientReapZeroCopy(c);
+		while (listLength(c->zc_pending)) {
+			zeroCopyRef *ref = listNodeValue(listFirst(c->zc_pending));
+			decrRefCount(ref->obj);
+			zfree(ref);
+			listDelNode(c->zc_pending,listFirst(c->zc_pending));
+		}
+		listRelease(c->zc_pending);
+	}
+
+	unlinkClient(c);
+
+	/* If this client was scheduled for async freeing we need to remove it
+	 * from the queue. */
+	if (c->flags & CLIENT_CLOSE_ASAP) {
+		ln = listSearchKey(server.clients_to_close,c);
+		if (ln) listDelNode(server.clients_to_close,ln);
+	}
+
+	/* Release other dynamically allocated client structure fields,
+	 * and finally release the client structure itself. */
+	if (c->name) decrRefCount(c->name);
+	zfree(c->argv);
+	zfree(c);
+}
+
+/* Schedule a client to free it at a safe time in the beforeSleep() function.
+ * This function is useful when we need to terminate a client but we are in
+ * a context where calling freeClient() is not possible, because the client
+ * should be valid for the continuation of the flow of the program. */
+void freeClientAsync(client *c) {
+	if (c->flags & CLIENT_CLOSE_ASAP) return;
+	c->flags |= CLIENT_CLOSE_ASAP;
+	listAddNodeTail(server.clients_to_close,c);
+}
+
+/* 在beforeSleep中调用，集中释放freeClientAsync()标记的客户端 */
+void freeClientsInAsyncFreeQueue(void) {
+	while (listLength(server.clients_to_close)) {
+		listNode *ln = listFirst(server.clients_to_close);
+		client *c = listNodeValue(ln);
+
+		c->flags &= ~CLIENT_CLOSE_ASAP;
+		listDelNode(server.clients_to_close,ln);
+		freeClient(c);
+	}
+}
+
+/*
+ * 从输出缓冲区的头部去掉已经写出的n个字节，先是固定缓冲区，然后是回复链表中的块
+ * 写完的块被释放，引用对象的块同时释放对象的引用；n为0时只去掉头部的空块
+ */
+static void clientReplyConsume(client *c, size_t n) {
+	if (c->bufpos > 0) {
+		size_t avail = c->bufpos - c->sentlen;
+
+		if (n < avail) {
+			c->sentlen += n;
+			return;
+		}
+		n -= avail;
+		c->bufpos = 0;
+		c->sentlen = 0;
+	}
+	while (listLength(c->reply)) {
+		clientReplyBlock *o = listNodeValue(listFirst(c->reply));
+		size_t avail = o->used - c->sentlen;
+
+		if (n < avail) {
+			c->sentlen += n;
+			return;
+		}
+		n -= avail;
+		c->reply_bytes -= o->size;
+		listDelNode(c->reply,listFirst(c->reply));
+		c->sentlen = 0;
+	}
+}
+
+/*
+ * 用一次writev写出固定缓冲区和回复链表中的多个块，引用对象的块直接指向对象的数据
+ * 开启了MSG_ZEROCOPY的客户端遇到引用对象的块时停下，由clientSendZeroCopy()发送
+ */
+static ssize_t writevToClient(client *c) {
+	struct iovec iov[NET_MAX_WRITEV_IOV];
+	int iovcnt = 0;
+	size_t iov_bytes = 0, offset;
+	listIter li;
+	listNode *ln;
+	ssize_t nwritten;
+
+	if (c->bufpos > 0) {
+		iov[iovcnt].iov_base = c->buf + c->sentlen;
+		iov[iovcnt].iov_len = c->bufpos - c->sentlen;
+		iov_bytes += iov[iovcnt++].iov_len;
+	}
+	offset = c->bufpos > 0 ? 0 : c->sentlen;
+	listRewind(c->reply,&li);
+	while ((ln = listNext(&li)) != NULL && iovcnt < NET_MAX_WRITEV_IOV &&
+			iov_bytes < NET_MAX_WRITES_PER_EVENT)
+	{
+		clientReplyBlock *o = listNodeValue(ln);
+
+		if (o->obj && (c->flags & CLIENT_ZEROCOPY)) break;
+		if (o->used == offset) {
+			offset = 0;
+			continue;
+		}
+		iov[iovcnt].iov_base = replyBlockData(o) + offset;
+		iov[iovcnt].iov_len = o->used - offset;
+		iov_bytes += iov[iovcnt++].iov_len;
+		offset = 0;
+	}
+	if (iovcnt == 0) {
+		clientReplyConsume(c,0);
+		return 0;
+	}
+
+	nwritten = writev(c->fd,iov,iovcnt);
+	if (nwritten > 0) clientReplyConsume(c,nwritten);
+	return nwritten;
+}
+
+/*
+ * 收取内核的MSG_ZEROCOPY完成通知，释放已经发送完成的值
+ * 完成通知以[lo,hi]序号区间的形式放在socket的错误队列中，TCP按发送顺序完成
+ */
+void clientReapZeroCopy(client *c) {
+#ifdef HAVE_MSG_ZEROCOPY
+	char control[128];
+	struct msghdr msg;
+	struct cmsghdr *cm;
+
+	if (c->fd == -1 || c->zc_pending == NULL || !listLength(c->zc_pending))
+		return;
+	while (1) {
+		memset(&msg,0,sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(c->fd,&msg,MSG_ERRQUEUE|MSG_DONTWAIT) == -1) break;
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg,cm)) {
+			struct sock_extended_err *serr;
+
+			if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+				(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+				continue;
+			serr = (struct sock_extended_err *) CMSG_DATA(cm);
+			if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			c->zc_completed = serr->ee_data + 1;
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				server.stat_zerocopy_copied += serr->ee_data - serr->ee_info + 1;
+		}
+	}
+
+	while (listLength(c->zc_pending)) {
+		zeroCopyRef *ref = listNodeValue(listFirst(c->zc_pending));
+
+		if ((int32_t)(ref->id - c->zc_completed) >= 0) break;
+		decrRefCount(ref->obj);
+		zfree(ref);
+		listDelNode(c->zc_pending,listFirst(c->zc_pending));
+	}
+#else
+	UNUSED(c);
+#endif
+}
+
+/*
+ * 用MSG_ZEROCOPY发送头部引用对象的块，内核直接从对象的内存发送数据，
+ * 块发送完之后对象的引用转到zc_pending，收到完成通知后才释放
+ */
+static ssize_t clientSendZeroCopy(client *c, clientReplyBlock *o) {
+#ifdef HAVE_MSG_ZEROCOPY
+	struct iovec iov;
+	struct msghdr msg;
+	ssize_t nwritten;
+
+	iov.iov_base = (char*)o->obj->ptr + c->sentlen;
+	iov.iov_len = o->used - c->sentlen;
+	memset(&msg,0,sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	nwritten = sendmsg(c->fd,&msg,MSG_ZEROCOPY);
+	if (nwritten == -1 && errno == ENOBUFS) {
+		/* 超过了可以锁定的内存，这次普通发送 */
+		nwritten = write(c->fd,iov.iov_base,iov.iov_len);
+		if (nwritten > 0) clientReplyConsume(c,nwritten);
+		return nwritten;
+	}
+	if (nwritten <= 0) return nwritten;
+
+	/* 每次成功的MSG_ZEROCOPY发送占用一个序号 */
+	c->zc_next_id++;
+	server.stat_zerocopy_sends++;
+	c->sentlen += nwritten;
+	if (c->sentlen == o->used) {
+		zeroCopyRef *ref = zmalloc(sizeof(*ref));
+
+		ref->obj = o->obj;
+		ref->id = c->zc_next_id - 1;
+		o->obj = NULL;
+		listAddNodeTail(c->zc_pending,ref);
+		c->reply_bytes -= o->size;
+		listDelNode(c->reply,listFirst(c->reply));
+		c->sentlen = 0;
+	}
+	return nwritten;
+#else
+	UNUSED(c);
+	UNUSED(o);
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
+/* Write data in output buffers to client. Return C_OK if the client
+ * is still valid after the call, C_ERR if it was freed. */
+/*
+ * 把客户端的输出缓冲区写入套接字
+ */
+int writeToClient(int fd, client *c, int handler_installed) {
+	ssize_t nwritten = 0, totwritten = 0;
+	clientReplyBlock *o;
+	UNUSED(fd);
+
+	if (c->flags & CLIENT_ZEROCOPY) clientReapZeroCopy(c);
+	while(clientHasPendingReplies(c)) {
+		o = c->bufpos == 0 ? listNodeValue(listFirst(c->reply)) : NULL;
+		if (o && o->obj && (c->flags & CLIENT_ZEROCOPY))
+			nwritten = clientSendZeroCopy(c,o);
+		else
+			nwritten = writevToClient(c);
+		if (nwritten < 0) break;
+		/* 只有空块时writevToClient()返回0并去掉它们 */
+		if (nwritten == 0 && clientHasPendingReplies(c)) break;
+		totwritten += nwritten;
+
+		/* Note that we avoid to send more than NET_MAX_WRITES_PER_EVENT
+		 * bytes, in a single threaded server it's a good idea to serve
+		 * other clients as well, even if a very large request comes from
+		 * super fast link that is always able to accept data (in real world
+		 * scenario think about 'KEYS *' against the loopback interface). */
+		if (totwritten > NET_MAX_WRITES_PER_EVENT) break;
+	}
+	server.stat_net_output_bytes += totwritten;
+	if (totwritten > 0) c->lastinteraction = server.unixtime;
+	if (nwritten == -1) {
+		if (errno == EAGAIN) {
+			nwritten = 0;
+		} else {
+			freeClient(c);
+			return C_ERR;
+		}
+	}
+	if ((c->flags & CLIENT_READ_PAUSED) &&
+		getClientOutputBufferMemoryUsage(c) <= server.client_read_pause_low)
+	{
+		resumeClientReads(c);
+	}
+	if (!clientHasPendingReplies(c)) {
+		c->sentlen = 0;
+		if (handler_installed) aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
+
+		/* Close connection after entire reply has been sent. */
+		if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
+			freeClient(c);
+			return C_ERR;
+		}
+	}
+	return C_OK;
+}
+
+/*
+ * 待发送的回复超过client_read_pause_high时移除读事件，请求留在查询缓冲区里，
+ * 客户端继续发送的数据积压在内核的接收缓冲区，最终由TCP流量控制让客户端停下来
+ */
+static void pauseClientReads(client *c) {
+	aeDeleteFileEvent(server.el,c->fd,AE_READABLE);
+	c->flags |= CLIENT_READ_PAUSED;
+	server.stat_client_read_pauses++;
+}
+
+/*
+ * 重新注册读事件
+ * 暂停读取或者在clients_pending_read中排队的客户端都没有读事件
+ */
+static int rearmClientReads(client *c) {
+	if (aeCreateFileEvent(server.el,c->fd,AE_READABLE,
+				readQueryFromClient,c) == AE_ERR)
+	{
+		freeClientAsync(c);
+		return C_ERR;
+	}
+	return C_OK;
+}
+
+/*
+ * 回复发送到client_read_pause_low以下时恢复读取，
+ * 查询缓冲区里剩下的请求不会再触发读事件，先放入clients_pending_read由beforeSleep处理，
+ * 处理完之后再注册读事件
+ */
+static void resumeClientReads(client *c) {
+	c->flags &= ~CLIENT_READ_PAUSED;
+	if (c->querybuf && sdslen(c->querybuf))
+		queueClientPendingRead(c);
+	else
+		rearmClientReads(c);
+}
+
+/*
+ * 客户端还有没处理完的请求，放到clients_pending_read尾部，等beforeSleep轮到它时再处理
+ * 排队期间不读取新的数据，避免大量管道请求的客户端在查询缓冲区里越积越多
+ */
+static void queueClientPendingRead(client *c) {
+	if (c->flags & CLIENT_PENDING_READ) return;
+	aeDeleteFileEvent(server.el,c->fd,AE_READABLE);
+	c->flags |= CLIENT_PENDING_READ;
+	listAddNodeTail(server.clients_pending_read,c);
+}
+
+/* Write event handler. Just send data to the client. */
+void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
+	client *c = privdata;
+	UNUSED(el);
+	UNUSED(mask);
+
+	/* 回复依赖的写命令还没有同步到磁盘，移除写事件，等同步完成后由beforeSleep发送 */
+	if (aofClientMustWaitFsync(c)) {
+		aeDeleteFileEvent(server.el,fd,AE_WRITABLE);
+		if (!(c->flags & CLIENT_PENDING_WRITE)) {
+			c->flags |= CLIENT_PENDING_WRITE;
+			listAddNodeHead(server.clients_pending_write,c);
+		}
+		return;
+	}
+	writeToClient(fd,privdata,1);
+}
+
+/* This function is called just before entering the event loop, in the hope
+ * we can just write the replies to the client output buffer without any
+ * need to use a syscall in order to install the writable event handler,
+ * get it called, and so forth. */
+/*
+ * 在beforeSleep中调用，直接向客户端写入回复，写不完再注册写事件
+ * appendfsync always模式下，写命令还没有持久化的客户端留在链表中等待下一轮
+ */
+int handleClientsWithPendingWrites(void) {
+	listIter li;
+	listNode *ln;
+	int processed = 0;
+
+	listRewind(server.clients_pending_write,&li);
+	while((ln = listNext(&li))) {
+		client *c = listNodeValue(ln);
+
+		if (aofClientMustWaitFsync(c)) continue;
+		c->flags &= ~CLIENT_PENDING_WRITE;
+		listDelNode(server.clients_pending_write,ln);
+		processed++;
+
+		/* Try to write buffers to the client socket. */
+		if (writeToClient(c->fd,c,0) == C_ERR) continue;
+
+		/* If after the synchronous writes above we still have data to
+		 * output to the client, we need to install the writable handler. */
+		if (clientHasPendingReplies(c)) {
+			if (aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
+						sendReplyToClient, c) == AE_ERR)
+			{
+				freeClientAsync(c);
+			}
+		}
+	}
+	return processed;
+}
+
 int processInlineBuffer(client *c) {
 	char *newline;
 	int argc, j;
@@ -158,6 +1131,9 @@ int processInlineBuffer(client *c) {
 
 	/* 如果没有\r\n，什么都不做 */
 	if (newline == NULL) {
+		if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+			setProtocolError("too big inline request",c,0);
+		}
 		return C_ERR;
 	}
 
@@ -171,6 +1147,7 @@ int processInlineBuffer(client *c) {
 	argv = sdssplitargs(aux,&argc);
 	sdsfree(aux);
 	if (argv == NULL) {
+		setProtocolError("unbalanced quotes in request",c,0);
 		return C_ERR;
 	}
 
@@ -178,9 +1155,10 @@ int processInlineBuffer(client *c) {
 	sdsrange(c->querybuf,querylen+2,-1);
 
 	/* 把参数数组添加到客户端结构体 */
-	if (argc) {
-		if (c->argv) zfree(c->argv);
-		c->argv = zmalloc(sizeof(robj*)*argc);
+	if (argc > c->argv_len) {
+		zfree(c->argv);
+		c->argv_len = argc;
+		c->argv = zmalloc(sizeof(robj*)*c->argv_len);
 	}
 
 	/* 为所有参数创建redis对象 */
@@ -205,6 +1183,9 @@ int processMultibulkBuffer(client *c) {
 		/* Multi bulk length cannot be read without a \r\n */
 		newline = strchr(c->querybuf,'\r');
 		if (newline == NULL) {
+			if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+				setProtocolError("too big mbulk count string",c,0);
+			}
 			return C_ERR;
 		}
 
@@ -216,6 +1197,7 @@ int processMultibulkBuffer(client *c) {
 		 * so go ahead and find out the multi bulk length. */
 		ok = string2ll(c->querybuf+1,newline-(c->querybuf+1),&ll);
 		if (!ok || ll > 1024*1024) {
+			setProtocolError("invalid multibulk length",c,pos);
 			return C_ERR;
 		}
 
@@ -227,9 +1209,13 @@ int processMultibulkBuffer(client *c) {
 
 		c->multibulklen = ll;
 
-		/* Setup argv array on client structure */
-		if (c->argv) zfree(c->argv);
-		c->argv = zmalloc(sizeof(robj*)*c->multibulklen);
+		/* Setup argv array on client structure, reusing the one of the
+		 * previous command when it is large enough. */
+		if (c->multibulklen > c->argv_len) {
+			zfree(c->argv);
+			c->argv_len = c->multibulklen;
+			c->argv = zmalloc(sizeof(robj*)*c->argv_len);
+		}
 	}
 
 	while(c->multibulklen) {
@@ -238,6 +1224,7 @@ int processMultibulkBuffer(client *c) {
 			newline = strchr(c->querybuf+pos,'\r');
 			if (newline == NULL) {
 				if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+					setProtocolError("too big bulk count string",c,0);
 					return C_ERR;
 				}
 				break;
@@ -248,11 +1235,13 @@ int processMultibulkBuffer(client *c) {
 				break;
 
 			if (c->querybuf[pos] != '$') {
+				setProtocolError("expected '$'",c,pos);
 				return C_ERR;
 			}
 
 			ok = string2ll(c->querybuf+pos+1,newline-(c->querybuf+pos+1),&ll);
 			if (!ok || ll < 0 || ll > 512*1024*1024) {
+				setProtocolError("invalid bulk length",c,pos);
 				return C_ERR;
 			}
 
@@ -266,6 +1255,12 @@ int processMultibulkBuffer(client *c) {
 				 * avoiding a large copy of data. */
 				sdsrange(c->querybuf,pos,-1);
 				pos = 0;
+				/* 共享缓冲区不能交给参数对象，大参数改用客户端自己的缓冲区 */
+				if (c->querybuf == thread_shared_qb) {
+					c->querybuf = sdsnewlen(thread_shared_qb,
+						sdslen(thread_shared_qb));
+					sdsclear(thread_shared_qb);
+				}
 				qblen = sdslen(c->querybuf);
 				/* Hint the sds library about the amount of bytes this string is
 				 * going to contain. */
@@ -285,14 +1280,14 @@ int processMultibulkBuffer(client *c) {
 			 * just use the current sds string. */
 			if (pos == 0 &&
 					c->bulklen >= PROTO_MBULK_BIG_ARG &&
-					(signed) sdslen(c->querybuf) == c->bulklen+2)
+					(signed) sdslen(c->querybuf) == c->bulklen+2 &&
+					c->querybuf != thread_shared_qb)
 			{
 				c->argv[c->argc++] = createObject(OBJ_STRING,c->querybuf);
 				sdsIncrLen(c->querybuf,-2); /* remove CRLF */
-				/* Assume that if we saw a fat argument we'll see another one
-				 * likely... */
-				c->querybuf = sdsnewlen(NULL,c->bulklen+2);
-				sdsclear(c->querybuf);
+				/* 下一个大参数到来时会按长度重新分配，这里不再预留空间，
+				 * 处理完之后空的缓冲区会被释放 */
+				c->querybuf = sdsempty();
 				pos = 0;
 			} else {
 				c->argv[c->argc++] =
@@ -314,13 +1309,75 @@ int processMultibulkBuffer(client *c) {
 	return C_ERR;
 }
 
+/* Helper function. Reply with the protocol error, trim the query buffer
+ * and set the client as CLIENT_CLOSE_AFTER_REPLY. */
+static void setProtocolError(const char *errstr, client *c, int pos) {
+	addReplyErrorFormat(c,"Protocol error: %s",errstr);
+	c->flags |= CLIENT_CLOSE_AFTER_REPLY;
+	sdsrange(c->querybuf,pos,-1);
+}
+
 /* resetClient prepare the client to process the next command */
 void resetClient(client *c) {
+	freeClientArgv(c);
+	/* 一次性的大命令用过的argv数组不再保留 */
+	if (c->argv_len > PROTO_ARGV_REUSE_MAX) {
+		zfree(c->argv);
+		c->argv = NULL;
+		c->argv_len = 0;
+	}
+	// 重置请求解析状态，准备解析下一条命令
+	c->reqtype = 0;
+	c->multibulklen = 0;
+	c->bulklen = -1;
+}
+
+/*
+ * 替换当前命令的第i个参数，用于在传播到AOF之前改写命令，比如INCRBYFLOAT改写成SET
+ * 替换第0个参数时同时更新c->cmd
+ */
+void rewriteClientCommandArgument(client *c, int i, robj *newval) {
+	robj *oldval = c->argv[i];
+
+	c->argv[i] = newval;
+	incrRefCount(newval);
+	decrRefCount(oldval);
+
+	if (i == 0) {
+		c->cmd = lookupCommand(c->argv[0]->ptr);
+		if (c->cmd == NULL) {
+			printf("Command rewritten to an unknown command\n");
+			exit(1);
+		}
+	}
 }
 
+/*
+ * 每次最多执行client_cmds_per_event条命令，超过之后客户端到clients_pending_read排队，
+ * 一个客户端的大量管道请求不会让同一轮事件中的其他客户端等待
+ */
 void processInputBuffer(client *c) {
+	int budget = server.client_cmds_per_event;
+
 	/* 如果querybuf不为空，一直处理 */
-	while(sdslen(c->querybuf)) {
+	while(c->querybuf && sdslen(c->querybuf)) {
+		/* 协议错误或者即将关闭的客户端不再处理后面的命令 */
+		if (c->flags & (CLIENT_CLOSE_AFTER_REPLY|CLIENT_CLOSE_ASAP)) break;
+
+		/* 客户端没有及时读取回复，剩下的请求等回复发送出去之后再处理 */
+		if (server.client_read_pause_high &&
+			getClientOutputBufferMemoryUsage(c) > server.client_read_pause_high)
+		{
+			if (!(c->flags & CLIENT_READ_PAUSED)) pauseClientReads(c);
+			break;
+		}
+
+		/* 这一轮的命令数用完了 */
+		if (server.client_cmds_per_event && budget == 0) {
+			queueClientPendingRead(c);
+			break;
+		}
+
 		/* 设置请求类型：批量/单个 */
 		if (!c->reqtype) {
 			if (c->querybuf[0] == '*') {
@@ -336,8 +1393,6 @@ void processInputBuffer(client *c) {
 		} else if (c->reqtype == PROTO_REQ_MULTIBULK) {
 			if (processMultibulkBuffer(c) != C_OK) break;
 		}
-		printf("argc : %d\n", c->argc);
-		printf("argv: %s\n", (char *)c->argv[0]->ptr);
 		/* Multibulk processing could see a <= 0 length. */
 		if (c->argc == 0) {
 			resetClient(c);
@@ -346,8 +1401,55 @@ void processInputBuffer(client *c) {
 			if (processCommand(c) == C_OK) {
 				resetClient(c);
 			}
+			budget--;
+		}
+	}
+}
+
+/*
+ * 处理完之后如果还在使用共享缓冲区，把剩下的半个请求拷贝到客户端自己的缓冲区；
+ * 客户端自己的缓冲区已经处理完的话直接释放，空闲的客户端不占用查询缓冲区
+ */
+static void resetQueryBufferAfterRead(client *c) {
+	if (c->querybuf == thread_shared_qb) {
+		size_t remaining = sdslen(thread_shared_qb);
+
+		c->querybuf = remaining ? sdsnewlen(thread_shared_qb,remaining) : NULL;
+		sdsclear(thread_shared_qb);
+	} else if (c->querybuf && sdslen(c->querybuf) == 0) {
+		sdsfree(c->querybuf);
+		c->querybuf = NULL;
+	}
+}
+
+/*
+ * 在beforeSleep中调用，处理clients_pending_read中排队的客户端
+ * 每次只把当前排队的客户端轮一遍，每个客户端执行一轮命令，还有剩余的重新排到队尾，
+ * 中间回到事件循环处理其他客户端的请求。产生的回复由随后的handleClientsWithPendingWrites()发送
+ */
+int handleClientsWithPendingReads(void) {
+	unsigned long pending = listLength(server.clients_pending_read);
+	int processed = 0;
+
+	while (pending--) {
+		listNode *ln = listFirst(server.clients_pending_read);
+		client *c = listNodeValue(ln);
+
+		c->flags &= ~CLIENT_PENDING_READ;
+		listDelNode(server.clients_pending_read,ln);
+		processed++;
+
+		processInputBuffer(c);
+		resetQueryBufferAfterRead(c);
+
+		/* 积压的请求处理完了，重新开始读取 */
+		if (!(c->flags & (CLIENT_PENDING_READ|CLIENT_READ_PAUSED|
+				CLIENT_CLOSE_AFTER_REPLY|CLIENT_CLOSE_ASAP)))
+		{
+			rearmClientReads(c);
 		}
 	}
+	return processed;
 }
 
 void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
@@ -357,25 +1459,220 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
 
 	readlen = PROTO_IOBUF_LEN;
 
+	/* MSG_ZEROCOPY的完成通知以EPOLLERR报告，也会触发读事件 */
+	if (c->flags & CLIENT_ZEROCOPY) clientReapZeroCopy(c);
+
+	/* 没有未处理完的请求，直接读到共享缓冲区里，它始终是空的并且至少有readlen的空间 */
+	if (c->querybuf == NULL) {
+		if (thread_shared_qb == NULL) {
+			thread_shared_qb = sdsnewlen(NULL,PROTO_IOBUF_LEN);
+			sdsclear(thread_shared_qb);
+		}
+		c->querybuf = thread_shared_qb;
+	}
 
 	qblen = sdslen(c->querybuf);
-	if (c->querybuf_peak < qblen) c->querybuf_peak = qblen;
 	c->querybuf = sdsMakeRoomFor(c->querybuf, readlen); // 创建SDS字符串保存客户端的请求
 	nread = read(fd, c->querybuf+qblen, readlen); // 读取请求内容
-	if (nread == -1) {
-		if (errno == EAGAIN) {
-			return;
-		} else {
-			return;
-		}
-	} else if (nread == 0) {
+	if (nread <= 0) {
+		if (c->querybuf == thread_shared_qb) c->querybuf = NULL;
+		if (nread == -1 && errno == EAGAIN) return;
+		/* Read error or client closed connection */
+		freeClient(c);
 		return;
 	}
 
 	sdsIncrLen(c->querybuf,nread);
+	c->lastinteraction = server.unixtime;
+	if (c->querybuf_peak < sdslen(c->querybuf))
+		c->querybuf_peak = sdslen(c->querybuf);
 	/*
 	 * 处理请求
 	 */
 	processInputBuffer(c);
+	resetQueryBufferAfterRead(c);
+}
+
+
+#ifdef NETWORKING_BENCHMARK_MAIN
+/*
+ * 1. 模拟重连风暴：每轮先发起NET_BENCH_BATCH个连接堆在监听队列里，
+ *    再由一次acceptTcpHandler全部接收，统计每个连接的开销和单次处理的最长耗时。
+ *    legacy是accept()+fcntl+setsockopt的旧路径，reject是超过maxclients的拒绝路径
+ * 2. 本机客户端分别通过TCP回环和Unix域套接字逐条发送GET，比较往返时延
+ * make networking-benchmark && ./networking-benchmark
+ */
+#include <pthread.h>
+
+#define NET_BENCH_BATCH 400
+#define NET_BENCH_ROUNDS 50
+#define NET_BENCH_RTT_REQUESTS 100000
+
+/* 旧的接收路径：accept之后每个连接再单独设置非阻塞和TCP选项 */
+static void netBenchLegacyAccept(int lfd) {
+	int cfd;
+
+	while ((cfd = accept(lfd,NULL,NULL)) != -1) {
+		anetNonBlock(NULL,cfd);
+		anetEnableTcpNoDelay(NULL,cfd);
+		if (server.tcpkeepalive)
+			anetKeepAlive(NULL,cfd,server.tcpkeepalive);
+		if (createClient(cfd) == NULL) close(cfd);
+	}
+}
+
+static void netBenchStorm(int lfd, char *ip, int port) {
+	static const char *names[] = {"accept4","legacy","reject"};
+	int cfds[NET_BENCH_BATCH];
+	int mode, round, j;
+
+	for (mode = 0; mode < 3; mode++) {
+		long long total = 0, worst = 0, start, us;
+		long long accepted = 0;
+		long long rejected = server.stat_rejected_conn;
+
+		server.maxclients = mode == 2 ? 0 : NET_BENCH_BATCH;
+		for (round = 0; round < NET_BENCH_ROUNDS; round++) {
+			for (j = 0; j < NET_BENCH_BATCH; j++) {
+				cfds[j] = anetTcpConnect(server.neterr,ip,port);
+				if (cfds[j] == ANET_ERR) {
+					printf("Can't connect: %s\n",server.neterr);
+					exit(1);
+				}
+			}
+
+			/* 计时包含释放客户端，和拒绝路径里的close对应 */
+			start = ustime();
+			if (mode == 1)
+				netBenchLegacyAccept(lfd);
+			else
+				acceptTcpHandler(server.el,lfd,NULL,0);
+			accepted += listLength(server.clients);
+			while (listLength(server.clients))
+				freeClient(listNodeValue(listFirst(server.clients)));
+			us = ustime()-start;
+			total += us;
+			if (us > worst) worst = us;
+
+			for (j = 0; j < NET_BENCH_BATCH; j++) close(cfds[j]);
+		}
+		printf("%-8s %6.2f us/conn  worst batch %6.2f ms  "
+			"%lld accepted  %lld rejected\n",
+			names[mode], (double)total/(NET_BENCH_ROUNDS*NET_BENCH_BATCH),
+			worst/1000.0, accepted, server.stat_rejected_conn-rejected);
+	}
+	server.maxclients = CONFIG_DEFAULT_MAX_CLIENTS;
+}
+
+typedef struct netBenchRtt {
+	int unix_socket;
+	int port;
+	long long *lat;     /* 每个请求的往返时间，微秒 */
+	volatile int done;
+} netBenchRtt;
+
+/* 客户端线程：每次发送一条GET，读完回复后再发下一条 */
+static void *netBenchRttClient(void *arg) {
+	static const char req[] = "*2\r\n$3\r\nGET\r\n$3\r\nkey\r\n";
+	netBenchRtt *b = arg;
+	char err[ANET_ERR_LEN], buf[64];
+	int fd, j, nread, got;
+
+	if (b->unix_socket) {
+		fd = anetUnixConnect(err,server.unixsocket);
+	} else {
+		fd = anetTcpConnect(err,"127.0.0.1",b->port);
+		if (fd != ANET_ERR) anetEnableTcpNoDelay(NULL,fd);
+	}
+	if (fd == ANET_ERR) {
+		printf("Can't connect: %s\n",err);
+		exit(1);
+	}
+	for (j = 0; j < NET_BENCH_RTT_REQUESTS; j++) {
+		long long start = ustime();
+
+		if (write(fd,req,sizeof(req)-1) != sizeof(req)-1) exit(1);
+		/* 不存在的key，回复是"$-1\r\n" */
+		for (got = 0; got < 5; got += nread) {
+			nread = read(fd,buf+got,sizeof(buf)-got);
+			if (nread <= 0) exit(1);
+		}
+		b->lat[j] = ustime()-start;
+	}
+	b->done = 1;
+	close(fd);
+	return NULL;
+}
+
+static int netBenchCompareLat(const void *a, const void *b) {
+	long long la = *(const long long*)a, lb = *(const long long*)b;
+	return (la > lb) - (la < lb);
+}
+
+static void netBenchRoundTrip(int port) {
+	netBenchRtt b;
+	pthread_t tid;
+	long long sum;
+	int j;
+
+	b.port = port;
+	b.lat = zmalloc(sizeof(long long)*NET_BENCH_RTT_REQUESTS);
+	for (b.unix_socket = 0; b.unix_socket <= 1; b.unix_socket++) {
+		b.done = 0;
+		pthread_create(&tid,NULL,netBenchRttClient,&b);
+		/* 和aeMain一样，每轮等待之前先发送回复 */
+		while (!b.done) {
+			handleClientsWithPendingReads();
+			handleClientsWithPendingWrites();
+			freeClientsInAsyncFreeQueue();
+			aeProcessEvents(server.el,AE_ALL_EVENTS);
+		}
+		pthread_join(tid,NULL);
+
+		for (sum = 0, j = 0; j < NET_BENCH_RTT_REQUESTS; j++) sum += b.lat[j];
+		qsort(b.lat,NET_BENCH_RTT_REQUESTS,sizeof(long long),netBenchCompareLat);
+		printf("%-8s rtt avg %6.2f us  p50 %lld us  p99 %lld us\n",
+			b.unix_socket ? "unix" : "tcp", (double)sum/NET_BENCH_RTT_REQUESTS,
+			b.lat[NET_BENCH_RTT_REQUESTS/2],
+			b.lat[NET_BENCH_RTT_REQUESTS*99/100]);
+	}
+	zfree(b.lat);
 }
 
+int main(void) {
+	int lfd, port;
+	char ip[NET_IP_STR_LEN];
+	char path[64];
+
+	initServerConfig();
+
+	/* 只监听Unix域套接字，TCP监听socket在下面单独创建 */
+	snprintf(path,sizeof(path),"/tmp/networking-benchmark-%d.sock",(int)getpid());
+	server.port = 0;
+	server.unixsocket = zstrdup(path);
+	initServer();
+
+	lfd = anetTcpServer(server.neterr,0,"127.0.0.1",NET_BENCH_BATCH);
+	if (lfd == ANET_ERR || anetSockName(lfd,ip,sizeof(ip),&port) == -1) {
+		printf("Can't create the listening socket: %s\n",server.neterr);
+		return 1;
+	}
+	anetNonBlock(NULL,lfd);
+#ifdef HAVE_ACCEPT_INHERIT_SOCKOPT
+	anetEnableTcpNoDelay(NULL,lfd);
+	if (server.tcpkeepalive) anetKeepAlive(NULL,lfd,server.tcpkeepalive);
+#endif
+
+	netBenchStorm(lfd,ip,port);
+
+	if (aeCreateFileEvent(server.el,lfd,AE_READABLE,acceptTcpHandler,NULL) == AE_ERR) {
+		printf("Can't create the accept event\n");
+		return 1;
+	}
+	netBenchRoundTrip(port);
+
+	close(lfd);
+	closeListeningSockets(1);
+	return 0;
+}
+#endif
@@ -30,9 +30,15 @@
  */
 
 #include "server.h"
+#include "rdb.h"
 #include "zmalloc.h"
+#include "util.h"
+#include "intset.h"
 #include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <ctype.h>
+#include <errno.h>
 #include <string.h>
 
 #ifdef __CYGWIN__
@@ -112,6 +118,109 @@ robj *createStringObject(const char *ptr, size_t len) {
 }
 
 
+/*
+ * 创建一个值为value的字符串对象，
+ * 在long的范围内时使用INT编码，ptr直接保存整数值
+ */
+robj *createStringObjectFromLongLong(long long value) {
+	robj *o;
+
+	if (value >= LONG_MIN && value <= LONG_MAX) {
+		o = createObject(OBJ_STRING, NULL);
+		o->encoding = OBJ_ENCODING_INT;
+		o->ptr = (void*)((long)value);
+	} else {
+		o = createObject(OBJ_STRING,sdsfromlonglong(value));
+	}
+	return o;
+}
+
+/* Create a string object from a long double. If humanfriendly is non-zero
+ * it does not use exponential format and trims trailing zeroes at the end,
+ * however this results in loss of precision. Otherwise exp format is used
+ * and the output of snprintf() is not modified.
+ *
+ * The 'humanfriendly' option is used for INCRBYFLOAT and HINCRBYFLOAT. */
+robj *createStringObjectFromLongDouble(long double value, int humanfriendly) {
+	char buf[MAX_LONG_DOUBLE_CHARS];
+	int len = ld2string(buf,sizeof(buf),value,humanfriendly);
+	return createStringObject(buf,len);
+}
+
+/*
+ * 创建一个快速列表编码的列表对象
+ */
+robj *createQuicklistObject(void) {
+	quicklist *l = quicklistCreate();
+	robj *o = createObject(OBJ_LIST,l);
+	o->encoding = OBJ_ENCODING_QUICKLIST;
+	return o;
+}
+
+/*
+ * 创建一个字典编码的集合对象，字典的值都是NULL
+ */
+robj *createSetObject(void) {
+	dict *d = dictCreate(&setDictType,NULL);
+	robj *o = createObject(OBJ_SET,d);
+	o->encoding = OBJ_ENCODING_HT;
+	return o;
+}
+
+/*
+ * 创建一个整数集合编码的集合对象
+ */
+robj *createIntsetObject(void) {
+	intset *is = intsetNew();
+	robj *o = createObject(OBJ_SET,is);
+	o->encoding = OBJ_ENCODING_INTSET;
+	return o;
+}
+
+/*
+ * 创建一个紧凑列表编码的哈希对象，field和value依次保存在同一个listpack中
+ */
+robj *createHashObject(void) {
+	unsigned char *lp = lpNew(0);
+	robj *o = createObject(OBJ_HASH, lp);
+	o->encoding = OBJ_ENCODING_LISTPACK;
+	return o;
+}
+
+/*
+ * 创建一个跳跃表编码的有序集合对象
+ */
+robj *createZsetObject(void) {
+	zset *zs = zmalloc(sizeof(*zs));
+	robj *o;
+
+	zs->dict = dictCreate(&zsetDictType,NULL);
+	zs->zsl = zslCreate();
+	o = createObject(OBJ_ZSET,zs);
+	o->encoding = OBJ_ENCODING_SKIPLIST;
+	return o;
+}
+
+/*
+ * 创建一个listpack编码的有序集合对象，元素和score依次相邻保存
+ */
+robj *createZsetListpackObject(void) {
+	unsigned char *lp = lpNew(0);
+	robj *o = createObject(OBJ_ZSET,lp);
+	o->encoding = OBJ_ENCODING_LISTPACK;
+	return o;
+}
+
+/*
+ * 创建一个空的流对象，元素保存在前缀树索引的listpack块中
+ */
+robj *createStreamObject(void) {
+	stream *s = streamNew();
+	robj *o = createObject(OBJ_STREAM,s);
+	o->encoding = OBJ_ENCODING_STREAM;
+	return o;
+}
+
 /*
  * 释放对象空间系列函数
  * ---begin---
@@ -119,9 +228,74 @@ robj *createStringObject(const char *ptr, size_t len) {
 void freeStringObject(robj *o) {
 	if (o->encoding == OBJ_ENCODING_RAW) {
 		sdsfree(o->ptr);
+	} else if (o->encoding == OBJ_ENCODING_DISKREF) {
+		// 还没有解码的值不持有内存，只需要释放对RDB映射的引用
+		rdbReleaseDiskRef(o);
 	}
 }
 
+void freeListObject(robj *o) {
+	if (o->encoding == OBJ_ENCODING_QUICKLIST) {
+		quicklistRelease(o->ptr);
+	} else {
+		printf("Unknown list encoding type\n");
+		exit(1);
+	}
+}
+
+void freeSetObject(robj *o) {
+	switch (o->encoding) {
+	case OBJ_ENCODING_HT:
+		dictRelease((dict*) o->ptr);
+		break;
+	case OBJ_ENCODING_INTSET:
+		zfree(o->ptr);
+		break;
+	default:
+		printf("Unknown set encoding type\n");
+		exit(1);
+		break;
+	}
+}
+
+void freeZsetObject(robj *o) {
+	zset *zs;
+	switch (o->encoding) {
+	case OBJ_ENCODING_SKIPLIST:
+		zs = o->ptr;
+		dictRelease(zs->dict);
+		zslFree(zs->zsl);
+		zfree(zs);
+		break;
+	case OBJ_ENCODING_LISTPACK:
+		lpFree(o->ptr);
+		break;
+	default:
+		printf("Unknown sorted set encoding\n");
+		exit(1);
+		break;
+	}
+}
+
+void freeHashObject(robj *o) {
+	switch (o->encoding) {
+	case OBJ_ENCODING_HT:
+		dictRelease((dict*) o->ptr);
+		break;
+	case OBJ_ENCODING_LISTPACK:
+		lpFree(o->ptr);
+		break;
+	default:
+		printf("Unknown hash encoding type\n");
+		exit(1);
+		break;
+	}
+}
+
+void freeStreamObject(robj *o) {
+	freeStream(o->ptr);
+}
+
 /*
  * 释放对象空间系列函数
  * ---end---
@@ -144,6 +318,11 @@ void decrRefCount(robj *o) {
 	if (o->refcount == 1) {
 		switch(o->type) {
 			case OBJ_STRING: freeStringObject(o); break;
+			case OBJ_LIST: freeListObject(o); break;
+			case OBJ_SET: freeSetObject(o); break;
+			case OBJ_ZSET: freeZsetObject(o); break;
+			case OBJ_HASH: freeHashObject(o); break;
+			case OBJ_STREAM: freeStreamObject(o); break;
 			default: break;
 		}
 		zfree(o);
@@ -152,6 +331,193 @@ void decrRefCount(robj *o) {
 	}
 }
 
+/* Get a decoded version of an encoded object (returned as a new object).
+ * If the object is already raw-encoded just increment the ref count. */
+/*
+ * 返回一个sds编码的对象，已经是sds编码的只增加引用计数
+ */
+robj *getDecodedObject(robj *o) {
+	robj *dec;
+
+	if (o->encoding == OBJ_ENCODING_DISKREF) rdbMaterializeObject(o);
+	if (sdsEncodedObject(o)) {
+		incrRefCount(o);
+		return o;
+	}
+	if (o->type == OBJ_STRING && o->encoding == OBJ_ENCODING_INT) {
+		char buf[32];
+
+		ll2string(buf,32,(long)o->ptr);
+		dec = createStringObject(buf,strlen(buf));
+		return dec;
+	} else {
+		printf("Unknown encoding type\n");
+		exit(1);
+	}
+}
+
+/*
+ * 返回字符串对象的长度
+ */
+size_t stringObjectLen(robj *o) {
+	if (o->encoding == OBJ_ENCODING_DISKREF) rdbMaterializeObject(o);
+	if (sdsEncodedObject(o)) {
+		return sdslen(o->ptr);
+	} else {
+		char buf[32];
+
+		return ll2string(buf,32,(long)o->ptr);
+	}
+}
+
+/*
+ * 检查对象的类型，类型不符时回复WRONGTYPE错误并返回1
+ */
+int checkType(client *c, robj *o, int type) {
+	if (o->type != type) {
+		addReply(c,shared.wrongtypeerr);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * 把字符串对象转换成long long，对象不能表示为整数时返回C_ERR
+ */
+int getLongLongFromObject(robj *o, long long *target) {
+	long long value;
+
+	if (o == NULL) {
+		value = 0;
+	} else {
+		if (o->encoding == OBJ_ENCODING_DISKREF) rdbMaterializeObject(o);
+		if (sdsEncodedObject(o)) {
+			if (string2ll(o->ptr,sdslen(o->ptr),&value) == 0) return C_ERR;
+		} else if (o->encoding == OBJ_ENCODING_INT) {
+			value = (long)o->ptr;
+		} else {
+			printf("Unknown string encoding\n");
+			exit(1);
+		}
+	}
+	if (target) *target = value;
+	return C_OK;
+}
+
+/*
+ * 把字符串对象转换成double，不接受NaN和带前导空格的字符串
+ */
+int getDoubleFromObject(const robj *o, double *target) {
+	double value;
+	char *eptr;
+
+	if (o == NULL) {
+		value = 0;
+	} else {
+		if (o->encoding == OBJ_ENCODING_DISKREF) rdbMaterializeObject((robj*)o);
+		if (sdsEncodedObject(o)) {
+			errno = 0;
+			value = strtod(o->ptr, &eptr);
+			if (sdslen(o->ptr) == 0 ||
+				isspace(((const char*)o->ptr)[0]) ||
+				(size_t)(eptr-(char*)o->ptr) != sdslen(o->ptr) ||
+				(errno == ERANGE &&
+					(value == HUGE_VAL || value == -HUGE_VAL || value == 0)) ||
+				isnan(value))
+				return C_ERR;
+		} else if (o->encoding == OBJ_ENCODING_INT) {
+			value = (long)o->ptr;
+		} else {
+			printf("Unknown string encoding\n");
+			exit(1);
+		}
+	}
+	*target = value;
+	return C_OK;
+}
+
+int getDoubleFromObjectOrReply(client *c, robj *o, double *target, const char *msg) {
+	double value;
+	if (getDoubleFromObject(o, &value) != C_OK) {
+		if (msg != NULL) {
+			addReplyError(c,(char*)msg);
+		} else {
+			addReplyError(c,"value is not a valid float");
+		}
+		return C_ERR;
+	}
+	*target = value;
+	return C_OK;
+}
+
+int getLongLongFromObjectOrReply(client *c, robj *o, long long *target, const char *msg) {
+	long long value;
+	if (getLongLongFromObject(o, &value) != C_OK) {
+		if (msg != NULL) {
+			addReplyError(c,(char*)msg);
+		} else {
+			addReplyError(c,"value is not an integer or out of range");
+		}
+		return C_ERR;
+	}
+	*target = value;
+	return C_OK;
+}
+
+int getLongFromObjectOrReply(client *c, robj *o, long *target, const char *msg) {
+	long long value;
+
+	if (getLongLongFromObjectOrReply(c, o, &value, msg) != C_OK) return C_ERR;
+	if (value < LONG_MIN || value > LONG_MAX) {
+		if (msg != NULL) {
+			addReplyError(c,(char*)msg);
+		} else {
+			addReplyError(c,"value is out of range");
+		}
+		return C_ERR;
+	}
+	*target = value;
+	return C_OK;
+}
+
+/*
+ * 把字符串对象转换成long double，不接受NaN和带前导空格的字符串
+ */
+int getLongDoubleFromObject(robj *o, long double *target) {
+	long double value;
+
+	if (o == NULL) {
+		value = 0;
+	} else {
+		if (o->encoding == OBJ_ENCODING_DISKREF) rdbMaterializeObject(o);
+		if (sdsEncodedObject(o)) {
+			if (!string2ld(o->ptr, sdslen(o->ptr), &value))
+				return C_ERR;
+		} else if (o->encoding == OBJ_ENCODING_INT) {
+			value = (long)o->ptr;
+		} else {
+			printf("Unknown string encoding\n");
+			exit(1);
+		}
+	}
+	*target = value;
+	return C_OK;
+}
+
+int getLongDoubleFromObjectOrReply(client *c, robj *o, long double *target, const char *msg) {
+	long double value;
+	if (getLongDoubleFromObject(o, &value) != C_OK) {
+		if (msg != NULL) {
+			addReplyError(c,(char*)msg);
+		} else {
+			addReplyError(c,"value is not a valid float");
+		}
+		return C_ERR;
+	}
+	*target = value;
+	return C_OK;
+}
+
 /* This variant of decrRefCount() gets its argument as void, and is useful
  * as free method in data structures that expect a 'void free_object(void*)'
  * prototype for the free method. */
@@ -0,0 +1,951 @@
+/* quicklist.c - A doubly linked list of listpacks
+ *
+ * Copyright (c) 2014, Matt Stancliff <matt@genges.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this quicklist of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this quicklist of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * 快速列表：由紧凑列表组成的双向链表
+ *
+ * 每个节点是一个大小受限的紧凑列表，保存多个元素，
+ * 相比每个元素一个链表节点，省去了每个元素的节点和指针开销。
+ * 距离两端超过compress个节点的中间节点使用LZF压缩，
+ * 访问时临时解压，访问结束后重新压缩。
+ */
+
+#include <string.h> /* for memcpy */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "quicklist.h"
+#include "zmalloc.h"
+#include "listpack.h"
+#include "util.h"
+#include "lzf.h"
+
+#ifndef REDIS_STATIC
+#define REDIS_STATIC static
+#endif
+
+/* Optimization levels for size-based filling.
+ * Note that the largest possible limit is 64k, so even if each record takes
+ * just one byte, it still won't overflow the 16 bit count field. */
+static const size_t optimization_level[] = {4096, 8192, 16384, 32768, 65536};
+
+/* Maximum size in bytes of any multi-element listpack.
+ * Larger values will live in their own isolated listpacks.
+ * This is used only if we're limited by record count. when we're limited by
+ * size, the maximum limit is bigger, but still safe.
+ * 8k is a recommended / default size limit */
+#define SIZE_SAFETY_LIMIT 8192
+
+/* Minimum listpack size in bytes for attempting compression. */
+#define MIN_COMPRESS_BYTES 48
+
+/* Minimum size reduction in bytes to store compressed quicklistNode data.
+ * This also prevents us from storing compression if the compression
+ * resulted in a larger size than the original data. */
+#define MIN_COMPRESS_IMPROVE 8
+
+/* Simple way to give quicklistEntry structs default values with one call. */
+#define initEntry(e)                                                           \
+    do {                                                                       \
+        (e)->zi = (e)->value = NULL;                                           \
+        (e)->longval = -123456789;                                             \
+        (e)->quicklist = NULL;                                                 \
+        (e)->node = NULL;                                                      \
+        (e)->offset = 123456789;                                               \
+        (e)->sz = 0;                                                           \
+    } while (0)
+
+/* Create a new quicklist.
+ * Free with quicklistRelease(). */
+quicklist *quicklistCreate(void) {
+	struct quicklist *quicklist;
+
+	quicklist = zmalloc(sizeof(*quicklist));
+	quicklist->head = quicklist->tail = NULL;
+	quicklist->len = 0;
+	quicklist->count = 0;
+	quicklist->compress = 0;
+	quicklist->fill = -2;
+	return quicklist;
+}
+
+#define COMPRESS_MAX (1 << 16)
+void quicklistSetCompressDepth(quicklist *quicklist, int compress) {
+	if (compress > COMPRESS_MAX) {
+		compress = COMPRESS_MAX;
+	} else if (compress < 0) {
+		compress = 0;
+	}
+	quicklist->compress = compress;
+}
+
+#define FILL_MAX (1 << 15)
+void quicklistSetFill(quicklist *quicklist, int fill) {
+	if (fill > FILL_MAX) {
+		fill = FILL_MAX;
+	} else if (fill < -5) {
+		fill = -5;
+	}
+	quicklist->fill = fill;
+}
+
+void quicklistSetOptions(quicklist *quicklist, int fill, int depth) {
+	quicklistSetFill(quicklist, fill);
+	quicklistSetCompressDepth(quicklist, depth);
+}
+
+/* Create a new quicklist with some default parameters. */
+quicklist *quicklistNew(int fill, int compress) {
+	quicklist *quicklist = quicklistCreate();
+	quicklistSetOptions(quicklist, fill, compress);
+	return quicklist;
+}
+
+REDIS_STATIC quicklistNode *quicklistCreateNode(void) {
+	quicklistNode *node;
+	node = zmalloc(sizeof(*node));
+	node->entry = NULL;
+	node->count = 0;
+	node->sz = 0;
+	node->next = node->prev = NULL;
+	node->encoding = QUICKLIST_NODE_ENCODING_RAW;
+	node->recompress = 0;
+	node->attempted_compress = 0;
+	node->extra = 0;
+	return node;
+}
+
+/* Return cached quicklist count */
+unsigned long quicklistCount(const quicklist *ql) { return ql->count; }
+
+/* Free entire quicklist. */
+void quicklistRelease(quicklist *quicklist) {
+	unsigned long len;
+	quicklistNode *current, *next;
+
+	current = quicklist->head;
+	len = quicklist->len;
+	while (len--) {
+		next = current->next;
+
+		zfree(current->entry);
+		quicklist->count -= current->count;
+
+		zfree(current);
+
+		quicklist->len--;
+		current = next;
+	}
+	zfree(quicklist);
+}
+
+/*
+ * 快速列表实际占用的内存，压缩节点按压缩后的大小计算
+ */
+size_t quicklistBytes(const quicklist *ql) {
+	size_t bytes = sizeof(*ql);
+	quicklistNode *node;
+
+	for (node = ql->head; node; node = node->next) {
+		bytes += sizeof(*node);
+		if (quicklistNodeIsCompressed(node)) {
+			quicklistLZF *lzf = (quicklistLZF *)node->entry;
+			bytes += sizeof(*lzf) + lzf->sz;
+		} else {
+			bytes += node->sz;
+		}
+	}
+	return bytes;
+}
+
+/* Compress the listpack in 'node' and update encoding details.
+ * Returns 1 if listpack compressed successfully.
+ * Returns 0 if compression failed or if listpack too small to compress. */
+REDIS_STATIC int __quicklistCompressNode(quicklistNode *node) {
+	quicklistLZF *lzf;
+
+	node->attempted_compress = 1;
+
+	/* validate that the node is neither
+	 * tail nor head (it has prev and next)*/
+	if (node->sz < MIN_COMPRESS_BYTES) return 0;
+
+	lzf = zmalloc(sizeof(*lzf) + node->sz);
+
+	/* Cancel if compression fails or doesn't compress small enough */
+	if (((lzf->sz = lzf_compress(node->entry, node->sz, lzf->compressed,
+								 node->sz)) == 0) ||
+		lzf->sz + MIN_COMPRESS_IMPROVE >= node->sz) {
+		/* lzf_compress aborts/rejects compression if value not compressible. */
+		zfree(lzf);
+		return 0;
+	}
+
+	lzf = zrealloc(lzf, sizeof(*lzf) + lzf->sz);
+	zfree(node->entry);
+	node->entry = (unsigned char *)lzf;
+	node->encoding = QUICKLIST_NODE_ENCODING_LZF;
+	node->recompress = 0;
+	return 1;
+}
+
+/* Compress only uncompressed nodes. */
+#define quicklistCompressNode(_node)                                           \
+    do {                                                                       \
+        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_RAW) {     \
+            __quicklistCompressNode((_node));                                  \
+        }                                                                      \
+    } while (0)
+
+/* Uncompress the listpack in 'node' and update encoding details.
+ * Returns 1 on successful decode, 0 on failure to decode. */
+REDIS_STATIC int __quicklistDecompressNode(quicklistNode *node) {
+	void *decompressed;
+	quicklistLZF *lzf;
+
+	node->attempted_compress = 0;
+
+	decompressed = zmalloc(node->sz);
+	lzf = (quicklistLZF *)node->entry;
+	if (lzf_decompress(lzf->compressed, lzf->sz, decompressed, node->sz) == 0) {
+		/* Someone requested decompress, but we can't decompress.  Not good. */
+		zfree(decompressed);
+		return 0;
+	}
+	zfree(lzf);
+	node->entry = decompressed;
+	node->encoding = QUICKLIST_NODE_ENCODING_RAW;
+	return 1;
+}
+
+/* Decompress only compressed nodes. */
+#define quicklistDecompressNode(_node)                                         \
+    do {                                                                       \
+        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_LZF) {     \
+            __quicklistDecompressNode((_node));                                \
+        }                                                                      \
+    } while (0)
+
+/* Force node to not be immediately re-compressible */
+#define quicklistDecompressNodeForUse(_node)                                   \
+    do {                                                                       \
+        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_LZF) {     \
+            __quicklistDecompressNode((_node));                                \
+            (_node)->recompress = 1;                                           \
+        }                                                                      \
+    } while (0)
+
+/* Extract the raw LZF data from this quicklistNode.
+ * Pointer to LZF data is assigned to '*data'.
+ * Return value is the length of compressed LZF data. */
+size_t quicklistGetLzf(const quicklistNode *node, void **data) {
+	quicklistLZF *lzf = (quicklistLZF *)node->entry;
+	*data = lzf->compressed;
+	return lzf->sz;
+}
+
+#define quicklistAllowsCompression(_ql) ((_ql)->compress != 0)
+
+/* Force 'quicklist' to meet compression guidelines set by compress depth.
+ * The only way to guarantee interior nodes get compressed is to iterate
+ * to our "interior" compress depth then compress the next node we find.
+ * If compress depth is larger than the entire list, we return immediately. */
+/*
+ * 保证距离两端compress个节点以内的节点不被压缩，
+ * 并压缩刚好越过这个深度的节点和node（如果它在中间）
+ */
+REDIS_STATIC void __quicklistCompress(const quicklist *quicklist,
+                                      quicklistNode *node) {
+	quicklistNode *forward, *reverse;
+	int depth = 0;
+	int in_depth = 0;
+
+	if (quicklist->len == 0) return;
+
+	/* If length is less than our compress depth (from both sides),
+	 * we can't compress anything. */
+	if (!quicklistAllowsCompression(quicklist) ||
+		quicklist->len < (unsigned int)(quicklist->compress * 2))
+		return;
+
+	/* Iterate until we reach compress depth for both sides of the list.a
+	 * Note: because we do length checks at the *top* of this function,
+	 *       we can skip explicit null checks below. Everything exists. */
+	forward = quicklist->head;
+	reverse = quicklist->tail;
+	while (depth++ < quicklist->compress) {
+		quicklistDecompressNode(forward);
+		quicklistDecompressNode(reverse);
+
+		if (forward == node || reverse == node)
+			in_depth = 1;
+
+		/* We passed into compress depth of opposite side of the quicklist
+		 * so there's no need to compress anything and we can exit. */
+		if (forward == reverse || forward->next == reverse)
+			return;
+
+		forward = forward->next;
+		reverse = reverse->prev;
+	}
+
+	if (!in_depth)
+		quicklistCompressNode(node);
+
+	/* At this point, forward and reverse are one node beyond depth */
+	quicklistCompressNode(forward);
+	quicklistCompressNode(reverse);
+}
+
+#define quicklistCompress(_ql, _node)                                          \
+    do {                                                                       \
+        if ((_node)->recompress)                                               \
+            quicklistCompressNode((_node));                                    \
+        else                                                                   \
+            __quicklistCompress((_ql), (_node));                               \
+    } while (0)
+
+/* If we previously used quicklistDecompressNodeForUse(), just recompress. */
+#define quicklistRecompressOnly(_node)                                         \
+    do {                                                                       \
+        if ((_node)->recompress)                                               \
+            quicklistCompressNode((_node));                                    \
+    } while (0)
+
+/* Insert 'new_node' after 'old_node' if 'after' is 1.
+ * Insert 'new_node' before 'old_node' if 'after' is 0.
+ * Note: 'new_node' is *always* uncompressed, so if we assign it to
+ *       head or tail, we do not need to uncompress it. */
+REDIS_STATIC void __quicklistInsertNode(quicklist *quicklist,
+                                        quicklistNode *old_node,
+                                        quicklistNode *new_node, int after) {
+	if (after) {
+		new_node->prev = old_node;
+		if (old_node) {
+			new_node->next = old_node->next;
+			if (old_node->next)
+				old_node->next->prev = new_node;
+			old_node->next = new_node;
+		}
+		if (quicklist->tail == old_node)
+			quicklist->tail = new_node;
+	} else {
+		new_node->next = old_node;
+		if (old_node) {
+			new_node->prev = old_node->prev;
+			if (old_node->prev)
+				old_node->prev->next = new_node;
+			old_node->prev = new_node;
+		}
+		if (quicklist->head == old_node)
+			quicklist->head = new_node;
+	}
+	/* If this insert creates the only element so far, initialize head/tail. */
+	if (quicklist->len == 0) {
+		quicklist->head = quicklist->tail = new_node;
+	}
+
+	/* Update len first, so in __quicklistCompress we know exactly len */
+	quicklist->len++;
+
+	if (old_node)
+		quicklistCompress(quicklist, old_node);
+}
+
+/* Wrappers for node inserting around existing node. */
+REDIS_STATIC void _quicklistInsertNodeBefore(quicklist *quicklist,
+                                             quicklistNode *old_node,
+                                             quicklistNode *new_node) {
+	__quicklistInsertNode(quicklist, old_node, new_node, 0);
+}
+
+REDIS_STATIC void _quicklistInsertNodeAfter(quicklist *quicklist,
+                                            quicklistNode *old_node,
+                                            quicklistNode *new_node) {
+	__quicklistInsertNode(quicklist, old_node, new_node, 1);
+}
+
+/* 按照fill限制，判断节点加入sz字节的元素后是否超过限制 */
+static int _quicklistNodeAllowInsert(const quicklistNode *node,
+                                     const int fill, const size_t sz) {
+	size_t new_sz;
+
+	if (node == NULL) return 0;
+
+	/* 估算新元素的编码开销：最多5字节的编码头和5字节的backlen */
+	new_sz = node->sz + sz + 10;
+	if (fill < 0) {
+		/* 按字节数限制 */
+		if (new_sz > optimization_level[(-fill)-1]) return 0;
+	} else {
+		/* 按元素数量限制，大元素单独保存在一个节点中 */
+		if (new_sz > SIZE_SAFETY_LIMIT) return 0;
+		if ((int)node->count >= fill) return 0;
+	}
+	/* count是16位的 */
+	if (node->count >= UINT16_MAX) return 0;
+	return 1;
+}
+
+#define quicklistNodeUpdateSz(node)                                            \
+    do {                                                                       \
+        (node)->sz = lpBytes((node)->entry);                                   \
+    } while (0)
+
+/* Add new entry to head node of quicklist.
+ *
+ * Returns 0 if used existing head.
+ * Returns 1 if new head created. */
+int quicklistPushHead(quicklist *quicklist, void *value, size_t sz) {
+	quicklistNode *orig_head = quicklist->head;
+
+	if (_quicklistNodeAllowInsert(quicklist->head, quicklist->fill, sz)) {
+		quicklist->head->entry = lpPrepend(quicklist->head->entry, value, sz);
+		quicklistNodeUpdateSz(quicklist->head);
+	} else {
+		quicklistNode *node = quicklistCreateNode();
+		node->entry = lpPrepend(lpNew(0), value, sz);
+
+		quicklistNodeUpdateSz(node);
+		_quicklistInsertNodeBefore(quicklist, quicklist->head, node);
+	}
+	quicklist->count++;
+	quicklist->head->count++;
+	return (orig_head != quicklist->head);
+}
+
+/* Add new entry to tail node of quicklist.
+ *
+ * Returns 0 if used existing tail.
+ * Returns 1 if new tail created. */
+int quicklistPushTail(quicklist *quicklist, void *value, size_t sz) {
+	quicklistNode *orig_tail = quicklist->tail;
+
+	if (_quicklistNodeAllowInsert(quicklist->tail, quicklist->fill, sz)) {
+		quicklist->tail->entry = lpAppend(quicklist->tail->entry, value, sz);
+		quicklistNodeUpdateSz(quicklist->tail);
+	} else {
+		quicklistNode *node = quicklistCreateNode();
+		node->entry = lpAppend(lpNew(0), value, sz);
+
+		quicklistNodeUpdateSz(node);
+		_quicklistInsertNodeAfter(quicklist, quicklist->tail, node);
+	}
+	quicklist->count++;
+	quicklist->tail->count++;
+	return (orig_tail != quicklist->tail);
+}
+
+/* Create new node consisting of a pre-formed listpack.
+ * Used for loading RDBs where entire listpacks have been stored
+ * to be retrieved later. */
+void quicklistAppendListpack(quicklist *quicklist, unsigned char *lp) {
+	quicklistNode *node = quicklistCreateNode();
+
+	node->entry = lp;
+	node->count = lpLength(node->entry);
+	node->sz = lpBytes(lp);
+
+	_quicklistInsertNodeAfter(quicklist, quicklist->tail, node);
+	quicklist->count += node->count;
+}
+
+/* Wrapper to allow argument-based switching between HEAD/TAIL pop */
+void quicklistPush(quicklist *quicklist, void *value, const size_t sz,
+                   int where) {
+	if (where == QUICKLIST_HEAD) {
+		quicklistPushHead(quicklist, value, sz);
+	} else if (where == QUICKLIST_TAIL) {
+		quicklistPushTail(quicklist, value, sz);
+	}
+}
+
+REDIS_STATIC void __quicklistDelNode(quicklist *quicklist,
+                                     quicklistNode *node) {
+	if (node->next)
+		node->next->prev = node->prev;
+	if (node->prev)
+		node->prev->next = node->next;
+
+	if (node == quicklist->tail) {
+		quicklist->tail = node->prev;
+	}
+
+	if (node == quicklist->head) {
+		quicklist->head = node->next;
+	}
+
+	/* Update len first, so in __quicklistCompress we know exactly len */
+	quicklist->len--;
+	quicklist->count -= node->count;
+
+	/* If we deleted a node within our compress depth, we
+	 * now have compressed nodes needing to be decompressed. */
+	__quicklistCompress(quicklist, NULL);
+
+	zfree(node->entry);
+	zfree(node);
+}
+
+/* Delete one entry from list given the node for the entry and a pointer
+ * to the entry in the node.
+ *
+ * Note: quicklistDelIndex() *requires* uncompressed nodes because you
+ *       already had to get *p from an uncompressed node somewhere.
+ *
+ * Returns 1 if the entire node was deleted, 0 if node still exists.
+ * Also updates in/out param 'p' with the next offset in the listpack. */
+REDIS_STATIC int quicklistDelIndex(quicklist *quicklist, quicklistNode *node,
+                                   unsigned char **p) {
+	int gone = 0;
+
+	node->entry = lpDelete(node->entry, *p, p);
+	node->count--;
+	if (node->count == 0) {
+		gone = 1;
+		__quicklistDelNode(quicklist, node);
+	} else {
+		quicklistNodeUpdateSz(node);
+	}
+	quicklist->count--;
+	/* If we deleted the node, the original node is no longer valid */
+	return gone ? 1 : 0;
+}
+
+/* Delete a range of elements from the quicklist.
+ *
+ * elements may span across multiple quicklistNodes, so we
+ * have to be careful about tracking where we start and end.
+ *
+ * Returns 1 if entries were deleted, 0 if nothing was deleted. */
+int quicklistDelRange(quicklist *quicklist, const long start,
+                      const long count) {
+	quicklistIter *iter;
+	quicklistNode *node;
+	unsigned long extent;
+	long offset;
+
+	if (count <= 0)
+		return 0;
+
+	extent = count; /* range is inclusive of start position */
+
+	if (start >= 0 && extent > (quicklist->count - start)) {
+		/* if requesting delete more elements than exist, limit to list size. */
+		extent = quicklist->count - start;
+	} else if (start < 0 && extent > (unsigned long)(-start)) {
+		/* else, if at negative offset, limit max size to rest of list. */
+		extent = -start; /* c.f. LREM -29 29; just delete until end. */
+	}
+
+	iter = quicklistGetIteratorAtIdx(quicklist, AL_START_TAIL, start);
+	if (!iter)
+		return 0;
+
+	node = iter->current;
+	offset = iter->offset;
+	quicklistReleaseIterator(iter);
+
+	/* iterate over next nodes until everything is deleted. */
+	while (extent) {
+		quicklistNode *next = node->next;
+
+		unsigned long del;
+		int delete_entire_node = 0;
+		if (offset == 0 && extent >= node->count) {
+			/* If we are deleting more than the count of this node, we
+			 * can just delete the entire node without listpack math. */
+			delete_entire_node = 1;
+			del = node->count;
+		} else if (offset >= 0 && extent + offset >= node->count) {
+			/* If deleting more nodes after this one, calculate delete based
+			 * on size of current node. */
+			del = node->count - offset;
+		} else if (offset < 0) {
+			/* If offset is negative, we are in the first run of this loop
+			 * and we are deleting the entire range
+			 * from this start offset to end of list.  Since the Negative
+			 * offset is the number of elements until the tail of the list,
+			 * just use it directly as the deletion count. */
+			del = -offset;
+
+			/* If the positive offset is greater than the remaining extent,
+			 * we only delete the remaining extent, not the entire offset.
+			 */
+			if (del > extent)
+				del = extent;
+		} else {
+			/* else, we are deleting less than the extent of this node, so
+			 * use extent directly. */
+			del = extent;
+		}
+
+		if (delete_entire_node) {
+			__quicklistDelNode(quicklist, node);
+		} else {
+			quicklistDecompressNodeForUse(node);
+			node->entry = lpDeleteRange(node->entry, offset, del);
+			quicklistNodeUpdateSz(node);
+			node->count -= del;
+			quicklist->count -= del;
+			if (node->count == 0) {
+				__quicklistDelNode(quicklist, node);
+			} else {
+				quicklistRecompressOnly(node);
+			}
+		}
+
+		extent -= del;
+
+		node = next;
+
+		offset = 0;
+	}
+	return 1;
+}
+
+/* Returns a quicklist iterator 'iter'. After the initialization every
+ * call to quicklistNext() will return the next element of the quicklist. */
+quicklistIter *quicklistGetIterator(quicklist *quicklist, int direction) {
+	quicklistIter *iter;
+
+	iter = zmalloc(sizeof(*iter));
+
+	if (direction == AL_START_HEAD) {
+		iter->current = quicklist->head;
+		iter->offset = 0;
+	} else if (direction == AL_START_TAIL) {
+		iter->current = quicklist->tail;
+		iter->offset = -1;
+	}
+
+	iter->direction = direction;
+	iter->quicklist = quicklist;
+
+	iter->zi = NULL;
+
+	return iter;
+}
+
+/* Initialize an iterator at a specific offset 'idx' and make the iterator
+ * return nodes in 'direction' direction. */
+/*
+ * 从距离较近的一端开始查找idx所在的节点，没有找到返回NULL
+ */
+quicklistIter *quicklistGetIteratorAtIdx(quicklist *quicklist,
+                                         const int direction,
+                                         const long long idx) {
+	quicklistNode *n;
+	unsigned long long accum = 0;
+	unsigned long long index;
+	int forward = idx < 0 ? 0 : 1; /* < 0 -> reverse, 0+ -> forward */
+	int seek_forward;
+	unsigned long long seek_index;
+	quicklistIter *iter;
+
+	index = forward ? idx : (-idx) - 1;
+	if (index >= quicklist->count)
+		return NULL;
+
+	/* Seek in the other direction if that way is shorter. */
+	seek_forward = forward;
+	seek_index = index;
+	if (index > (quicklist->count - 1) / 2) {
+		seek_forward = !forward;
+		seek_index = quicklist->count - 1 - index;
+	}
+
+	n = seek_forward ? quicklist->head : quicklist->tail;
+	while (n) {
+		if ((accum + n->count) > seek_index) {
+			break;
+		} else {
+			accum += n->count;
+			n = seek_forward ? n->next : n->prev;
+		}
+	}
+
+	if (!n)
+		return NULL;
+
+	/* Fix accum so it looks like we seeked in the other direction. */
+	if (seek_forward != forward) accum = quicklist->count - n->count - accum;
+
+	iter = quicklistGetIterator(quicklist, direction);
+	iter->current = n;
+	if (forward) {
+		/* forward = normal head-to-tail offset. */
+		iter->offset = index - accum;
+	} else {
+		/* reverse = need negative offset for tail-to-head, so undo
+		 * the result of the original index = (-idx) - 1 above. */
+		iter->offset = (-index) - 1 + accum;
+	}
+
+	return iter;
+}
+
+/* Release iterator.
+ * If we still have a valid current node, then re-encode current node. */
+void quicklistReleaseIterator(quicklistIter *iter) {
+	if (!iter) return;
+	if (iter->current)
+		quicklistCompress(iter->quicklist, iter->current);
+
+	zfree(iter);
+}
+
+/* Get next element in iterator.
+ *
+ * Note: You must NOT insert into the list while iterating over it.
+ * You *may* delete from the list while iterating using the
+ * quicklistDelEntry() function.
+ * If you insert into the quicklist while iterating, you should
+ * re-create the iterator after your addition.
+ *
+ * iter = quicklistGetIterator(quicklist,<direction>);
+ * quicklistEntry entry;
+ * while (quicklistNext(iter, &entry)) {
+ *     if (entry.value)
+ *          [[ use entry.value with entry.sz ]]
+ *     else
+ *          [[ use entry.longval ]]
+ * }
+ *
+ * Populates 'entry' with values for this iteration.
+ * Returns 0 when iteration is complete or if iteration not possible.
+ * If return value is 0, the contents of 'entry' are not valid.
+ */
+int quicklistNext(quicklistIter *iter, quicklistEntry *entry) {
+	initEntry(entry);
+
+	if (!iter) return 0;
+
+	entry->quicklist = iter->quicklist;
+	entry->node = iter->current;
+
+	if (!iter->current) return 0;
+
+	if (!iter->zi) {
+		/* If !zi, use current index. */
+		quicklistDecompressNodeForUse(iter->current);
+		iter->zi = lpSeek(iter->current->entry, iter->offset);
+	} else {
+		/* else, use existing iterator offset and get prev/next as necessary. */
+		if (iter->direction == AL_START_HEAD) {
+			iter->zi = lpNext(iter->current->entry, iter->zi);
+			iter->offset += 1;
+		} else if (iter->direction == AL_START_TAIL) {
+			iter->zi = lpPrev(iter->current->entry, iter->zi);
+			iter->offset += -1;
+		}
+	}
+
+	entry->zi = iter->zi;
+	entry->offset = iter->offset;
+
+	if (iter->zi) {
+		/* Populate value from existing listpack position */
+		entry->value = lpGetValue(entry->zi, &entry->sz, &entry->longval);
+		return 1;
+	} else {
+		/* We ran out of listpack entries.
+		 * Pick next node, update offset, then re-run retrieval. */
+		quicklistCompress(iter->quicklist, iter->current);
+		if (iter->direction == AL_START_HEAD) {
+			/* Forward traversal */
+			iter->current = iter->current->next;
+			iter->offset = 0;
+		} else if (iter->direction == AL_START_TAIL) {
+			/* Reverse traversal */
+			iter->current = iter->current->prev;
+			iter->offset = -1;
+		}
+		iter->zi = NULL;
+		return quicklistNext(iter, entry);
+	}
+}
+
+/* Default pop function
+ *
+ * Returns malloc'd value from quicklist */
+REDIS_STATIC void *_quicklistSaver(unsigned char *data, size_t sz) {
+	unsigned char *vstr;
+	if (data) {
+		vstr = zmalloc(sz);
+		memcpy(vstr, data, sz);
+		return vstr;
+	}
+	return NULL;
+}
+
+/* pop from quicklist and return result in 'data' ptr.  Value of 'data'
+ * is the return value of 'saver' function pointer if the data is NOT a number.
+ *
+ * If the quicklist element is a long long, then the return value is returned in
+ * 'sval'.
+ *
+ * Return value of 0 means no elements available.
+ * Return value of 1 means check 'data' and 'sval' for values.
+ * If 'data' is set, use 'data' and 'sz'.  Otherwise, use 'sval'. */
+int quicklistPopCustom(quicklist *quicklist, int where, unsigned char **data,
+                       size_t *sz, long long *sval,
+                       void *(*saver)(unsigned char *data, size_t sz)) {
+	unsigned char *p;
+	unsigned char *vstr;
+	unsigned int vlen;
+	long long vlong;
+	int pos = (where == QUICKLIST_HEAD) ? 0 : -1;
+	quicklistNode *node;
+
+	if (quicklist->count == 0)
+		return 0;
+
+	if (data)
+		*data = NULL;
+	if (sz)
+		*sz = 0;
+	if (sval)
+		*sval = -123456789;
+	if (saver == NULL)
+		saver = _quicklistSaver;
+
+	/* 两端的节点总是不压缩的 */
+	if (where == QUICKLIST_HEAD && quicklist->head) {
+		node = quicklist->head;
+	} else if (where == QUICKLIST_TAIL && quicklist->tail) {
+		node = quicklist->tail;
+	} else {
+		return 0;
+	}
+
+	p = lpSeek(node->entry, pos);
+	vstr = lpGetValue(p, &vlen, &vlong);
+	if (vstr) {
+		if (data)
+			*data = saver(vstr, vlen);
+		if (sz)
+			*sz = vlen;
+	} else {
+		if (data)
+			*data = NULL;
+		if (sval)
+			*sval = vlong;
+	}
+	quicklistDelIndex(quicklist, node, &p);
+	return 1;
+}
+
+/* ------------------------------- Benchmark ---------------------------------*/
+
+#ifdef QUICKLIST_BENCHMARK_MAIN
+
+#include <sys/time.h>
+#include "adlist.h"
+#include "sds.h"
+
+static long long ustime(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+/* 模拟任务队列中的一个任务 */
+static int fillJob(char *buf, size_t len, long id) {
+	return snprintf(buf,len,"{\"id\":%ld,\"queue\":\"emails\","
+			"\"tries\":0,\"payload\":\"user:%ld:welcome\"}", id, id%100000);
+}
+
+static void benchQuicklist(long count, int fill, int compress) {
+	size_t before = zmalloc_used_memory();
+	quicklist *ql = quicklistNew(fill,compress);
+	long long start, push_us, pop_us;
+	unsigned char *data;
+	char buf[128];
+	size_t sz;
+	long j;
+
+	start = ustime();
+	for (j = 0; j < count; j++) {
+		int len = fillJob(buf,sizeof(buf),j);
+		quicklistPushTail(ql,buf,len);
+	}
+	push_us = ustime()-start;
+	printf("quicklist fill=%d compress=%d: %.1f bytes/element, "
+		"%.1f bytes/element (quicklistBytes), push %.1f ns/op",
+		fill, compress,
+		(double)(zmalloc_used_memory()-before)/count,
+		(double)quicklistBytes(ql)/count,
+		(double)push_us*1000/count);
+
+	start = ustime();
+	while (quicklistPopCustom(ql,QUICKLIST_HEAD,&data,&sz,NULL,NULL)) zfree(data);
+	pop_us = ustime()-start;
+	printf(", pop %.1f ns/op\n", (double)pop_us*1000/count);
+	quicklistRelease(ql);
+}
+
+static void benchAdlist(long count) {
+	size_t before = zmalloc_used_memory();
+	list *l = listCreate();
+	long long start, push_us, pop_us;
+	char buf[128];
+	long j;
+
+	start = ustime();
+	for (j = 0; j < count; j++) {
+		int len = fillJob(buf,sizeof(buf),j);
+		listAddNodeTail(l,sdsnewlen(buf,len));
+	}
+	push_us = ustime()-start;
+	printf("adlist + sds: %.1f bytes/element, push %.1f ns/op",
+		(double)(zmalloc_used_memory()-before)/count,
+		(double)push_us*1000/count);
+
+	start = ustime();
+	while (listLength(l)) {
+		listNode *ln = listFirst(l);
+		sdsfree(ln->value);
+		listDelNode(l,ln);
+	}
+	pop_us = ustime()-start;
+	printf(", pop %.1f ns/op\n", (double)pop_us*1000/count);
+	listRelease(l);
+}
+
+/* quicklist-benchmark [count] */
+int main(int argc, char **argv) {
+	long count = (argc == 2) ? strtol(argv[1],NULL,10) : 1000000;
+
+	benchAdlist(count);
+	benchQuicklist(count,-2,0);
+	benchQuicklist(count,-2,1);
+	benchQuicklist(count,128,1);
+	return 0;
+}
+#endif
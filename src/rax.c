@@ -0,0 +1,489 @@
+/* Rax -- A radix tree implementation.
+ *
+ * Copyright (c) 2017, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include "rax.h"
+#include "zmalloc.h"
+
+/* This is a special pointer that is guaranteed to never have the same value
+ * of a radix tree node. It's used in order to report "not found" error without
+ * requiring the function to have multiple return values. */
+static int raxNotFoundMarker;
+void *raxNotFound = (void*)&raxNotFoundMarker;
+
+/* ------------------------------------------------------------------------- */
+/* 节点操作 */
+/* ------------------------------------------------------------------------- */
+
+static raxNode *raxNewNode(unsigned char *prefix, size_t plen) {
+	raxNode *n = zmalloc(sizeof(*n)+plen);
+
+	n->iskey = 0;
+	n->size = 0;
+	n->plen = plen;
+	n->data = NULL;
+	n->children = NULL;
+	if (plen) memcpy(n->prefix,prefix,plen);
+	return n;
+}
+
+/*
+ * 在子节点中二分查找第一个字节为c的节点
+ * 找到返回下标，否则返回-1，并在*pos中保存应该插入的位置
+ */
+static int raxFindChild(raxNode *n, unsigned char c, int *pos) {
+	int lo = 0, hi = (int)n->size-1;
+
+	while (lo <= hi) {
+		int mid = (lo+hi)/2;
+		unsigned char mc = n->children[mid]->prefix[0];
+
+		if (mc == c) return mid;
+		if (mc < c) lo = mid+1;
+		else hi = mid-1;
+	}
+	if (pos) *pos = lo;
+	return -1;
+}
+
+static void raxAddChild(raxNode *n, raxNode *child, int pos) {
+	n->children = zrealloc(n->children,sizeof(raxNode*)*(n->size+1));
+	memmove(n->children+pos+1,n->children+pos,
+		sizeof(raxNode*)*(n->size-pos));
+	n->children[pos] = child;
+	n->size++;
+}
+
+static void raxDelChild(raxNode *n, int pos) {
+	memmove(n->children+pos,n->children+pos+1,
+		sizeof(raxNode*)*(n->size-pos-1));
+	n->size--;
+	if (n->size == 0) {
+		zfree(n->children);
+		n->children = NULL;
+	}
+}
+
+static size_t raxCommonPrefix(unsigned char *a, size_t alen,
+	unsigned char *b, size_t blen)
+{
+	size_t i, max = alen < blen ? alen : blen;
+
+	for (i = 0; i < max && a[i] == b[i]; i++);
+	return i;
+}
+
+/* ------------------------------------------------------------------------- */
+/* 创建，查找，插入，删除 */
+/* ------------------------------------------------------------------------- */
+
+rax *raxNew(void) {
+	rax *r = zmalloc(sizeof(*r));
+
+	r->head = raxNewNode(NULL,0);
+	r->numele = 0;
+	r->numnodes = 1;
+	return r;
+}
+
+void *raxFind(rax *rax, unsigned char *s, size_t len) {
+	raxNode *n = rax->head;
+
+	while (len) {
+		int idx = raxFindChild(n,s[0],NULL);
+		raxNode *c;
+
+		if (idx == -1) return raxNotFound;
+		c = n->children[idx];
+		if (c->plen > len || memcmp(c->prefix,s,c->plen) != 0)
+			return raxNotFound;
+		s += c->plen;
+		len -= c->plen;
+		n = c;
+	}
+	return n->iskey ? n->data : raxNotFound;
+}
+
+/*
+ * 插入或者更新键s
+ * 新插入返回1，键已经存在时更新值，旧值保存在*old中，返回0
+ */
+int raxInsert(rax *rax, unsigned char *s, size_t len, void *data, void **old) {
+	raxNode *n = rax->head;
+
+	while (len) {
+		int pos, idx = raxFindChild(n,s[0],&pos);
+		raxNode *c;
+		size_t m;
+
+		if (idx == -1) {
+			/* 没有公共前缀的子节点，剩下的部分整个作为新的子节点 */
+			c = raxNewNode(s,len);
+			c->iskey = 1;
+			c->data = data;
+			raxAddChild(n,c,pos);
+			rax->numnodes++;
+			rax->numele++;
+			return 1;
+		}
+
+		c = n->children[idx];
+		m = raxCommonPrefix(c->prefix,c->plen,s,len);
+		if (m < c->plen) {
+			/*
+			 * 只匹配了子节点前缀的一部分，把子节点拆成两段：
+			 * 公共部分作为新的中间节点，剩下的部分还留在原来的节点中
+			 */
+			raxNode *mid = raxNewNode(c->prefix,m);
+
+			memmove(c->prefix,c->prefix+m,c->plen-m);
+			c->plen -= m;
+			raxAddChild(mid,c,0);
+			n->children[idx] = mid;
+			rax->numnodes++;
+			c = mid;
+		}
+		s += m;
+		len -= m;
+		n = c;
+	}
+
+	if (n->iskey) {
+		if (old) *old = n->data;
+		n->data = data;
+		return 0;
+	}
+	n->iskey = 1;
+	n->data = data;
+	rax->numele++;
+	return 1;
+}
+
+/*
+ * 删除键之后整理节点*ref：
+ * 没有子节点的非键节点直接释放，只有一个子节点的非键节点和子节点合并
+ */
+static void raxCompact(rax *rax, raxNode **ref, int isroot) {
+	raxNode *n = *ref, *c, *merged;
+
+	if (n->iskey || isroot) return;
+
+	if (n->size == 0) {
+		zfree(n);
+		*ref = NULL;
+		rax->numnodes--;
+	} else if (n->size == 1) {
+		c = n->children[0];
+		merged = zmalloc(sizeof(*merged)+n->plen+c->plen);
+		merged->plen = n->plen+c->plen;
+		memcpy(merged->prefix,n->prefix,n->plen);
+		memcpy(merged->prefix+n->plen,c->prefix,c->plen);
+		merged->iskey = c->iskey;
+		merged->data = c->data;
+		merged->size = c->size;
+		merged->children = c->children;
+		zfree(n->children);
+		zfree(n);
+		zfree(c);
+		*ref = merged;
+		rax->numnodes--;
+	}
+}
+
+static int raxRemoveFrom(rax *rax, raxNode **ref, int isroot,
+	unsigned char *s, size_t len, void **old)
+{
+	raxNode *n = *ref, *c;
+	int idx;
+
+	if (len == 0) {
+		if (!n->iskey) return 0;
+		if (old) *old = n->data;
+		n->iskey = 0;
+		n->data = NULL;
+		rax->numele--;
+		raxCompact(rax,ref,isroot);
+		return 1;
+	}
+
+	idx = raxFindChild(n,s[0],NULL);
+	if (idx == -1) return 0;
+	c = n->children[idx];
+	if (c->plen > len || memcmp(c->prefix,s,c->plen) != 0) return 0;
+	if (!raxRemoveFrom(rax,&n->children[idx],0,s+c->plen,len-c->plen,old))
+		return 0;
+	if (n->children[idx] == NULL) {
+		raxDelChild(n,idx);
+		raxCompact(rax,ref,isroot);
+	}
+	return 1;
+}
+
+/*
+ * 删除键s，成功返回1，键不存在返回0
+ */
+int raxRemove(rax *rax, unsigned char *s, size_t len, void **old) {
+	return raxRemoveFrom(rax,&rax->head,1,s,len,old);
+}
+
+static void raxFreeNode(rax *rax, raxNode *n, void (*free_callback)(void*)) {
+	uint32_t i;
+
+	for (i = 0; i < n->size; i++)
+		raxFreeNode(rax,n->children[i],free_callback);
+	if (free_callback && n->iskey) free_callback(n->data);
+	zfree(n->children);
+	zfree(n);
+	rax->numnodes--;
+}
+
+void raxFreeWithCallback(rax *rax, void (*free_callback)(void*)) {
+	raxFreeNode(rax,rax->head,free_callback);
+	zfree(rax);
+}
+
+void raxFree(rax *rax) {
+	raxFreeWithCallback(rax,NULL);
+}
+
+uint64_t raxSize(rax *rax) {
+	return rax->numele;
+}
+
+/* ------------------------------------------------------------------------- */
+/* 迭代器 */
+/* ------------------------------------------------------------------------- */
+
+void raxStart(raxIterator *it, rax *rt) {
+	it->flags = RAX_ITER_EOF;
+	it->rt = rt;
+	it->key_len = 0;
+	it->key = it->key_static_string;
+	it->key_max = RAX_ITER_STATIC_LEN;
+	it->data = NULL;
+}
+
+static void raxIteratorAppend(raxIterator *it, unsigned char *s, size_t len) {
+	if (it->key_len+len > it->key_max) {
+		size_t newmax = (it->key_len+len)*2;
+
+		if (it->key == it->key_static_string) {
+			it->key = zmalloc(newmax);
+			memcpy(it->key,it->key_static_string,it->key_len);
+		} else {
+			it->key = zrealloc(it->key,newmax);
+		}
+		it->key_max = newmax;
+	}
+	memcpy(it->key+it->key_len,s,len);
+	it->key_len += len;
+}
+
+/* 子树中最小的键 */
+static raxNode *raxSeekLeftmost(raxIterator *it, raxNode *n) {
+	while (!n->iskey) {
+		if (n->size == 0) return NULL;
+		n = n->children[0];
+		raxIteratorAppend(it,n->prefix,n->plen);
+	}
+	return n;
+}
+
+/* 子树中最大的键，也就是最深的最后一个子节点 */
+static raxNode *raxSeekRightmost(raxIterator *it, raxNode *n) {
+	while (n->size) {
+		n = n->children[n->size-1];
+		raxIteratorAppend(it,n->prefix,n->plen);
+	}
+	return n->iskey ? n : NULL;
+}
+
+/*
+ * 在n的子树中查找大于(inclusive时大于等于)s的最小的键，n的前缀已经匹配
+ */
+static raxNode *raxSeekGreater(raxIterator *it, raxNode *n,
+	unsigned char *s, size_t len, int inclusive)
+{
+	size_t saved = it->key_len;
+	uint32_t i;
+
+	if (len == 0) {
+		if (inclusive && n->iskey) return n;
+		/* 子节点的键都以s为前缀，都比s大 */
+		if (n->size == 0) return NULL;
+		n = n->children[0];
+		raxIteratorAppend(it,n->prefix,n->plen);
+		return raxSeekLeftmost(it,n);
+	}
+
+	/* n本身的键是s的真前缀，比s小，只需要看子节点 */
+	for (i = 0; i < n->size; i++) {
+		raxNode *c = n->children[i], *found;
+
+		if (c->prefix[0] < s[0]) continue;
+		it->key_len = saved;
+		raxIteratorAppend(it,c->prefix,c->plen);
+		if (c->prefix[0] > s[0]) return raxSeekLeftmost(it,c);
+
+		size_t m = c->plen < len ? c->plen : len;
+		int cmp = memcmp(c->prefix,s,m);
+
+		if (cmp < 0) continue;
+		if (cmp > 0 || c->plen > len) return raxSeekLeftmost(it,c);
+		found = raxSeekGreater(it,c,s+c->plen,len-c->plen,inclusive);
+		if (found) return found;
+	}
+	it->key_len = saved;
+	return NULL;
+}
+
+/*
+ * 在n的子树中查找小于(inclusive时小于等于)s的最大的键，n的前缀已经匹配
+ */
+static raxNode *raxSeekLess(raxIterator *it, raxNode *n,
+	unsigned char *s, size_t len, int inclusive)
+{
+	size_t saved = it->key_len;
+	int i;
+
+	if (len == 0) {
+		/* 子节点的键都比s大 */
+		return (inclusive && n->iskey) ? n : NULL;
+	}
+
+	for (i = (int)n->size-1; i >= 0; i--) {
+		raxNode *c = n->children[i], *found;
+
+		if (c->prefix[0] > s[0]) continue;
+		it->key_len = saved;
+		raxIteratorAppend(it,c->prefix,c->plen);
+		if (c->prefix[0] < s[0]) return raxSeekRightmost(it,c);
+
+		size_t m = c->plen < len ? c->plen : len;
+		int cmp = memcmp(c->prefix,s,m);
+
+		if (cmp > 0 || (cmp == 0 && c->plen > len)) continue;
+		if (cmp < 0) return raxSeekRightmost(it,c);
+		found = raxSeekLess(it,c,s+c->plen,len-c->plen,inclusive);
+		if (found) return found;
+	}
+	it->key_len = saved;
+	/* n本身的键是s的真前缀，比s小 */
+	return n->iskey ? n : NULL;
+}
+
+static int raxSeekInternal(raxIterator *it, const char *op,
+	unsigned char *ele, size_t len)
+{
+	raxNode *found = NULL;
+
+	it->key_len = 0;
+	if (op[0] == '^' && op[1] == '\0') {
+		found = raxSeekLeftmost(it,it->rt->head);
+	} else if (op[0] == '$' && op[1] == '\0') {
+		found = raxSeekRightmost(it,it->rt->head);
+	} else if (op[0] == '=' && op[1] == '=' && op[2] == '\0') {
+		void *data = raxFind(it->rt,ele,len);
+
+		if (data != raxNotFound) {
+			raxIteratorAppend(it,ele,len);
+			it->data = data;
+			return 1;
+		}
+	} else if (op[0] == '>') {
+		found = raxSeekGreater(it,it->rt->head,ele,len,op[1] == '=');
+	} else if (op[0] == '<') {
+		found = raxSeekLess(it,it->rt->head,ele,len,op[1] == '=');
+	}
+
+	if (found == NULL) return 0;
+	it->data = found->data;
+	return 1;
+}
+
+/*
+ * 把迭代器定位到满足op的第一个元素，op可以是">", ">=", "<", "<=", "==",
+ * "^"(第一个元素)和"$"(最后一个元素)
+ * 之后第一次调用raxNext()/raxPrev()返回定位到的元素，op不合法时返回0
+ */
+int raxSeek(raxIterator *it, const char *op, unsigned char *ele, size_t len) {
+	unsigned char buf[RAX_ITER_STATIC_LEN], *copy = buf;
+	int found;
+
+	if (strcmp(op,">") && strcmp(op,">=") && strcmp(op,"<") &&
+		strcmp(op,"<=") && strcmp(op,"==") && strcmp(op,"^") &&
+		strcmp(op,"$"))
+		return 0;
+
+	/* ele可能就是it->key，先复制一份 */
+	if (len > sizeof(buf)) copy = zmalloc(len);
+	if (len) memcpy(copy,ele,len);
+	found = raxSeekInternal(it,op,copy,len);
+	if (copy != buf) zfree(copy);
+
+	it->flags = found ? RAX_ITER_JUST_SEEKED : RAX_ITER_EOF;
+	return 1;
+}
+
+static int raxStep(raxIterator *it, const char *op) {
+	if (it->flags & RAX_ITER_EOF) return 0;
+	if (it->flags & RAX_ITER_JUST_SEEKED) {
+		it->flags &= ~RAX_ITER_JUST_SEEKED;
+		return 1;
+	}
+	if (!raxSeek(it,op,it->key,it->key_len) || (it->flags & RAX_ITER_EOF))
+		return 0;
+	it->flags &= ~RAX_ITER_JUST_SEEKED;
+	return 1;
+}
+
+/*
+ * 移动到下一个(上一个)元素，键和值保存在it->key和it->data中，
+ * 没有更多元素时返回0
+ */
+int raxNext(raxIterator *it) {
+	return raxStep(it,">");
+}
+
+int raxPrev(raxIterator *it) {
+	return raxStep(it,"<");
+}
+
+int raxEOF(raxIterator *it) {
+	return it->flags & RAX_ITER_EOF;
+}
+
+void raxStop(raxIterator *it) {
+	if (it->key != it->key_static_string) zfree(it->key);
+	it->key = it->key_static_string;
+	it->key_max = RAX_ITER_STATIC_LEN;
+	it->key_len = 0;
+}
@@ -0,0 +1,93 @@
+/* Rax -- A radix tree implementation.
+ *
+ * Copyright (c) 2017, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RAX_H
+#define __RAX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 压缩前缀树，键按字节比较，可以按顺序遍历
+ * 每个节点保存从父节点到它的一段前缀，子节点按前缀的第一个字节升序排列；
+ * 不是键并且只有一个子节点的节点会和子节点合并，根节点的前缀总是空的
+ */
+typedef struct raxNode {
+    uint32_t iskey:1;           /* 从根到这个节点的路径是一个键 */
+    uint32_t size:31;           /* 子节点数量 */
+    uint32_t plen;              /* 前缀长度 */
+    void *data;                 /* 键对应的值 */
+    struct raxNode **children;  /* 子节点，按前缀的第一个字节排序 */
+    unsigned char prefix[];
+} raxNode;
+
+typedef struct rax {
+    raxNode *head;
+    uint64_t numele;
+    uint64_t numnodes;
+} rax;
+
+/*
+ * 迭代器只保存当前的键，每一步都从根开始查找下一个键，
+ * 所以遍历过程中可以修改树
+ */
+#define RAX_ITER_STATIC_LEN 128
+#define RAX_ITER_JUST_SEEKED (1<<0) /* raxSeek()之后第一次调用raxNext()/raxPrev()
+                                       直接返回定位到的元素 */
+#define RAX_ITER_EOF (1<<1)         /* 没有更多元素了 */
+
+typedef struct raxIterator {
+    int flags;
+    rax *rt;                /* 遍历的树 */
+    unsigned char *key;     /* 当前键 */
+    void *data;             /* 当前键对应的值 */
+    size_t key_len;
+    size_t key_max;         /* key缓冲区的大小 */
+    unsigned char key_static_string[RAX_ITER_STATIC_LEN];
+} raxIterator;
+
+/* A special pointer returned for not found items. */
+extern void *raxNotFound;
+
+rax *raxNew(void);
+int raxInsert(rax *rax, unsigned char *s, size_t len, void *data, void **old);
+int raxRemove(rax *rax, unsigned char *s, size_t len, void **old);
+void *raxFind(rax *rax, unsigned char *s, size_t len);
+void raxFree(rax *rax);
+void raxFreeWithCallback(rax *rax, void (*free_callback)(void*));
+void raxStart(raxIterator *it, rax *rt);
+int raxSeek(raxIterator *it, const char *op, unsigned char *ele, size_t len);
+int raxNext(raxIterator *it);
+int raxPrev(raxIterator *it);
+void raxStop(raxIterator *it);
+int raxEOF(raxIterator *it);
+uint64_t raxSize(rax *rax);
+
+#endif
@@ -0,0 +1,1705 @@
+/*
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "rdb.h"
+#include "util.h"
+#include "zmalloc.h"
+#include "atomicvar.h"
+#include "listpack.h"
+#include "lzf.h"
+#include "intset.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <strings.h>
+
+/* 加载时每个section在索引中的描述，以及解码后的暂存数组 */
+typedef struct rdbSection {
+	int dbid;
+	uint64_t nkeys;
+	uint64_t offset;        /* payload在文件中的偏移量 */
+	uint64_t len;           /* payload长度 */
+	sds *keys;              /* 解码线程填充的暂存数组 */
+	robj **vals;
+	uint64_t loaded;        /* 暂存数组中已解码的键值对数量 */
+} rdbSection;
+
+/* 多个加载线程共享的状态 */
+typedef struct rdbLoadJob {
+	int fd;
+	unsigned char *map;     /* 懒加载模式下整个文件的只读映射，否则为NULL */
+	rdbSection *sections;
+	int nsections;
+	int next;               /* 下一个待解码的section，线程间原子递增 */
+	int error;
+} rdbLoadJob;
+
+/* 每个加载线程的统计信息 */
+typedef struct rdbLoadWorker {
+	pthread_t tid;
+	rdbLoadJob *job;
+	long long io_us;
+	long long decode_us;
+} rdbLoadWorker;
+
+/* ------------------------------ 编码 ------------------------------------ */
+
+/* 把长度按照RDB_*BITLEN格式追加到s中 */
+static sds rdbEncodeLen(sds s, uint64_t len) {
+	unsigned char buf[9];
+	size_t nwritten;
+
+	if (len < (1<<6)) {
+		/* Save a 6 bit len */
+		buf[0] = (len&0xFF)|(RDB_6BITLEN<<6);
+		nwritten = 1;
+	} else if (len < (1<<14)) {
+		/* Save a 14 bit len */
+		buf[0] = ((len>>8)&0xFF)|(RDB_14BITLEN<<6);
+		buf[1] = len&0xFF;
+		nwritten = 2;
+	} else if (len <= UINT32_MAX) {
+		/* Save a 32 bit len */
+		buf[0] = RDB_32BITLEN;
+		buf[1] = (len>>24)&0xFF;
+		buf[2] = (len>>16)&0xFF;
+		buf[3] = (len>>8)&0xFF;
+		buf[4] = len&0xFF;
+		nwritten = 5;
+	} else {
+		/* Save a 64 bit len */
+		int j;
+		buf[0] = RDB_64BITLEN;
+		for (j = 0; j < 8; j++) buf[1+j] = (len>>(56-j*8))&0xFF;
+		nwritten = 9;
+	}
+	return sdscatlen(s,buf,nwritten);
+}
+
+static sds rdbEncodeRawString(sds s, const char *p, size_t len) {
+	s = rdbEncodeLen(s,len);
+	return sdscatlen(s,p,len);
+}
+
+static int rdbDecodeRawString(unsigned char **pp, unsigned char *end,
+		char **strp, size_t *lenp);
+
+/* 编码一个字符串对象，整数编码的对象先转换成字符串 */
+static sds rdbEncodeStringObject(sds s, robj *o) {
+	if (o->encoding == OBJ_ENCODING_INT) {
+		char buf[LONG_STR_SIZE];
+		int len = ll2string(buf,sizeof(buf),(long)o->ptr);
+		return rdbEncodeRawString(s,buf,len);
+	} else if (o->encoding == OBJ_ENCODING_DISKREF) {
+		/* 还没有被访问过的值，直接从映射中拷贝，不需要物化成对象 */
+		unsigned char *p = o->ptr;
+		char *str;
+		size_t len;
+
+		if (rdbDecodeRawString(&p,server.rdb_map+server.rdb_map_size,
+				&str,&len) == C_ERR)
+		{
+			serverPanic("corrupted disk reference value");
+		}
+		return rdbEncodeRawString(s,str,len);
+	}
+	return rdbEncodeRawString(s,o->ptr,sdslen(o->ptr));
+}
+
+/*
+ * 编码一个快速列表：节点数 + 每个节点的listpack
+ * 压缩过的节点先解压，文件中保存的都是原始的listpack，加载时可以直接使用
+ */
+static sds rdbEncodeQuicklistObject(sds s, robj *o) {
+	quicklist *ql = o->ptr;
+	quicklistNode *node = ql->head;
+
+	s = rdbEncodeLen(s,ql->len);
+	while (node) {
+		if (quicklistNodeIsCompressed(node)) {
+			void *data;
+			size_t compress_len = quicklistGetLzf(node,&data);
+			unsigned char *lp = zmalloc(node->sz);
+
+			if (lzf_decompress(data,compress_len,lp,node->sz) == 0) {
+				serverPanic("LZF decompression failed");
+			}
+			s = rdbEncodeRawString(s,(char*)lp,node->sz);
+			zfree(lp);
+		} else {
+			s = rdbEncodeRawString(s,(char*)node->entry,node->sz);
+		}
+		node = node->next;
+	}
+	return s;
+}
+
+/* 编码一个字典编码的哈希对象：field数 + field/value对 */
+static sds rdbEncodeHashTableObject(sds s, robj *o) {
+	dictIterator *di = dictGetIterator(o->ptr);
+	dictEntry *de;
+
+	s = rdbEncodeLen(s,dictSize((dict*)o->ptr));
+	while ((de = dictNext(di)) != NULL) {
+		sds field = dictGetKey(de), value = dictGetVal(de);
+
+		s = rdbEncodeRawString(s,field,sdslen(field));
+		s = rdbEncodeRawString(s,value,sdslen(value));
+	}
+	dictReleaseIterator(di);
+	return s;
+}
+
+/* 编码一个字典编码的集合对象：元素数 + 元素 */
+static sds rdbEncodeSetObject(sds s, robj *o) {
+	dictIterator *di = dictGetIterator(o->ptr);
+	dictEntry *de;
+
+	s = rdbEncodeLen(s,dictSize((dict*)o->ptr));
+	while ((de = dictNext(di)) != NULL) {
+		sds ele = dictGetKey(de);
+		s = rdbEncodeRawString(s,ele,sdslen(ele));
+	}
+	dictReleaseIterator(di);
+	return s;
+}
+
+/*
+ * 编码一个跳跃表编码的有序集合：元素数 + 元素/score对
+ * score以8字节小端序的二进制double保存，不经过字符串转换，加载时不会损失精度
+ */
+static sds rdbEncodeZsetObject(sds s, robj *o) {
+	zskiplist *zsl = ((zset*)o->ptr)->zsl;
+	zskiplistNode *ln = zsl->header->level[0].forward;
+
+	s = rdbEncodeLen(s,zsl->length);
+	while (ln) {
+		unsigned char buf[8];
+		uint64_t bits;
+		int j;
+
+		memcpy(&bits,&ln->score,sizeof(bits));
+		for (j = 0; j < 8; j++) buf[j] = (bits>>(j*8))&0xFF;
+		s = rdbEncodeRawString(s,ln->ele,sdslen(ln->ele));
+		s = sdscatlen(s,buf,sizeof(buf));
+		ln = ln->level[0].forward;
+	}
+	return s;
+}
+
+/*
+ * 编码一个流：块数 + 每个块的(16字节的master ID, listpack) + 元素个数 + 最后的ID
+ * 块的listpack原样保存，加载时校验之后直接插入前缀树
+ */
+static sds rdbEncodeStreamObject(sds s, robj *o) {
+	stream *st = o->ptr;
+	raxIterator ri;
+
+	s = rdbEncodeLen(s,raxSize(st->rax));
+	raxStart(&ri,st->rax);
+	raxSeek(&ri,"^",NULL,0);
+	while (raxNext(&ri)) {
+		unsigned char *lp = ri.data;
+
+		s = rdbEncodeRawString(s,(char*)ri.key,ri.key_len);
+		s = rdbEncodeRawString(s,(char*)lp,lpBytes(lp));
+	}
+	raxStop(&ri);
+	s = rdbEncodeLen(s,st->length);
+	s = rdbEncodeLen(s,st->last_id.ms);
+	s = rdbEncodeLen(s,st->last_id.seq);
+	return s;
+}
+
+/* 返回值对象在RDB中的类型 */
+static unsigned char rdbObjectType(robj *o) {
+	switch (o->type) {
+	case OBJ_LIST:
+		return RDB_TYPE_LIST_QUICKLIST;
+	case OBJ_SET:
+		return (o->encoding == OBJ_ENCODING_INTSET) ?
+			RDB_TYPE_SET_INTSET : RDB_TYPE_SET;
+	case OBJ_HASH:
+		return (o->encoding == OBJ_ENCODING_LISTPACK) ?
+			RDB_TYPE_HASH_LISTPACK : RDB_TYPE_HASH;
+	case OBJ_ZSET:
+		return (o->encoding == OBJ_ENCODING_LISTPACK) ?
+			RDB_TYPE_ZSET_LISTPACK : RDB_TYPE_ZSET_2;
+	case OBJ_STREAM:
+		return RDB_TYPE_STREAM_LISTPACKS;
+	default:
+		return RDB_TYPE_STRING;
+	}
+}
+
+/* 编码一个键值对：类型 + key + value */
+static sds rdbEncodeKeyValuePair(sds s, sds key, robj *val) {
+	unsigned char type = rdbObjectType(val);
+
+	s = sdscatlen(s,&type,1);
+	s = rdbEncodeRawString(s,key,sdslen(key));
+	switch (type) {
+	case RDB_TYPE_LIST_QUICKLIST:
+		return rdbEncodeQuicklistObject(s,val);
+	case RDB_TYPE_SET_INTSET:
+		/* intset在内存中就是小端序的，直接作为字符串保存 */
+		return rdbEncodeRawString(s,val->ptr,intsetBlobLen(val->ptr));
+	case RDB_TYPE_SET:
+		return rdbEncodeSetObject(s,val);
+	case RDB_TYPE_HASH_LISTPACK:
+		/* listpack本身就是连续的内存，直接作为字符串保存 */
+		return rdbEncodeRawString(s,val->ptr,lpBytes(val->ptr));
+	case RDB_TYPE_HASH:
+		return rdbEncodeHashTableObject(s,val);
+	case RDB_TYPE_ZSET_LISTPACK:
+		return rdbEncodeRawString(s,val->ptr,lpBytes(val->ptr));
+	case RDB_TYPE_ZSET_2:
+		return rdbEncodeZsetObject(s,val);
+	case RDB_TYPE_STREAM_LISTPACKS:
+		return rdbEncodeStreamObject(s,val);
+	default:
+		return rdbEncodeStringObject(s,val);
+	}
+}
+
+/* ------------------------------ 解码 ------------------------------------ */
+
+static int rdbDecodeLen(unsigned char **pp, unsigned char *end, uint64_t *lenp) {
+	unsigned char *p = *pp;
+	int type, j;
+
+	if (p >= end) return C_ERR;
+	type = (p[0]&0xC0)>>6;
+	if (type == RDB_6BITLEN) {
+		*lenp = p[0]&0x3F;
+		p += 1;
+	} else if (type == RDB_14BITLEN) {
+		if (end-p < 2) return C_ERR;
+		*lenp = ((uint64_t)(p[0]&0x3F)<<8)|p[1];
+		p += 2;
+	} else if (p[0] == RDB_32BITLEN) {
+		if (end-p < 5) return C_ERR;
+		*lenp = ((uint64_t)p[1]<<24)|((uint64_t)p[2]<<16)|
+			((uint64_t)p[3]<<8)|p[4];
+		p += 5;
+	} else if (p[0] == RDB_64BITLEN) {
+		if (end-p < 9) return C_ERR;
+		*lenp = 0;
+		for (j = 0; j < 8; j++) *lenp = (*lenp<<8)|p[1+j];
+		p += 9;
+	} else {
+		return C_ERR;
+	}
+	*pp = p;
+	return C_OK;
+}
+
+/* 解码一个字符串，返回指向buffer内部的指针，不做拷贝 */
+static int rdbDecodeRawString(unsigned char **pp, unsigned char *end,
+		char **strp, size_t *lenp)
+{
+	uint64_t len;
+
+	if (rdbDecodeLen(pp,end,&len) == C_ERR) return C_ERR;
+	if ((uint64_t)(end-*pp) < len) return C_ERR;
+	*strp = (char*)*pp;
+	*lenp = len;
+	*pp += len;
+	return C_OK;
+}
+
+/*
+ * 创建一个指向映射文件中已编码值的对象，值在第一次被访问时才解码
+ * 每个这样的对象都持有一个映射的引用
+ */
+static robj *createDiskRefObject(unsigned char *p) {
+	robj *o = createObject(OBJ_STRING,p);
+	o->encoding = OBJ_ENCODING_DISKREF;
+	atomicIncr(server.rdb_map_refs,1);
+	return o;
+}
+
+/*
+ * 解码一个快速列表，每个listpack校验之后拷贝一份直接作为节点
+ * 列表、集合和哈希总是立即解码，不使用懒加载
+ */
+static robj *rdbDecodeQuicklistObject(unsigned char **pp, unsigned char *end) {
+	uint64_t len;
+	char *lp;
+	size_t lplen;
+	robj *o;
+
+	if (rdbDecodeLen(pp,end,&len) == C_ERR || len == 0) return NULL;
+	o = createQuicklistObject();
+	quicklistSetOptions(o->ptr,server.list_max_ziplist_size,
+			server.list_compress_depth);
+	while (len--) {
+		unsigned char *copy;
+
+		if (rdbDecodeRawString(pp,end,&lp,&lplen) == C_ERR ||
+			!lpValidate((unsigned char*)lp,lplen))
+		{
+			decrRefCount(o);
+			return NULL;
+		}
+		/* 空的listpack直接跳过 */
+		if (lpLength((unsigned char*)lp) == 0) continue;
+		copy = zmalloc(lplen);
+		memcpy(copy,lp,lplen);
+		quicklistAppendListpack(o->ptr,copy);
+	}
+	if (quicklistCount(o->ptr) == 0) {
+		decrRefCount(o);
+		return NULL;
+	}
+	return o;
+}
+
+/*
+ * 解码一个intset编码的集合对象，超过当前配置的限制时转换成字典编码
+ */
+static robj *rdbDecodeIntsetObject(unsigned char **pp, unsigned char *end) {
+	char *is;
+	size_t islen;
+	robj *o;
+
+	if (rdbDecodeRawString(pp,end,&is,&islen) == C_ERR ||
+		!intsetValidateIntegrity((unsigned char*)is,islen)) return NULL;
+	o = createObject(OBJ_SET,zmalloc(islen));
+	o->encoding = OBJ_ENCODING_INTSET;
+	memcpy(o->ptr,is,islen);
+	if (intsetLen(o->ptr) > server.set_max_intset_entries)
+		setTypeConvert(o,OBJ_ENCODING_HT);
+	return o;
+}
+
+/*
+ * 解码一个字典编码的集合对象，元素都是整数并且数量不超过限制时重新编码成intset
+ */
+static robj *rdbDecodeSetObject(unsigned char **pp, unsigned char *end) {
+	uint64_t len;
+	char *ele;
+	size_t elelen;
+	robj *o;
+
+	if (rdbDecodeLen(pp,end,&len) == C_ERR || len == 0) return NULL;
+	if (len > server.set_max_intset_entries) {
+		o = createSetObject();
+		if (len > DICT_HT_INITIAL_SIZE) dictExpand(o->ptr,len);
+	} else {
+		o = createIntsetObject();
+	}
+
+	while (len--) {
+		sds sdsele;
+
+		if (rdbDecodeRawString(pp,end,&ele,&elelen) == C_ERR) {
+			decrRefCount(o);
+			return NULL;
+		}
+		sdsele = sdsnewlen(ele,elelen);
+		if (!setTypeAdd(o,sdsele)) {
+			/* 重复的元素说明文件已经损坏 */
+			sdsfree(sdsele);
+			decrRefCount(o);
+			return NULL;
+		}
+		sdsfree(sdsele);
+	}
+	return o;
+}
+
+/*
+ * 解码一个listpack编码的哈希对象，超过当前配置的限制时转换成字典编码
+ */
+static robj *rdbDecodeHashListpackObject(unsigned char **pp, unsigned char *end) {
+	char *lp;
+	size_t lplen;
+	unsigned char *copy, *p;
+	unsigned long len;
+	int convert = 0;
+	robj *o;
+
+	if (rdbDecodeRawString(pp,end,&lp,&lplen) == C_ERR ||
+		!lpValidate((unsigned char*)lp,lplen)) return NULL;
+	len = lpLength((unsigned char*)lp);
+	if (len == 0 || len % 2) return NULL;
+
+	copy = zmalloc(lplen);
+	memcpy(copy,lp,lplen);
+	o = createObject(OBJ_HASH,copy);
+	o->encoding = OBJ_ENCODING_LISTPACK;
+
+	if (len/2 > server.hash_max_ziplist_entries) convert = 1;
+	for (p = lpFirst(copy); p && !convert; p = lpNext(copy,p)) {
+		unsigned int vlen;
+		long long vll;
+
+		if (lpGetValue(p,&vlen,&vll) && vlen > server.hash_max_ziplist_value)
+			convert = 1;
+	}
+	if (convert) hashTypeConvert(o,OBJ_ENCODING_HT);
+	return o;
+}
+
+/*
+ * 解码一个字典编码的哈希对象，数量和长度都在限制之内时重新编码成listpack
+ */
+static robj *rdbDecodeHashTableObject(unsigned char **pp, unsigned char *end) {
+	uint64_t len;
+	char *field, *value;
+	size_t flen, vlen;
+	robj *o;
+
+	if (rdbDecodeLen(pp,end,&len) == C_ERR || len == 0) return NULL;
+	o = createHashObject();
+	if (len > server.hash_max_ziplist_entries)
+		hashTypeConvert(o,OBJ_ENCODING_HT);
+
+	while (len--) {
+		if (rdbDecodeRawString(pp,end,&field,&flen) == C_ERR ||
+			rdbDecodeRawString(pp,end,&value,&vlen) == C_ERR)
+		{
+			decrRefCount(o);
+			return NULL;
+		}
+		if (o->encoding == OBJ_ENCODING_LISTPACK &&
+			(flen > server.hash_max_ziplist_value ||
+			 vlen > server.hash_max_ziplist_value))
+		{
+			hashTypeConvert(o,OBJ_ENCODING_HT);
+		}
+		if (o->encoding == OBJ_ENCODING_LISTPACK) {
+			/* 文件中的field不会重复，直接追加，不需要查找 */
+			o->ptr = lpAppend(o->ptr,(unsigned char*)field,flen);
+			o->ptr = lpAppend(o->ptr,(unsigned char*)value,vlen);
+		} else {
+			sds f = sdsnewlen(field,flen), v = sdsnewlen(value,vlen);
+
+			if (dictAdd(o->ptr,f,v) != DICT_OK) {
+				sdsfree(f);
+				sdsfree(v);
+				decrRefCount(o);
+				return NULL;
+			}
+		}
+	}
+	return o;
+}
+
+/*
+ * 解码一个listpack编码的有序集合，超过当前配置的限制时转换成跳跃表编码
+ */
+static robj *rdbDecodeZsetListpackObject(unsigned char **pp, unsigned char *end) {
+	char *lp;
+	size_t lplen;
+	unsigned char *copy, *p;
+	unsigned long len;
+	int convert = 0;
+	robj *o;
+
+	if (rdbDecodeRawString(pp,end,&lp,&lplen) == C_ERR ||
+		!lpValidate((unsigned char*)lp,lplen)) return NULL;
+	len = lpLength((unsigned char*)lp);
+	if (len == 0 || len % 2) return NULL;
+
+	copy = zmalloc(lplen);
+	memcpy(copy,lp,lplen);
+	o = createObject(OBJ_ZSET,copy);
+	o->encoding = OBJ_ENCODING_LISTPACK;
+
+	if (len/2 > server.zset_max_ziplist_entries) convert = 1;
+	for (p = lpFirst(copy); p && !convert; p = lpNext(copy,p)) {
+		unsigned int vlen;
+		long long vll;
+
+		if (lpGetValue(p,&vlen,&vll) && vlen > server.zset_max_ziplist_value)
+			convert = 1;
+		p = lpNext(copy,p); /* 跳过score */
+	}
+	if (convert) zsetConvert(o,OBJ_ENCODING_SKIPLIST);
+	return o;
+}
+
+/*
+ * 解码一个跳跃表编码的有序集合，数量和长度都在限制之内时重新编码成listpack
+ */
+static robj *rdbDecodeZsetObject(unsigned char **pp, unsigned char *end) {
+	uint64_t len, bits;
+	char *ele;
+	size_t elelen;
+	robj *o;
+
+	if (rdbDecodeLen(pp,end,&len) == C_ERR || len == 0) return NULL;
+	if (len > server.zset_max_ziplist_entries) {
+		o = createZsetObject();
+		if (len > DICT_HT_INITIAL_SIZE)
+			dictExpand(((zset*)o->ptr)->dict,len);
+	} else {
+		o = createZsetListpackObject();
+	}
+
+	while (len--) {
+		sds sdsele;
+		double score;
+		int flags, j;
+
+		if (rdbDecodeRawString(pp,end,&ele,&elelen) == C_ERR ||
+			end-*pp < 8)
+		{
+			decrRefCount(o);
+			return NULL;
+		}
+		bits = 0;
+		for (j = 7; j >= 0; j--) bits = (bits<<8)|(*pp)[j];
+		memcpy(&score,&bits,sizeof(score));
+		*pp += 8;
+
+		sdsele = sdsnewlen(ele,elelen);
+		if (!zsetAdd(o,score,sdsele,ZADD_IN_NX,&flags,NULL) ||
+			!(flags & ZADD_OUT_ADDED))
+		{
+			/* score为NaN或者重复的元素说明文件已经损坏 */
+			sdsfree(sdsele);
+			decrRefCount(o);
+			return NULL;
+		}
+		sdsfree(sdsele);
+	}
+	return o;
+}
+
+/*
+ * 解码一个流，每个块的listpack校验之后拷贝一份插入前缀树
+ * 块的键必须是16字节的ID并且不能重复，每个listpack至少包含master entry
+ */
+static robj *rdbDecodeStreamObject(unsigned char **pp, unsigned char *end) {
+	uint64_t nodes, length, ms, seq;
+	char *key, *lp;
+	size_t keylen, lplen;
+	robj *o = createStreamObject();
+	stream *s = o->ptr;
+
+	if (rdbDecodeLen(pp,end,&nodes) == C_ERR) goto err;
+	while (nodes--) {
+		unsigned char *copy;
+
+		if (rdbDecodeRawString(pp,end,&key,&keylen) == C_ERR ||
+			keylen != sizeof(streamID) ||
+			rdbDecodeRawString(pp,end,&lp,&lplen) == C_ERR ||
+			!lpValidate((unsigned char*)lp,lplen) ||
+			lpFirst((unsigned char*)lp) == NULL) goto err;
+		copy = zmalloc(lplen);
+		memcpy(copy,lp,lplen);
+		if (!raxInsert(s->rax,(unsigned char*)key,keylen,copy,NULL)) {
+			zfree(copy);
+			goto err;
+		}
+	}
+	if (rdbDecodeLen(pp,end,&length) == C_ERR ||
+		rdbDecodeLen(pp,end,&ms) == C_ERR ||
+		rdbDecodeLen(pp,end,&seq) == C_ERR) goto err;
+	s->length = length;
+	s->last_id.ms = ms;
+	s->last_id.seq = seq;
+	return o;
+
+err:
+	decrRefCount(o);
+	return NULL;
+}
+
+/* 把一个section的payload解码到它的暂存数组中，lazy为真时只解码字符串的key */
+static int rdbDecodeSection(rdbSection *sec, unsigned char *buf, int lazy) {
+	unsigned char *p = buf, *end = buf+sec->len, *valp;
+	char *key, *val;
+	size_t keylen, vallen;
+	robj *o;
+	int type;
+
+	sec->keys = zmalloc(sizeof(sds)*sec->nkeys);
+	sec->vals = zmalloc(sizeof(robj*)*sec->nkeys);
+	while (sec->loaded < sec->nkeys) {
+		if (p >= end) return C_ERR;
+		type = *p++;
+		if (rdbDecodeRawString(&p,end,&key,&keylen) == C_ERR) return C_ERR;
+		if (type == RDB_TYPE_STRING) {
+			valp = p;
+			if (rdbDecodeRawString(&p,end,&val,&vallen) == C_ERR)
+				return C_ERR;
+			o = lazy ? createDiskRefObject(valp) :
+				createStringObject(val,vallen);
+		} else if (type == RDB_TYPE_LIST_QUICKLIST) {
+			if ((o = rdbDecodeQuicklistObject(&p,end)) == NULL) return C_ERR;
+		} else if (type == RDB_TYPE_SET_INTSET) {
+			if ((o = rdbDecodeIntsetObject(&p,end)) == NULL) return C_ERR;
+		} else if (type == RDB_TYPE_SET) {
+			if ((o = rdbDecodeSetObject(&p,end)) == NULL) return C_ERR;
+		} else if (type == RDB_TYPE_HASH_LISTPACK) {
+			if ((o = rdbDecodeHashListpackObject(&p,end)) == NULL) return C_ERR;
+		} else if (type == RDB_TYPE_HASH) {
+			if ((o = rdbDecodeHashTableObject(&p,end)) == NULL) return C_ERR;
+		} else if (type == RDB_TYPE_ZSET_LISTPACK) {
+			if ((o = rdbDecodeZsetListpackObject(&p,end)) == NULL) return C_ERR;
+		} else if (type == RDB_TYPE_ZSET_2) {
+			if ((o = rdbDecodeZsetObject(&p,end)) == NULL) return C_ERR;
+		} else if (type == RDB_TYPE_STREAM_LISTPACKS) {
+			if ((o = rdbDecodeStreamObject(&p,end)) == NULL) return C_ERR;
+		} else {
+			return C_ERR;
+		}
+		sec->keys[sec->loaded] = sdsnewlen(key,keylen);
+		sec->vals[sec->loaded] = o;
+		sec->loaded++;
+	}
+	return (p == end) ? C_OK : C_ERR;
+}
+
+/* ------------------------------ 懒加载 ---------------------------------- */
+
+/* 释放一个映射引用，最后一个引用释放时解除映射 */
+static void rdbReleaseMapRef(void) {
+	unsigned long refs;
+
+	atomicDecr(server.rdb_map_refs,1);
+	atomicGet(server.rdb_map_refs,refs);
+	if (refs == 0 && server.rdb_map) {
+		munmap(server.rdb_map,server.rdb_map_size);
+		server.rdb_map = NULL;
+		server.rdb_map_size = 0;
+	}
+}
+
+/*
+ * 把OBJ_ENCODING_DISKREF编码的对象原地解码成RAW编码的字符串对象
+ * 原地转换保证所有持有这个对象的地方都能看到解码后的值
+ */
+void rdbMaterializeObject(robj *o) {
+	unsigned char *p = o->ptr;
+	char *str;
+	size_t len;
+
+	if (o->encoding != OBJ_ENCODING_DISKREF) return;
+	/* 加载时已经校验过长度，失败说明映射被破坏了 */
+	if (rdbDecodeRawString(&p,server.rdb_map+server.rdb_map_size,
+			&str,&len) == C_ERR)
+	{
+		serverPanic("corrupted disk reference value");
+	}
+	o->ptr = sdsnewlen(str,len);
+	o->encoding = OBJ_ENCODING_RAW;
+	rdbReleaseMapRef();
+}
+
+/* decrRefCount释放一个还没有被解码的对象时调用 */
+void rdbReleaseDiskRef(robj *o) {
+	if (o->encoding != OBJ_ENCODING_DISKREF) return;
+	o->ptr = NULL;
+	rdbReleaseMapRef();
+}
+
+/* ------------------------------ 保存 ------------------------------------ */
+
+static void rdbEncodeU64LE(unsigned char *buf, uint64_t v) {
+	int j;
+	for (j = 0; j < 8; j++) buf[j] = (v>>(j*8))&0xFF;
+}
+
+static uint64_t rdbDecodeU64LE(unsigned char *buf) {
+	uint64_t v = 0;
+	int j;
+	for (j = 7; j >= 0; j--) v = (v<<8)|buf[j];
+	return v;
+}
+
+/*
+ * RDB文件的顺序写入器，按照db把键值对组织成section，
+ * 前台保存、fork子进程保存和不fork的后台快照都使用它
+ */
+typedef struct rdbWriter {
+	FILE *fp;
+	sds payload;            /* 当前section的payload */
+	sds index;              /* 已经写入的section的索引 */
+	uint64_t offset;        /* 已经写入文件的字节数 */
+	uint64_t nkeys;         /* 当前section中的键值对数量 */
+	uint64_t nsections;
+	int dbid;               /* 当前section所属的db */
+} rdbWriter;
+
+/* 把section头部和payload写入文件，并在索引中记录它的位置 */
+static int rdbWriterFlushSection(rdbWriter *w) {
+	unsigned char opcode = RDB_OPCODE_SECTION;
+	sds hdr;
+
+	if (w->nkeys == 0) return C_OK;
+	hdr = sdsempty();
+	hdr = sdscatlen(hdr,&opcode,1);
+	hdr = rdbEncodeLen(hdr,w->dbid);
+	hdr = rdbEncodeLen(hdr,w->nkeys);
+	hdr = rdbEncodeLen(hdr,sdslen(w->payload));
+	if (fwrite(hdr,sdslen(hdr),1,w->fp) == 0 ||
+		(sdslen(w->payload) &&
+		 fwrite(w->payload,sdslen(w->payload),1,w->fp) == 0))
+	{
+		sdsfree(hdr);
+		return C_ERR;
+	}
+	w->offset += sdslen(hdr);
+
+	w->index = rdbEncodeLen(w->index,w->dbid);
+	w->index = rdbEncodeLen(w->index,w->nkeys);
+	w->index = rdbEncodeLen(w->index,w->offset);
+	w->index = rdbEncodeLen(w->index,sdslen(w->payload));
+	w->offset += sdslen(w->payload);
+	w->nsections++;
+	w->nkeys = 0;
+	sdsclear(w->payload);
+	sdsfree(hdr);
+	return C_OK;
+}
+
+/* 写入文件头 */
+static int rdbWriterInit(rdbWriter *w, FILE *fp) {
+	char magic[RDB_HEADER_LEN+1];
+
+	w->fp = fp;
+	w->payload = sdsempty();
+	w->index = sdsempty();
+	w->offset = 0;
+	w->nkeys = 0;
+	w->nsections = 0;
+	w->dbid = 0;
+
+	snprintf(magic,sizeof(magic),"REDIS%04d",RDB_VERSION);
+	if (fwrite(magic,RDB_HEADER_LEN,1,fp) == 0) return C_ERR;
+	w->offset += RDB_HEADER_LEN;
+	return C_OK;
+}
+
+/*
+ * 追加count个已经编码好的键值对，db变化时结束当前section，
+ * payload超过RDB_SECTION_BYTES时也结束当前section
+ */
+static int rdbWriterAppend(rdbWriter *w, int dbid, const char *entries,
+		size_t len, uint64_t count)
+{
+	if (count == 0) return C_OK;
+	if (dbid != w->dbid) {
+		if (rdbWriterFlushSection(w) == C_ERR) return C_ERR;
+		w->dbid = dbid;
+	}
+	w->payload = sdscatlen(w->payload,entries,len);
+	w->nkeys += count;
+	if (sdslen(w->payload) >= RDB_SECTION_BYTES)
+		return rdbWriterFlushSection(w);
+	return C_OK;
+}
+
+static int rdbWriterAppendKeyValuePair(rdbWriter *w, int dbid, sds key,
+		robj *val)
+{
+	if (dbid != w->dbid) {
+		if (rdbWriterFlushSection(w) == C_ERR) return C_ERR;
+		w->dbid = dbid;
+	}
+	w->payload = rdbEncodeKeyValuePair(w->payload,key,val);
+	w->nkeys++;
+	if (sdslen(w->payload) >= RDB_SECTION_BYTES)
+		return rdbWriterFlushSection(w);
+	return C_OK;
+}
+
+/* 写入最后一个section、索引和文件尾，并同步到磁盘 */
+static int rdbWriterFinish(rdbWriter *w) {
+	unsigned char trailer[RDB_TRAILER_LEN];
+	unsigned char opcode = RDB_OPCODE_INDEX;
+	sds idxhdr;
+	int retval = C_ERR;
+
+	if (rdbWriterFlushSection(w) == C_ERR) return C_ERR;
+
+	/* 写入section索引 */
+	idxhdr = sdscatlen(sdsempty(),&opcode,1);
+	idxhdr = rdbEncodeLen(idxhdr,w->nsections);
+	if (fwrite(idxhdr,sdslen(idxhdr),1,w->fp) == 0) goto out;
+	if (sdslen(w->index) &&
+		fwrite(w->index,sdslen(w->index),1,w->fp) == 0) goto out;
+
+	/* EOF + 索引的偏移量 */
+	trailer[0] = RDB_OPCODE_EOF;
+	rdbEncodeU64LE(trailer+1,w->offset);
+	if (fwrite(trailer,RDB_TRAILER_LEN,1,w->fp) == 0) goto out;
+
+	/* Make sure data will not remain on the OS's output buffers */
+	if (fflush(w->fp) == EOF) goto out;
+	if (fsync(fileno(w->fp)) == -1) goto out;
+	retval = C_OK;
+
+out:
+	sdsfree(idxhdr);
+	return retval;
+}
+
+static void rdbWriterFree(rdbWriter *w) {
+	sdsfree(w->payload);
+	sdsfree(w->index);
+}
+
+/* Save the DB on disk. Return C_ERR on error, C_OK on success. */
+/*
+ * 把所有数据库保存到RDB文件中
+ * 每个数据库的键值对被切分成若干个不超过RDB_SECTION_BYTES的section，
+ * 文件末尾的索引记录每个section的偏移量，加载时可以多线程并行解码
+ */
+int rdbSave(char *filename) {
+	char tmpfile[256];
+	rdbWriter w;
+	FILE *fp;
+	dictIterator *di = NULL;
+	dictEntry *de;
+	int j;
+
+	snprintf(tmpfile,sizeof(tmpfile),"temp-%d.rdb",(int)getpid());
+	fp = fopen(tmpfile,"w");
+	if (!fp) {
+		printf("Failed opening the RDB file %s for saving: %s\n",
+				tmpfile, strerror(errno));
+		return C_ERR;
+	}
+
+	if (rdbWriterInit(&w,fp) == C_ERR) goto werr;
+	for (j = 0; j < server.dbnum; j++) {
+		redisDb *db = server.db+j;
+		if (dictSize(db->dict) == 0) continue;
+
+		di = dictGetIterator(db->dict);
+		while((de = dictNext(di)) != NULL) {
+			if (rdbWriterAppendKeyValuePair(&w,j,dictGetKey(de),
+						dictGetVal(de)) == C_ERR)
+				goto werr;
+		}
+		dictReleaseIterator(di);
+		di = NULL;
+	}
+	if (rdbWriterFinish(&w) == C_ERR) goto werr;
+	if (fclose(fp) == EOF) { fp = NULL; goto werr; }
+	fp = NULL;
+
+	/* Use RENAME to make sure the DB file is changed atomically only
+	 * if the generate DB file is ok. */
+	if (rename(tmpfile,filename) == -1) {
+		printf("Error moving temp DB file %s on the final destination %s: %s\n",
+				tmpfile, filename, strerror(errno));
+		unlink(tmpfile);
+		rdbWriterFree(&w);
+		return C_ERR;
+	}
+	printf("DB saved on disk\n");
+	rdbWriterFree(&w);
+	server.dirty = 0;
+	server.lastsave = time(NULL);
+	server.lastbgsave_status = C_OK;
+	return C_OK;
+
+werr:
+	printf("Write error saving DB on disk: %s\n", strerror(errno));
+	if (di) dictReleaseIterator(di);
+	if (fp) fclose(fp);
+	unlink(tmpfile);
+	rdbWriterFree(&w);
+	return C_ERR;
+}
+
+/* ----------------------------- 后台保存 --------------------------------- */
+
+/*
+ * BGSAVE有两种方式：
+ *
+ * fork     子进程保存fork时刻的内存快照，父进程继续处理命令。
+ *          fork需要复制页表，父进程写入的每个页面都会被复制一份（写时复制）。
+ *
+ * forkless 在本进程内由后台线程使用dictScan游标遍历键空间，
+ *          写命令修改还没有被遍历到的key之前，先把它的旧值编码保存下来（版本化），
+ *          遍历到这个key时写入保存的旧值，这样生成的文件是快照开始时刻的一致视图。
+ *          后台线程每次持有snapshot锁遍历一小批桶，主线程执行命令时也持有这个锁，
+ *          所以字典本身不需要支持并发访问。
+ *          key是否已被遍历通过dictScanVisited()判断，和哈希表的扩容缩容无关。
+ */
+
+/* 快照后台线程每次持有锁时最多遍历的桶数量和编码的字节数 */
+#define RDB_SNAPSHOT_SCAN_STEPS 256
+#define RDB_SNAPSHOT_CHUNK_BYTES (1024*64)
+
+typedef struct rdbSnapshot {
+	pthread_t tid;
+	pthread_mutex_t lock;   /* 后台线程遍历字典和主线程执行命令时持有 */
+	int dbid;               /* 正在遍历的db，小于它的db已经遍历完成 */
+	unsigned long cursor;   /* dbid的dictScan游标 */
+	dict **versions;        /* 每个db一个：key -> 修改前编码的键值对，NULL表示快照开始时不存在 */
+	size_t version_bytes;   /* 保存旧值使用的内存 */
+	size_t version_bytes_peak;
+	long long max_wait_us;  /* 主线程等待锁的最长时间 */
+	long long preserved;    /* 保存的旧版本数量 */
+	int done;               /* 后台线程已经结束，原子访问 */
+	int error;
+	char tmpfile[256];
+} rdbSnapshot;
+
+static rdbSnapshot *snapshot = NULL;
+
+/* 快照期间保存旧版本的字典，key是sds，值是编码后的键值对 */
+static dictType snapshotVersionsDictType = {
+	dictSdsHash,                /* hash function */
+	NULL,                       /* key dup */
+	NULL,                       /* val dup */
+	dictSdsKeyCompare,          /* key compare */
+	dictSdsDestructor,          /* key destructor */
+	dictSdsDestructor           /* val destructor */
+};
+
+/* 是否有正在进行的后台保存，fork子进程或者快照线程 */
+int rdbSaveInProgress(void) {
+	return server.rdb_child_pid != -1 || snapshot != NULL;
+}
+
+/* 调用者持有快照锁 */
+static int rdbSnapshotKeyVisited(int dbid, sds key) {
+	if (dbid < snapshot->dbid) return 1;
+	if (dbid > snapshot->dbid) return 0;
+	return dictScanVisited(server.db[dbid].dict,key,snapshot->cursor);
+}
+
+/*
+ * 写命令执行前，保存它将要修改的、还没有被遍历到的key的旧版本
+ * 每个key只保存第一次修改前的版本
+ */
+static void rdbSnapshotPreserveKeys(client *c) {
+	struct redisCommand *cmd = c->cmd;
+	int dbid = c->db->id;
+	int j, last;
+
+	if (cmd->firstkey == 0) return;
+	last = cmd->lastkey;
+	if (last < 0) last = c->argc+last;
+	for (j = cmd->firstkey; j <= last && j < c->argc; j += cmd->keystep) {
+		sds key = c->argv[j]->ptr;
+		dict *versions = snapshot->versions[dbid];
+		robj *o;
+		sds old = NULL;
+
+		if (rdbSnapshotKeyVisited(dbid,key)) continue;
+		if (dictFind(versions,key) != NULL) continue;
+
+		if ((o = dictFetchValue(c->db->dict,key)) != NULL)
+			old = rdbEncodeKeyValuePair(sdsempty(),key,o);
+		dictAdd(versions,sdsdup(key),old);
+		snapshot->preserved++;
+		snapshot->version_bytes += sdslen(key) + (old ? sdsAllocSize(old) : 0);
+		if (snapshot->version_bytes > snapshot->version_bytes_peak)
+			snapshot->version_bytes_peak = snapshot->version_bytes;
+		if (cmd->keystep == 0) break;
+	}
+}
+
+/*
+ * 在call()中执行命令前调用，快照进行中时返回1，命令执行完后需要调用rdbSnapshotUnlock()
+ */
+int rdbSnapshotLock(client *c) {
+	long long start, waited;
+
+	if (snapshot == NULL) return 0;
+	start = ustime();
+	pthread_mutex_lock(&snapshot->lock);
+	waited = ustime()-start;
+	if (waited > snapshot->max_wait_us) snapshot->max_wait_us = waited;
+	if (c->cmd->flags & CMD_WRITE) rdbSnapshotPreserveKeys(c);
+	return 1;
+}
+
+void rdbSnapshotUnlock(void) {
+	pthread_mutex_unlock(&snapshot->lock);
+}
+
+/* dictScan回调函数的私有数据 */
+typedef struct rdbSnapshotScanData {
+	dict *d;
+	dict *versions;
+	unsigned long cursor;   /* 本次dictScan调用开始时的游标 */
+	sds buf;
+	uint64_t count;
+} rdbSnapshotScanData;
+
+static void rdbSnapshotScanCallback(void *privdata, const dictEntry *de) {
+	rdbSnapshotScanData *data = privdata;
+	sds key = dictGetKey(de);
+	dictEntry *ve;
+
+	/* 缩容后同一个key可能被再次返回，只处理游标之后的key */
+	if (dictScanVisited(data->d,key,data->cursor)) return;
+
+	if ((ve = dictFind(data->versions,key)) != NULL) {
+		sds old = dictGetVal(ve);
+
+		/* 快照开始后被修改过，写入修改前的版本，快照开始后才创建的key被跳过 */
+		if (old) {
+			data->buf = sdscatsds(data->buf,old);
+			data->count++;
+			snapshot->version_bytes -= sdsAllocSize(old);
+		}
+		snapshot->version_bytes -= sdslen(key);
+		dictDelete(data->versions,key);
+		return;
+	}
+	data->buf = rdbEncodeKeyValuePair(data->buf,key,dictGetVal(de));
+	data->count++;
+}
+
+static void *rdbSnapshotThreadMain(void *arg) {
+	rdbSnapshot *snap = arg;
+	rdbSnapshotScanData data;
+	rdbWriter w;
+	FILE *fp;
+	int j, steps, finished;
+
+	data.buf = sdsempty();
+	if ((fp = fopen(snap->tmpfile,"w")) == NULL) {
+		printf("Failed opening the RDB file %s for saving: %s\n",
+				snap->tmpfile, strerror(errno));
+		sdsfree(data.buf);
+		atomicSet(snap->error,1);
+		atomicSet(snap->done,1);
+		return NULL;
+	}
+	if (rdbWriterInit(&w,fp) == C_ERR) goto werr;
+
+	for (j = 0; j < server.dbnum; j++) {
+		dictIterator *di;
+		dictEntry *de;
+
+		data.d = server.db[j].dict;
+		data.versions = snap->versions[j];
+		finished = 0;
+		while (!finished) {
+			pthread_mutex_lock(&snap->lock);
+			data.count = 0;
+			for (steps = 0; steps < RDB_SNAPSHOT_SCAN_STEPS &&
+					sdslen(data.buf) < RDB_SNAPSHOT_CHUNK_BYTES; steps++)
+			{
+				data.cursor = snap->cursor;
+				snap->cursor = dictScan(data.d,snap->cursor,
+						rdbSnapshotScanCallback,NULL,&data);
+				if (snap->cursor == 0) {
+					/* 这个db遍历完成，之后对它的修改都不需要保存旧版本 */
+					snap->dbid = j+1;
+					finished = 1;
+					break;
+				}
+			}
+			pthread_mutex_unlock(&snap->lock);
+
+			/* 编码好的数据在锁外写入文件 */
+			if (rdbWriterAppend(&w,j,data.buf,sdslen(data.buf),
+						data.count) == C_ERR)
+				goto werr;
+			sdsclear(data.buf);
+		}
+
+		/*
+		 * 剩下的旧版本是快照开始后、遍历到之前被删除的key，
+		 * db已经遍历完成，主线程不会再访问这个字典
+		 */
+		di = dictGetIterator(data.versions);
+		while ((de = dictNext(di)) != NULL) {
+			sds old = dictGetVal(de);
+			if (old == NULL) continue;
+			if (rdbWriterAppend(&w,j,old,sdslen(old),1) == C_ERR) {
+				dictReleaseIterator(di);
+				goto werr;
+			}
+		}
+		dictReleaseIterator(di);
+	}
+	if (rdbWriterFinish(&w) == C_ERR) goto werr;
+	if (fclose(fp) == EOF) { fp = NULL; goto werr; }
+	rdbWriterFree(&w);
+	sdsfree(data.buf);
+	atomicSet(snap->done,1);
+	return NULL;
+
+werr:
+	printf("Write error saving DB on disk: %s\n", strerror(errno));
+	if (fp) fclose(fp);
+	rdbWriterFree(&w);
+	sdsfree(data.buf);
+	atomicSet(snap->error,1);
+	atomicSet(snap->done,1);
+	return NULL;
+}
+
+/* 不fork的后台快照，开始时只需要初始化状态和创建线程 */
+static int rdbSaveForklessBackground(void) {
+	rdbSnapshot *snap = zcalloc(sizeof(*snap));
+	long long start = ustime();
+	int j;
+
+	pthread_mutex_init(&snap->lock,NULL);
+	snap->versions = zmalloc(sizeof(dict*)*server.dbnum);
+	for (j = 0; j < server.dbnum; j++)
+		snap->versions[j] = dictCreate(&snapshotVersionsDictType,NULL);
+	snprintf(snap->tmpfile,sizeof(snap->tmpfile),"temp-snapshot-%d.rdb",
+			(int)getpid());
+
+	snapshot = snap;
+	if (pthread_create(&snap->tid,NULL,rdbSnapshotThreadMain,snap) != 0) {
+		printf("Can't save in background: pthread_create: %s\n",
+				strerror(errno));
+		snapshot = NULL;
+		for (j = 0; j < server.dbnum; j++) dictRelease(snap->versions[j]);
+		zfree(snap->versions);
+		pthread_mutex_destroy(&snap->lock);
+		zfree(snap);
+		return C_ERR;
+	}
+	server.stat_rdb_bgsave_start_us = ustime()-start;
+	server.rdb_child_type = RDB_CHILD_TYPE_FORKLESS;
+	printf("Background saving started by thread (forkless, %.3f ms)\n",
+			(double)server.stat_rdb_bgsave_start_us/1000);
+	return C_OK;
+}
+
+/* 子进程退出前通过管道把写时复制的内存大小发送给父进程 */
+static void sendChildCOWInfo(void) {
+	size_t private_dirty = zmalloc_get_private_dirty(-1);
+
+	if (server.child_info_pipe[1] == -1) return;
+	server.child_info_data.process_type = CHILD_INFO_TYPE_RDB;
+	server.child_info_data.cow_size = private_dirty;
+	server.child_info_data.magic = CHILD_INFO_MAGIC;
+	if (write(server.child_info_pipe[1],&server.child_info_data,
+				sizeof(server.child_info_data)) == -1)
+	{
+		/* 父进程只是拿不到统计信息 */
+	}
+}
+
+static void receiveChildInfo(void) {
+	ssize_t wlen = sizeof(server.child_info_data);
+
+	if (server.child_info_pipe[0] == -1) return;
+	if (read(server.child_info_pipe[0],&server.child_info_data,wlen) == wlen &&
+		server.child_info_data.magic == CHILD_INFO_MAGIC)
+	{
+		server.stat_rdb_cow_bytes = server.child_info_data.cow_size;
+	}
+}
+
+static void closeChildInfoPipe(void) {
+	if (server.child_info_pipe[0] != -1) close(server.child_info_pipe[0]);
+	if (server.child_info_pipe[1] != -1) close(server.child_info_pipe[1]);
+	server.child_info_pipe[0] = server.child_info_pipe[1] = -1;
+}
+
+static int rdbSaveForkBackground(char *filename) {
+	pid_t childpid;
+	long long start;
+
+	if (pipe(server.child_info_pipe) == -1) {
+		server.child_info_pipe[0] = server.child_info_pipe[1] = -1;
+	} else {
+		anetNonBlock(NULL,server.child_info_pipe[0]);
+	}
+
+	/* 避免子进程继承还没有输出的日志 */
+	fflush(stdout);
+	start = ustime();
+	if ((childpid = fork()) == 0) {
+		int retval;
+
+		/* Child */
+		closeListeningSockets(0);
+		retval = rdbSave(filename);
+		if (retval == C_OK) sendChildCOWInfo();
+		fflush(stdout);
+		_exit((retval == C_OK) ? 0 : 1);
+	} else {
+		/* Parent */
+		server.stat_fork_time = ustime()-start;
+		server.stat_rdb_bgsave_start_us = server.stat_fork_time;
+		if (childpid == -1) {
+			closeChildInfoPipe();
+			server.lastbgsave_status = C_ERR;
+			printf("Can't save in background: fork: %s\n",
+					strerror(errno));
+			return C_ERR;
+		}
+		printf("Background saving started by pid %d (fork took %.3f ms)\n",
+				childpid, (double)server.stat_fork_time/1000);
+		server.rdb_child_pid = childpid;
+		server.rdb_child_type = RDB_CHILD_TYPE_DISK;
+		return C_OK;
+	}
+	return C_OK; /* unreached */
+}
+
+/*
+ * 开始后台保存，使用rdb-bgsave-mode配置的方式
+ */
+int rdbSaveBackground(char *filename) {
+	int retval;
+
+	if (rdbSaveInProgress()) return C_ERR;
+
+	server.dirty_before_bgsave = server.dirty;
+	server.lastbgsave_try = time(NULL);
+	server.rdb_save_time_start = time(NULL);
+	server.stat_rdb_bgsave_rss_start = zmalloc_get_rss();
+	server.stat_rdb_bgsave_rss_peak = server.stat_rdb_bgsave_rss_start;
+	if (server.rdb_bgsave_forkless)
+		retval = rdbSaveForklessBackground();
+	else
+		retval = rdbSaveForkBackground(filename);
+	if (retval == C_ERR) server.rdb_save_time_start = -1;
+	return retval;
+}
+
+/* 保存结束后更新状态和统计信息 */
+static void backgroundSaveDone(int ok) {
+	if (ok) {
+		printf("Background saving terminated with success\n");
+		server.dirty = server.dirty - server.dirty_before_bgsave;
+		server.lastsave = time(NULL);
+		server.lastbgsave_status = C_OK;
+	} else {
+		printf("Background saving error\n");
+		server.lastbgsave_status = C_ERR;
+	}
+	server.rdb_save_time_last = time(NULL)-server.rdb_save_time_start;
+	server.rdb_save_time_start = -1;
+	server.rdb_last_bgsave_type = server.rdb_child_type;
+	server.rdb_child_type = RDB_CHILD_TYPE_NONE;
+}
+
+/* A background saving child (BGSAVE) terminated its work. Handle this.
+ * This function covers the case of actual BGSAVEs. */
+void backgroundSaveDoneHandler(int exitcode, int bysignal) {
+	char tmpfile[256];
+
+	if (!bysignal && exitcode == 0) {
+		receiveChildInfo();
+		backgroundSaveDone(1);
+	} else {
+		if (bysignal)
+			printf("Background saving terminated by signal %d\n", bysignal);
+		snprintf(tmpfile,sizeof(tmpfile),"temp-%d.rdb",
+				(int)server.rdb_child_pid);
+		unlink(tmpfile);
+		backgroundSaveDone(0);
+	}
+	closeChildInfoPipe();
+	server.rdb_child_pid = -1;
+}
+
+/*
+ * 在serverCron中调用，快照线程结束后回收线程、重命名文件并释放快照状态
+ * 如果wait为真则阻塞等待线程结束
+ */
+void rdbSnapshotCron(int wait) {
+	rdbSnapshot *snap = snapshot;
+	int done, error, j, ok = 0;
+	size_t rss;
+
+	if (snap == NULL) return;
+	rss = zmalloc_get_rss();
+	if (rss > server.stat_rdb_bgsave_rss_peak)
+		server.stat_rdb_bgsave_rss_peak = rss;
+
+	atomicGet(snap->done,done);
+	if (!done && !wait) return;
+	pthread_join(snap->tid,NULL);
+
+	atomicGet(snap->error,error);
+	if (!error) {
+		if (rename(snap->tmpfile,server.rdb_filename) == -1) {
+			printf("Error moving temp DB file %s on the final destination %s: %s\n",
+					snap->tmpfile, server.rdb_filename, strerror(errno));
+		} else {
+			ok = 1;
+		}
+	}
+	if (!ok) unlink(snap->tmpfile);
+
+	server.stat_rdb_snapshot_max_wait_us = snap->max_wait_us;
+	server.stat_rdb_snapshot_versions = snap->preserved;
+	server.stat_rdb_snapshot_version_bytes_peak = snap->version_bytes_peak;
+	printf("Forkless snapshot: %lld versions preserved, %zu bytes peak, "
+		"max command wait %.3f ms\n", snap->preserved,
+		snap->version_bytes_peak, (double)snap->max_wait_us/1000);
+
+	snapshot = NULL;
+	for (j = 0; j < server.dbnum; j++) dictRelease(snap->versions[j]);
+	zfree(snap->versions);
+	pthread_mutex_destroy(&snap->lock);
+	zfree(snap);
+	backgroundSaveDone(ok);
+}
+
+/* 关闭服务器时终止正在进行的后台保存 */
+void killRDBChild(void) {
+	int statloc;
+
+	if (server.rdb_child_pid != -1) {
+		char tmpfile[256];
+
+		kill(server.rdb_child_pid,SIGUSR1);
+		while(wait3(&statloc,0,NULL) != server.rdb_child_pid);
+		snprintf(tmpfile,sizeof(tmpfile),"temp-%d.rdb",
+				(int)server.rdb_child_pid);
+		unlink(tmpfile);
+		closeChildInfoPipe();
+		server.rdb_child_pid = -1;
+		server.rdb_child_type = RDB_CHILD_TYPE_NONE;
+	}
+	/* 快照线程不能被安全地取消，等待它完成 */
+	rdbSnapshotCron(1);
+}
+
+/* BGSAVE [FORK|FORKLESS] */
+void bgsaveCommand(client *c) {
+	int forkless = server.rdb_bgsave_forkless;
+	int retval;
+
+	if (c->argc == 2) {
+		if (!strcasecmp(c->argv[1]->ptr,"fork")) {
+			forkless = 0;
+		} else if (!strcasecmp(c->argv[1]->ptr,"forkless")) {
+			forkless = 1;
+		} else {
+			addReply(c,shared.syntaxerr);
+			return;
+		}
+	}
+
+	if (rdbSaveInProgress()) {
+		addReplyError(c,"Background save already in progress");
+	} else if (server.aof_child_pid != -1) {
+		addReplyError(c,"An AOF log rewriting in progress: can't BGSAVE right now.");
+		return;
+	} else {
+		int saved = server.rdb_bgsave_forkless;
+
+		server.rdb_bgsave_forkless = forkless;
+		retval = rdbSaveBackground(server.rdb_filename);
+		server.rdb_bgsave_forkless = saved;
+		if (retval == C_OK)
+			addReplyStatus(c,"Background saving started");
+		else
+			addReply(c,shared.err);
+	}
+}
+
+/* ------------------------------ 加载 ------------------------------------ */
+
+static int rdbReadAt(int fd, void *buf, size_t len, off_t offset) {
+	size_t done = 0;
+	ssize_t nread;
+
+	while (done < len) {
+		nread = pread(fd,(char*)buf+done,len-done,offset+done);
+		if (nread == -1 && errno == EINTR) continue;
+		if (nread <= 0) return C_ERR;
+		done += nread;
+	}
+	return C_OK;
+}
+
+/*
+ * 加载线程：不断领取下一个section，读取payload后解码到section的暂存数组
+ * 线程之间只共享job->next计数器，暂存数组各自独立，不需要加锁
+ */
+static void *rdbLoadWorkerMain(void *arg) {
+	rdbLoadWorker *w = arg;
+	rdbLoadJob *job = w->job;
+	int idx, error;
+	long long start;
+
+	while (1) {
+		rdbSection *sec;
+		unsigned char *buf;
+
+		atomicGet(job->error,error);
+		if (error) break;
+		atomicGetIncr(job->next,idx,1);
+		if (idx >= job->nsections) break;
+		sec = job->sections+idx;
+
+		/* 懒加载模式下直接在映射上解码，由页缓存负责I/O */
+		if (job->map) {
+			start = ustime();
+			if (rdbDecodeSection(sec,job->map+sec->offset,1) == C_ERR)
+				atomicSet(job->error,1);
+			w->decode_us += ustime()-start;
+			continue;
+		}
+
+		start = ustime();
+		buf = zmalloc(sec->len ? sec->len : 1);
+		if (rdbReadAt(job->fd,buf,sec->len,sec->offset) == C_ERR) {
+			zfree(buf);
+			atomicSet(job->error,1);
+			break;
+		}
+		w->io_us += ustime()-start;
+
+		start = ustime();
+		if (rdbDecodeSection(sec,buf,0) == C_ERR) atomicSet(job->error,1);
+		w->decode_us += ustime()-start;
+		zfree(buf);
+	}
+	return NULL;
+}
+
+/* 释放section暂存数组中还没有插入数据库的键值对 */
+static void rdbFreeSections(rdbSection *sections, int nsections) {
+	int j;
+	uint64_t i;
+
+	for (j = 0; j < nsections; j++) {
+		rdbSection *sec = sections+j;
+		for (i = 0; i < sec->loaded; i++) {
+			if (sec->keys[i]) sdsfree(sec->keys[i]);
+			if (sec->vals[i]) decrRefCount(sec->vals[i]);
+		}
+		zfree(sec->keys);
+		zfree(sec->vals);
+	}
+	zfree(sections);
+}
+
+/* 读取文件尾部的section索引 */
+static rdbSection *rdbLoadIndex(int fd, off_t size, int *nsectionsp) {
+	unsigned char trailer[RDB_TRAILER_LEN];
+	unsigned char *buf = NULL, *p, *end;
+	uint64_t idxoff, nsections, v, j;
+	rdbSection *sections = NULL;
+
+	if (size < RDB_HEADER_LEN+RDB_TRAILER_LEN) return NULL;
+	if (rdbReadAt(fd,trailer,RDB_TRAILER_LEN,size-RDB_TRAILER_LEN) == C_ERR)
+		return NULL;
+	if (trailer[0] != RDB_OPCODE_EOF) return NULL;
+	idxoff = rdbDecodeU64LE(trailer+1);
+	if (idxoff < RDB_HEADER_LEN || idxoff >= (uint64_t)size-RDB_TRAILER_LEN)
+		return NULL;
+
+	buf = zmalloc(size-RDB_TRAILER_LEN-idxoff);
+	if (rdbReadAt(fd,buf,size-RDB_TRAILER_LEN-idxoff,idxoff) == C_ERR)
+		goto err;
+	p = buf;
+	end = buf+(size-RDB_TRAILER_LEN-idxoff);
+	if (*p++ != RDB_OPCODE_INDEX) goto err;
+	if (rdbDecodeLen(&p,end,&nsections) == C_ERR) goto err;
+	if (nsections > (uint64_t)(end-p)) goto err;
+
+	sections = zcalloc(sizeof(rdbSection)*(nsections ? nsections : 1));
+	for (j = 0; j < nsections; j++) {
+		rdbSection *sec = sections+j;
+		if (rdbDecodeLen(&p,end,&v) == C_ERR) goto err;
+		if (v >= (uint64_t)server.dbnum) goto err;
+		sec->dbid = v;
+		if (rdbDecodeLen(&p,end,&sec->nkeys) == C_ERR) goto err;
+		if (rdbDecodeLen(&p,end,&sec->offset) == C_ERR) goto err;
+		if (rdbDecodeLen(&p,end,&sec->len) == C_ERR) goto err;
+		if (sec->offset+sec->len > idxoff) goto err;
+		/* 每个键值对至少占3个字节，防止损坏的索引导致分配过大的暂存数组 */
+		if (sec->nkeys > sec->len/3) goto err;
+	}
+	if (p != end) goto err;
+	zfree(buf);
+	*nsectionsp = nsections;
+	return sections;
+
+err:
+	zfree(buf);
+	zfree(sections);
+	return NULL;
+}
+
+/*
+ * 加载RDB文件，分为三个阶段：
+ * 1) I/O + 解码：多个线程并行读取并解码section到各自的暂存数组
+ * 2) 插入：主线程按照索引中每个db的键数量预先扩展好字典，再批量插入，
+ *    插入过程中不会触发渐进式rehash
+ * 每个阶段的耗时都会打印出来
+ *
+ * 如果开启了rdb-lazy-load，文件会被只读映射到内存，加载时只解码key，
+ * 值保存为指向映射的OBJ_ENCODING_DISKREF对象，第一次访问时才解码，
+ * 启动耗时只和key的数量相关
+ */
+int rdbLoad(char *filename) {
+	char magic[RDB_HEADER_LEN+1];
+	struct stat sb;
+	rdbSection *sections;
+	rdbLoadWorker *workers;
+	rdbLoadJob job;
+	uint64_t *dbkeys, i;
+	long long start, parallel_us, insert_us, io_us = 0, decode_us = 0;
+	int fd, nsections, nthreads, j, retval = C_ERR;
+
+	if ((fd = open(filename,O_RDONLY)) == -1) return C_ERR;
+	start = ustime();
+	if (fstat(fd,&sb) == -1 ||
+		rdbReadAt(fd,magic,RDB_HEADER_LEN,0) == C_ERR)
+	{
+		close(fd);
+		return C_ERR;
+	}
+	magic[RDB_HEADER_LEN] = '\0';
+	if (memcmp(magic,"REDIS",5) != 0 || atoi(magic+5) != RDB_VERSION) {
+		printf("Wrong signature or version trying to load DB from file\n");
+		close(fd);
+		errno = EINVAL;
+		return C_ERR;
+	}
+	if ((sections = rdbLoadIndex(fd,sb.st_size,&nsections)) == NULL) {
+		printf("Corrupted section index trying to load DB from file\n");
+		close(fd);
+		errno = EINVAL;
+		return C_ERR;
+	}
+
+	job.map = NULL;
+	if (server.rdb_lazy_load && sb.st_size > 0) {
+		void *map = mmap(NULL,sb.st_size,PROT_READ,MAP_SHARED,fd,0);
+		if (map == MAP_FAILED) {
+			printf("Can't mmap the RDB file, loading it eagerly: %s\n",
+					strerror(errno));
+		} else {
+			/* 值是按key随机访问的，预读没有意义 */
+			madvise(map,sb.st_size,MADV_RANDOM);
+			server.rdb_map = job.map = map;
+			server.rdb_map_size = sb.st_size;
+			/* 加载期间持有一个引用，防止映射被提前释放 */
+			server.rdb_map_refs = 1;
+		}
+	}
+
+	/* 并行读取、解码所有section */
+	nthreads = server.rdb_load_threads;
+	if (nthreads > nsections) nthreads = nsections;
+	if (nthreads < 1) nthreads = 1;
+	job.fd = fd;
+	job.sections = sections;
+	job.nsections = nsections;
+	job.next = 0;
+	job.error = 0;
+	workers = zcalloc(sizeof(rdbLoadWorker)*nthreads);
+	for (j = 0; j < nthreads; j++) {
+		workers[j].job = &job;
+		if (pthread_create(&workers[j].tid,NULL,rdbLoadWorkerMain,
+					workers+j) != 0)
+		{
+			/* 创建线程失败时，由已经创建的线程（或者下面的主线程）继续完成工作 */
+			break;
+		}
+	}
+	if (j == 0) rdbLoadWorkerMain(workers);
+	nthreads = j ? j : 1;
+	while (j-- > 0) pthread_join(workers[j].tid,NULL);
+	for (j = 0; j < nthreads; j++) {
+		io_us += workers[j].io_us;
+		decode_us += workers[j].decode_us;
+	}
+	zfree(workers);
+	close(fd);
+	parallel_us = ustime()-start;
+	if (job.error) {
+		printf("Short read or corrupted section trying to load DB from file\n");
+		rdbFreeSections(sections,nsections);
+		if (job.map) rdbReleaseMapRef();
+		errno = EINVAL;
+		return C_ERR;
+	}
+
+	/* 按照索引统计的键数量预先扩展每个数据库的字典 */
+	start = ustime();
+	dbkeys = zcalloc(sizeof(uint64_t)*server.dbnum);
+	for (j = 0; j < nsections; j++) dbkeys[sections[j].dbid] += sections[j].nkeys;
+	for (j = 0; j < server.dbnum; j++) {
+		dict *d = server.db[j].dict;
+		if (dbkeys[j]) dictExpand(d,dictSize(d)+dbkeys[j]);
+	}
+	zfree(dbkeys);
+
+	/* 按照文件中的顺序批量插入 */
+	for (j = 0; j < nsections; j++) {
+		rdbSection *sec = sections+j;
+		dict *d = server.db[sec->dbid].dict;
+
+		for (i = 0; i < sec->loaded; i++) {
+			if (dictAdd(d,sec->keys[i],sec->vals[i]) != DICT_OK) {
+				/* 不能留下只加载了一部分的数据，清空已经插入的键 */
+				printf("RDB has duplicated key '%s'\n", sec->keys[i]);
+				emptyDb(-1);
+				goto out;
+			}
+			sec->keys[i] = NULL;
+			sec->vals[i] = NULL;
+		}
+	}
+	insert_us = ustime()-start;
+	retval = C_OK;
+
+	server.stat_rdb_load_io_us = io_us;
+	server.stat_rdb_load_decode_us = decode_us;
+	server.stat_rdb_load_insert_us = insert_us;
+	printf("DB loaded from disk%s: %.3f seconds "
+		"(%d sections, %d threads; io %.3fs, decode %.3fs, insert %.3fs)\n",
+		job.map ? " (lazy)" : "",
+		(float)(parallel_us+insert_us)/1000000, nsections, nthreads,
+		(float)io_us/1000000, (float)decode_us/1000000,
+		(float)insert_us/1000000);
+
+out:
+	rdbFreeSections(sections,nsections);
+	if (job.map) rdbReleaseMapRef();
+	/* 调用者用errno区分文件不存在和文件损坏 */
+	if (retval == C_ERR) errno = EINVAL;
+	return retval;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RDB_H
+#define __RDB_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "server.h"
+
+/* The current RDB version. When the format changes in a way that is no longer
+ * backward compatible this number gets incremented. */
+#define RDB_VERSION 1
+
+/* Defines related to the dump file format. To store 32 bits lengths for short
+ * keys requires a lot of space, so we check the most significant 2 bits of
+ * the first byte to interpreter the length:
+ *
+ * 00|XXXXXX => if the two MSB are 00 the len is the 6 bits of this byte
+ * 01|XXXXXX XXXXXXXX =>  01, the len is 14 byes, 6 bits + 8 bits of next byte
+ * 10|000000 [32 bit integer] => A full 32 bit len in net byte order will follow
+ * 10|000001 [64 bit integer] => A full 64 bit len in net byte order will follow
+ */
+#define RDB_6BITLEN 0
+#define RDB_14BITLEN 1
+#define RDB_32BITLEN 0x80
+#define RDB_64BITLEN 0x81
+#define RDB_LENERR UINT64_MAX
+
+/* Object types, stored in front of every key / value pair. */
+#define RDB_TYPE_STRING 0
+#define RDB_TYPE_SET 2              /* 元素数 + 元素 */
+#define RDB_TYPE_HASH 4             /* field数 + field/value对 */
+#define RDB_TYPE_ZSET_2 5           /* 元素数 + 元素/8字节小端序double对 */
+#define RDB_TYPE_SET_INTSET 11      /* 整个intset作为一个字符串 */
+#define RDB_TYPE_LIST_QUICKLIST 14  /* 节点数 + 每个节点的listpack */
+#define RDB_TYPE_STREAM_LISTPACKS 15 /* 块数 + 每块的ID/listpack + 长度 + 最后的ID */
+#define RDB_TYPE_HASH_LISTPACK 16   /* 整个listpack作为一个字符串 */
+#define RDB_TYPE_ZSET_LISTPACK 17   /* 整个listpack作为一个字符串 */
+
+/* Special RDB opcodes.
+ *
+ * 文件布局：
+ * "REDIS" + 4位版本号
+ * SECTION dbid nkeys len <payload> ...     每个section保存同一个db的一批键值对
+ * INDEX nsections [dbid nkeys offset len]* section索引，用于并行加载
+ * EOF <8字节小端序的索引偏移量>
+ */
+#define RDB_OPCODE_SECTION    250
+#define RDB_OPCODE_INDEX      251
+#define RDB_OPCODE_EOF        255
+
+#define RDB_HEADER_LEN 9    /* "REDIS" + 4位版本号 */
+#define RDB_TRAILER_LEN 9   /* EOF opcode + 8字节索引偏移量 */
+
+/* section的payload超过这个大小就结束当前section，保证加载线程之间的负载均衡 */
+#define RDB_SECTION_BYTES (1024*1024*4)
+#define RDB_LOAD_MAX_THREADS 64
+
+int rdbSave(char *filename);
+int rdbLoad(char *filename);
+void rdbMaterializeObject(robj *o);
+void rdbReleaseDiskRef(robj *o);
+
+#endif
@@ -1,10 +1,15 @@
 #include "server.h"
 #include "dict.h"
 #include "sds.h"
+#include "rdb.h"
+#include "bio.h"
+#include "zmalloc.h"
+#include "atomicvar.h"
 
 #include <stdio.h>
 #include <time.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/time.h>
@@ -32,15 +37,168 @@
 #include <sys/socket.h>
 
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask);
+void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 
 /*================================= Globals ================================= */
 
 /* Global vars */
 struct redisServer server; /* Server global state */
+struct sharedObjectsStruct shared;
+
+/*============================ Utility functions ============================ */
+
+/*
+ * Low level logging. To use only for very big messages, otherwise
+ * serverLog() is to prefer.
+ * logfile为空时输出到标准输出，否则追加到日志文件
+ */
+void serverLogRaw(int level, const char *msg) {
+	const char *c = ".-*#";
+	FILE *fp;
+	char buf[64];
+	int rawmode = (level & LL_RAW);
+	int log_to_stdout = server.logfile == NULL || server.logfile[0] == '\0';
+
+	level &= 0xff; /* clear flags */
+	if (level < server.verbosity) return;
+
+	fp = log_to_stdout ? stdout : fopen(server.logfile,"a");
+	if (!fp) return;
+
+	if (rawmode) {
+		fprintf(fp,"%s",msg);
+	} else {
+		int off;
+		struct timeval tv;
+
+		gettimeofday(&tv,NULL);
+		off = strftime(buf,sizeof(buf),"%d %b %H:%M:%S.",localtime(&tv.tv_sec));
+		snprintf(buf+off,sizeof(buf)-off,"%03d",(int)tv.tv_usec/1000);
+		fprintf(fp,"%d:%s %c %s\n",(int)getpid(),buf,c[level],msg);
+	}
+	fflush(fp);
+	if (!log_to_stdout) fclose(fp);
+}
+
+/*
+ * Like serverLogRaw() but with printf-alike support. This is the function that
+ * is used across the code.
+ */
+void serverLog(int level, const char *fmt, ...) {
+	va_list ap;
+	char msg[LOG_MAX_LEN];
+
+	if ((level&0xff) < server.verbosity) return;
+
+	va_start(ap, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+
+	serverLogRaw(level,msg);
+}
+
+/* 记录出错的位置和原因后退出，通过serverPanic()宏调用 */
+void _serverPanic(const char *file, int line, const char *msg, ...) {
+	va_list ap;
+	char fmtmsg[256];
+
+	va_start(ap,msg);
+	vsnprintf(fmtmsg,sizeof(fmtmsg),msg,ap);
+	va_end(ap);
+
+	serverLog(LL_WARNING,"------------------------------------------------");
+	serverLog(LL_WARNING,"!!! Software Failure.");
+	serverLog(LL_WARNING,"Guru Meditation: %s #%s:%d",fmtmsg,file,line);
+	serverLog(LL_WARNING,"------------------------------------------------");
+	exit(1);
+}
+
+/* Return the UNIX time in microseconds */
+long long ustime(void) {
+	struct timeval tv;
+	long long ust;
+
+	gettimeofday(&tv, NULL);
+	ust = ((long long)tv.tv_sec)*1000000;
+	ust += tv.tv_usec;
+	return ust;
+}
+
+/* Return the UNIX time in milliseconds */
+mstime_t mstime(void) {
+	return ustime()/1000;
+}
 
 void setCommand(client *c);
 void getCommand(client *c);
+void getsetCommand(client *c);
+void setrangeCommand(client *c);
+void getrangeCommand(client *c);
+void incrCommand(client *c);
+void decrCommand(client *c);
+void incrbyCommand(client *c);
+void decrbyCommand(client *c);
+void incrbyfloatCommand(client *c);
+void appendCommand(client *c);
+void strlenCommand(client *c);
+void mgetCommand(client *c);
+void setbitCommand(client *c);
+void getbitCommand(client *c);
+void bitcountCommand(client *c);
+void bitposCommand(client *c);
+void bitopCommand(client *c);
+void bitfieldCommand(client *c);
+void pfaddCommand(client *c);
+void pfcountCommand(client *c);
+void pfmergeCommand(client *c);
+void xaddCommand(client *c);
+void xrangeCommand(client *c);
+void xrevrangeCommand(client *c);
+void xlenCommand(client *c);
+void xreadCommand(client *c);
+void xtrimCommand(client *c);
+void geoaddCommand(client *c);
+void geodistCommand(client *c);
+void geosearchCommand(client *c);
+void msetCommand(client *c);
+void msetnxCommand(client *c);
 void commandCommand(client *c);
+void infoCommand(client *c);
+void bgrewriteaofCommand(client *c);
+void bgsaveCommand(client *c);
+void lpushCommand(client *c);
+void rpushCommand(client *c);
+void lpopCommand(client *c);
+void rpopCommand(client *c);
+void llenCommand(client *c);
+void lindexCommand(client *c);
+void lrangeCommand(client *c);
+void ltrimCommand(client *c);
+void saddCommand(client *c);
+void sremCommand(client *c);
+void sismemberCommand(client *c);
+void scardCommand(client *c);
+void smembersCommand(client *c);
+void sinterCommand(client *c);
+void sunionCommand(client *c);
+void sdiffCommand(client *c);
+void zaddCommand(client *c);
+void zincrbyCommand(client *c);
+void zremCommand(client *c);
+void zcardCommand(client *c);
+void zscoreCommand(client *c);
+void zrankCommand(client *c);
+void zrevrankCommand(client *c);
+void zrangeCommand(client *c);
+void zrevrangeCommand(client *c);
+void zrangebyscoreCommand(client *c);
+void hsetCommand(client *c);
+void hgetCommand(client *c);
+void hmgetCommand(client *c);
+void hdelCommand(client *c);
+void hlenCommand(client *c);
+void hgetallCommand(client *c);
+void hincrbyCommand(client *c);
 
 void commandCommand(client *c) {
 	dictIterator *di;
@@ -55,7 +213,74 @@ void commandCommand(client *c) {
 struct redisCommand redisCommandTable[] = {
 	{"get",getCommand,2,"rF",0,NULL,1,1,1,0,0},
 	{"set",setCommand,-3,"wm",0,NULL,1,1,1,0,0},
-	{"command",commandCommand,0,"lt",0,NULL,0,0,0,0,0}
+	{"getset",getsetCommand,3,"wm",0,NULL,1,1,1,0,0},
+	{"setrange",setrangeCommand,4,"wm",0,NULL,1,1,1,0,0},
+	{"getrange",getrangeCommand,4,"r",0,NULL,1,1,1,0,0},
+	{"incr",incrCommand,2,"wmF",0,NULL,1,1,1,0,0},
+	{"decr",decrCommand,2,"wmF",0,NULL,1,1,1,0,0},
+	{"incrby",incrbyCommand,3,"wmF",0,NULL,1,1,1,0,0},
+	{"decrby",decrbyCommand,3,"wmF",0,NULL,1,1,1,0,0},
+	{"incrbyfloat",incrbyfloatCommand,3,"wmF",0,NULL,1,1,1,0,0},
+	{"append",appendCommand,3,"wm",0,NULL,1,1,1,0,0},
+	{"strlen",strlenCommand,2,"rF",0,NULL,1,1,1,0,0},
+	{"mget",mgetCommand,-2,"r",0,NULL,1,-1,1,0,0},
+	{"mset",msetCommand,-3,"wm",0,NULL,1,-1,2,0,0},
+	{"msetnx",msetnxCommand,-3,"wm",0,NULL,1,-1,2,0,0},
+	{"setbit",setbitCommand,4,"wm",0,NULL,1,1,1,0,0},
+	{"getbit",getbitCommand,3,"rF",0,NULL,1,1,1,0,0},
+	{"bitcount",bitcountCommand,-2,"r",0,NULL,1,1,1,0,0},
+	{"bitpos",bitposCommand,-3,"r",0,NULL,1,1,1,0,0},
+	{"bitop",bitopCommand,-4,"wm",0,NULL,2,-1,1,0,0},
+	{"bitfield",bitfieldCommand,-2,"wm",0,NULL,1,1,1,0,0},
+	{"pfadd",pfaddCommand,-2,"wmF",0,NULL,1,1,1,0,0},
+	{"pfcount",pfcountCommand,-2,"r",0,NULL,1,-1,1,0,0},
+	{"pfmerge",pfmergeCommand,-2,"wm",0,NULL,1,-1,1,0,0},
+	{"xadd",xaddCommand,-5,"wmF",0,NULL,1,1,1,0,0},
+	{"xrange",xrangeCommand,-4,"r",0,NULL,1,1,1,0,0},
+	{"xrevrange",xrevrangeCommand,-4,"r",0,NULL,1,1,1,0,0},
+	{"xlen",xlenCommand,2,"rF",0,NULL,1,1,1,0,0},
+	{"xread",xreadCommand,-4,"r",0,NULL,0,0,0,0,0},
+	{"xtrim",xtrimCommand,-2,"w",0,NULL,1,1,1,0,0},
+	{"geoadd",geoaddCommand,-5,"wm",0,NULL,1,1,1,0,0},
+	{"geodist",geodistCommand,-4,"r",0,NULL,1,1,1,0,0},
+	{"geosearch",geosearchCommand,-7,"r",0,NULL,1,1,1,0,0},
+	{"rpush",rpushCommand,-3,"wmF",0,NULL,1,1,1,0,0},
+	{"lpush",lpushCommand,-3,"wmF",0,NULL,1,1,1,0,0},
+	{"rpop",rpopCommand,2,"wF",0,NULL,1,1,1,0,0},
+	{"lpop",lpopCommand,2,"wF",0,NULL,1,1,1,0,0},
+	{"llen",llenCommand,2,"rF",0,NULL,1,1,1,0,0},
+	{"lindex",lindexCommand,3,"r",0,NULL,1,1,1,0,0},
+	{"lrange",lrangeCommand,4,"r",0,NULL,1,1,1,0,0},
+	{"ltrim",ltrimCommand,4,"w",0,NULL,1,1,1,0,0},
+	{"sadd",saddCommand,-3,"wmF",0,NULL,1,1,1,0,0},
+	{"srem",sremCommand,-3,"wF",0,NULL,1,1,1,0,0},
+	{"sismember",sismemberCommand,3,"rF",0,NULL,1,1,1,0,0},
+	{"scard",scardCommand,2,"rF",0,NULL,1,1,1,0,0},
+	{"smembers",smembersCommand,2,"rS",0,NULL,1,1,1,0,0},
+	{"sinter",sinterCommand,-2,"rS",0,NULL,1,-1,1,0,0},
+	{"sunion",sunionCommand,-2,"rS",0,NULL,1,-1,1,0,0},
+	{"sdiff",sdiffCommand,-2,"rS",0,NULL,1,-1,1,0,0},
+	{"zadd",zaddCommand,-4,"wmF",0,NULL,1,1,1,0,0},
+	{"zincrby",zincrbyCommand,4,"wmF",0,NULL,1,1,1,0,0},
+	{"zrem",zremCommand,-3,"wF",0,NULL,1,1,1,0,0},
+	{"zcard",zcardCommand,2,"rF",0,NULL,1,1,1,0,0},
+	{"zscore",zscoreCommand,3,"rF",0,NULL,1,1,1,0,0},
+	{"zrank",zrankCommand,3,"rF",0,NULL,1,1,1,0,0},
+	{"zrevrank",zrevrankCommand,3,"rF",0,NULL,1,1,1,0,0},
+	{"zrange",zrangeCommand,-4,"r",0,NULL,1,1,1,0,0},
+	{"zrevrange",zrevrangeCommand,-4,"r",0,NULL,1,1,1,0,0},
+	{"zrangebyscore",zrangebyscoreCommand,-4,"r",0,NULL,1,1,1,0,0},
+	{"hset",hsetCommand,-4,"wmF",0,NULL,1,1,1,0,0},
+	{"hget",hgetCommand,3,"rF",0,NULL,1,1,1,0,0},
+	{"hmget",hmgetCommand,-3,"r",0,NULL,1,1,1,0,0},
+	{"hdel",hdelCommand,-3,"wF",0,NULL,1,1,1,0,0},
+	{"hlen",hlenCommand,2,"rF",0,NULL,1,1,1,0,0},
+	{"hgetall",hgetallCommand,2,"r",0,NULL,1,1,1,0,0},
+	{"hincrby",hincrbyCommand,4,"wmF",0,NULL,1,1,1,0,0},
+	{"command",commandCommand,0,"lt",0,NULL,0,0,0,0,0},
+	{"info",infoCommand,-1,"lt",0,NULL,0,0,0,0,0},
+	{"bgrewriteaof",bgrewriteaofCommand,1,"a",0,NULL,0,0,0,0,0},
+	{"bgsave",bgsaveCommand,-1,"a",0,NULL,0,0,0,0,0}
 };
 
 /* A case insensitive version used for the command lookup table and other
@@ -75,9 +300,62 @@ struct redisCommand *lookupCommand(sds name) {
 	return dictFetchValue(server.commands, name);
 }
 
+/* Call() is the core of Redis execution of a command.
+ *
+ * The following flags can be passed:
+ * CMD_CALL_NONE        No flags.
+ * CMD_CALL_SLOWLOG     Check command speed and log in the slow log if needed.
+ * CMD_CALL_STATS       Populate command stats.
+ * CMD_CALL_PROPAGATE_AOF   Append command to AOF if it modified the dataset
+ *                          or if the client flags are forcing propagation.
+ * CMD_CALL_PROPAGATE_REPL  Send command to salves if it modified the dataset
+ *                          or if the client flags are forcing propagation.
+ * CMD_CALL_PROPAGATE   Alias for PROPAGATE_AOF|PROPAGATE_REPL.
+ * CMD_CALL_FULL        Alias for SLOWLOG|STATS|PROPAGATE.
+ */
+/*
+ * 执行命令，修改了数据库的写命令会被追加到AOF缓冲区
+ */
 void call(client *c, int flags) {
-	printf("cmd name :%s\n", c->cmd->name);
+	long long dirty, start, duration;
+	int locked;
+
+	// 不fork的BGSAVE进行中时，和快照线程互斥，并保存写命令将要修改的key的旧版本
+	locked = rdbSnapshotLock(c);
+	dirty = server.dirty;
+	start = ustime();
 	c->cmd->proc(c); // 执行实现函数
+	duration = ustime()-start;
+	if (locked) rdbSnapshotUnlock();
+	dirty = server.dirty-dirty;
+	if (dirty < 0) dirty = 0;
+
+	if (flags & CMD_CALL_STATS) {
+		c->lastcmd->microseconds += duration;
+		c->lastcmd->calls++;
+	}
+
+	/* Propagate the command into the AOF. */
+	if ((flags & CMD_CALL_PROPAGATE_AOF) && (c->cmd->flags & CMD_WRITE) &&
+		dirty && !(c->flags & CLIENT_PREVENT_AOF_PROP))
+	{
+		feedAppendOnlyFile(c->cmd,c->db->id,c->argv,c->argc);
+		// 记录这条命令在AOF中的位置，always模式下同步到这里之后才回复客户端
+		c->woff = server.aof_fed_offset;
+	}
+	server.stat_numcommands++;
+}
+
+/*
+ * 用于maxmemory判断的已用内存
+ * 客户端输出缓冲区的块由zmalloc分配，已经包含在内，堆积回复的慢客户端同样占用配额；
+ * AOF缓冲区在beforeSleep中就会清空，和Redis一样不计入
+ */
+static size_t getUsedMemoryForMaxmemory(void) {
+	size_t used = zmalloc_used_memory();
+	size_t overhead = server.aof_buf ? sdsalloc(server.aof_buf) : 0;
+
+	return used > overhead ? used-overhead : 0;
 }
 
 int processCommand(client *c) {
@@ -86,6 +364,24 @@ int processCommand(client *c) {
 	 * 然后检查参数是否错误
 	 */
 	c->cmd = c->lastcmd = lookupCommand(c->argv[0]->ptr);
+	if (!c->cmd) {
+		addReplyErrorFormat(c,"unknown command '%s'",
+				(char*)c->argv[0]->ptr);
+		return C_OK;
+	} else if ((c->cmd->arity > 0 && c->cmd->arity != c->argc) ||
+			(c->argc < -c->cmd->arity)) {
+		addReplyErrorFormat(c,"wrong number of arguments for '%s' command",
+				c->cmd->name);
+		return C_OK;
+	}
+
+	/* 超过maxmemory时拒绝可能增加内存的命令，目前只有noeviction一种策略 */
+	if (server.maxmemory && (c->cmd->flags & CMD_DENYOOM) &&
+			getUsedMemoryForMaxmemory() > server.maxmemory)
+	{
+		addReply(c,shared.oomerr);
+		return C_OK;
+	}
 	call(c,CMD_CALL_FULL);
 	return C_OK;
 }
@@ -97,11 +393,79 @@ void dictSdsDestructor(void *privdata, void *val)
 	sdsfree(val);
 }
 
+void dictObjectDestructor(void *privdata, void *val)
+{
+	DICT_NOTUSED(privdata);
+
+	if (val == NULL) return; /* Lazy freeing will set value to NULL. */
+	decrRefCount(val);
+}
+
+int dictSdsKeyCompare(void *privdata, const void *key1,
+		const void *key2)
+{
+	int l1,l2;
+	DICT_NOTUSED(privdata);
+
+	l1 = sdslen((sds)key1);
+	l2 = sdslen((sds)key2);
+	if (l1 != l2) return 0;
+	return memcmp(key1, key2, l1) == 0;
+}
+
+uint64_t dictSdsHash(const void *key) {
+	return dictGenHashFunction((unsigned char*)key, sdslen((char*)key));
+}
+
 uint64_t dictSdsCaseHash(const void *key) {
 	return dictGenCaseHashFunction((unsigned char*)key, sdslen((char*)key));
 }
 
+/* Db->dict, keys are sds strings, vals are Redis objects. */
+/* 键空间字典类型，键是sds字符串，值是redis对象 */
+dictType dbDictType = {
+	dictSdsHash,                /* hash function */
+	NULL,                       /* key dup */
+	NULL,                       /* val dup */
+	dictSdsKeyCompare,          /* key compare */
+	dictSdsDestructor,          /* key destructor */
+	dictObjectDestructor        /* val destructor */
+};
+
 /* Command table. sds string -> command struct pointer. */
+/* Set dictionary type. Keys are SDS strings, values are not used. */
+/* 集合对象的字典类型，只使用键 */
+dictType setDictType = {
+	dictSdsHash,                /* hash function */
+	NULL,                       /* key dup */
+	NULL,                       /* val dup */
+	dictSdsKeyCompare,          /* key compare */
+	dictSdsDestructor,          /* key destructor */
+	NULL                        /* val destructor */
+};
+
+/* Sorted sets hash (note: a skiplist is used in addition to the hash table) */
+/* 有序集合的字典类型，元素的sds由跳跃表释放，值指向跳跃表节点中的score */
+dictType zsetDictType = {
+	dictSdsHash,                /* hash function */
+	NULL,                       /* key dup */
+	NULL,                       /* val dup */
+	dictSdsKeyCompare,          /* key compare */
+	NULL,                       /* Note: SDS string shared & freed by skiplist */
+	NULL                        /* val destructor */
+};
+
+/* Hash type hash table (note that small hashes are represented with listpacks) */
+/* 哈希对象的字典类型，field和value都是sds字符串 */
+dictType hashDictType = {
+	dictSdsHash,                /* hash function */
+	NULL,                       /* key dup */
+	NULL,                       /* val dup */
+	dictSdsKeyCompare,          /* key compare */
+	dictSdsDestructor,          /* key destructor */
+	dictSdsDestructor           /* val destructor */
+};
+
 dictType commandTableDictType = {
 	dictSdsCaseHash,           /* hash function */
 	NULL,                      /* key dup */
@@ -149,6 +513,38 @@ void populateCommandTable(void) {
 	}
 }
 
+/*
+ * 创建共享对象
+ */
+void createSharedObjects(void) {
+	int j;
+
+	shared.crlf = createObject(OBJ_STRING,sdsnew("\r\n"));
+	shared.ok = createObject(OBJ_STRING,sdsnew("+OK\r\n"));
+	shared.err = createObject(OBJ_STRING,sdsnew("-ERR\r\n"));
+	shared.emptybulk = createObject(OBJ_STRING,sdsnew("$0\r\n\r\n"));
+	shared.czero = createObject(OBJ_STRING,sdsnew(":0\r\n"));
+	shared.cone = createObject(OBJ_STRING,sdsnew(":1\r\n"));
+	shared.pong = createObject(OBJ_STRING,sdsnew("+PONG\r\n"));
+	shared.nullbulk = createObject(OBJ_STRING,sdsnew("$-1\r\n"));
+	shared.emptymultibulk = createObject(OBJ_STRING,sdsnew("*0\r\n"));
+	shared.nullmultibulk = createObject(OBJ_STRING,sdsnew("*-1\r\n"));
+	shared.wrongtypeerr = createObject(OBJ_STRING,sdsnew(
+		"-WRONGTYPE Operation against a key holding the wrong kind of value\r\n"));
+	shared.syntaxerr = createObject(OBJ_STRING,sdsnew(
+		"-ERR syntax error\r\n"));
+	shared.oomerr = createObject(OBJ_STRING,sdsnew(
+		"-OOM command not allowed when used memory > 'maxmemory'.\r\n"));
+	shared.outofrangeerr = createObject(OBJ_STRING,sdsnew(
+		"-ERR index out of range\r\n"));
+	for (j = 0; j < OBJ_SHARED_BULKHDR_LEN; j++) {
+		shared.mbulkhdr[j] = createObject(OBJ_STRING,
+			sdscatprintf(sdsempty(),"*%d\r\n",j));
+		shared.bulkhdr[j] = createObject(OBJ_STRING,
+			sdscatprintf(sdsempty(),"$%d\r\n",j));
+	}
+}
+
 /*
  * 初始化redisServer变量
  */
@@ -157,15 +553,84 @@ void initServerConfig(void) {
 
 	// 初始化其他属性
 	server.hz = CONFIG_DEFAULT_HZ;
+	server.verbosity = CONFIG_DEFAULT_VERBOSITY;
+	server.logfile = zstrdup(CONFIG_DEFAULT_LOGFILE);
 	server.arch_bits = (sizeof(long) == 8) ? 64 : 32;
 	server.port = CONFIG_DEFAULT_SERVER_PORT;
 	server.tcp_backlog = CONFIG_DEFAULT_TCP_BACKLOG;
 	server.bindaddr_count = 0;
 
 	server.ipfd_count = 0;
+	server.sofd = -1;
+	server.reuseport_listeners = CONFIG_DEFAULT_REUSEPORT_LISTENERS;
+	server.reuseport_cpu_steering = CONFIG_DEFAULT_REUSEPORT_CPU_STEERING;
+	server.unixsocket = NULL;
+	server.unixsocketperm = CONFIG_DEFAULT_UNIX_SOCKET_PERM;
 	server.dbnum = CONFIG_DEFAULT_DBNUM;
+	server.maxidletime = CONFIG_DEFAULT_CLIENT_TIMEOUT;
 	server.tcpkeepalive = CONFIG_DEFAULT_TCP_KEEPALIVE;
 	server.maxclients = CONFIG_DEFAULT_MAX_CLIENTS;
+	server.maxmemory = CONFIG_DEFAULT_MAXMEMORY;
+	server.client_read_pause_high = CONFIG_DEFAULT_CLIENT_READ_PAUSE_HIGH;
+	server.client_read_pause_low = CONFIG_DEFAULT_CLIENT_READ_PAUSE_LOW;
+	server.client_cmds_per_event = CONFIG_DEFAULT_CLIENT_CMDS_PER_EVENT;
+	server.reply_ref_threshold = CONFIG_DEFAULT_REPLY_REF_THRESHOLD;
+	server.reply_zerocopy = CONFIG_DEFAULT_REPLY_ZEROCOPY;
+	for (j = 0; j < CLIENT_TYPE_OBUF_COUNT; j++)
+		server.client_obuf_limits[j] = clientBufferLimitsDefaults[j];
+	server.rdb_filename = zstrdup(CONFIG_DEFAULT_RDB_FILENAME);
+	server.rdb_load_threads = CONFIG_DEFAULT_RDB_LOAD_THREADS;
+	server.rdb_lazy_load = CONFIG_DEFAULT_RDB_LAZY_LOAD;
+	server.rdb_map = NULL;
+	server.rdb_map_size = 0;
+	server.rdb_map_refs = 0;
+	server.set_max_intset_entries = OBJ_SET_MAX_INTSET_ENTRIES;
+	server.zset_max_ziplist_entries = OBJ_ZSET_MAX_ZIPLIST_ENTRIES;
+	server.zset_max_ziplist_value = OBJ_ZSET_MAX_ZIPLIST_VALUE;
+	server.hll_sparse_max_bytes = CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES;
+	server.stream_node_max_bytes = OBJ_STREAM_NODE_MAX_BYTES;
+	server.stream_node_max_entries = OBJ_STREAM_NODE_MAX_ENTRIES;
+	server.hash_max_ziplist_entries = OBJ_HASH_MAX_ZIPLIST_ENTRIES;
+	server.hash_max_ziplist_value = OBJ_HASH_MAX_ZIPLIST_VALUE;
+	server.list_max_ziplist_size = OBJ_LIST_MAX_ZIPLIST_SIZE;
+	server.list_compress_depth = OBJ_LIST_COMPRESS_DEPTH;
+	server.aof_state = AOF_OFF;
+	server.aof_fsync = CONFIG_DEFAULT_AOF_FSYNC;
+	server.aof_filename = zstrdup(CONFIG_DEFAULT_AOF_FILENAME);
+	server.aof_load_truncated = CONFIG_DEFAULT_AOF_LOAD_TRUNCATED;
+	server.aof_fd = -1;
+	server.aof_selected_db = -1; /* Make sure the first time will not match */
+	server.aof_flush_postponed_start = 0;
+	server.aof_last_fsync = time(NULL);
+	server.aof_delayed_fsync = 0;
+	server.aof_last_write_status = C_OK;
+	server.aof_last_write_errno = 0;
+	server.aof_current_size = 0;
+	server.aof_rewrite_base_size = 0;
+	server.aof_fed_offset = 0;
+	server.aof_written_offset = 0;
+	server.aof_fsynced_offset = 0;
+	server.aof_fsync_requested_offset = 0;
+	server.aof_bio_fsync_status = C_OK;
+	server.aof_bio_fsync_errno = 0;
+	server.aof_rewrite_perc = AOF_REWRITE_PERC;
+	server.aof_rewrite_min_size = AOF_REWRITE_MIN_SIZE;
+	server.aof_use_rdb_preamble = CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE;
+	server.aof_rewrite_scheduled = 0;
+	server.aof_rewrite_time_last = -1;
+	server.aof_rewrite_time_start = -1;
+	server.aof_lastbgrewrite_status = C_OK;
+	server.aof_child_pid = -1;
+	server.aof_manifest = NULL;
+	server.aof_last_incr_size = 0;
+	server.rdb_child_pid = -1;
+	server.rdb_child_type = RDB_CHILD_TYPE_NONE;
+	server.rdb_last_bgsave_type = RDB_CHILD_TYPE_NONE;
+	server.rdb_bgsave_forkless = CONFIG_DEFAULT_RDB_BGSAVE_FORKLESS;
+	server.rdb_save_time_last = -1;
+	server.rdb_save_time_start = -1;
+	server.lastbgsave_status = C_OK;
+	server.child_info_pipe[0] = server.child_info_pipe[1] = -1;
 
 	/* 创建命令表
 	 * Command table -- we initiialize it here as it is part of the
@@ -180,20 +645,206 @@ void initServerConfig(void) {
 void closeListeningSockets(int unlink_unix_socket) {
 	int j;
 	for (j = 0; j < server.ipfd_count; j++) close(server.ipfd[j]);
+	if (server.sofd != -1) close(server.sofd);
+	if (unlink_unix_socket && server.unixsocket) {
+		printf("Removing the unix socket file.\n");
+		unlink(server.unixsocket); /* don't care if this fails */
+	}
 }
 
 int prepareForShutdown(int flags) {
+	int nosave = flags & SHUTDOWN_NOSAVE;
+
+	// 终止正在进行的BGSAVE，快照线程会被等待到结束
+	killRDBChild();
+	// 关闭前保存数据库，保存失败则拒绝关闭
+	if (!nosave && rdbSave(server.rdb_filename) != C_OK) {
+		printf("Error trying to save the DB, can't exit.\n");
+		return C_ERR;
+	}
+	// 终止正在进行的AOF重写，重写生成的临时文件会被删除
+	killAppendOnlyChild();
+	// 把AOF缓冲区写入文件并同步到磁盘
+	if (server.aof_state != AOF_OFF) stopAppendOnly();
 	// 关闭监听套接字,这样在重启的时候会快一点
 	closeListeningSockets(1);
 	return C_OK;
 }
 
+/* We take a cached value of the unix time in the global state because with
+ * virtual memory and aging there is to store the current time in objects at
+ * every object access, and accuracy is not needed. To access a global var is
+ * a lot faster than calling time(NULL) */
+void updateCachedTime(void) {
+	time_t unixtime = time(NULL);
+	atomicSet(server.unixtime,unixtime);
+	server.mstime = mstime();
+}
+
+/* 空闲超过timeout秒的客户端直接关闭，返回1表示客户端已经被释放 */
+int clientsCronHandleTimeout(client *c, time_t now) {
+	if (server.maxidletime &&
+		!(c->flags & CLIENT_BLOCKED) &&
+		(now - c->lastinteraction > server.maxidletime))
+	{
+		freeClient(c);
+		return 1;
+	}
+	return 0;
+}
+
+/* The client query buffer is an sds.c string that can end with a lot of
+ * free space not used, this function reclaims space if needed.
+ *
+ * The function always returns 0 as it never terminates the client. */
+/*
+ * 空闲客户端的查询缓冲区在读取之后就已经释放，这里只处理还有半个请求的客户端：
+ * 缓冲区比最近一段时间的峰值大很多时释放多余的空间
+ */
+int clientsCronResizeQueryBuffer(client *c) {
+	size_t querybuf_size;
+
+	if (c->querybuf == NULL) {
+		c->querybuf_peak = 0;
+		return 0;
+	}
+	querybuf_size = sdsAllocSize(c->querybuf);
+
+	/* 正在读取的大参数已经按长度分配好了空间，不要收缩 */
+	if (querybuf_size > PROTO_MBULK_BIG_ARG &&
+		(querybuf_size/(c->querybuf_peak+1)) > 2 &&
+		c->bulklen < PROTO_MBULK_BIG_ARG)
+	{
+		/* Only resize the query buffer if it is actually wasting at least a
+		 * few kbytes. */
+		if (sdsavail(c->querybuf) > 1024*4)
+			c->querybuf = sdsRemoveFreeSpace(c->querybuf);
+	}
+	/* Reset the peak again to capture the peak memory usage in the next
+	 * cycle. */
+	c->querybuf_peak = 0;
+	return 0;
+}
+
+/*
+ * 没有正在解析的命令时，释放之前大命令留下的argv数组，
+ * resetClient只释放超过PROTO_ARGV_REUSE_MAX的数组，这里处理空闲客户端剩下的部分
+ */
+int clientsCronTrimArgv(client *c) {
+	if (c->argc == 0 && c->multibulklen == 0 &&
+		c->argv_len > CLIENTS_CRON_ARGV_TRIM)
+	{
+		zfree(c->argv);
+		c->argv = NULL;
+		c->argv_len = 0;
+	}
+	return 0;
+}
+
+/* This function is used in order to track clients using the biggest amount
+ * of memory in the latest few seconds. This way we can provide such information
+ * in the INFO output (clients section), without having to do an O(N) scan for
+ * all the clients.
+ *
+ * This is how it works. We have an array of CLIENTS_PEAK_MEM_USAGE_SLOTS slots
+ * where we track, for each, the biggest client output and input buffers we
+ * saw in that slot. Every slot correspond to one of the latest seconds, since
+ * the array is indexed by doing UNIXTIME % CLIENTS_PEAK_MEM_USAGE_SLOTS.
+ *
+ * When we want to know what was recently the peak memory usage, we just scan
+ * such few slots searching for the maximum value. */
+#define CLIENTS_PEAK_MEM_USAGE_SLOTS 8
+size_t ClientsPeakMemInput[CLIENTS_PEAK_MEM_USAGE_SLOTS];
+size_t ClientsPeakMemOutput[CLIENTS_PEAK_MEM_USAGE_SLOTS];
+
+int clientsCronTrackExpansiveClients(client *c) {
+	size_t in_usage = c->querybuf ? sdsAllocSize(c->querybuf) : 0;
+	size_t out_usage = getClientOutputBufferMemoryUsage(c);
+	int i = server.unixtime % CLIENTS_PEAK_MEM_USAGE_SLOTS;
+	int zeroidx = (i+1) % CLIENTS_PEAK_MEM_USAGE_SLOTS;
+
+	/* Always zero the next sample, so that when we switch to that second, we'll
+	 * only register samples that are greater in that second without considering
+	 * the history of such slot.
+	 *
+	 * Note: our index may jump to any random position if serverCron() is not
+	 * called for some reason with the normal frequency, for instance because
+	 * some slow command is called taking multiple seconds to execute. In that
+	 * case our array may end containing data which is potentially older
+	 * than CLIENTS_PEAK_MEM_USAGE_SLOTS seconds: however this is not a problem
+	 * since here we want just to track if "recently" there were very expansive
+	 * clients from the POV of memory usage. */
+	ClientsPeakMemInput[zeroidx] = 0;
+	ClientsPeakMemOutput[zeroidx] = 0;
+
+	/* Track the biggest values observed so far in this slot. */
+	if (in_usage > ClientsPeakMemInput[i]) ClientsPeakMemInput[i] = in_usage;
+	if (out_usage > ClientsPeakMemOutput[i]) ClientsPeakMemOutput[i] = out_usage;
+
+	return 0; /* This function never terminates the client. */
+}
+
+/* Return the max samples in the memory usage of clients tracked by
+ * the function clientsCronTrackExpansiveClients(). */
+void getExpansiveClientsInfo(size_t *in_usage, size_t *out_usage) {
+	size_t i = 0, o = 0;
+	for (int j = 0; j < CLIENTS_PEAK_MEM_USAGE_SLOTS; j++) {
+		if (ClientsPeakMemInput[j] > i) i = ClientsPeakMemInput[j];
+		if (ClientsPeakMemOutput[j] > o) o = ClientsPeakMemOutput[j];
+	}
+	*in_usage = i;
+	*out_usage = o;
+}
+
+/*
+ * 每次只处理一部分客户端：把链表尾部的客户端转到头部再处理，
+ * 每次处理numclients/hz个，这样不管hz是多少，每个客户端大约每秒被检查一次
+ */
 void clientsCron(void) {
-	// todo
+	/* Try to process at least numclients/server.hz of clients
+	 * per call. Since normally (if there are no big latency events) this
+	 * function is called server.hz times per second, in the average case we
+	 * process all the clients in 1 second. */
+	int numclients = listLength(server.clients);
+	int iterations = numclients/server.hz;
+	time_t now = server.unixtime;
+
+	/* Process at least a few clients while we are at it, even if we need
+	 * to process less than CLIENTS_CRON_MIN_ITERATIONS to meet our contract
+	 * of processing each client once per second. */
+	if (iterations < CLIENTS_CRON_MIN_ITERATIONS)
+		iterations = (numclients < CLIENTS_CRON_MIN_ITERATIONS) ?
+					 numclients : CLIENTS_CRON_MIN_ITERATIONS;
+
+	while(listLength(server.clients) && iterations--) {
+		client *c;
+		listNode *head;
+
+		/* Rotate the list, take the current head, process.
+		 * This makes sure that if the client must be removed from the
+		 * list, it's always the head element, so the removal is O(1). */
+		listRotate(server.clients);
+		head = listFirst(server.clients);
+		c = listNodeValue(head);
+		/* The following functions do different service checks on the client.
+		 * The protocol is that they return non-zero if the client was
+		 * terminated. */
+		if (clientsCronHandleTimeout(c,now)) continue;
+		if (clientsCronResizeQueryBuffer(c)) continue;
+		if (clientsCronTrimArgv(c)) continue;
+		/* 完成通知没有触发事件的客户端（读写事件都没有注册）在这里收取 */
+		if (c->flags & CLIENT_ZEROCOPY) clientReapZeroCopy(c);
+		if (clientsCronTrackExpansiveClients(c)) continue;
+	}
 }
 
 int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 	int j;
+	UNUSED(eventLoop);
+	UNUSED(id);
+	UNUSED(clientData);
+
+	updateCachedTime();
 	// 服务器进程收到 SIGTERM 消息,关闭服务器
 	if (server.shutdown_asap) {
 		// 尝试关闭服务器
@@ -203,11 +854,94 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 	}
 	// 检查客户端,关闭超时的客户端,并释放客户端多余的缓冲区
 	clientsCron();
-	return 1000000 / server.hz; // 这个返回的值决定了下次什么时候再调用这个函数
+	/* Start a scheduled AOF rewrite if this was requested by the user while
+	 * a BGSAVE was in progress. */
+	if (!rdbSaveInProgress() && server.aof_child_pid == -1 &&
+		server.aof_rewrite_scheduled)
+	{
+		rewriteAppendOnlyFileBackground();
+	}
+
+	/* Check if a background saving or AOF rewrite in progress terminated. */
+	if (server.rdb_child_pid != -1 || server.aof_child_pid != -1) {
+		int statloc;
+		pid_t pid;
+
+		if ((pid = wait3(&statloc,WNOHANG,NULL)) != 0) {
+			int exitcode = WIFEXITED(statloc) ? WEXITSTATUS(statloc) : -1;
+			int bysignal = 0;
+
+			if (WIFSIGNALED(statloc)) bysignal = WTERMSIG(statloc);
+
+			if (pid == -1) {
+				printf("wait3() returned an error: %s. "
+					"rdb_child_pid = %d, aof_child_pid = %d\n",
+					strerror(errno),
+					(int) server.rdb_child_pid,
+					(int) server.aof_child_pid);
+			} else if (pid == server.rdb_child_pid) {
+				backgroundSaveDoneHandler(exitcode,bysignal);
+			} else if (pid == server.aof_child_pid) {
+				backgroundRewriteDoneHandler(exitcode,bysignal);
+			}
+		}
+	} else if (rdbSaveInProgress()) {
+		/* 不fork的BGSAVE，检查快照线程是否结束 */
+		rdbSnapshotCron(0);
+	} else if (server.aof_state == AOF_ON &&
+			server.aof_rewrite_perc &&
+			server.aof_current_size > server.aof_rewrite_min_size)
+	{
+		/* Trigger an AOF rewrite if needed. */
+		long long base = server.aof_rewrite_base_size ?
+			server.aof_rewrite_base_size : 1;
+		long long growth = (server.aof_current_size*100/base) - 100;
+		if (growth >= server.aof_rewrite_perc) {
+			printf("Starting automatic rewriting of AOF on %lld%% growth\n",growth);
+			rewriteAppendOnlyFileBackground();
+		}
+	}
+
+	/* AOF postponed flush: Try at every cron cycle if the slow fsync
+	 * completed. */
+	if (server.aof_flush_postponed_start) flushAppendOnlyFile(0);
+
+	server.cronloops++;
+	return 1000/server.hz; // 这个返回的值(毫秒)决定了下次什么时候再调用这个函数
+}
+
+/* This function gets called every time Redis is entering the
+ * main loop of the event driven library, that is, before to sleep
+ * for ready file descriptors. */
+/*
+ * 每次进入事件循环等待之前调用：
+ * 先把本轮的写命令一次性写入AOF，再发送客户端的回复
+ */
+void beforeSleep(struct aeEventLoop *eventLoop) {
+	UNUSED(eventLoop);
+
+	/* 排队的客户端继续执行剩下的请求，要在写AOF之前，保证回复之前命令已经写入AOF */
+	handleClientsWithPendingReads();
+
+	/* Write the AOF buffer on disk */
+	flushAppendOnlyFile(0);
+
+	/* Handle writes with pending output buffers. */
+	handleClientsWithPendingWrites();
+
+	/* 回复发送完之后再集中释放需要关闭的客户端 */
+	freeClientsInAsyncFreeQueue();
+
+	/* 还有客户端在排队，或者上面发送回复时又有客户端恢复了读取，
+	 * 不要阻塞在poll上，处理完已经就绪的事件后马上轮到它们 */
+	aeSetDontWait(server.el,listLength(server.clients_pending_read) != 0);
 }
 
 static void sigtermHandler(int sig) {
-	// todo
+	UNUSED(sig);
+
+	// 不在信号处理函数中直接关闭，由serverCron检查标志后安全地关闭服务器
+	server.shutdown_asap = 1;
 }
 
 /*
@@ -222,6 +956,65 @@ void setupSignalHandlers(void) {
 
 }
 
+/*
+ * 监听socket设置为非阻塞
+ * Linux上accept得到的连接会继承监听socket的TCP_NODELAY和keepalive设置，
+ * 在这里设置一次，每个新连接就不用再调用setsockopt
+ */
+static void initListenSocket(int fd) {
+	anetNonBlock(NULL,fd);
+#ifdef HAVE_ACCEPT_INHERIT_SOCKOPT
+	anetEnableTcpNoDelay(NULL,fd);
+	if (server.tcpkeepalive)
+		anetKeepAlive(NULL,fd,server.tcpkeepalive);
+#endif
+}
+
+/*
+ * 在一个地址上创建server.reuseport_listeners个监听socket
+ * 大于1时使用SO_REUSEPORT，每个socket有自己的accept队列，重连风暴时SYN的处理
+ * 不再集中在一个监听socket上；打开cpu steering后按处理SYN的CPU分配连接，
+ * 目前所有监听socket仍然由同一个事件循环处理
+ * 失败时关闭这个地址上已经创建的socket，errno保留bind/listen的错误
+ */
+static int listenToAddr(int port, char *addr, int af, int *fds, int *count) {
+	int j, fd, err, first = *count, n = server.reuseport_listeners;
+
+	for (j = 0; j < n; j++) {
+		if (n == 1) {
+			fd = af == AF_INET6 ?
+				anetTcp6Server(server.neterr,port,addr,server.tcp_backlog) :
+				anetTcpServer(server.neterr,port,addr,server.tcp_backlog);
+		} else {
+			fd = af == AF_INET6 ?
+				anetTcp6ReusePortServer(server.neterr,port,addr,server.tcp_backlog) :
+				anetTcpReusePortServer(server.neterr,port,addr,server.tcp_backlog);
+		}
+		if (fd == ANET_ERR) {
+			err = errno;
+			while (*count > first) close(fds[--(*count)]);
+			errno = err;
+			return C_ERR;
+		}
+		initListenSocket(fd);
+		fds[(*count)++] = fd;
+	}
+
+	if (n > 1 && server.reuseport_cpu_steering &&
+			anetReusePortSteerByCpu(server.neterr,fds[first],n) == ANET_ERR)
+	{
+		/* 内核不支持reuseport BPF时退回SO_INCOMING_CPU */
+		printf("Warning: %s, falling back to SO_INCOMING_CPU\n",server.neterr);
+		for (j = 0; j < n; j++) {
+			if (anetSetIncomingCpu(server.neterr,fds[first+j],j) == ANET_ERR) {
+				printf("Warning: %s\n",server.neterr);
+				break;
+			}
+		}
+	}
+	return C_OK;
+}
+
 int listenToPort(int port, int *fds, int *count) {
 	int j;
 
@@ -230,47 +1023,34 @@ int listenToPort(int port, int *fds, int *count) {
 	if (server.bindaddr_count == 0) server.bindaddr[0] = NULL;
 	for (j = 0; j < server.bindaddr_count || j == 0; j++) {
 		if (server.bindaddr[j] == NULL) {
-			int unsupported = 0;
+			int bound = 0, unsupported = 0;
 			/* Bind * for both IPv6 and IPv4, we enter here only if
 			 * server.bindaddr_count == 0. */
-			fds[*count] = anetTcp6Server(server.neterr,port,NULL,
-					server.tcp_backlog);
-			if (fds[*count] != ANET_ERR) {
-				anetNonBlock(NULL,fds[*count]);
-				(*count)++;
-			} else if (errno == EAFNOSUPPORT) {
+			if (listenToAddr(port,NULL,AF_INET6,fds,count) == C_OK)
+				bound++;
+			else if (errno == EAFNOSUPPORT)
 				unsupported++;
-			}
 
-			if (*count == 1 || unsupported) {
+			if (bound || unsupported) {
 				/* Bind the IPv4 address as well. */
-				fds[*count] = anetTcpServer(server.neterr,port,NULL,
-						server.tcp_backlog);
-				if (fds[*count] != ANET_ERR) {
-					anetNonBlock(NULL,fds[*count]);
-					(*count)++;
-				} else if (errno == EAFNOSUPPORT) {
+				if (listenToAddr(port,NULL,AF_INET,fds,count) == C_OK)
+					bound++;
+				else if (errno == EAFNOSUPPORT)
 					unsupported++;
-				}
 			}
 			/* Exit the loop if we were able to bind * on IPv4 and IPv6,
-			 * otherwise fds[*count] will be ANET_ERR and we'll print an
-			 * error and return to the caller with an error. */
-			if (*count + unsupported == 2) break;
+			 * otherwise return to the caller with an error. */
+			if (bound + unsupported == 2) break;
+			return C_ERR;
 		} else if (strchr(server.bindaddr[j],':')) {
 			/* Bind IPv6 address. */
-			fds[*count] = anetTcp6Server(server.neterr,port,server.bindaddr[j],
-					server.tcp_backlog);
+			if (listenToAddr(port,server.bindaddr[j],AF_INET6,fds,count) == C_ERR)
+				return C_ERR;
 		} else {
 			/* Bind IPv4 address. */
-			fds[*count] = anetTcpServer(server.neterr,port,server.bindaddr[j],
-					server.tcp_backlog);
+			if (listenToAddr(port,server.bindaddr[j],AF_INET,fds,count) == C_ERR)
+				return C_ERR;
 		}
-		if (fds[*count] == ANET_ERR) {
-			return C_ERR;
-		}
-		anetNonBlock(NULL,fds[*count]);
-		(*count)++;
 	}
 	return C_OK;
 }
@@ -288,6 +1068,21 @@ void initServer(void) {
 
 	server.clients = listCreate(); // 客户端链表
 	server.clients_to_close = listCreate();
+	server.clients_pending_write = listCreate();
+	server.clients_pending_read = listCreate();
+	createSharedObjects();
+	updateCachedTime();
+	// 创建数据库
+	server.db = zmalloc(sizeof(redisDb)*server.dbnum);
+	for (j = 0; j < server.dbnum; j++) {
+		server.db[j].dict = dictCreate(&dbDictType,NULL);
+		server.db[j].expires = NULL;
+		server.db[j].blocking_keys = NULL;
+		server.db[j].ready_keys = NULL;
+		server.db[j].watched_keys = NULL;
+		server.db[j].id = j;
+		server.db[j].avg_ttl = 0;
+	}
 	/* 初始化事件循环 */
 	server.el = aeCreateEventLoop(server.maxclients+CONFIG_FDSET_INCR);
 	if (server.el == NULL) {
@@ -299,6 +1094,18 @@ void initServer(void) {
 			listenToPort(server.port,server.ipfd,&server.ipfd_count) == C_ERR)
 		exit(1);
 
+	/* 打开Unix域套接字，同一台机器上的客户端可以绕过TCP协议栈 */
+	if (server.unixsocket != NULL) {
+		unlink(server.unixsocket); /* don't care if this fails */
+		server.sofd = anetUnixServer(server.neterr,server.unixsocket,
+				server.unixsocketperm, server.tcp_backlog);
+		if (server.sofd == ANET_ERR) {
+			printf("Opening Unix socket: %s\n", server.neterr);
+			exit(1);
+		}
+		anetNonBlock(NULL,server.sofd);
+	}
+
 	/*
 	 * 注册时间事件定时器
 	 * 这是redis处理后台操作的方法，比如客户端超时，删除超时的key等等
@@ -318,24 +1125,280 @@ void initServer(void) {
 			exit(1);
 		}
 	}
+	if (server.sofd != -1 && aeCreateFileEvent(server.el,server.sofd,AE_READABLE,
+				acceptUnixHandler,NULL) == AE_ERR)
+	{
+		printf("Unrecoverable error creating server.sofd file event.\n");
+		exit(1);
+	}
+
+	/* bio线程完成AOF同步后通过这个管道唤醒事件循环 */
+	if (pipe(server.aof_fsync_notify_pipe) == -1) {
+		printf("Can't create the AOF fsync notify pipe: %s\n",strerror(errno));
+		exit(1);
+	}
+	anetNonBlock(NULL,server.aof_fsync_notify_pipe[0]);
+	anetNonBlock(NULL,server.aof_fsync_notify_pipe[1]);
+	if (aeCreateFileEvent(server.el, server.aof_fsync_notify_pipe[0],
+				AE_READABLE, aofFsyncNotifyHandler,NULL) == AE_ERR)
+	{
+		printf("Can't create the AOF fsync notify event\n");
+		exit(1);
+	}
+
+	server.aof_buf = sdsempty();
+
+	bioInit();
+}
+
+/*
+ * INFO [section]
+ * 目前只有clients、persistence和stats三部分
+ */
+sds genRedisInfoString(char *section) {
+	sds info = sdsempty();
+	int allsections = 0, defsections = 0;
+	int sections = 0;
+
+	if (section == NULL) section = "default";
+	allsections = strcasecmp(section,"all") == 0;
+	defsections = strcasecmp(section,"default") == 0;
+
+	/* Persistence */
+	if (allsections || defsections || !strcasecmp(section,"persistence")) {
+		long long written, fsynced, count, total, last, max, stalls;
+		int bio_fsync_status;
+
+		atomicGet(server.aof_written_offset,written);
+		atomicGet(server.aof_fsynced_offset,fsynced);
+		atomicGet(server.stat_aof_fsync_count,count);
+		atomicGet(server.stat_aof_fsync_total_us,total);
+		atomicGet(server.stat_aof_fsync_last_us,last);
+		atomicGet(server.stat_aof_fsync_max_us,max);
+		atomicGet(server.stat_aof_fsync_stalls,stalls);
+		atomicGet(server.aof_bio_fsync_status,bio_fsync_status);
+		if (sections++) info = sdscat(info,"\r\n");
+		info = sdscatprintf(info,
+			"# Persistence\r\n"
+			"loading:%d\r\n"
+			"rdb_changes_since_last_save:%lld\r\n"
+			"rdb_load_io_usec:%lld\r\n"
+			"rdb_load_decode_usec:%lld\r\n"
+			"rdb_load_insert_usec:%lld\r\n"
+			"rdb_bgsave_in_progress:%d\r\n"
+			"rdb_last_save_time:%jd\r\n"
+			"rdb_last_bgsave_status:%s\r\n"
+			"rdb_last_bgsave_mode:%s\r\n"
+			"rdb_last_bgsave_time_sec:%jd\r\n"
+			"rdb_current_bgsave_time_sec:%jd\r\n"
+			"rdb_last_bgsave_start_usec:%lld\r\n"
+			"rdb_last_cow_size:%zu\r\n"
+			"rdb_last_bgsave_rss_start:%zu\r\n"
+			"rdb_last_bgsave_rss_peak:%zu\r\n"
+			"rdb_last_snapshot_versions:%lld\r\n"
+			"rdb_last_snapshot_version_bytes_peak:%zu\r\n"
+			"rdb_last_snapshot_max_wait_usec:%lld\r\n"
+			"aof_enabled:%d\r\n"
+			"aof_fsync:%s\r\n"
+			"aof_current_size:%lld\r\n"
+			"aof_buffer_length:%zu\r\n"
+			"aof_last_write_status:%s\r\n"
+			"aof_last_bio_fsync_status:%s\r\n"
+			"aof_fed_offset:%lld\r\n"
+			"aof_written_offset:%lld\r\n"
+			"aof_fsynced_offset:%lld\r\n"
+			"aof_pending_bio_fsync:%llu\r\n"
+			"aof_delayed_fsync:%lu\r\n"
+			"aof_fsync_count:%lld\r\n"
+			"aof_fsync_avg_usec:%lld\r\n"
+			"aof_fsync_last_usec:%lld\r\n"
+			"aof_fsync_max_usec:%lld\r\n"
+			"aof_fsync_stalls:%lld\r\n"
+			"aof_write_max_usec:%lld\r\n"
+			"aof_rewrite_in_progress:%d\r\n"
+			"aof_rewrite_scheduled:%d\r\n"
+			"aof_last_rewrite_time_sec:%jd\r\n"
+			"aof_current_rewrite_time_sec:%jd\r\n"
+			"aof_last_bgrewrite_status:%s\r\n"
+			"aof_base_size:%lld\r\n"
+			"aof_incr_files:%lu\r\n",
+			server.loading,
+			server.dirty,
+			server.stat_rdb_load_io_us,
+			server.stat_rdb_load_decode_us,
+			server.stat_rdb_load_insert_us,
+			rdbSaveInProgress(),
+			(intmax_t)server.lastsave,
+			(server.lastbgsave_status == C_OK) ? "ok" : "err",
+			server.rdb_last_bgsave_type == RDB_CHILD_TYPE_FORKLESS ?
+				"forkless" : "fork",
+			(intmax_t)server.rdb_save_time_last,
+			(intmax_t)((server.rdb_save_time_start == -1) ?
+				-1 : time(NULL)-server.rdb_save_time_start),
+			server.stat_rdb_bgsave_start_us,
+			server.stat_rdb_cow_bytes,
+			server.stat_rdb_bgsave_rss_start,
+			server.stat_rdb_bgsave_rss_peak,
+			server.stat_rdb_snapshot_versions,
+			server.stat_rdb_snapshot_version_bytes_peak,
+			server.stat_rdb_snapshot_max_wait_us,
+			server.aof_state != AOF_OFF,
+			server.aof_fsync == AOF_FSYNC_ALWAYS ? "always" :
+			(server.aof_fsync == AOF_FSYNC_EVERYSEC ? "everysec" : "no"),
+			(long long) server.aof_current_size,
+			sdslen(server.aof_buf),
+			(server.aof_last_write_status == C_OK) ? "ok" : "err",
+			(bio_fsync_status == C_OK) ? "ok" : "err",
+			server.aof_fed_offset,
+			written,
+			fsynced,
+			bioPendingJobsOfType(BIO_AOF_FSYNC),
+			server.aof_delayed_fsync,
+			count,
+			count ? total/count : 0,
+			last,
+			max,
+			stalls,
+			server.stat_aof_write_max_us,
+			server.aof_child_pid != -1,
+			server.aof_rewrite_scheduled,
+			(intmax_t)server.aof_rewrite_time_last,
+			(intmax_t)((server.aof_child_pid == -1) ?
+				-1 : time(NULL)-server.aof_rewrite_time_start),
+			(server.aof_lastbgrewrite_status == C_OK) ? "ok" : "err",
+			(long long) server.aof_rewrite_base_size,
+			server.aof_manifest ?
+				listLength(server.aof_manifest->incr_aof_list) : 0);
+	}
+
+	/* Clients */
+	if (allsections || defsections || !strcasecmp(section,"clients")) {
+		size_t maxin, maxout;
+
+		getExpansiveClientsInfo(&maxin,&maxout);
+		if (sections++) info = sdscat(info,"\r\n");
+		info = sdscatprintf(info,
+			"# Clients\r\n"
+			"connected_clients:%lu\r\n"
+			"client_recent_max_input_buffer:%zu\r\n"
+			"client_recent_max_output_buffer:%zu\r\n"
+			"maxclients:%u\r\n"
+			"timeout:%d\r\n",
+			listLength(server.clients),
+			maxin, maxout,
+			server.maxclients,
+			server.maxidletime);
+	}
 
+	/* Stats */
+	if (allsections || defsections || !strcasecmp(section,"stats")) {
+		if (sections++) info = sdscat(info,"\r\n");
+		info = sdscatprintf(info,
+			"# Stats\r\n"
+			"total_commands_processed:%lld\r\n"
+			"total_net_output_bytes:%lld\r\n"
+			"client_read_pauses:%lld\r\n"
+			"reply_obj_refs:%lld\r\n"
+			"reply_zerocopy_sends:%lld\r\n"
+			"reply_zerocopy_copied:%lld\r\n"
+			"used_memory:%zu\r\n"
+			"used_memory_rss:%zu\r\n",
+			server.stat_numcommands,
+			server.stat_net_output_bytes,
+			server.stat_client_read_pauses,
+			server.stat_reply_obj_refs,
+			server.stat_zerocopy_sends,
+			server.stat_zerocopy_copied,
+			zmalloc_used_memory(),
+			zmalloc_get_rss());
+	}
+	return info;
+}
+
+void infoCommand(client *c) {
+	char *section = c->argc == 2 ? c->argv[1]->ptr : "default";
+
+	if (c->argc > 2) {
+		addReply(c,shared.syntaxerr);
+		return;
+	}
+	addReplyBulkSds(c, genRedisInfoString(section));
+}
+
+/*
+ * 启动时从磁盘加载数据
+ */
+void loadDataFromDisk(void) {
+	// 开启AOF时AOF文件包含最完整的数据，优先使用AOF
+	if (server.aof_state == AOF_ON) {
+		loadAppendOnlyFiles(server.aof_manifest);
+		return;
+	}
+	// 加载耗时由rdbLoad按阶段打印
+	if (rdbLoad(server.rdb_filename) != C_OK && errno != ENOENT) {
+		printf("Fatal error loading the DB: %s. Exiting.\n",strerror(errno));
+		exit(1);
+	}
 }
 
 /*
  * main，程序入口，server启动函数
+ * 编译模块的基准测试时由模块自己提供main，见Makefile中的BENCHS
  */
+#ifndef SERVER_NO_MAIN
 int main(int argc, char **argv) {
 	struct timeval tv;
 	int j;
 
 	initServerConfig(); // 初始化服务器状态
 
+	/*
+	 * 解析启动参数：第一个参数如果不是以"--"开头则作为配置文件路径，
+	 * 其余的"--name value"参数转换成配置行，例如 ./server --rdb-lazy-load yes
+	 */
+	if (argc >= 2) {
+		char *configfile = NULL;
+		sds options = sdsempty();
+
+		j = 1;
+		if (argv[j][0] != '-' || argv[j][1] != '-') configfile = argv[j++];
+		while(j != argc) {
+			if (argv[j][0] == '-' && argv[j][1] == '-') {
+				/* Option name */
+				if (sdslen(options)) options = sdscat(options,"\n");
+				options = sdscat(options,argv[j]+2);
+				options = sdscat(options," ");
+			} else {
+				/* Option argument */
+				options = sdscatrepr(options,argv[j],strlen(argv[j]));
+				options = sdscat(options," ");
+			}
+			j++;
+		}
+		loadServerConfig(configfile,options);
+		sdsfree(options);
+	}
+
 	// 初始化服务器
 	initServer();
+	/*
+	 * Abort if there are no listening sockets at all.
+	 * 检查放在这里而不是initServer()，基准测试会有意用port 0初始化服务器
+	 */
+	if (server.ipfd_count == 0 && server.sofd == -1) {
+		printf("Configured to not listen anywhere, exiting.\n");
+		exit(1);
+	}
 	printf("*************init server done ************\n");
+	if (server.aof_state == AOF_ON) aofLoadManifestFromDisk();
+	loadDataFromDisk();
+	// 加载完成后打开最新的incr文件继续追加
+	if (aofOpenIfNeededOnServerStart() == C_ERR) exit(1);
+	aeSetBeforeSleepProc(server.el,beforeSleep);
 	// 启动事件循环器，开始监听事件
 	aeMain(server.el);
 	return 0;
 }
+#endif
 
 /* The end */
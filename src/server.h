@@ -1,8 +1,16 @@
+#ifndef __REDIS_H
+#define __REDIS_H
+
+#include "config.h"
 #include "dict.h" 
 #include "adlist.h"
 #include "ae.h"
 #include "sds.h"
 #include "anet.h"
+#include "quicklist.h"
+#include "listpack.h"
+#include "zskiplist.h"
+#include "stream.h"
 #include <limits.h>
 
 /* Error codes */
@@ -16,10 +24,13 @@
 #define CONFIG_DEFAULT_SERVER_PORT        6379    /* TCP port */
 #define CONFIG_DEFAULT_TCP_BACKLOG       511     /* TCP listen backlog */
 #define CONFIG_DEFAULT_CLIENT_TIMEOUT       0       /* default client timeout: infinite */
+#define CLIENTS_CRON_MIN_ITERATIONS 5 /* clientsCron每次至少检查的客户端数量 */
+#define CLIENTS_CRON_ARGV_TRIM  64 /* 空闲客户端的argv数组超过这个容量时在cron中释放 */
 #define CONFIG_DEFAULT_DBNUM     16
 #define CONFIG_MAX_LINE    1024
 #define CRON_DBS_PER_CALL 16
 #define NET_MAX_WRITES_PER_EVENT (1024*64)
+#define NET_MAX_WRITEV_IOV 64 /* writeToClient每次writev最多的块数 */
 #define PROTO_SHARED_SELECT_CMDS 10
 #define OBJ_SHARED_INTEGERS 10000 /* redis在初始化服务器时，会创建值为0-9999的字符串对象，做共享对象使用 */
 #define OBJ_SHARED_BULKHDR_LEN 32
@@ -31,6 +42,11 @@
 #define CONFIG_DEFAULT_SLOWLOG_LOG_SLOWER_THAN 10000
 #define CONFIG_DEFAULT_SLOWLOG_MAX_LEN 128
 #define CONFIG_DEFAULT_MAX_CLIENTS 10000
+#define CONFIG_DEFAULT_CLIENT_READ_PAUSE_HIGH (1024*1024) /* 0表示不限制 */
+#define CONFIG_DEFAULT_CLIENT_READ_PAUSE_LOW (256*1024)
+#define CONFIG_DEFAULT_CLIENT_CMDS_PER_EVENT 100 /* 0表示不限制 */
+#define CONFIG_DEFAULT_REPLY_REF_THRESHOLD (64*1024) /* 0表示总是拷贝 */
+#define CONFIG_DEFAULT_REPLY_ZEROCOPY 0
 #define CONFIG_AUTHPASS_MAX_LEN 512
 #define CONFIG_DEFAULT_SLAVE_PRIORITY 100
 #define CONFIG_DEFAULT_REPL_TIMEOUT 60
@@ -50,6 +66,8 @@
 #define CONFIG_DEFAULT_DAEMONIZE 0
 #define CONFIG_DEFAULT_UNIX_SOCKET_PERM 0
 #define CONFIG_DEFAULT_TCP_KEEPALIVE 300
+#define CONFIG_DEFAULT_REUSEPORT_LISTENERS 1
+#define CONFIG_DEFAULT_REUSEPORT_CPU_STEERING 0
 #define CONFIG_DEFAULT_PROTECTED_MODE 1
 #define CONFIG_DEFAULT_LOGFILE ""
 #define CONFIG_DEFAULT_SYSLOG_ENABLED 0
@@ -57,6 +75,9 @@
 #define CONFIG_DEFAULT_RDB_COMPRESSION 1
 #define CONFIG_DEFAULT_RDB_CHECKSUM 1
 #define CONFIG_DEFAULT_RDB_FILENAME "dump.rdb"
+#define CONFIG_DEFAULT_RDB_LOAD_THREADS 4
+#define CONFIG_DEFAULT_RDB_LAZY_LOAD 0
+#define CONFIG_DEFAULT_RDB_BGSAVE_FORKLESS 0
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC 0
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY 5
 #define CONFIG_DEFAULT_SLAVE_SERVE_STALE_DATA 1
@@ -79,6 +100,7 @@
 #define NET_IP_STR_LEN 46 /* INET6_ADDRSTRLEN is 46, but we need to be sure */
 #define NET_PEER_ID_LEN (NET_IP_STR_LEN+32) /* Must be enough for ip:port */
 #define CONFIG_BINDADDR_MAX 16
+#define CONFIG_REUSEPORT_MAX 16 /* 每个地址最多的SO_REUSEPORT监听socket数 */
 #define CONFIG_MIN_RESERVED_FDS 32
 #define CONFIG_DEFAULT_LATENCY_MONITOR_THRESHOLD 0
 #define CONFIG_DEFAULT_SLAVE_LAZY_FLUSH 0
@@ -108,10 +130,12 @@
 
 /* Protocol and I/O related defines */
 #define PROTO_MAX_QUERYBUF_LEN  (1024*1024*1024) /* 1GB max query buffer. */
+#define PROTO_MAX_BULK_LEN (512ll*1024*1024) /* 字符串的最大长度 */
 #define PROTO_IOBUF_LEN         (1024*16)  /* Generic I/O buffer size */
 #define PROTO_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
 #define PROTO_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define PROTO_MBULK_BIG_ARG     (1024*32)
+#define PROTO_ARGV_REUSE_MAX    1024 /* argv数组超过这个容量时不再保留 */
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
 #define AOF_AUTOSYNC_BYTES (1024*1024*32) /* fdatasync every 32MB */
 
@@ -180,6 +204,10 @@
 #define CLIENT_LUA_DEBUG (1<<25)  /* Run EVAL in debug mode. */
 #define CLIENT_LUA_DEBUG_SYNC (1<<26)  /* EVAL debugging without fork() */
 #define CLIENT_MODULE (1<<27) /* Non connected client used by some module. */
+#define CLIENT_READ_PAUSED (1<<28) /* 待发送的回复太多，暂停读取请求 */
+#define CLIENT_PENDING_READ (1<<29) /* 还有未处理的请求，在clients_pending_read
+                                       中等待处理 */
+#define CLIENT_ZEROCOPY (1<<30) /* socket已开启SO_ZEROCOPY，大的值用MSG_ZEROCOPY发送 */
 
 /* Client block type (btype field in client structure)
  * if CLIENT_BLOCKED flag is set. */
@@ -264,14 +292,28 @@
 /* Anti-warning macro... */
 #define UNUSED(V) ((void) V)
 
-#define ZSKIPLIST_MAXLEVEL 32 /* Should be enough for 2^32 elements */
-#define ZSKIPLIST_P 0.25      /* Skiplist P = 1/4 */
+/* 记录错误的位置后退出，用于不可恢复的内部错误 */
+#define serverPanic(...) _serverPanic(__FILE__,__LINE__,__VA_ARGS__)
 
 /* Append only defines */
 #define AOF_FSYNC_NO 0
 #define AOF_FSYNC_ALWAYS 1
 #define AOF_FSYNC_EVERYSEC 2
 #define CONFIG_DEFAULT_AOF_FSYNC AOF_FSYNC_EVERYSEC
+#define AOF_FSYNC_STALL_US 100000 /* fdatasync超过100ms记为一次停顿 */
+#define AOF_REWRITE_BUF_BYTES (1024*64) /* 重写时每64k写入一次文件 */
+
+/* AOF manifest definition */
+#define AOF_MANIFEST_MAX_LINE 1024
+#define AOF_MANIFEST_KEY_FILE_NAME "file"
+#define AOF_MANIFEST_KEY_FILE_SEQ "seq"
+#define AOF_MANIFEST_KEY_FILE_TYPE "type"
+#define BASE_FILE_SUFFIX ".base"
+#define INCR_FILE_SUFFIX ".incr"
+#define RDB_FORMAT_SUFFIX ".rdb"
+#define AOF_FORMAT_SUFFIX ".aof"
+#define MANIFEST_NAME_SUFFIX ".manifest"
+#define TEMP_FILE_NAME_PREFIX "temp-"
 
 /* Zip structure related defaults */
 #define OBJ_HASH_MAX_ZIPLIST_ENTRIES 512
@@ -287,6 +329,10 @@
 /* HyperLogLog defines */
 #define CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES 3000
 
+/* Stream defaults */
+#define OBJ_STREAM_NODE_MAX_BYTES 4096
+#define OBJ_STREAM_NODE_MAX_ENTRIES 100
+
 /* Sets operations codes */
 #define SET_OP_UNION 0
 #define SET_OP_DIFF 1
@@ -343,6 +389,12 @@
 #define RDB_CHILD_TYPE_NONE 0
 #define RDB_CHILD_TYPE_DISK 1     /* RDB is written to disk. */
 #define RDB_CHILD_TYPE_SOCKET 2   /* RDB is written to slave socket. */
+#define RDB_CHILD_TYPE_FORKLESS 3 /* 不fork，由本进程的快照线程写入磁盘 */
+
+/* Child info pipe */
+#define CHILD_INFO_MAGIC 0xC17DDA7A12345678LL
+#define CHILD_INFO_TYPE_RDB 0
+#define CHILD_INFO_TYPE_AOF 1
 
 /* Keyspace changes notification classes. Every class is associated with a
  * character for configuration purposes. */
@@ -392,6 +444,7 @@
  * in order to dispatch the loading to the right module, plus a 10 bits
  * encoding version. */
 #define OBJ_MODULE 5
+#define OBJ_STREAM 6
 
 /* Extract encver / signature from a module type ID. */
 #define REDISMODULE_TYPE_ENCVER_BITS 10
@@ -434,6 +487,9 @@ typedef struct RedisModuleDigest {
 #define OBJ_ENCODING_SKIPLIST 7  /* 跳跃表 Encoded as skiplist */
 #define OBJ_ENCODING_EMBSTR 8  /* 用于保存短字符串的编码类型 Embedded sds string encoding */
 #define OBJ_ENCODING_QUICKLIST 9 /* 压缩链表和双向链表组成的快速列表 Encoded as linked list of ziplists */
+#define OBJ_ENCODING_DISKREF 10 /* 指向RDB文件映射中的值，第一次访问时解码 Reference to a value in the mmapped RDB */
+#define OBJ_ENCODING_LISTPACK 11 /* 紧凑列表 Encoded as a listpack */
+#define OBJ_ENCODING_STREAM 12 /* 前缀树索引的listpack块 Encoded as a radix tree of listpacks */
 
 #define LRU_BITS 24
 #define LRU_CLOCK_MAX ((1<<LRU_BITS)-1) /* Max value of obj->lru */
@@ -490,6 +546,15 @@ typedef struct moduleValue {
     void *value;
 } moduleValue;
 
+/*
+ * 跳跃表编码的有序集合，跳跃表按照score排序，字典保存元素到score的映射
+ * 两者共享同一个元素的sds字符串，字典的值指向跳跃表节点中的score
+ */
+typedef struct zset {
+    dict *dict;
+    zskiplist *zsl;
+} zset;
+
 /*
  * 表示redis的数据库
  * 不同数据库用不同的id表示，id取值范围是0到最大配置值
@@ -523,24 +588,53 @@ typedef struct redisObject {
  */
 typedef struct client {
 	int fd; //  套接字描述符
+	int flags; // 客户端状态标志 CLIENT_*
 	redisDb *db; // 当前正在使用的数据库
 	int dictid; //  当前正在使用的数据库的 id （号码）
 	robj *name; // 客户端的名字
 	sds querybuf; // 查询缓冲区
 	size_t querybuf_peak; // 查询缓冲区长度峰值
 	int argc; // 参数数量
+	int argv_len; // argv数组的容量，命令执行完后数组留给下一条命令使用
 	robj **argv; // 参数对象数组
 	struct redisCommand *cmd, *lastcmd; // 记录被客户端执行的命令
 	int reqtype; // 请求的类型,是内联命令还是多条命令 
 	int multibulklen; // 剩余未读取的命令内容数量
 	long bulklen; // 命令内容的长度
-	list *reply; // 回复链表
-	unsigned long reply_bytes; // 回复链表中对象的总大小
+	list *reply; // 回复链表，节点是clientReplyBlock
+	unsigned long reply_bytes; // 回复链表中所有块的分配大小之和
+	time_t obuf_soft_limit_reached_time; // 输出缓冲区开始超过软限制的时间，0表示没有超过
+	size_t sentlen; // 当前缓冲区或者链表节点中已经发送的字节数
+	long long woff; // 最后一条写命令在AOF中的结束偏移量，always模式下同步到这里之后才能回复
+	listNode *client_list_node; // 在server.clients中的节点，释放客户端时O(1)删除
+	time_t ctime; // 客户端的创建时间
+	time_t lastinteraction; // 最后一次读到请求或者写出回复的时间，用于空闲超时
+	list *zc_pending; // 已经用MSG_ZEROCOPY发送、内核可能还在引用的值，节点是zeroCopyRef
+	uint32_t zc_next_id; // 下一次MSG_ZEROCOPY发送的序号，和内核的计数一致
+	uint32_t zc_completed; // 序号小于它的发送已经完成
 	int bufpos; // 回复偏移量
 	char buf[PROTO_REPLY_CHUNK_BYTES];
 } client;
 
 
+/*
+ * 回复链表中的一个块，默认PROTO_REPLY_CHUNK_BYTES大小
+ * 新的回复先填满尾部块的剩余空间，放不下时再分配新块
+ * obj不为NULL时块中没有数据，直接发送对象的sds（size和used都是它的长度），
+ * 大的值不拷贝到输出缓冲区，这种块之后的回复总是放进新块
+ */
+typedef struct clientReplyBlock {
+    size_t size, used;
+    robj *obj;
+    char buf[];
+} clientReplyBlock;
+
+/* MSG_ZEROCOPY发送之后等待内核完成通知的值 */
+typedef struct zeroCopyRef {
+    robj *obj;
+    uint32_t id; /* 最后一次发送这个值的sendmsg序号 */
+} zeroCopyRef;
+
 typedef void redisCommandProc(client *c);
 typedef int *redisGetKeysProc(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 // redis命令结构体定义
@@ -563,6 +657,32 @@ struct redisCommand {
 
 typedef long long mstime_t; /* millisecond time type. */
 
+/* AOF文件的类型 */
+typedef enum {
+    AOF_FILE_TYPE_BASE = 'b', /* BASE file */
+    AOF_FILE_TYPE_HIST = 'h', /* HISTORY file */
+    AOF_FILE_TYPE_INCR = 'i', /* INCR file */
+} aof_file_type;
+
+typedef struct {
+    sds file_name;              /* file name */
+    long long file_seq;         /* file sequence */
+    aof_file_type file_type;    /* file type */
+} aofInfo;
+
+/* manifest记录组成AOF的所有文件 */
+typedef struct {
+    aofInfo *base_aof_info;     /* BASE file information. NULL if there is no BASE file. */
+    list *incr_aof_list;        /* INCR AOFs list. We may have multiple INCR AOF when rewrite fails. */
+    list *history_aof_list;     /* HISTORY AOF list. When the AOFRW success, The aofInfo contained in
+                                   `base_aof_info` and `incr_aof_list` will be moved to this list. We
+                                   will delete these AOF files when AOFRW finish. */
+    long long curr_base_file_seq;   /* The sequence number used by the current BASE file. */
+    long long curr_incr_file_seq;   /* The sequence number used by the current INCR file. */
+    int dirty;                  /* 1 Indicates that the aofManifest in the memory is inconsistent with
+                                   disk, we need to persist it immediately. */
+} aofManifest;
+
 
 
 /* Client MULTI/EXEC state */
@@ -608,6 +728,8 @@ typedef struct clientBufferLimitsConfig {
     time_t soft_limit_seconds;
 } clientBufferLimitsConfig;
 
+extern clientBufferLimitsConfig clientBufferLimitsDefaults[CLIENT_TYPE_OBUF_COUNT];
+
 /* The redisOp structure defines a Redis Operation, that is an instance of
  * a command with an argument vector, database ID, propagation target
  * (PROPAGATE_*), and command pointer.
@@ -667,14 +789,17 @@ struct redisServer {
     int bindaddr_count;         /* Number of addresses in server.bindaddr[] */
     char *unixsocket;           /* UNIX socket path */
     mode_t unixsocketperm;      /* UNIX socket permission */
-    int ipfd[CONFIG_BINDADDR_MAX]; /* TCP socket file descriptors */
+    int ipfd[CONFIG_BINDADDR_MAX*CONFIG_REUSEPORT_MAX]; /* TCP socket file descriptors */
     int ipfd_count;             /* Used slots in ipfd[] */
     int sofd;                   /* Unix socket file descriptor */
+    int reuseport_listeners;    /* 每个地址上的SO_REUSEPORT监听socket数，1表示不使用 */
+    int reuseport_cpu_steering; /* 按处理SYN的CPU把连接分配给监听socket */
     int cfd[CONFIG_BINDADDR_MAX];/* Cluster bus listening socket */
     int cfd_count;              /* Used slots in cfd[] */
     list *clients;              /* 所有连接到服务器的客户端 */
     list *clients_to_close;     /* Clients to close asynchronously */
     list *clients_pending_write; /* There is to write or install handler. */
+    list *clients_pending_read; /* 查询缓冲区里还有请求等待处理的客户端 */
     list *slaves, *monitors;    /* List of slaves and MONITORs */
     client *current_client; /* Current client, only used on crash report */
     int clients_paused;         /* True if clients are currently paused */
@@ -709,6 +834,10 @@ struct redisServer {
     long long stat_fork_time;       /* Time needed to perform latest fork() */
     double stat_fork_rate;          /* Fork rate in GB/sec. */
     long long stat_rejected_conn;   /* Clients rejected because of maxclients */
+    long long stat_client_read_pauses; /* 因为回复积压暂停读取的次数 */
+    long long stat_reply_obj_refs;  /* 直接引用值对象、没有拷贝的回复数量 */
+    long long stat_zerocopy_sends;  /* MSG_ZEROCOPY发送次数 */
+    long long stat_zerocopy_copied; /* 内核最终还是拷贝了数据的MSG_ZEROCOPY发送次数 */
     long long stat_sync_full;       /* Number of full resyncs with slaves. */
     long long stat_sync_partial_ok; /* Number of accepted PSYNC requests. */
     long long stat_sync_partial_err;/* Number of unaccepted PSYNC requests. */
@@ -772,6 +901,22 @@ struct redisServer {
     int aof_last_write_errno;       /* Valid if aof_last_write_status is ERR */
     int aof_load_truncated;         /* Don't stop on unexpected AOF EOF. */
     int aof_use_rdb_preamble;       /* 混合持久化开关 */
+    /* AOF group commit：各偏移量都是从启动开始追加的字节数 */
+    long long aof_fed_offset;       /* 已追加到aof_buf的字节数 */
+    long long aof_written_offset;   /* 已write()到文件的字节数，bio线程读取 */
+    long long aof_fsynced_offset;   /* 已同步到磁盘的字节数，bio线程写入 */
+    long long aof_fsync_requested_offset; /* 最后一次提交同步任务时的写入偏移量 */
+    int aof_fsync_notify_pipe[2];   /* bio线程同步完成后唤醒事件循环 */
+    int aof_bio_fsync_status;       /* 后台同步的结果，C_OK or C_ERR，bio线程写入 */
+    int aof_bio_fsync_errno;        /* Valid if aof_bio_fsync_status is ERR */
+    aofManifest *aof_manifest;      /* 组成AOF的base、incr文件 */
+    off_t aof_last_incr_size;       /* 当前incr文件的大小 */
+    long long stat_aof_fsync_count;    /* 后台fdatasync次数 */
+    long long stat_aof_fsync_total_us; /* fdatasync总耗时 */
+    long long stat_aof_fsync_last_us;  /* 最近一次fdatasync耗时 */
+    long long stat_aof_fsync_max_us;   /* fdatasync最大耗时 */
+    long long stat_aof_fsync_stalls;   /* 耗时超过AOF_FSYNC_STALL_US的次数 */
+    long long stat_aof_write_max_us;   /* 主线程write()最大耗时 */
     /* AOF pipes used to communicate between parent and child during rewrite. */
     int aof_pipe_write_data_to_child;
     int aof_pipe_read_data_from_parent;
@@ -791,6 +936,14 @@ struct redisServer {
     char *rdb_filename;             /* Name of RDB file */
     int rdb_compression;            /* Use compression in RDB? */
     int rdb_checksum;               /* Use RDB checksum? */
+    int rdb_load_threads;           /* 启动时并行加载RDB的线程数 */
+    long long stat_rdb_load_io_us;     /* 启动加载RDB各阶段耗时：读取 */
+    long long stat_rdb_load_decode_us; /* 解码 */
+    long long stat_rdb_load_insert_us; /* 插入键空间 */
+    int rdb_lazy_load;              /* 启动时映射RDB文件，值在第一次访问时才解码 */
+    unsigned char *rdb_map;         /* RDB文件的只读映射，懒加载时使用 */
+    size_t rdb_map_size;
+    unsigned long rdb_map_refs;     /* 引用映射的DISKREF对象数量，为0时解除映射 */
     time_t lastsave;                /* Unix time of last successful save */
     time_t lastbgsave_try;          /* Unix time of last attempted bgsave */
     time_t rdb_save_time_last;      /* Time used by last RDB save run. */
@@ -798,6 +951,14 @@ struct redisServer {
     int rdb_bgsave_scheduled;       /* BGSAVE when possible if true. */
     int rdb_child_type;             /* Type of save by active child. */
     int lastbgsave_status;          /* C_OK or C_ERR */
+    int rdb_last_bgsave_type;       /* 上一次BGSAVE的方式 */
+    int rdb_bgsave_forkless;        /* BGSAVE默认使用快照线程而不是fork */
+    long long stat_rdb_bgsave_start_us;     /* 上一次BGSAVE启动时主线程阻塞的时间 */
+    size_t stat_rdb_bgsave_rss_start;       /* 上一次BGSAVE开始时的RSS */
+    size_t stat_rdb_bgsave_rss_peak;        /* 上一次不fork的BGSAVE期间RSS的峰值 */
+    long long stat_rdb_snapshot_max_wait_us;/* 上一次不fork的BGSAVE期间命令等待快照锁的最长时间 */
+    long long stat_rdb_snapshot_versions;   /* 上一次不fork的BGSAVE保存的旧版本数量 */
+    size_t stat_rdb_snapshot_version_bytes_peak; /* 旧版本占用内存的峰值 */
     int stop_writes_on_bgsave_err;  /* Don't allow writes if can't BGSAVE */
     int rdb_pipe_write_result_to_parent; /* RDB pipes used to return the state */
     int rdb_pipe_read_result_from_child; /* of each slave in diskless SYNC. */
@@ -877,6 +1038,11 @@ struct redisServer {
     /* Limits */
     unsigned int maxclients;            /* Max number of simultaneous clients */
     unsigned long long maxmemory;   /* Max number of memory bytes to use */
+    unsigned long long client_read_pause_high; /* 待发送回复超过这个大小时暂停读取 */
+    unsigned long long client_read_pause_low;  /* 回复发送到低于这个大小时恢复读取 */
+    int client_cmds_per_event;      /* 每个客户端每轮事件循环最多执行的命令数 */
+    size_t reply_ref_threshold;     /* 超过这个长度的值回复时直接引用对象，不拷贝 */
+    int reply_zerocopy;             /* 引用对象的回复用MSG_ZEROCOPY发送 */
     int maxmemory_policy;           /* Policy for key eviction */
     int maxmemory_samples;          /* Pricision of random sampling */
     unsigned int lfu_log_factor;    /* LFU logarithmic counter factor. */
@@ -898,6 +1064,8 @@ struct redisServer {
     size_t zset_max_ziplist_entries;
     size_t zset_max_ziplist_value;
     size_t hll_sparse_max_bytes;
+    size_t stream_node_max_bytes;
+    long long stream_node_max_entries;
     /* List parameters */
     int list_max_ziplist_size;
     int list_compress_depth;
@@ -959,11 +1127,225 @@ struct redisServer {
     pthread_mutex_t lruclock_mutex;
     pthread_mutex_t next_client_id_mutex;
     pthread_mutex_t unixtime_mutex;
+    pthread_mutex_t rdb_map_refs_mutex;
+};
+
+/* 共享对象，常用的回复不需要每次都创建 */
+struct sharedObjectsStruct {
+    robj *crlf, *ok, *err, *emptybulk, *czero, *cone, *pong, *nullbulk,
+    *emptymultibulk, *nullmultibulk, *syntaxerr, *wrongtypeerr, *outofrangeerr,
+    *oomerr,
+    *mbulkhdr[OBJ_SHARED_BULKHDR_LEN], /* "*<value>\r\n" */
+    *bulkhdr[OBJ_SHARED_BULKHDR_LEN];  /* "$<value>\r\n" */
 };
 
+/* Macro used to initialize a Redis object allocated on the stack.
+ * Note that this macro is taken near the structure definition to make sure
+ * we'll update it when the structure is changed, to avoid bugs like
+ * bug #85 introduced exactly in this way. */
+#define initStaticStringObject(_var,_ptr) do { \
+    _var.refcount = 1; \
+    _var.type = OBJ_STRING; \
+    _var.encoding = OBJ_ENCODING_RAW; \
+    _var.ptr = _ptr; \
+} while(0)
+
+#define sdsEncodedObject(objptr) (objptr->encoding == OBJ_ENCODING_RAW || objptr->encoding == OBJ_ENCODING_EMBSTR)
+
 robj *createObject(int type, void *ptr);
 robj *createStringObject(const char *ptr, size_t len);
 robj *createRawStringObject(const char *ptr, size_t len);
 robj *createEmbeddedStringObject(const char *ptr, size_t len);
-
+robj *getDecodedObject(robj *o);
+size_t stringObjectLen(robj *o);
+robj *createStringObjectFromLongLong(long long value);
+robj *createStringObjectFromLongDouble(long double value, int humanfriendly);
+robj *createQuicklistObject(void);
+robj *createSetObject(void);
+robj *createIntsetObject(void);
+robj *createHashObject(void);
+robj *createZsetObject(void);
+robj *createZsetListpackObject(void);
+robj *createStreamObject(void);
+int checkType(client *c, robj *o, int type);
+int getLongLongFromObject(robj *o, long long *target);
+int getDoubleFromObject(const robj *o, double *target);
+int getDoubleFromObjectOrReply(client *c, robj *o, double *target, const char *msg);
+int getLongLongFromObjectOrReply(client *c, robj *o, long long *target, const char *msg);
+int getLongFromObjectOrReply(client *c, robj *o, long *target, const char *msg);
+int getLongDoubleFromObject(robj *o, long double *target);
+int getLongDoubleFromObjectOrReply(client *c, robj *o, long double *target, const char *msg);
+
+void initServerConfig(void);
+void initServer(void);
 int processCommand(client *c);
+void call(client *c, int flags);
+void closeListeningSockets(int unlink_unix_socket);
+struct redisCommand *lookupCommand(sds name);
+
+/*-----------------------------------------------------------------------------
+ * Extern declarations
+ *----------------------------------------------------------------------------*/
+
+extern struct redisServer server;
+extern dictType dbDictType;
+extern dictType setDictType;
+extern dictType hashDictType;
+extern dictType zsetDictType;
+extern struct sharedObjectsStruct shared;
+
+/* Utils */
+uint64_t dictSdsHash(const void *key);
+int dictSdsKeyCompare(void *privdata, const void *key1, const void *key2);
+void dictSdsDestructor(void *privdata, void *val);
+long long ustime(void);
+long long mstime(void);
+void serverLogRaw(int level, const char *msg);
+#ifdef __GNUC__
+void serverLog(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+void _serverPanic(const char *file, int line, const char *msg, ...)
+    __attribute__((format(printf, 3, 4), noreturn));
+#else
+void serverLog(int level, const char *fmt, ...);
+void _serverPanic(const char *file, int line, const char *msg, ...);
+#endif
+
+/* Object implementation */
+void incrRefCount(robj *o);
+void decrRefCount(robj *o);
+void decrRefCountVoid(void *o);
+
+/* networking.c -- Networking and Client related operations */
+client *createClient(int fd);
+void freeClient(client *c);
+void freeClientAsync(client *c);
+void freeClientsInAsyncFreeQueue(void);
+void resetClient(client *c);
+void rewriteClientCommandArgument(client *c, int i, robj *newval);
+void addReply(client *c, robj *obj);
+void addReplySds(client *c, sds s);
+void addReplyProtoSds(client *c, sds s);
+void addReplyString(client *c, const char *s, size_t len);
+void addReplyBulk(client *c, robj *obj);
+void addReplyBulkCBuffer(client *c, const void *p, size_t len);
+void addReplyBulkCString(client *c, const char *s);
+void addReplyBulkSds(client *c, sds s);
+void addReplyError(client *c, const char *err);
+void addReplyErrorFormat(client *c, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+void addReplyStatus(client *c, const char *status);
+void addReplyLongLong(client *c, long long ll);
+void addReplyBulkLongLong(client *c, long long ll);
+void addReplyDouble(client *c, double d);
+void addReplyMultiBulkLen(client *c, long length);
+int clientHasPendingReplies(client *c);
+unsigned long getClientOutputBufferMemoryUsage(client *c);
+void getExpansiveClientsInfo(size_t *in_usage, size_t *out_usage);
+void clientReapZeroCopy(client *c);
+int getClientType(client *c);
+int getClientTypeByName(char *name);
+char *getClientTypeName(int class);
+void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask);
+int handleClientsWithPendingWrites(void);
+int handleClientsWithPendingReads(void);
+
+/* AOF persistence */
+void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc);
+void flushAppendOnlyFile(int force);
+void aofBackgroundFsync(int fd, int close_fd, long long offset);
+void aofFsyncNotifyHandler(aeEventLoop *el, int fd, void *privdata, int mask);
+int aofClientMustWaitFsync(client *c);
+int loadAppendOnlyFile(char *filename);
+void stopAppendOnly(void);
+void aofLoadManifestFromDisk(void);
+int loadAppendOnlyFiles(aofManifest *am);
+int aofOpenIfNeededOnServerStart(void);
+int rewriteAppendOnlyFileBackground(void);
+void backgroundRewriteDoneHandler(int exitcode, int bysignal);
+void killAppendOnlyChild(void);
+sds catAppendOnlyGenericCommand(sds dst, int argc, robj **argv);
+int bg_unlink(const char *filename);
+
+/* RDB persistence */
+int rdbSaveInProgress(void);
+int rdbSaveBackground(char *filename);
+void backgroundSaveDoneHandler(int exitcode, int bysignal);
+int rdbSnapshotLock(client *c);
+void rdbSnapshotUnlock(void);
+void rdbSnapshotCron(int wait);
+void killRDBChild(void);
+
+/* Configuration */
+void loadServerConfig(char *filename, char *options);
+
+/* List data type */
+void listTypePush(robj *subject, robj *value, int where);
+robj *listTypePop(robj *subject, int where);
+unsigned long listTypeLength(const robj *subject);
+
+/* Set data type */
+robj *setTypeCreate(sds value);
+int setTypeAdd(robj *subject, sds value);
+int setTypeRemove(robj *subject, sds value);
+int setTypeIsMember(robj *subject, sds value);
+unsigned long setTypeSize(const robj *subject);
+void setTypeConvert(robj *subject, int enc);
+
+/* Sorted sets data type */
+
+/* Input flags. */
+#define ZADD_IN_NONE 0
+#define ZADD_IN_INCR (1<<0)    /* Increment the score instead of setting it. */
+#define ZADD_IN_NX (1<<1)      /* Don't touch elements not already existing. */
+#define ZADD_IN_XX (1<<2)      /* Only touch elements already existing. */
+
+/* Output flags. */
+#define ZADD_OUT_NOP (1<<0)     /* Operation not performed because of conditionals.*/
+#define ZADD_OUT_NAN (1<<1)     /* Only touch elements already existing. */
+#define ZADD_OUT_ADDED (1<<2)   /* The element was new and was added. */
+#define ZADD_OUT_UPDATED (1<<3) /* The element already existed, score updated. */
+
+unsigned long zsetLength(const robj *zobj);
+void zsetConvert(robj *zobj, int encoding);
+int zsetScore(robj *zobj, sds member, double *score);
+int zsetAdd(robj *zobj, double score, sds ele, int in_flags, int *out_flags, double *newscore);
+int zsetDel(robj *zobj, sds ele);
+long zsetRank(robj *zobj, sds ele, int reverse);
+unsigned char *zzlInsert(unsigned char *zl, sds ele, double score);
+double zzlGetScore(unsigned char *sptr);
+sds lpGetObject(unsigned char *sptr);
+void zzlNext(unsigned char *zl, unsigned char **eptr, unsigned char **sptr);
+unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range);
+
+/* Hash data type */
+#define HASH_SET_TAKE_FIELD (1<<0)
+#define HASH_SET_TAKE_VALUE (1<<1)
+#define HASH_SET_COPY 0
+
+void hashTypeConvert(robj *o, int enc);
+void hashTypeTryConversion(robj *subject, robj **argv, int start, int end);
+int hashTypeExists(robj *o, sds key);
+int hashTypeDelete(robj *o, sds key);
+unsigned long hashTypeLength(const robj *o);
+int hashTypeSet(robj *o, sds field, sds value, int flags);
+
+/* Stream data type */
+int streamAppendItem(stream *s, robj **argv, int64_t numfields, streamID *added_id, streamID *use_id);
+int64_t streamTrimByLength(stream *s, size_t maxlen, int approx);
+
+/* db.c -- Keyspace access API */
+robj *lookupKey(redisDb *db, robj *key);
+robj *lookupKeyReadOrReply(client *c, robj *key, robj *reply);
+robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply);
+void dbAdd(redisDb *db, robj *key, robj *val);
+void dbOverwrite(redisDb *db, robj *key, robj *val);
+void setKey(redisDb *db, robj *key, robj *val);
+int dbDelete(redisDb *db, robj *key);
+robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o);
+long long emptyDb(int dbnum);
+
+/* string.c -- String type */
+int checkStringLength(client *c, long long size);
+
+#endif
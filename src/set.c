@@ -0,0 +1,546 @@
+#include "server.h"
+#include "intset.h"
+#include "zmalloc.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*-----------------------------------------------------------------------------
+ * Set Commands
+ *
+ * 只包含整数的小集合使用intset编码，元素超过set-max-intset-entries，
+ * 或者加入了不能表示成整数的元素时转换成字典编码，转换是单向的
+ *----------------------------------------------------------------------------*/
+
+typedef struct {
+	robj *subject;
+	int encoding;
+	int ii; /* intset iterator */
+	dictIterator *di;
+} setTypeIterator;
+
+/* Factory method to return a set that *can* hold "value". When the object has
+ * an integer-encodable value, an intset will be returned. Otherwise a regular
+ * hash table. */
+robj *setTypeCreate(sds value) {
+	long long llval;
+
+	if (string2ll(value,sdslen(value),&llval))
+		return createIntsetObject();
+	return createSetObject();
+}
+
+/* Add the specified value into a set.
+ *
+ * If the value was already member of the set, nothing is done and 0 is
+ * returned, otherwise the new element is added and 1 is returned. */
+int setTypeAdd(robj *subject, sds value) {
+	long long llval;
+
+	if (subject->encoding == OBJ_ENCODING_HT) {
+		dict *ht = subject->ptr;
+		dictEntry *de = dictAddRaw(ht,value,NULL);
+		if (de) {
+			dictSetKey(ht,de,sdsdup(value));
+			dictSetVal(ht,de,NULL);
+			return 1;
+		}
+	} else if (subject->encoding == OBJ_ENCODING_INTSET) {
+		if (string2ll(value,sdslen(value),&llval)) {
+			uint8_t success = 0;
+			subject->ptr = intsetAdd(subject->ptr,llval,&success);
+			if (success) {
+				/* Convert to regular set when the intset contains
+				 * too many entries. */
+				if (intsetLen(subject->ptr) > server.set_max_intset_entries)
+					setTypeConvert(subject,OBJ_ENCODING_HT);
+				return 1;
+			}
+		} else {
+			/* Failed to get integer from object, convert to regular set. */
+			setTypeConvert(subject,OBJ_ENCODING_HT);
+
+			/* The set *was* an intset and this value is not integer
+			 * encodable, so dictAdd should always work. */
+			dictAdd(subject->ptr,sdsdup(value),NULL);
+			return 1;
+		}
+	} else {
+		printf("Unknown set encoding\n");
+		exit(1);
+	}
+	return 0;
+}
+
+int setTypeRemove(robj *setobj, sds value) {
+	long long llval;
+
+	if (setobj->encoding == OBJ_ENCODING_HT) {
+		if (dictDelete(setobj->ptr,value) == DICT_OK) return 1;
+	} else if (setobj->encoding == OBJ_ENCODING_INTSET) {
+		if (string2ll(value,sdslen(value),&llval)) {
+			int success;
+			setobj->ptr = intsetRemove(setobj->ptr,llval,&success);
+			if (success) return 1;
+		}
+	} else {
+		printf("Unknown set encoding\n");
+		exit(1);
+	}
+	return 0;
+}
+
+int setTypeIsMember(robj *set, sds value) {
+	long long llval;
+
+	if (set->encoding == OBJ_ENCODING_HT) {
+		return dictFind((dict*)set->ptr,value) != NULL;
+	} else if (set->encoding == OBJ_ENCODING_INTSET) {
+		if (string2ll(value,sdslen(value),&llval))
+			return intsetFind((intset*)set->ptr,llval);
+	} else {
+		printf("Unknown set encoding\n");
+		exit(1);
+	}
+	return 0;
+}
+
+unsigned long setTypeSize(const robj *subject) {
+	if (subject->encoding == OBJ_ENCODING_HT) {
+		return dictSize((const dict*)subject->ptr);
+	} else if (subject->encoding == OBJ_ENCODING_INTSET) {
+		return intsetLen((const intset*)subject->ptr);
+	} else {
+		printf("Unknown set encoding\n");
+		exit(1);
+	}
+}
+
+static setTypeIterator *setTypeInitIterator(robj *subject) {
+	setTypeIterator *si = zmalloc(sizeof(setTypeIterator));
+	si->subject = subject;
+	si->encoding = subject->encoding;
+	if (si->encoding == OBJ_ENCODING_HT) {
+		si->di = dictGetIterator(subject->ptr);
+	} else if (si->encoding == OBJ_ENCODING_INTSET) {
+		si->ii = 0;
+	} else {
+		printf("Unknown set encoding\n");
+		exit(1);
+	}
+	return si;
+}
+
+static void setTypeReleaseIterator(setTypeIterator *si) {
+	if (si->encoding == OBJ_ENCODING_HT)
+		dictReleaseIterator(si->di);
+	zfree(si);
+}
+
+/* Move to the next entry in the set. Returns the object at the current
+ * position.
+ *
+ * Since set elements can be internally be stored as SDS strings or
+ * simple arrays of integers, setTypeNext returns the encoding of the
+ * set object you are iterating, and will populate the appropriate pointer
+ * (sdsele) or (llele) accordingly.
+ *
+ * When there are no longer elements -1 is returned. */
+static int setTypeNext(setTypeIterator *si, sds *sdsele, int64_t *llele) {
+	if (si->encoding == OBJ_ENCODING_HT) {
+		dictEntry *de = dictNext(si->di);
+		if (de == NULL) return -1;
+		*sdsele = dictGetKey(de);
+		*llele = -123456789; /* Not needed. Defensive. */
+	} else if (si->encoding == OBJ_ENCODING_INTSET) {
+		if (!intsetGet(si->subject->ptr,si->ii++,llele))
+			return -1;
+		*sdsele = NULL; /* Not needed. Defensive. */
+	} else {
+		printf("Wrong set encoding in setTypeNext\n");
+		exit(1);
+	}
+	return si->encoding;
+}
+
+/* Convert the set to specified encoding. The resulting dict (when converting
+ * to a hash table) is presized to hold the number of elements in the original
+ * set. */
+void setTypeConvert(robj *setobj, int enc) {
+	setTypeIterator *si;
+
+	if (setobj->encoding != OBJ_ENCODING_INTSET || enc != OBJ_ENCODING_HT) {
+		printf("Unsupported set conversion\n");
+		exit(1);
+	}
+
+	int64_t intele;
+	dict *d = dictCreate(&setDictType,NULL);
+	sds element;
+
+	/* Presize the dict to avoid rehashing */
+	dictExpand(d,intsetLen(setobj->ptr));
+
+	/* To add the elements we extract integers and create redis objects */
+	si = setTypeInitIterator(setobj);
+	while (setTypeNext(si,&element,&intele) != -1) {
+		element = sdsfromlonglong(intele);
+		dictAdd(d,element,NULL);
+	}
+	setTypeReleaseIterator(si);
+
+	setobj->encoding = OBJ_ENCODING_HT;
+	zfree(setobj->ptr);
+	setobj->ptr = d;
+}
+
+/* 把集合迭代器当前的元素作为bulk回复 */
+static void addReplySetElement(client *c, int encoding, sds elesds, int64_t intobj) {
+	if (encoding == OBJ_ENCODING_HT) {
+		addReplyBulkCBuffer(c,elesds,sdslen(elesds));
+	} else {
+		addReplyBulkLongLong(c,intobj);
+	}
+}
+
+/* 回复整个集合的所有元素 */
+static void addReplySetMembers(client *c, robj *set) {
+	setTypeIterator *si;
+	sds elesds;
+	int64_t intobj;
+	int encoding;
+
+	addReplyMultiBulkLen(c,setTypeSize(set));
+	si = setTypeInitIterator(set);
+	while ((encoding = setTypeNext(si,&elesds,&intobj)) != -1)
+		addReplySetElement(c,encoding,elesds,intobj);
+	setTypeReleaseIterator(si);
+}
+
+/* SADD key member [member ...] */
+void saddCommand(client *c) {
+	robj *set;
+	int j, added = 0;
+
+	set = lookupKey(c->db,c->argv[1]);
+	if (set == NULL) {
+		robj *first = getDecodedObject(c->argv[2]);
+		set = setTypeCreate(first->ptr);
+		decrRefCount(first);
+		dbAdd(c->db,c->argv[1],set);
+	} else {
+		if (set->type != OBJ_SET) {
+			addReply(c,shared.wrongtypeerr);
+			return;
+		}
+	}
+
+	for (j = 2; j < c->argc; j++) {
+		robj *ele = getDecodedObject(c->argv[j]);
+		if (setTypeAdd(set,ele->ptr)) added++;
+		decrRefCount(ele);
+	}
+	server.dirty += added;
+	addReplyLongLong(c,added);
+}
+
+/* SREM key member [member ...] */
+void sremCommand(client *c) {
+	robj *set;
+	int j, deleted = 0;
+
+	if ((set = lookupKeyWriteOrReply(c,c->argv[1],shared.czero)) == NULL ||
+		checkType(c,set,OBJ_SET)) return;
+
+	for (j = 2; j < c->argc; j++) {
+		robj *ele = getDecodedObject(c->argv[j]);
+		int ok = setTypeRemove(set,ele->ptr);
+
+		decrRefCount(ele);
+		if (ok) {
+			deleted++;
+			// 集合为空时删除这个键
+			if (setTypeSize(set) == 0) {
+				dbDelete(c->db,c->argv[1]);
+				break;
+			}
+		}
+	}
+	server.dirty += deleted;
+	addReplyLongLong(c,deleted);
+}
+
+/* SISMEMBER key member */
+void sismemberCommand(client *c) {
+	robj *set, *ele;
+
+	if ((set = lookupKeyReadOrReply(c,c->argv[1],shared.czero)) == NULL ||
+		checkType(c,set,OBJ_SET)) return;
+
+	ele = getDecodedObject(c->argv[2]);
+	if (setTypeIsMember(set,ele->ptr))
+		addReply(c,shared.cone);
+	else
+		addReply(c,shared.czero);
+	decrRefCount(ele);
+}
+
+/* SCARD key */
+void scardCommand(client *c) {
+	robj *o;
+
+	if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.czero)) == NULL ||
+		checkType(c,o,OBJ_SET)) return;
+
+	addReplyLongLong(c,setTypeSize(o));
+}
+
+/* SMEMBERS key */
+void smembersCommand(client *c) {
+	robj *set;
+
+	if ((set = lookupKeyReadOrReply(c,c->argv[1],shared.emptymultibulk)) == NULL
+		|| checkType(c,set,OBJ_SET)) return;
+
+	addReplySetMembers(c,set);
+}
+
+/*-----------------------------------------------------------------------------
+ * SINTER / SUNION / SDIFF
+ *
+ * 所有输入集合都是intset编码时，元素本来就是有序的，直接对有序数组做归并，
+ * 结果保存在一个整数数组中，不需要创建临时的集合对象；
+ * 其它情况使用通用的实现，结果先放在一个临时集合中再回复
+ *----------------------------------------------------------------------------*/
+
+#define SET_OP_UNION 0
+#define SET_OP_DIFF 1
+#define SET_OP_INTER 2
+
+static int qsortCompareSetsByCardinality(const void *s1, const void *s2) {
+	if (setTypeSize(*(robj**)s1) > setTypeSize(*(robj**)s2)) return 1;
+	if (setTypeSize(*(robj**)s1) < setTypeSize(*(robj**)s2)) return -1;
+	return 0;
+}
+
+/* 把整数数组作为multi bulk回复 */
+static void addReplyIntegerArray(client *c, int64_t *vals, unsigned long len) {
+	unsigned long j;
+
+	addReplyMultiBulkLen(c,len);
+	for (j = 0; j < len; j++) addReplyBulkLongLong(c,vals[j]);
+}
+
+/*
+ * 有序整数集合的交集：遍历最小的集合，其余每个集合维护一个只会前进的游标
+ * sets已经按照大小排序
+ */
+static unsigned long intsetMergeInter(robj **sets, int setnum, int64_t *out) {
+	intset *first = sets[0]->ptr;
+	uint32_t *cursor = zcalloc(sizeof(uint32_t)*setnum);
+	uint32_t i, len = intsetLen(first);
+	unsigned long n = 0;
+	int64_t v, cur;
+	int j;
+
+	for (i = 0; i < len; i++) {
+		intsetGet(first,i,&v);
+		for (j = 1; j < setnum; j++) {
+			intset *is = sets[j]->ptr;
+
+			while (intsetGet(is,cursor[j],&cur) && cur < v) cursor[j]++;
+			/* 某个集合已经遍历完，后面不可能再有交集 */
+			if (cursor[j] == intsetLen(is)) goto done;
+			if (cur != v) break;
+		}
+		if (j == setnum) out[n++] = v;
+	}
+done:
+	zfree(cursor);
+	return n;
+}
+
+/* 有序整数集合的并集：多路归并，每次取所有游标中最小的元素 */
+static unsigned long intsetMergeUnion(robj **sets, int setnum, int64_t *out) {
+	uint32_t *cursor = zcalloc(sizeof(uint32_t)*setnum);
+	unsigned long n = 0;
+	int64_t v, min;
+	int j, found;
+
+	while (1) {
+		found = 0;
+		min = 0;
+		for (j = 0; j < setnum; j++) {
+			if (sets[j] && intsetGet(sets[j]->ptr,cursor[j],&v) &&
+				(!found || v < min))
+			{
+				min = v;
+				found = 1;
+			}
+		}
+		if (!found) break;
+		out[n++] = min;
+		/* 所有等于min的游标一起前进，去掉重复元素 */
+		for (j = 0; j < setnum; j++) {
+			if (sets[j] && intsetGet(sets[j]->ptr,cursor[j],&v) && v == min)
+				cursor[j]++;
+		}
+	}
+	zfree(cursor);
+	return n;
+}
+
+/* 有序整数集合的差集：第一个集合中不在其它任何集合中的元素 */
+static unsigned long intsetMergeDiff(robj **sets, int setnum, int64_t *out) {
+	intset *first = sets[0]->ptr;
+	uint32_t *cursor = zcalloc(sizeof(uint32_t)*setnum);
+	uint32_t i, len = intsetLen(first);
+	unsigned long n = 0;
+	int64_t v, cur;
+	int j;
+
+	for (i = 0; i < len; i++) {
+		intsetGet(first,i,&v);
+		for (j = 1; j < setnum; j++) {
+			if (sets[j] == NULL) continue;
+			while (intsetGet(sets[j]->ptr,cursor[j],&cur) && cur < v)
+				cursor[j]++;
+			if (intsetGet(sets[j]->ptr,cursor[j],&cur) && cur == v) break;
+		}
+		if (j == setnum) out[n++] = v;
+	}
+	zfree(cursor);
+	return n;
+}
+
+/* 不存在的key当作空集合，sets中对应的位置是NULL */
+static void setOperationIntset(client *c, robj **sets, int setnum, int op) {
+	unsigned long maxlen = 0, len = 0;
+	int64_t *vals;
+	int j;
+
+	for (j = 0; j < setnum; j++) {
+		if (sets[j] == NULL) continue;
+		if (op == SET_OP_UNION) maxlen += setTypeSize(sets[j]);
+		else if (j == 0) maxlen = setTypeSize(sets[j]);
+	}
+	vals = zmalloc(sizeof(int64_t)*(maxlen ? maxlen : 1));
+
+	if (op == SET_OP_INTER) {
+		qsort(sets,setnum,sizeof(robj*),qsortCompareSetsByCardinality);
+		len = intsetMergeInter(sets,setnum,vals);
+	} else if (op == SET_OP_UNION) {
+		len = intsetMergeUnion(sets,setnum,vals);
+	} else if (sets[0]) {
+		len = intsetMergeDiff(sets,setnum,vals);
+	}
+	addReplyIntegerArray(c,vals,len);
+	zfree(vals);
+}
+
+/* 通用实现，结果保存在临时集合dstset中 */
+static void setOperationGeneric(client *c, robj **sets, int setnum, int op) {
+	robj *dstset = createIntsetObject();
+	setTypeIterator *si;
+	sds sdsele;
+	int64_t intele;
+	int j, encoding;
+
+	if (op == SET_OP_INTER) {
+		/* Sort sets from the smallest to largest, this will improve our
+		 * algorithm's performance */
+		qsort(sets,setnum,sizeof(robj*),qsortCompareSetsByCardinality);
+
+		/* Iterate all the elements of the first (smallest) set, and test
+		 * the element against all the other sets, if at least one set does
+		 * not include the element it is discarded */
+		si = setTypeInitIterator(sets[0]);
+		while ((encoding = setTypeNext(si,&sdsele,&intele)) != -1) {
+			sds ele = (encoding == OBJ_ENCODING_INTSET) ?
+				sdsfromlonglong(intele) : sdsele;
+
+			for (j = 1; j < setnum; j++) {
+				if (sets[j] == sets[0]) continue;
+				if (!setTypeIsMember(sets[j],ele)) break;
+			}
+			if (j == setnum) setTypeAdd(dstset,ele);
+			if (encoding == OBJ_ENCODING_INTSET) sdsfree(ele);
+		}
+		setTypeReleaseIterator(si);
+	} else {
+		for (j = 0; j < setnum; j++) {
+			if (!sets[j]) continue; /* non existing keys are like empty sets */
+
+			si = setTypeInitIterator(sets[j]);
+			while ((encoding = setTypeNext(si,&sdsele,&intele)) != -1) {
+				sds ele = (encoding == OBJ_ENCODING_INTSET) ?
+					sdsfromlonglong(intele) : sdsele;
+
+				if (op == SET_OP_UNION || j == 0) {
+					setTypeAdd(dstset,ele);
+				} else {
+					setTypeRemove(dstset,ele);
+				}
+				if (encoding == OBJ_ENCODING_INTSET) sdsfree(ele);
+			}
+			setTypeReleaseIterator(si);
+
+			/* Exit if result set is empty as any additional removal
+			 * of elements will have no effect. */
+			if (op == SET_OP_DIFF && setTypeSize(dstset) == 0) break;
+		}
+	}
+	addReplySetMembers(c,dstset);
+	decrRefCount(dstset);
+}
+
+static void setOperationGenericCommand(client *c, robj **setkeys, int setnum, int op) {
+	robj **sets = zmalloc(sizeof(robj*)*setnum);
+	int j, allintset = 1;
+
+	for (j = 0; j < setnum; j++) {
+		robj *setobj = lookupKey(c->db,setkeys[j]);
+
+		if (!setobj) {
+			/* 交集中任何一个集合为空，结果都是空集 */
+			if (op == SET_OP_INTER) {
+				zfree(sets);
+				addReply(c,shared.emptymultibulk);
+				return;
+			}
+			sets[j] = NULL;
+			continue;
+		}
+		if (checkType(c,setobj,OBJ_SET)) {
+			zfree(sets);
+			return;
+		}
+		if (setobj->encoding != OBJ_ENCODING_INTSET) allintset = 0;
+		sets[j] = setobj;
+	}
+
+	if (op == SET_OP_DIFF && sets[0] == NULL) {
+		addReply(c,shared.emptymultibulk);
+	} else if (allintset) {
+		setOperationIntset(c,sets,setnum,op);
+	} else {
+		setOperationGeneric(c,sets,setnum,op);
+	}
+	zfree(sets);
+}
+
+/* SINTER key [key ...] */
+void sinterCommand(client *c) {
+	setOperationGenericCommand(c,c->argv+1,c->argc-1,SET_OP_INTER);
+}
+
+/* SUNION key [key ...] */
+void sunionCommand(client *c) {
+	setOperationGenericCommand(c,c->argv+1,c->argc-1,SET_OP_UNION);
+}
+
+/* SDIFF key [key ...] */
+void sdiffCommand(client *c) {
+	setOperationGenericCommand(c,c->argv+1,c->argc-1,SET_OP_DIFF);
+}
@@ -0,0 +1,1174 @@
+/*
+ * Copyright (c) 2017, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "zmalloc.h"
+#include "util.h"
+#include "endianconv.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*-----------------------------------------------------------------------------
+ * Stream type API
+ *
+ * 每个listpack块的开头是master entry，后面是若干个元素：
+ *
+ * master entry: count | deleted | num-fields | field_1 | ... | field_N | 0
+ * 元素:         flags | ms-diff | seq-diff | num-fields | field_1 | value_1 |
+ *               ... | field_N | value_N | lp-count
+ *
+ * ID保存为和master entry的ID的差值，字段和master entry相同的元素设置
+ * SAMEFIELDS标志，只保存值；lp-count是元素占用的listpack项数，用于反向遍历
+ * 删除元素只设置DELETED标志，整个块的元素都删除之后才释放块
+ *----------------------------------------------------------------------------*/
+
+/* Create a new stream data structure. */
+stream *streamNew(void) {
+	stream *s = zmalloc(sizeof(*s));
+
+	s->rax = raxNew();
+	s->length = 0;
+	s->last_id.ms = 0;
+	s->last_id.seq = 0;
+	return s;
+}
+
+static void streamFreeListpack(void *lp) {
+	lpFree(lp);
+}
+
+/* Free a stream, including the listpacks stored inside the radix tree. */
+void freeStream(stream *s) {
+	raxFreeWithCallback(s->rax,streamFreeListpack);
+	zfree(s);
+}
+
+/*
+ * ID加1，ID已经是最大值时返回C_ERR
+ */
+static int streamIncrID(streamID *id) {
+	if (id->seq == UINT64_MAX) {
+		if (id->ms == UINT64_MAX) return C_ERR;
+		id->ms++;
+		id->seq = 0;
+	} else {
+		id->seq++;
+	}
+	return C_OK;
+}
+
+/* Generate the next stream item ID given the previous one. If the current
+ * milliseconds Unix time is greater than the previous one, just use this
+ * as time part and start with sequence part of zero. Otherwise we use the
+ * previous time (and never go backward) and increment the sequence. */
+static int streamNextID(streamID *last_id, streamID *new_id) {
+	uint64_t ms = mstime();
+
+	if (ms > last_id->ms) {
+		new_id->ms = ms;
+		new_id->seq = 0;
+		return C_OK;
+	}
+	*new_id = *last_id;
+	return streamIncrID(new_id);
+}
+
+/* This is just a wrapper for lpAppend() to directly use a 64 bit integer
+ * instead of a string. */
+static unsigned char *lpAppendInteger(unsigned char *lp, int64_t value) {
+	char buf[LP_INTBUF_SIZE];
+	int slen = ll2string(buf,sizeof(buf),value);
+
+	return lpAppend(lp,(unsigned char*)buf,slen);
+}
+
+/* This is just a wrapper for lpReplace() to directly use a 64 bit integer
+ * instead of a string to replace the current element. The function returns
+ * the new listpack as return value, and also updates the current cursor
+ * by updating '*pos'. */
+static unsigned char *lpReplaceInteger(unsigned char *lp, unsigned char **pos,
+	int64_t value)
+{
+	char buf[LP_INTBUF_SIZE];
+	int slen = ll2string(buf,sizeof(buf),value);
+
+	return lpInsert(lp,(unsigned char*)buf,slen,*pos,LP_REPLACE,pos);
+}
+
+/* This is a wrapper function for lpGet() to directly get an integer value
+ * from the listpack (that may store numbers as a string), converting
+ * the string if needed. */
+static int64_t lpGetInteger(unsigned char *ele) {
+	int64_t v;
+	long long ll;
+	unsigned char *e = lpGet(ele,&v,NULL);
+
+	if (e == NULL) return v;
+	/* 整数总是以整数编码保存，走到这里说明listpack已经损坏 */
+	if (!string2ll((char*)e,v,&ll)) {
+		printf("Panic: stream listpack contains a non integer field\n");
+		exit(1);
+	}
+	return ll;
+}
+
+/* Convert the specified stream entry ID as a 128 bit big endian number, so
+ * that the IDs can be sorted lexicographically. */
+void streamEncodeID(void *buf, streamID *id) {
+	uint64_t e[2];
+
+	e[0] = htonu64(id->ms);
+	e[1] = htonu64(id->seq);
+	memcpy(buf,e,sizeof(e));
+}
+
+/* This is the reverse of streamEncodeID(): the decoded ID will be stored
+ * in the 'id' structure passed by reference. The buffer 'buf' must point
+ * to a 128 bit big-endian encoded ID. */
+void streamDecodeID(void *buf, streamID *id) {
+	uint64_t e[2];
+
+	memcpy(e,buf,sizeof(e));
+	id->ms = ntohu64(e[0]);
+	id->seq = ntohu64(e[1]);
+}
+
+/* Compare two stream IDs. Return -1 if a < b, 0 if a == b, 1 if a > b. */
+int streamCompareID(streamID *a, streamID *b) {
+	if (a->ms > b->ms) return 1;
+	else if (a->ms < b->ms) return -1;
+	/* The ms part is the same. Check the sequence part. */
+	else if (a->seq > b->seq) return 1;
+	else if (a->seq < b->seq) return -1;
+	/* Everything is the same: IDs are equal. */
+	return 0;
+}
+
+/* Adds a new item into the stream 's' having the specified number of
+ * field-value pairs as specified in 'numfields' and stored into 'argv'.
+ * Returns the new entry ID populating the 'added_id' structure.
+ *
+ * If 'use_id' is not NULL, the ID is not auto-generated by the function,
+ * but instead the passed ID is uesd to add the new entry. In this case
+ * adding the entry may fail as specified later in this comment.
+ *
+ * The function returns C_OK if the item was added, this is always true
+ * if the ID was generated by the function. However the function may return
+ * C_ERR if an ID was given via 'use_id', but adding it failed since the
+ * current top ID is greater or equal. */
+int streamAppendItem(stream *s, robj **argv, int64_t numfields,
+	streamID *added_id, streamID *use_id)
+{
+	raxIterator ri;
+	unsigned char *lp = NULL, *tail = NULL;
+	size_t lp_bytes = 0;
+	uint64_t rax_key[2];    /* Key in the radix tree containing the listpack.*/
+	streamID id, master_id; /* ID of the master entry in the listpack. */
+	int64_t i, lp_count;
+	int flags = STREAM_ITEM_FLAG_NONE;
+
+	/* If an ID was given, check that it's greater than the last entry ID
+	 * or return an error. Automatically generated IDs may fail only when
+	 * the last ID is the biggest possible one. */
+	if (use_id) {
+		if (streamCompareID(use_id,&s->last_id) <= 0) return C_ERR;
+		id = *use_id;
+	} else {
+		if (streamNextID(&s->last_id,&id) == C_ERR) return C_ERR;
+	}
+
+	/* 找到最后一个块，新元素总是追加到最后 */
+	raxStart(&ri,s->rax);
+	raxSeek(&ri,"$",NULL,0);
+	if (raxNext(&ri)) {
+		tail = lp = ri.data;
+		lp_bytes = lpBytes(lp);
+		memcpy(rax_key,ri.key,sizeof(rax_key));
+	}
+	raxStop(&ri);
+
+	/* First of all, check if we can append to the current macro node or
+	 * if we need to switch to the next one. 'lp' will be set to NULL if
+	 * the current node is full. */
+	if (lp != NULL) {
+		if (server.stream_node_max_bytes &&
+			lp_bytes >= server.stream_node_max_bytes)
+		{
+			lp = NULL;
+		} else if (server.stream_node_max_entries) {
+			unsigned char *p = lpFirst(lp);
+			int64_t count = lpGetInteger(p);
+
+			/* 已经删除的元素也占用空间，一起计算 */
+			count += lpGetInteger(lpNext(lp,p));
+			if (count >= server.stream_node_max_entries) lp = NULL;
+		}
+	}
+
+	if (lp == NULL) {
+		/*
+		 * 创建新的块，用第一个元素的字段作为master entry的字段，
+		 * 第一个元素本身不在master entry中，而是作为普通元素追加在后面
+		 */
+		master_id = id;
+		streamEncodeID(rax_key,&id);
+		lp = lpNew(0);
+		lp = lpAppendInteger(lp,1); /* One item, the one we are adding. */
+		lp = lpAppendInteger(lp,0); /* Zero deleted so far. */
+		lp = lpAppendInteger(lp,numfields);
+		for (i = 0; i < numfields; i++) {
+			sds field = argv[i*2]->ptr;
+			lp = lpAppend(lp,(unsigned char*)field,sdslen(field));
+		}
+		lp = lpAppendInteger(lp,0); /* Master entry zero terminator. */
+		raxInsert(s->rax,(unsigned char*)rax_key,sizeof(rax_key),lp,NULL);
+		tail = lp;
+		/* The first entry we insert, has obviously the same fields of the
+		 * master entry. */
+		flags |= STREAM_ITEM_FLAG_SAMEFIELDS;
+	} else {
+		unsigned char *lp_ele = lpFirst(lp);
+		int64_t count, master_fields_count;
+
+		/* Read the master ID from the radix tree key. */
+		streamDecodeID(rax_key,&master_id);
+
+		/* Update count and skip the deleted fields. */
+		count = lpGetInteger(lp_ele);
+		lp = lpReplaceInteger(lp,&lp_ele,count+1);
+		lp_ele = lpNext(lp,lp_ele); /* seek deleted. */
+		lp_ele = lpNext(lp,lp_ele); /* seek master entry num fields. */
+
+		/* Check if the entry we are adding, have the same fields
+		 * as the master entry. */
+		master_fields_count = lpGetInteger(lp_ele);
+		lp_ele = lpNext(lp,lp_ele);
+		if (numfields == master_fields_count) {
+			for (i = 0; i < master_fields_count; i++) {
+				sds field = argv[i*2]->ptr;
+				int64_t e_len;
+				unsigned char buf[LP_INTBUF_SIZE];
+				unsigned char *e = lpGet(lp_ele,&e_len,buf);
+
+				/* Stop if there is a mismatch. */
+				if (sdslen(field) != (size_t)e_len ||
+					memcmp(e,field,e_len) != 0) break;
+				lp_ele = lpNext(lp,lp_ele);
+			}
+			/* All fields are the same! We can compress the field names
+			 * setting a single bit in the flags. */
+			if (i == master_fields_count)
+				flags |= STREAM_ITEM_FLAG_SAMEFIELDS;
+		}
+	}
+
+	/* Populate the listpack with the new entry. The entry-id field is
+	 * actually two separated fields: the ms and seq difference compared to
+	 * the master entry. The seq difference may be negative when the ms part
+	 * advanced, and it is stored as a signed integer that wraps back to the
+	 * right value when added to the master seq. */
+	lp = lpAppendInteger(lp,flags);
+	lp = lpAppendInteger(lp,(int64_t)(id.ms - master_id.ms));
+	lp = lpAppendInteger(lp,(int64_t)(id.seq - master_id.seq));
+	if (!(flags & STREAM_ITEM_FLAG_SAMEFIELDS))
+		lp = lpAppendInteger(lp,numfields);
+	for (i = 0; i < numfields; i++) {
+		sds field = argv[i*2]->ptr, value = argv[i*2+1]->ptr;
+
+		if (!(flags & STREAM_ITEM_FLAG_SAMEFIELDS))
+			lp = lpAppend(lp,(unsigned char*)field,sdslen(field));
+		lp = lpAppend(lp,(unsigned char*)value,sdslen(value));
+	}
+	/* Compute and store the lp-count field. */
+	lp_count = numfields;
+	lp_count += 3; /* Add the 3 fixed fields flags + ms-diff + seq-diff. */
+	if (!(flags & STREAM_ITEM_FLAG_SAMEFIELDS)) {
+		/* If the item is not compressed, it also has the fields other than
+		 * the values, and an additional num-fileds field. */
+		lp_count += numfields+1;
+	}
+	lp = lpAppendInteger(lp,lp_count);
+
+	/* Insert back into the tree in order to update the listpack pointer. */
+	if (tail != lp)
+		raxInsert(s->rax,(unsigned char*)rax_key,sizeof(rax_key),lp,NULL);
+	s->length++;
+	s->last_id = id;
+	if (added_id) *added_id = id;
+	return C_OK;
+}
+
+/* Trim the stream 's' to have no more than maxlen elements, and return the
+ * number of elements removed from the stream. The 'approx' option, if non-zero,
+ * specifies that the trimming must be performed in a approximated way in
+ * order to maximize performances. This means that the stream may contain
+ * more elements than 'maxlen', and elements are only removed if we can remove
+ * a *whole* node of the radix tree. The elements are removed from the head
+ * of the stream (older elements).
+ *
+ * The function may return zero if:
+ *
+ * 1) The stream is already shorter or equal to the specified max length.
+ * 2) The 'approx' option is true and the head node had not enough elements
+ *    to be deleted, leaving the stream with a number of elements >= maxlen.
+ */
+int64_t streamTrimByLength(stream *s, size_t maxlen, int approx) {
+	raxIterator ri;
+	int64_t deleted = 0;
+
+	if (s->length <= maxlen) return 0;
+
+	raxStart(&ri,s->rax);
+	raxSeek(&ri,"^",NULL,0);
+	while (s->length > maxlen && raxNext(&ri)) {
+		unsigned char *lp = ri.data, *p = lpFirst(lp);
+		int64_t entries = lpGetInteger(p);
+		int64_t to_delete, marked_deleted, master_fields_count, j;
+
+		/* Check if we can remove the whole node, and still have at
+		 * least maxlen elements. */
+		if (s->length - entries >= maxlen) {
+			lpFree(lp);
+			raxRemove(s->rax,ri.key,ri.key_len,NULL);
+			raxSeek(&ri,">=",ri.key,ri.key_len);
+			s->length -= entries;
+			deleted += entries;
+			continue;
+		}
+
+		/* If we cannot remove a whole element, and approx is true,
+		 * stop here. */
+		if (approx) break;
+
+		/* Otherwise, we have to mark single entries inside the listpack
+		 * as deleted. We start by updating the entries/deleted counters. */
+		to_delete = s->length - maxlen;
+		lp = lpReplaceInteger(lp,&p,entries-to_delete);
+		p = lpNext(lp,p); /* Seek deleted field. */
+		marked_deleted = lpGetInteger(p);
+		lp = lpReplaceInteger(lp,&p,marked_deleted+to_delete);
+		p = lpNext(lp,p); /* Seek num-of-fields in the master entry. */
+
+		/* Skip all the master fields. */
+		master_fields_count = lpGetInteger(p);
+		p = lpNext(lp,p); /* Seek the first field. */
+		for (j = 0; j < master_fields_count; j++)
+			p = lpNext(lp,p); /* Skip all master fields. */
+		p = lpNext(lp,p); /* Skip the zero master entry terminator. */
+
+		/* 'p' is now pointing to the first entry inside the listpack.
+		 * We have to run entry after entry, marking entries as deleted
+		 * if they are already not deleted. */
+		while (p) {
+			int flags = lpGetInteger(p);
+			int64_t to_skip;
+
+			/* Mark the entry as deleted. */
+			if (!(flags & STREAM_ITEM_FLAG_DELETED)) {
+				flags |= STREAM_ITEM_FLAG_DELETED;
+				lp = lpReplaceInteger(lp,&p,flags);
+				deleted++;
+				s->length--;
+				if (s->length <= maxlen) break; /* Enough entries deleted. */
+			}
+
+			p = lpNext(lp,p); /* Skip ID ms delta. */
+			p = lpNext(lp,p); /* Skip ID seq delta. */
+			p = lpNext(lp,p); /* Seek num-fields or values (if compressed). */
+			if (flags & STREAM_ITEM_FLAG_SAMEFIELDS) {
+				to_skip = master_fields_count;
+			} else {
+				to_skip = lpGetInteger(p);
+				to_skip = 1+(to_skip*2);
+			}
+
+			while (to_skip--) p = lpNext(lp,p); /* Skip the whole entry. */
+			p = lpNext(lp,p); /* Skip the final lp-count field. */
+		}
+
+		/* Update the listpack with the new pointer. */
+		raxInsert(s->rax,ri.key,ri.key_len,lp,NULL);
+
+		break; /* If we are here, there was enough to delete in the current
+		          node, so no need to go to the next node. */
+	}
+
+	raxStop(&ri);
+	return deleted;
+}
+
+/* Initialize the stream iterator, so that we can call iterating functions
+ * to get the next items. This requires a corresponding streamIteratorStop()
+ * at the end. The 'rev' parameter controls the direction. If it's zero the
+ * iteration is from the start to the end element (inclusive), otherwise
+ * if rev is non-zero, the iteration is reversed.
+ *
+ * Once the iterator is initialized, we iterate like this:
+ *
+ *  streamIterator myiterator;
+ *  streamIteratorStart(&myiterator,...);
+ *  int64_t numfields;
+ *  while(streamIteratorGetID(&myiterator,&ID,&numfields)) {
+ *      while(numfields--) {
+ *          unsigned char *key, *value;
+ *          size_t key_len, value_len;
+ *          streamIteratorGetField(&myiterator,&key,&value,&key_len,&value_len);
+ *
+ *          ... do what you want with key and value ...
+ *      }
+ *  }
+ *  streamIteratorStop(&myiterator); */
+void streamIteratorStart(streamIterator *si, stream *s, streamID *start,
+	streamID *end, int rev)
+{
+	/* Intialize the iterator and translates the iteration start/stop
+	 * elements into a 128 big big-endian number. */
+	if (start) {
+		streamEncodeID(si->start_key,start);
+	} else {
+		si->start_key[0] = 0;
+		si->start_key[1] = 0;
+	}
+
+	if (end) {
+		streamEncodeID(si->end_key,end);
+	} else {
+		si->end_key[0] = UINT64_MAX;
+		si->end_key[1] = UINT64_MAX;
+	}
+
+	/*
+	 * 块的键是块中第一个元素的ID，所以包含起始ID的块是键小于等于起始ID的
+	 * 最后一个块，之后的读取都是在连续的listpack中顺序进行的
+	 */
+	raxStart(&si->ri,s->rax);
+	if (!rev) {
+		if (start && (start->ms || start->seq)) {
+			raxSeek(&si->ri,"<=",(unsigned char*)si->start_key,
+				sizeof(si->start_key));
+			if (raxEOF(&si->ri)) raxSeek(&si->ri,"^",NULL,0);
+		} else {
+			raxSeek(&si->ri,"^",NULL,0);
+		}
+	} else {
+		if (end && (end->ms || end->seq)) {
+			raxSeek(&si->ri,"<=",(unsigned char*)si->end_key,
+				sizeof(si->end_key));
+			if (raxEOF(&si->ri)) raxSeek(&si->ri,"$",NULL,0);
+		} else {
+			raxSeek(&si->ri,"$",NULL,0);
+		}
+	}
+	si->stream = s;
+	si->lp = NULL; /* There is no current listpack right now. */
+	si->lp_ele = NULL; /* Current listpack cursor. */
+	si->rev = rev;  /* Direction, if non-zero reversed, from end to start. */
+}
+
+/* Return 1 and store the current item ID at 'id' if there are still
+ * elements within the iteration range, otherwise return 0 in order to
+ * signal the iteration terminated. The caller must consume all the
+ * 'numfields' fields with streamIteratorGetField() before calling this
+ * function again. */
+int streamIteratorGetID(streamIterator *si, streamID *id, int64_t *numfields) {
+	while (1) { /* Will stop when element > stop_key or end of radix tree. */
+		/* If the current listpack is set to NULL, this is the start of the
+		 * iteration or the previous listpack was completely iterated.
+		 * Go to the next node. */
+		if (si->lp == NULL || si->lp_ele == NULL) {
+			if (!si->rev && !raxNext(&si->ri)) return 0;
+			else if (si->rev && !raxPrev(&si->ri)) return 0;
+			/* Get the master ID. */
+			streamDecodeID(si->ri.key,&si->master_id);
+			/* Get the master fields count. */
+			si->lp = si->ri.data;
+			si->lp_ele = lpFirst(si->lp);           /* Seek items count */
+			si->lp_ele = lpNext(si->lp,si->lp_ele); /* Seek deleted count. */
+			si->lp_ele = lpNext(si->lp,si->lp_ele); /* Seek num fields. */
+			si->master_fields_count = lpGetInteger(si->lp_ele);
+			si->lp_ele = lpNext(si->lp,si->lp_ele); /* Seek first field. */
+			si->master_fields_start = si->lp_ele;
+			/* We are now pointing to the first field of the master entry.
+			 * We need to seek either the first or the last entry depending
+			 * on the direction of the iteration. */
+			if (!si->rev) {
+				/* If we are iterating in normal order, skip the master fields
+				 * to seek the first actual entry. */
+				uint64_t i;
+
+				for (i = 0; i < si->master_fields_count; i++)
+					si->lp_ele = lpNext(si->lp,si->lp_ele);
+			} else {
+				/* If we are iterating in reverse direction, just seek the
+				 * last part of the last entry in the listpack (that is, the
+				 * fields count). */
+				si->lp_ele = lpLast(si->lp);
+			}
+		} else if (si->rev) {
+			/* If we are itereating in the reverse order, and this is not
+			 * the first entry emitted for this listpack, then we already
+			 * emitted the current entry, and have to go back to the previous
+			 * one. */
+			int64_t lp_count = lpGetInteger(si->lp_ele);
+
+			while (lp_count--) si->lp_ele = lpPrev(si->lp,si->lp_ele);
+			/* Seek lp-count of prev entry. */
+			si->lp_ele = lpPrev(si->lp,si->lp_ele);
+		}
+
+		/* For every radix tree node, iterate the corresponding listpack,
+		 * returning elements when they are within range. */
+		while (1) {
+			unsigned char buf[sizeof(streamID)];
+			int flags;
+
+			if (!si->rev) {
+				/* If we are going forward, skip the previous entry
+				 * lp-count field (or in case of the master entry, the zero
+				 * term field) */
+				si->lp_ele = lpNext(si->lp,si->lp_ele);
+				if (si->lp_ele == NULL) break;
+			} else {
+				/* If we are going backward, read the number of elements this
+				 * entry is composed of, and jump backward N times to seek
+				 * its start. */
+				int64_t lp_count = lpGetInteger(si->lp_ele);
+
+				if (lp_count == 0) { /* We reached the master entry. */
+					si->lp = NULL;
+					si->lp_ele = NULL;
+					break;
+				}
+				while (lp_count--) si->lp_ele = lpPrev(si->lp,si->lp_ele);
+			}
+
+			/* Get the flags entry. */
+			si->lp_flags = si->lp_ele;
+			flags = lpGetInteger(si->lp_ele);
+			si->lp_ele = lpNext(si->lp,si->lp_ele); /* Seek ID. */
+
+			/* Get the ID: it is encoded as difference between the master
+			 * ID and this entry ID. */
+			*id = si->master_id;
+			id->ms += lpGetInteger(si->lp_ele);
+			si->lp_ele = lpNext(si->lp,si->lp_ele);
+			id->seq += lpGetInteger(si->lp_ele);
+			si->lp_ele = lpNext(si->lp,si->lp_ele);
+			streamEncodeID(buf,id);
+
+			/* The number of entries is here or not depending on the
+			 * flags. */
+			if (flags & STREAM_ITEM_FLAG_SAMEFIELDS) {
+				*numfields = si->master_fields_count;
+			} else {
+				*numfields = lpGetInteger(si->lp_ele);
+				si->lp_ele = lpNext(si->lp,si->lp_ele);
+			}
+
+			/* If current >= start, and the entry is not marked as
+			 * deleted, emit it. */
+			if (!si->rev) {
+				if (memcmp(buf,si->start_key,sizeof(streamID)) >= 0 &&
+					!(flags & STREAM_ITEM_FLAG_DELETED))
+				{
+					if (memcmp(buf,si->end_key,sizeof(streamID)) > 0)
+						return 0; /* We are already out of range. */
+					si->entry_flags = flags;
+					if (flags & STREAM_ITEM_FLAG_SAMEFIELDS)
+						si->master_fields_ptr = si->master_fields_start;
+					return 1; /* Valid item returned. */
+				}
+			} else {
+				if (memcmp(buf,si->end_key,sizeof(streamID)) <= 0 &&
+					!(flags & STREAM_ITEM_FLAG_DELETED))
+				{
+					if (memcmp(buf,si->start_key,sizeof(streamID)) < 0)
+						return 0; /* We are already out of range. */
+					si->entry_flags = flags;
+					if (flags & STREAM_ITEM_FLAG_SAMEFIELDS)
+						si->master_fields_ptr = si->master_fields_start;
+					return 1; /* Valid item returned. */
+				}
+			}
+
+			/* If we do not emit, we have to discard if we are going
+			 * forward, or seek the previous entry if we are going
+			 * backward. */
+			if (!si->rev) {
+				int64_t i, to_discard = (flags & STREAM_ITEM_FLAG_SAMEFIELDS) ?
+					*numfields : *numfields*2;
+
+				for (i = 0; i < to_discard; i++)
+					si->lp_ele = lpNext(si->lp,si->lp_ele);
+			} else {
+				/* flag + id ms + id seq + one more to go back to the
+				 * previous entry "count" field. If the entry was not
+				 * flagged SAMEFIELD we also read the number of fields,
+				 * so go back one more. */
+				int64_t prev_times = 4;
+
+				if (!(flags & STREAM_ITEM_FLAG_SAMEFIELDS)) prev_times++;
+				while (prev_times--) si->lp_ele = lpPrev(si->lp,si->lp_ele);
+			}
+		}
+
+		/* End of listpack reached. Try the next/prev radix tree node. */
+	}
+}
+
+/* Get the field and value of the current item we are iterating. This should
+ * be called immediately after streamIteratorGetID(), and for each field
+ * according to the number of fields returned by streamIteratorGetID().
+ * The function populates the field and value pointers and the corresponding
+ * lengths by reference, that are valid until the next iterator call, assuming
+ * no one touches the stream meanwhile. */
+void streamIteratorGetField(streamIterator *si, unsigned char **fieldptr,
+	unsigned char **valueptr, int64_t *fieldlen, int64_t *valuelen)
+{
+	if (si->entry_flags & STREAM_ITEM_FLAG_SAMEFIELDS) {
+		*fieldptr = lpGet(si->master_fields_ptr,fieldlen,si->field_buf);
+		si->master_fields_ptr = lpNext(si->lp,si->master_fields_ptr);
+	} else {
+		*fieldptr = lpGet(si->lp_ele,fieldlen,si->field_buf);
+		si->lp_ele = lpNext(si->lp,si->lp_ele);
+	}
+	*valueptr = lpGet(si->lp_ele,valuelen,si->value_buf);
+	si->lp_ele = lpNext(si->lp,si->lp_ele);
+}
+
+/* Stop the stream iterator. The only cleanup we need is to free the rax
+ * itereator, since the stream iterator itself is supposed to be stack
+ * allocated. */
+void streamIteratorStop(streamIterator *si) {
+	raxStop(&si->ri);
+}
+
+/*-----------------------------------------------------------------------------
+ * Stream commands implementation
+ *----------------------------------------------------------------------------*/
+
+/* 把ID格式化成"<ms>-<seq>"，返回长度，buf至少需要STREAM_ID_STR_LEN字节 */
+#define STREAM_ID_STR_LEN 42
+static int streamFormatID(char *buf, streamID *id) {
+	int len = ull2string(buf,STREAM_ID_STR_LEN,id->ms);
+
+	buf[len++] = '-';
+	len += ull2string(buf+len,STREAM_ID_STR_LEN-len,id->seq);
+	return len;
+}
+
+/* 追加一个"$<len>\r\n<p>\r\n" */
+static sds streamCatBulk(sds buf, const void *p, size_t len) {
+	char *dst;
+	int hlen;
+
+	buf = sdsMakeRoomFor(buf,1+20+2+len+2);
+	dst = buf+sdslen(buf);
+	dst[0] = '$';
+	hlen = 1+ll2string(dst+1,21,len);
+	dst[hlen++] = '\r';
+	dst[hlen++] = '\n';
+	memcpy(dst+hlen,p,len);
+	dst[hlen+len] = '\r';
+	dst[hlen+len+1] = '\n';
+	sdsIncrLen(buf,hlen+len+2);
+	return buf;
+}
+
+/* 追加一个"*<len>\r\n" */
+static sds streamCatMultiBulkLen(sds buf, long long len) {
+	char *dst;
+	int hlen;
+
+	buf = sdsMakeRoomFor(buf,1+20+2);
+	dst = buf+sdslen(buf);
+	dst[0] = '*';
+	hlen = 1+ll2string(dst+1,21,len);
+	dst[hlen++] = '\r';
+	dst[hlen++] = '\n';
+	sdsIncrLen(buf,hlen);
+	return buf;
+}
+
+/*
+ * 把start到end之间(包含两端)的最多count个元素格式化成协议追加到buf中，
+ * count为0表示没有限制，*emitted保存实际输出的元素个数
+ * 每个元素是一个两项的数组：ID和field/value交替排列的数组
+ */
+static sds streamCatRange(sds buf, stream *s, streamID *start, streamID *end,
+	size_t count, int rev, size_t *emitted)
+{
+	streamIterator si;
+	streamID id;
+	int64_t numfields;
+	size_t arraylen = 0;
+
+	streamIteratorStart(&si,s,start,end,rev);
+	while (streamIteratorGetID(&si,&id,&numfields)) {
+		char idbuf[STREAM_ID_STR_LEN];
+		int idlen = streamFormatID(idbuf,&id);
+
+		buf = streamCatMultiBulkLen(buf,2);
+		buf = streamCatBulk(buf,idbuf,idlen);
+		buf = streamCatMultiBulkLen(buf,numfields*2);
+		/* Emit the field-value pairs. */
+		while (numfields--) {
+			unsigned char *key, *value;
+			int64_t key_len, value_len;
+
+			streamIteratorGetField(&si,&key,&value,&key_len,&value_len);
+			buf = streamCatBulk(buf,key,key_len);
+			buf = streamCatBulk(buf,value,value_len);
+		}
+		arraylen++;
+		if (count && count == arraylen) break;
+	}
+	streamIteratorStop(&si);
+	*emitted = arraylen;
+	return buf;
+}
+
+/* 按类型查找流对象，不存在时创建一个新的 */
+static robj *streamTypeLookupWriteOrCreate(client *c, robj *key) {
+	robj *o = lookupKey(c->db,key);
+
+	if (o == NULL) {
+		o = createStreamObject();
+		dbAdd(c->db,key,o);
+	} else {
+		if (o->type != OBJ_STREAM) {
+			addReply(c,shared.wrongtypeerr);
+			return NULL;
+		}
+	}
+	return o;
+}
+
+/*
+ * 解析"<ms>-<seq>"格式的ID，只有<ms>时seq使用missing_seq
+ * strict为0时还接受"-"(最小ID)和"+"(最大ID)
+ */
+static int streamGenericParseIDOrReply(client *c, robj *o, streamID *id,
+	uint64_t missing_seq, int strict)
+{
+	sds s = o->ptr;
+	size_t len = sdslen(s);
+	unsigned long long ms, seq;
+	char *dash;
+
+	if (!strict && len == 1 && (s[0] == '-' || s[0] == '+')) {
+		id->ms = id->seq = (s[0] == '-') ? 0 : UINT64_MAX;
+		return C_OK;
+	}
+
+	dash = memchr(s,'-',len);
+	if (dash) {
+		if (!string2ull(s,dash-s,&ms) ||
+			!string2ull(dash+1,len-(dash-s)-1,&seq)) goto invalid;
+	} else {
+		if (!string2ull(s,len,&ms)) goto invalid;
+		seq = missing_seq;
+	}
+	id->ms = ms;
+	id->seq = seq;
+	return C_OK;
+
+invalid:
+	addReplyError(c,"Invalid stream ID specified as stream command argument");
+	return C_ERR;
+}
+
+static int streamParseIDOrReply(client *c, robj *o, streamID *id,
+	uint64_t missing_seq)
+{
+	return streamGenericParseIDOrReply(c,o,id,missing_seq,0);
+}
+
+/*
+ * 解析MAXLEN [~|=] <count>，*i指向MAXLEN，成功时*i指向count参数
+ */
+static int streamParseMaxlenOrReply(client *c, int *i, long long *maxlen,
+	int *approx)
+{
+	int j = *i, moreargs = (c->argc-1) - j;
+	char *next;
+
+	if (moreargs == 0) {
+		addReply(c,shared.syntaxerr);
+		return C_ERR;
+	}
+	next = c->argv[j+1]->ptr;
+	*approx = 0;
+	/* Check for the form MAXLEN ~ <count>. */
+	if (moreargs >= 2 && (next[0] == '~' || next[0] == '=') &&
+		next[1] == '\0')
+	{
+		*approx = next[0] == '~';
+		j++;
+	}
+	if (getLongLongFromObjectOrReply(c,c->argv[j+1],maxlen,NULL) != C_OK)
+		return C_ERR;
+	if (*maxlen < 0) {
+		addReplyError(c,"The MAXLEN argument must be >= 0.");
+		return C_ERR;
+	}
+	*i = j+1;
+	return C_OK;
+}
+
+/*
+ * 近似裁剪的结果取决于块的划分，重放时节点大小的配置可能不同，
+ * 所以把"MAXLEN ~ <count>"改写成精确的"MAXLEN = <当前长度>"再传播
+ */
+static void streamRewriteApproxMaxlen(client *c, stream *s, int maxlen_arg_idx) {
+	robj *equal_obj = createStringObject("=",1);
+	robj *maxlen_obj = createStringObjectFromLongLong(s->length);
+
+	rewriteClientCommandArgument(c,maxlen_arg_idx-1,equal_obj);
+	rewriteClientCommandArgument(c,maxlen_arg_idx,maxlen_obj);
+	decrRefCount(equal_obj);
+	decrRefCount(maxlen_obj);
+}
+
+/* XADD key [MAXLEN [~|=] <count>] <ID or *> [field value] [field value] ... */
+void xaddCommand(client *c) {
+	streamID id;
+	int id_given = 0; /* Was an ID different than "*" specified? */
+	long long maxlen = -1;  /* If left to -1 no trimming is performed. */
+	int approx_maxlen = 0;  /* If 1 only delete whole radix tree nodes, so
+	                           the maxium length is not applied verbatim. */
+	int maxlen_arg_idx = 0; /* Index of the count in MAXLEN, for rewriting. */
+	int i, field_pos;
+	char idbuf[STREAM_ID_STR_LEN];
+	int idlen;
+	robj *o, *idarg;
+	stream *s;
+
+	/* Parse options. */
+	for (i = 2; i < c->argc; i++) {
+		char *opt = c->argv[i]->ptr;
+
+		if (opt[0] == '*' && opt[1] == '\0') {
+			/* This is just a fast path for the common case of auto-ID
+			 * creation. */
+			break;
+		} else if (!strcasecmp(opt,"maxlen")) {
+			if (streamParseMaxlenOrReply(c,&i,&maxlen,&approx_maxlen) != C_OK)
+				return;
+			maxlen_arg_idx = i;
+		} else {
+			/* If we are here is a syntax error or a valid ID. */
+			if (streamGenericParseIDOrReply(c,c->argv[i],&id,0,1) != C_OK)
+				return;
+			id_given = 1;
+			break;
+		}
+	}
+	field_pos = i+1;
+
+	/* Check arity. */
+	if ((c->argc - field_pos) < 2 || ((c->argc-field_pos) % 2) == 1) {
+		addReplyError(c,"wrong number of arguments for XADD");
+		return;
+	}
+
+	/* Return ASAP if minimal ID (0-0) was given so we avoid possibly creating
+	 * a new stream and have streamAppendItem fail, leaving an empty key in the
+	 * database. */
+	if (id_given && id.ms == 0 && id.seq == 0) {
+		addReplyError(c,"The ID specified in XADD must be greater than 0-0");
+		return;
+	}
+
+	/* Lookup the stream at key. */
+	if ((o = streamTypeLookupWriteOrCreate(c,c->argv[1])) == NULL) return;
+	s = o->ptr;
+
+	/* Append using the low level function and return the ID. */
+	if (streamAppendItem(s,c->argv+field_pos,(c->argc-field_pos)/2,
+		&id,id_given ? &id : NULL) == C_ERR)
+	{
+		if (id_given)
+			addReplyError(c,"The ID specified in XADD is equal or smaller "
+				"than the target stream top item");
+		else
+			addReplyError(c,"The stream has exhausted the last possible ID, "
+				"unable to add more items");
+		return;
+	}
+	idlen = streamFormatID(idbuf,&id);
+	addReplyBulkCBuffer(c,idbuf,idlen);
+	server.dirty++;
+
+	/* Remove older elements if MAXLEN was specified. */
+	if (maxlen >= 0) {
+		streamTrimByLength(s,maxlen,approx_maxlen);
+		if (approx_maxlen) streamRewriteApproxMaxlen(c,s,maxlen_arg_idx);
+	}
+
+	/* Let's rewrite the ID argument with the one actually generated for
+	 * AOF propagation. */
+	idarg = createRawStringObject(idbuf,idlen);
+	rewriteClientCommandArgument(c,i,idarg);
+	decrRefCount(idarg);
+}
+
+/* XRANGE/XREVRANGE actual implementation. */
+static void xrangeGenericCommand(client *c, int rev) {
+	robj *o;
+	stream *s;
+	streamID startid, endid;
+	long long count = -1;
+	robj *startarg = rev ? c->argv[3] : c->argv[2];
+	robj *endarg = rev ? c->argv[2] : c->argv[3];
+	size_t emitted;
+	sds buf;
+	int j;
+
+	if (streamParseIDOrReply(c,startarg,&startid,0) == C_ERR) return;
+	if (streamParseIDOrReply(c,endarg,&endid,UINT64_MAX) == C_ERR) return;
+
+	/* Parse the COUNT option if any. */
+	for (j = 4; j < c->argc; j++) {
+		int additional = c->argc-j-1;
+
+		if (strcasecmp(c->argv[j]->ptr,"COUNT") == 0 && additional >= 1) {
+			if (getLongLongFromObjectOrReply(c,c->argv[j+1],&count,NULL)
+				!= C_OK) return;
+			if (count < 0) count = 0;
+			j++; /* Consume additional arg. */
+		} else {
+			addReply(c,shared.syntaxerr);
+			return;
+		}
+	}
+
+	if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.emptymultibulk)) == NULL
+		|| checkType(c,o,OBJ_STREAM)) return;
+	if (count == 0) {
+		addReply(c,shared.emptymultibulk);
+		return;
+	}
+	s = o->ptr;
+
+	/*
+	 * 元素个数要遍历之后才知道，先把元素格式化到一块缓冲区中，
+	 * 再一次性放入输出缓冲区
+	 */
+	buf = streamCatRange(sdsempty(),s,&startid,&endid,count == -1 ? 0 : count,
+		rev,&emitted);
+	addReplyMultiBulkLen(c,emitted);
+	addReplyProtoSds(c,buf);
+}
+
+/* XRANGE key start end [COUNT <n>] */
+void xrangeCommand(client *c) {
+	xrangeGenericCommand(c,0);
+}
+
+/* XREVRANGE key end start [COUNT <n>] */
+void xrevrangeCommand(client *c) {
+	xrangeGenericCommand(c,1);
+}
+
+/* XLEN */
+void xlenCommand(client *c) {
+	robj *o;
+
+	if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.czero)) == NULL
+		|| checkType(c,o,OBJ_STREAM)) return;
+	addReplyLongLong(c,((stream*)o->ptr)->length);
+}
+
+#define XREAD_STATIC_STREAMS 8
+
+/*
+ * XREAD [COUNT <count>] STREAMS key_1 key_2 ... key_N ID_1 ID_2 ... ID_N
+ * 返回每个流中ID大于指定ID的元素，所有流都没有新元素时回复空数组
+ * 这里没有阻塞客户端的机制，所以不支持BLOCK选项
+ */
+void xreadCommand(client *c) {
+	long long count = 0;
+	int streams_count = 0;
+	int streams_arg = 0;
+	streamID static_ids[XREAD_STATIC_STREAMS], *ids = static_ids;
+	int i, arraylen = 0;
+
+	/* Parse arguments. */
+	for (i = 1; i < c->argc; i++) {
+		int moreargs = c->argc-i-1;
+		char *o = c->argv[i]->ptr;
+
+		if (!strcasecmp(o,"BLOCK") && moreargs) {
+			addReplyError(c,"XREAD BLOCK is not supported");
+			return;
+		} else if (!strcasecmp(o,"COUNT") && moreargs) {
+			i++;
+			if (getLongLongFromObjectOrReply(c,c->argv[i],&count,NULL) != C_OK)
+				return;
+			if (count < 0) count = 0;
+		} else if (!strcasecmp(o,"STREAMS") && moreargs) {
+			streams_arg = i+1;
+			streams_count = (c->argc-streams_arg);
+			if ((streams_count % 2) != 0) {
+				addReplyError(c,"Unbalanced XREAD list of streams: "
+					"for each stream key an ID or '$' must be "
+					"specified.");
+				return;
+			}
+			streams_count /= 2; /* We have two arguments for each stream. */
+			break;
+		} else {
+			addReply(c,shared.syntaxerr);
+			return;
+		}
+	}
+
+	/* STREAMS option is mandatory. */
+	if (streams_arg == 0) {
+		addReply(c,shared.syntaxerr);
+		return;
+	}
+
+	/* Parse the IDs and resolve "$" into the last ID of each stream. */
+	if (streams_count > XREAD_STATIC_STREAMS)
+		ids = zmalloc(sizeof(streamID)*streams_count);
+
+	for (i = streams_arg+streams_count; i < c->argc; i++) {
+		/* Specifying "$" as last-known-id means that the client wants to be
+		 * served with just the messages that will arrive into the stream
+		 * starting from now. */
+		int id_idx = i - streams_arg - streams_count;
+		robj *key = c->argv[i-streams_count];
+		robj *o = lookupKey(c->db,key);
+
+		if (o && checkType(c,o,OBJ_STREAM)) goto cleanup;
+		if (strcmp(c->argv[i]->ptr,"$") == 0) {
+			if (o) {
+				ids[id_idx] = ((stream*)o->ptr)->last_id;
+			} else {
+				ids[id_idx].ms = 0;
+				ids[id_idx].seq = 0;
+			}
+			continue;
+		}
+		if (streamParseIDOrReply(c,c->argv[i],ids+id_idx,0) != C_OK)
+			goto cleanup;
+	}
+
+	/*
+	 * 只从头部裁剪，所以非空的流中最后一个ID对应的元素一定存在，
+	 * 不用遍历就可以知道有多少个流需要回复
+	 */
+	for (i = 0; i < streams_count; i++) {
+		robj *o = lookupKey(c->db,c->argv[streams_arg+i]);
+		stream *s;
+
+		if (o == NULL) continue;
+		s = o->ptr;
+		if (s->length && streamCompareID(&s->last_id,ids+i) > 0) arraylen++;
+	}
+
+	if (arraylen == 0) {
+		addReply(c,shared.nullmultibulk);
+		goto cleanup;
+	}
+
+	addReplyMultiBulkLen(c,arraylen);
+	for (i = 0; i < streams_count; i++) {
+		robj *o = lookupKey(c->db,c->argv[streams_arg+i]);
+		streamID start;
+		stream *s;
+		size_t emitted;
+		sds buf;
+
+		if (o == NULL) continue;
+		s = o->ptr;
+		if (!s->length || streamCompareID(&s->last_id,ids+i) <= 0) continue;
+
+		/* Emit the two elements sub-array consisting of the name
+		 * of the stream and the data we extracted from it. */
+		start = ids[i];
+		streamIncrID(&start);
+		buf = streamCatRange(sdsempty(),s,&start,NULL,count,0,&emitted);
+		addReplyMultiBulkLen(c,2);
+		addReplyBulk(c,c->argv[streams_arg+i]);
+		addReplyMultiBulkLen(c,emitted);
+		addReplyProtoSds(c,buf);
+	}
+
+cleanup:
+	if (ids != static_ids) zfree(ids);
+}
+
+/* XTRIM key MAXLEN [~|=] <count> */
+void xtrimCommand(client *c) {
+	robj *o;
+	stream *s;
+	long long maxlen = -1;  /* If left to -1 no trimming is performed. */
+	int approx_maxlen = 0;  /* If 1 only delete whole radix tree nodes, so
+	                           the maxium length is not applied verbatim. */
+	int maxlen_arg_idx = 0; /* Index of the count in MAXLEN, for rewriting. */
+	int64_t deleted;
+	int i;
+
+	/* Parse options. */
+	for (i = 2; i < c->argc; i++) {
+		char *opt = c->argv[i]->ptr;
+
+		if (!strcasecmp(opt,"maxlen")) {
+			if (streamParseMaxlenOrReply(c,&i,&maxlen,&approx_maxlen) != C_OK)
+				return;
+			maxlen_arg_idx = i;
+		} else {
+			addReply(c,shared.syntaxerr);
+			return;
+		}
+	}
+
+	if (maxlen_arg_idx == 0) {
+		addReplyError(c,"XTRIM called without an option to trim the stream");
+		return;
+	}
+
+	/* If the key does not exist, we are ok returning zero, that is, the
+	 * number of elements removed from the stream. */
+	if ((o = lookupKeyWriteOrReply(c,c->argv[1],shared.czero)) == NULL
+		|| checkType(c,o,OBJ_STREAM)) return;
+	s = o->ptr;
+
+	/* Propagate the write if needed. */
+	deleted = streamTrimByLength(s,maxlen,approx_maxlen);
+	if (deleted) {
+		server.dirty += deleted;
+		if (approx_maxlen) streamRewriteApproxMaxlen(c,s,maxlen_arg_idx);
+	}
+	addReplyLongLong(c,deleted);
+}
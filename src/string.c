@@ -1,10 +1,30 @@
 #include "server.h"
+#include "zmalloc.h"
+#include "util.h"
 #include <math.h> /* isnan(), isinf() */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 
+/*
+ * GET命令的通用实现，键不存在时回复空值，类型错误时回复错误
+ */
 int getGenericCommand(client *c) {
-	printf("get command!\n");
+	robj *o;
+
+	if ((o = lookupKey(c->db,c->argv[1])) == NULL) {
+		addReply(c,shared.nullbulk);
+		return C_OK;
+	}
+
+	if (o->type != OBJ_STRING) {
+		addReply(c,shared.wrongtypeerr);
+		return C_ERR;
+	} else {
+		addReplyBulk(c,o);
+		return C_OK;
+	}
 }
 
 
@@ -14,5 +34,501 @@ void getCommand(client *c) {
 
 /* SET key value [NX] [XX] [EX <seconds>] [PX <milliseconds>] */
 void setCommand(client *c) {
-	printf("set command!\n");
+	// 选项参数还没有实现
+	if (c->argc != 3) {
+		addReply(c,shared.syntaxerr);
+		return;
+	}
+	setKey(c->db,c->argv[1],c->argv[2]);
+	server.dirty++;
+	addReply(c,shared.ok);
+}
+
+/* 检查修改之后的字符串长度是否超过限制，超过时回复错误并返回C_ERR */
+int checkStringLength(client *c, long long size) {
+	if (size > PROTO_MAX_BULK_LEN) {
+		addReplyError(c,"string exceeds maximum allowed size (512MB)");
+		return C_ERR;
+	}
+	return C_OK;
+}
+
+/* GETSET key value */
+void getsetCommand(client *c) {
+	if (getGenericCommand(c) == C_ERR) return;
+	setKey(c->db,c->argv[1],c->argv[2]);
+	server.dirty++;
+}
+
+/*
+ * SETRANGE key offset value
+ * 字符串先取消共享，然后用sdsgrowzero在原地扩展，不足的部分用0填充
+ */
+void setrangeCommand(client *c) {
+	robj *o;
+	long offset;
+	sds value = c->argv[3]->ptr;
+
+	if (getLongFromObjectOrReply(c,c->argv[2],&offset,NULL) != C_OK)
+		return;
+
+	if (offset < 0) {
+		addReplyError(c,"offset is out of range");
+		return;
+	}
+
+	o = lookupKey(c->db,c->argv[1]);
+	if (o == NULL) {
+		/* Return 0 when setting nothing on a non-existing string */
+		if (sdslen(value) == 0) {
+			addReply(c,shared.czero);
+			return;
+		}
+
+		/* Return when the resulting string exceeds allowed size */
+		if (checkStringLength(c,offset+sdslen(value)) != C_OK)
+			return;
+
+		o = createObject(OBJ_STRING,sdsnewlen(NULL, offset+sdslen(value)));
+		dbAdd(c->db,c->argv[1],o);
+	} else {
+		size_t olen;
+
+		/* Key exists, check type */
+		if (checkType(c,o,OBJ_STRING))
+			return;
+
+		/* Return existing string length when setting nothing */
+		olen = stringObjectLen(o);
+		if (sdslen(value) == 0) {
+			addReplyLongLong(c,olen);
+			return;
+		}
+
+		/* Return when the resulting string exceeds allowed size */
+		if (checkStringLength(c,offset+sdslen(value)) != C_OK)
+			return;
+
+		/* Create a copy when the object is shared or encoded. */
+		o = dbUnshareStringValue(c->db,c->argv[1],o);
+	}
+
+	if (sdslen(value) > 0) {
+		o->ptr = sdsgrowzero(o->ptr,offset+sdslen(value));
+		memcpy((char*)o->ptr+offset,value,sdslen(value));
+		server.dirty++;
+	}
+	addReplyLongLong(c,sdslen(o->ptr));
+}
+
+/* GETRANGE key start end */
+void getrangeCommand(client *c) {
+	robj *o;
+	long long start, end;
+	char *str, llbuf[32];
+	size_t strlen;
+
+	if (getLongLongFromObjectOrReply(c,c->argv[2],&start,NULL) != C_OK)
+		return;
+	if (getLongLongFromObjectOrReply(c,c->argv[3],&end,NULL) != C_OK)
+		return;
+	if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.emptybulk)) == NULL ||
+		checkType(c,o,OBJ_STRING)) return;
+
+	if (o->encoding == OBJ_ENCODING_INT) {
+		str = llbuf;
+		strlen = ll2string(llbuf,sizeof(llbuf),(long)o->ptr);
+	} else {
+		str = o->ptr;
+		strlen = sdslen(str);
+	}
+
+	/* Convert negative indexes */
+	if (start < 0 && end < 0 && start > end) {
+		addReply(c,shared.emptybulk);
+		return;
+	}
+	if (start < 0) start = strlen+start;
+	if (end < 0) end = strlen+end;
+	if (start < 0) start = 0;
+	if (end < 0) end = 0;
+	if ((unsigned long long)end >= strlen) end = strlen-1;
+
+	/* Precondition: end >= 0 && end < strlen, so the only condition where
+	 * nothing can be returned is: start > end. */
+	if (start > end || strlen == 0) {
+		addReply(c,shared.emptybulk);
+	} else {
+		addReplyBulkCBuffer(c,(char*)str+start,end-start+1);
+	}
+}
+
+/* MGET的key数量不超过这个值时，查找结果保存在栈上的数组中 */
+#define MGET_STACK_KEYS 128
+
+/* MSET一次写入的key超过这个数量时提前扩展字典 */
+#define MSET_PRESIZE_MIN_KEYS 128
+
+/* 写入"<prefix><n>\r\n"，返回写入之后的位置 */
+static char *mgetWriteLen(char *p, char prefix, long long n) {
+	*p++ = prefix;
+	p += ll2string(p,32,n);
+	*p++ = '\r';
+	*p++ = '\n';
+	return p;
+}
+
+/*
+ * MGET key [key ...]
+ * 第一遍查找所有的key并计算回复的总长度，第二遍在一块大小正好的内存中
+ * 生成整个回复，最后一次性放入客户端的输出缓冲区
+ */
+void mgetCommand(client *c) {
+	robj *stackvals[MGET_STACK_KEYS], **vals = stackvals;
+	int j, numkeys = c->argc-1;
+	size_t totlen;
+	sds reply;
+	char *p;
+
+	if (numkeys > MGET_STACK_KEYS) vals = zmalloc(sizeof(robj*)*numkeys);
+
+	totlen = 1+digits10(numkeys)+2;
+	for (j = 0; j < numkeys; j++) {
+		robj *o = lookupKey(c->db,c->argv[j+1]);
+
+		/* 不是字符串的值和不存在的key一样回复空值 */
+		if (o && o->type != OBJ_STRING) o = NULL;
+		vals[j] = o;
+		if (o == NULL) {
+			totlen += 5; /* "$-1\r\n" */
+		} else {
+			size_t vlen = sdsEncodedObject(o) ? sdslen(o->ptr) :
+				sdigits10((long)o->ptr);
+			totlen += 1+digits10(vlen)+2+vlen+2;
+		}
+	}
+
+	reply = sdsnewlen(NULL,totlen);
+	p = mgetWriteLen(reply,'*',numkeys);
+	for (j = 0; j < numkeys; j++) {
+		robj *o = vals[j];
+
+		if (o == NULL) {
+			memcpy(p,"$-1\r\n",5);
+			p += 5;
+		} else if (sdsEncodedObject(o)) {
+			p = mgetWriteLen(p,'$',sdslen(o->ptr));
+			memcpy(p,o->ptr,sdslen(o->ptr));
+			p += sdslen(o->ptr);
+			*p++ = '\r';
+			*p++ = '\n';
+		} else {
+			char buf[32];
+			int len = ll2string(buf,sizeof(buf),(long)o->ptr);
+
+			p = mgetWriteLen(p,'$',len);
+			memcpy(p,buf,len);
+			p += len;
+			*p++ = '\r';
+			*p++ = '\n';
+		}
+	}
+	if ((size_t)(p-reply) != totlen) {
+		printf("Panic: MGET reply length mismatch\n");
+		exit(1);
+	}
+
+	if (vals != stackvals) zfree(vals);
+	addReplyProtoSds(c,reply);
+}
+
+/*
+ * MSET和MSETNX的通用实现，nx为真时只要有一个key已经存在就什么都不做
+ */
+static void msetGenericCommand(client *c, int nx) {
+	dict *d = c->db->dict;
+	unsigned long numkeys = c->argc/2;
+	int j;
+
+	if ((c->argc % 2) == 0) {
+		addReplyError(c,"wrong number of arguments for MSET");
+		return;
+	}
+
+	/* Handle the NX flag. The MSETNX semantic is to return zero and don't
+	 * set anything if at least one key already exists. */
+	if (nx) {
+		for (j = 1; j < c->argc; j += 2) {
+			if (dictFind(d,c->argv[j]->ptr) != NULL) {
+				addReply(c,shared.czero);
+				return;
+			}
+		}
+	}
+
+	/* 一次写入很多key时提前扩展字典，避免在循环中多次触发rehash */
+	if (numkeys > MSET_PRESIZE_MIN_KEYS &&
+		dictSize(d)+numkeys > dictSlots(d))
+	{
+		dictExpand(d,dictSize(d)+numkeys);
+	}
+
+	for (j = 1; j < c->argc; j += 2) {
+		setKey(c->db,c->argv[j],c->argv[j+1]);
+	}
+	server.dirty += numkeys;
+	addReply(c, nx ? shared.cone : shared.ok);
+}
+
+/* MSET key value [key value ...] */
+void msetCommand(client *c) {
+	msetGenericCommand(c,0);
+}
+
+/* MSETNX key value [key value ...] */
+void msetnxCommand(client *c) {
+	msetGenericCommand(c,1);
+}
+
+/*
+ * INCR/DECR/INCRBY/DECRBY的通用实现
+ * 值已经是INT编码并且没有被共享时直接修改ptr中保存的整数，不分配新的对象
+ */
+static void incrDecrCommand(client *c, long long incr) {
+	long long value, oldvalue;
+	robj *o, *new;
+
+	o = lookupKey(c->db,c->argv[1]);
+	if (o != NULL && checkType(c,o,OBJ_STRING)) return;
+	if (getLongLongFromObjectOrReply(c,o,&value,NULL) != C_OK) return;
+
+	oldvalue = value;
+	if ((incr < 0 && oldvalue < 0 && incr < (LLONG_MIN-oldvalue)) ||
+		(incr > 0 && oldvalue > 0 && incr > (LLONG_MAX-oldvalue))) {
+		addReplyError(c,"increment or decrement would overflow");
+		return;
+	}
+	value += incr;
+
+	if (o && o->refcount == 1 && o->encoding == OBJ_ENCODING_INT &&
+		value >= LONG_MIN && value <= LONG_MAX)
+	{
+		new = o;
+		o->ptr = (void*)((long)value);
+	} else {
+		new = createStringObjectFromLongLong(value);
+		if (o) {
+			dbOverwrite(c->db,c->argv[1],new);
+		} else {
+			dbAdd(c->db,c->argv[1],new);
+		}
+	}
+	server.dirty++;
+	addReplyLongLong(c,value);
+}
+
+/* INCR key */
+void incrCommand(client *c) {
+	incrDecrCommand(c,1);
+}
+
+/* DECR key */
+void decrCommand(client *c) {
+	incrDecrCommand(c,-1);
+}
+
+/* INCRBY key increment */
+void incrbyCommand(client *c) {
+	long long incr;
+
+	if (getLongLongFromObjectOrReply(c, c->argv[2], &incr, NULL) != C_OK) return;
+	incrDecrCommand(c,incr);
+}
+
+/* DECRBY key decrement */
+void decrbyCommand(client *c) {
+	long long incr;
+
+	if (getLongLongFromObjectOrReply(c, c->argv[2], &incr, NULL) != C_OK) return;
+	/* Overflow check: negating LLONG_MIN will cause an overflow */
+	if (incr == LLONG_MIN) {
+		addReplyError(c, "decrement would overflow");
+		return;
+	}
+	incrDecrCommand(c,-incr);
+}
+
+/*
+ * INCRBYFLOAT key increment
+ * 没有被共享的RAW字符串在剩余空间足够时原地写入新值
+ * 为了避免不同平台上浮点数精度的差异，传播到AOF时改写成SET命令
+ */
+void incrbyfloatCommand(client *c) {
+	long double incr, value;
+	char buf[MAX_LONG_DOUBLE_CHARS];
+	robj *o, *new, *aux;
+	int len;
+
+	o = lookupKey(c->db,c->argv[1]);
+	if (o != NULL && checkType(c,o,OBJ_STRING)) return;
+	if (getLongDoubleFromObjectOrReply(c,o,&value,NULL) != C_OK ||
+		getLongDoubleFromObjectOrReply(c,c->argv[2],&incr,NULL) != C_OK)
+		return;
+
+	value += incr;
+	if (isnan(value) || isinf(value)) {
+		addReplyError(c,"increment would produce NaN or Infinity");
+		return;
+	}
+	len = ld2string(buf,sizeof(buf),value,1);
+
+	if (o && o->refcount == 1 && o->encoding == OBJ_ENCODING_RAW &&
+		sdsalloc(o->ptr) >= (size_t)len)
+	{
+		new = o;
+		sdsclear(o->ptr);
+		o->ptr = sdscatlen(o->ptr,buf,len);
+	} else {
+		new = createStringObject(buf,len);
+		if (o)
+			dbOverwrite(c->db,c->argv[1],new);
+		else
+			dbAdd(c->db,c->argv[1],new);
+	}
+	server.dirty++;
+	addReplyBulk(c,new);
+
+	/* Always replicate INCRBYFLOAT as a SET command with the final value
+	 * in order to make sure that differences in float precision or formatting
+	 * will not create differences in replicas or after an AOF restart. */
+	aux = createStringObject("SET",3);
+	rewriteClientCommandArgument(c,0,aux);
+	decrRefCount(aux);
+	aux = createStringObject(buf,len);
+	rewriteClientCommandArgument(c,2,aux);
+	decrRefCount(aux);
+}
+
+/*
+ * APPEND key value
+ * sdscatlen通过sdsMakeRoomFor预留额外的空间，连续追加时不会每次都重新分配内存
+ */
+void appendCommand(client *c) {
+	size_t totlen;
+	robj *o, *append;
+
+	o = lookupKey(c->db,c->argv[1]);
+	if (o == NULL) {
+		/* Create the key */
+		dbAdd(c->db,c->argv[1],c->argv[2]);
+		incrRefCount(c->argv[2]);
+		totlen = stringObjectLen(c->argv[2]);
+	} else {
+		/* Key exists, check type */
+		if (checkType(c,o,OBJ_STRING))
+			return;
+
+		/* "append" is an argument, so always an sds */
+		append = c->argv[2];
+		totlen = stringObjectLen(o)+sdslen(append->ptr);
+		if (checkStringLength(c,totlen) != C_OK)
+			return;
+
+		/* Append the value */
+		o = dbUnshareStringValue(c->db,c->argv[1],o);
+		o->ptr = sdscatlen(o->ptr,append->ptr,sdslen(append->ptr));
+		totlen = sdslen(o->ptr);
+	}
+	server.dirty++;
+	addReplyLongLong(c,totlen);
+}
+
+/* STRLEN key */
+void strlenCommand(client *c) {
+	robj *o;
+
+	if ((o = lookupKeyReadOrReply(c,c->argv[1],shared.czero)) == NULL ||
+		checkType(c,o,OBJ_STRING)) return;
+	addReplyLongLong(c,stringObjectLen(o));
+}
+
+#ifdef STRING_BENCHMARK_MAIN
+/*
+ * 字符串命令的微基准测试：
+ * make string-benchmark && ./string-benchmark
+ * 通过伪客户端直接调用命令的实现函数，统计每次调用的耗时，
+ * 以及zmalloc已分配内存的变化和值对象的sds扩容的次数
+ * INCRBYFLOAT每次都会改写参数，不能复用同一组参数，不在这里测试
+ */
+/* 用同一组参数重复执行n次命令，参数对象在整个过程中复用 */
+static void benchRun(client *c, const char *name, redisCommandProc *proc,
+		robj **argv, int argc, long n)
+{
+	robj *before, *after;
+	size_t mem_before, mem_after;
+	size_t alloc;
+	long long start, elapsed;
+	long j, grows = 0;
+
+	c->argv = argv;
+	c->argc = argc;
+	/* 前两次调用可能会创建key、取消共享或者转换编码，不计入统计 */
+	proc(c);
+	proc(c);
+
+	before = lookupKey(c->db,argv[1]);
+	alloc = sdsEncodedObject(before) ? sdsalloc(before->ptr) : 0;
+	mem_before = zmalloc_used_memory();
+	start = ustime();
+	for (j = 0; j < n; j++) {
+		proc(c);
+		if (sdsEncodedObject(before) && sdsalloc(before->ptr) != alloc) {
+			grows++;
+			alloc = sdsalloc(before->ptr);
+		}
+	}
+	elapsed = ustime()-start;
+	mem_after = zmalloc_used_memory();
+	after = lookupKey(c->db,argv[1]);
+
+	printf("%-28s %8.1f ns/op  same object: %-3s  mem delta: %lld bytes  sds grows: %ld\n",
+		name, (double)elapsed*1000/n, before == after ? "yes" : "no",
+		(long long)mem_after-(long long)mem_before, grows);
+}
+
+int main(void) {
+	robj *argv[3];
+	client *c;
+	long n = 10000000;
+
+	initServerConfig();
+	server.port = 0;
+	initServer();
+	c = createClient(-1);
+
+	argv[0] = createStringObject("INCR",4);
+	argv[1] = createStringObject("counter",7);
+	benchRun(c,"INCR (int encoded)",incrCommand,argv,2,n);
+
+	argv[1] = createStringObject("counter2",8);
+	argv[2] = createStringObject("12345",5);
+	benchRun(c,"INCRBY (int encoded)",incrbyCommand,argv,3,n);
+
+	argv[1] = createStringObject("appended",8);
+	argv[2] = createStringObject("0123456789abcdef",16);
+	benchRun(c,"APPEND 16 bytes",appendCommand,argv,3,n/10);
+
+	argv[1] = createStringObject("ranged",6);
+	argv[2] = createStringObject("0",1);
+	{
+		/* SETRANGE key 0 value，覆盖已有的内容 */
+		robj *sargv[4];
+		sargv[0] = argv[0];
+		sargv[1] = argv[1];
+		sargv[2] = argv[2];
+		sargv[3] = createStringObject("hello world",11);
+		benchRun(c,"SETRANGE overwrite",setrangeCommand,sargv,4,n);
+	}
+	return 0;
 }
+#endif
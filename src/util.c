@@ -262,43 +262,24 @@ uint32_t sdigits10(int64_t v) {
 	}
 }
 
-/* Convert a long long into a string. Returns the number of
+/* Convert a unsigned long long into a string. Returns the number of
  * characters needed to represent the number.
  * If the buffer is not big enough to store the string, 0 is returned.
  *
  * Based on the following article (that apparently does not provide a
  * novel approach but only publicizes an already used technique):
  *
- * https://www.facebook.com/notes/facebook-engineering/three-optimization-tips-for-c/10151361643253920
- *
- * Modified in order to handle signed integers since the original code was
- * designed for unsigned integers. */
-int ll2string(char *dst, size_t dstlen, long long svalue) {
+ * https://www.facebook.com/notes/facebook-engineering/three-optimization-tips-for-c/10151361643253920 */
+int ull2string(char *dst, size_t dstlen, unsigned long long value) {
 	static const char digits[201] =
 		"0001020304050607080910111213141516171819"
 		"2021222324252627282930313233343536373839"
 		"4041424344454647484950515253545556575859"
 		"6061626364656667686970717273747576777879"
 		"8081828384858687888990919293949596979899";
-	int negative;
-	unsigned long long value;
-
-	/* The main loop works with 64bit unsigned integers for simplicity, so
-	 * we convert the number here and remember if it is negative. */
-	if (svalue < 0) {
-		if (svalue != LLONG_MIN) {
-			value = -svalue;
-		} else {
-			value = ((unsigned long long) LLONG_MAX)+1;
-		}
-		negative = 1;
-	} else {
-		value = svalue;
-		negative = 0;
-	}
 
 	/* Check length. */
-	uint32_t const length = digits10(value)+negative;
+	uint32_t const length = digits10(value);
 	if (length >= dstlen) return 0;
 
 	/* Null term. */
@@ -321,12 +302,39 @@ int ll2string(char *dst, size_t dstlen, long long svalue) {
 		dst[next] = digits[i + 1];
 		dst[next - 1] = digits[i];
 	}
-
-	/* Add sign. */
-	if (negative) dst[0] = '-';
 	return length;
 }
 
+/* Convert a long long into a string. Returns the number of
+ * characters needed to represent the number.
+ * If the buffer is not big enough to store the string, 0 is returned. */
+/* 负数先写入符号，再按无符号数转换 */
+int ll2string(char *dst, size_t dstlen, long long svalue) {
+	unsigned long long value;
+	int negative = 0, length;
+
+	/* The main loop works with 64bit unsigned integers for simplicity, so
+	 * we convert the number here and remember if it is negative. */
+	if (svalue < 0) {
+		if (svalue != LLONG_MIN) {
+			value = -svalue;
+		} else {
+			value = ((unsigned long long) LLONG_MAX)+1;
+		}
+		if (dstlen < 2) return 0;
+		negative = 1;
+		dst[0] = '-';
+		dst++;
+		dstlen--;
+	} else {
+		value = svalue;
+	}
+
+	length = ull2string(dst,dstlen,value);
+	if (length == 0) return 0;
+	return length+negative;
+}
+
 /* Convert a string into a long long. Returns 1 if the string could be parsed
  * into a (non-overflowing) long long, 0 otherwise. The value will be set to
  * the parsed value when appropriate.
@@ -429,6 +437,27 @@ int string2l(const char *s, size_t slen, long *lval) {
 	return 1;
 }
 
+/* Convert a string into an unsigned long long. Returns 1 if the string
+ * could be parsed into a (non-overflowing) unsigned long long, 0 otherwise.
+ * Like string2ll(), no spaces or sign are accepted. */
+int string2ull(const char *s, size_t slen, unsigned long long *value) {
+	unsigned long long v = 0;
+	size_t i;
+
+	if (slen == 0 || slen > 20) return 0;
+	/* 和string2ll一样不接受前导0 */
+	if (slen > 1 && s[0] == '0') return 0;
+	for (i = 0; i < slen; i++) {
+		unsigned int d = (unsigned char)s[i]-'0';
+
+		if (d > 9) return 0;
+		if (v > (ULLONG_MAX-d)/10) return 0;
+		v = v*10+d;
+	}
+	if (value) *value = v;
+	return 1;
+}
+
 /* Convert a string into a double. Returns 1 if the string could be parsed
  * into a (non-overflowing) double, 0 otherwise. The value will be set to
  * the parsed value when appropriate.
@@ -41,6 +41,7 @@ void zlibc_free(void *ptr) {
 
 #include <string.h>
 #include <pthread.h>
+#include "config.h"
 #include "zmalloc.h"
 #include "atomicvar.h"
 
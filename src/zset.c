@@ -0,0 +1,1093 @@
+#include "server.h"
+#include "zmalloc.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/*-----------------------------------------------------------------------------
+ * Sorted set API
+ *
+ * ZSETs are ordered sets using two data structures to hold the same elements
+ * in order to get O(log(N)) INSERT and REMOVE operations into a sorted
+ * data structure.
+ *
+ * The elements are added to a hash table mapping Redis objects to scores.
+ * At the same time the elements are added to a skip list mapping scores
+ * to Redis objects (so objects are sorted by scores in this "view").
+ *
+ * 小的有序集合使用listpack编码，元素和score依次相邻保存，按照score从小到大排序；
+ * 元素数量超过zset-max-ziplist-entries，或者元素长度超过zset-max-ziplist-value时
+ * 转换成跳跃表+字典编码，转换是单向的。跳跃表的实现见zskiplist.c
+ *----------------------------------------------------------------------------*/
+
+/* Parse a range like "(1" or "-inf" into a zrangespec. */
+static int zslParseRange(robj *min, robj *max, zrangespec *spec) {
+	char *eptr;
+	spec->minex = spec->maxex = 0;
+
+	/* Parse the min-max interval. If one of the values is prefixed
+	 * by the "(" character, it's considered "open". For instance
+	 * ZRANGEBYSCORE zset (1.5 (2.5 will match min < x < max
+	 * ZRANGEBYSCORE zset 1.5 2.5 will instead match min <= x <= max */
+	if (min->encoding == OBJ_ENCODING_INT) {
+		spec->min = (long)min->ptr;
+	} else {
+		if (((char*)min->ptr)[0] == '(') {
+			spec->min = strtod((char*)min->ptr+1,&eptr);
+			if (eptr[0] != '\0' || isnan(spec->min)) return C_ERR;
+			spec->minex = 1;
+		} else {
+			spec->min = strtod((char*)min->ptr,&eptr);
+			if (eptr[0] != '\0' || isnan(spec->min)) return C_ERR;
+		}
+	}
+	if (max->encoding == OBJ_ENCODING_INT) {
+		spec->max = (long)max->ptr;
+	} else {
+		if (((char*)max->ptr)[0] == '(') {
+			spec->max = strtod((char*)max->ptr+1,&eptr);
+			if (eptr[0] != '\0' || isnan(spec->max)) return C_ERR;
+			spec->maxex = 1;
+		} else {
+			spec->max = strtod((char*)max->ptr,&eptr);
+			if (eptr[0] != '\0' || isnan(spec->max)) return C_ERR;
+		}
+	}
+
+	return C_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * Listpack-backed sorted set API
+ *----------------------------------------------------------------------------*/
+
+static double zzlStrtod(unsigned char *vstr, unsigned int vlen) {
+	char buf[128];
+	if (vlen > sizeof(buf) - 1)
+		vlen = sizeof(buf) - 1;
+	memcpy(buf,vstr,vlen);
+	buf[vlen] = '\0';
+	return strtod(buf,NULL);
+}
+
+double zzlGetScore(unsigned char *sptr) {
+	unsigned char *vstr;
+	unsigned int vlen;
+	long long vlong;
+	double score;
+
+	vstr = lpGetValue(sptr,&vlen,&vlong);
+	if (vstr) {
+		score = zzlStrtod(vstr,vlen);
+	} else {
+		score = vlong;
+	}
+	return score;
+}
+
+/* Return a listpack element as an SDS string. */
+sds lpGetObject(unsigned char *sptr) {
+	unsigned char *vstr;
+	unsigned int vlen;
+	long long vlong;
+
+	vstr = lpGetValue(sptr,&vlen,&vlong);
+	if (vstr) {
+		return sdsnewlen((char*)vstr,vlen);
+	} else {
+		return sdsfromlonglong(vlong);
+	}
+}
+
+/* Compare element in sorted set with given element. */
+static int zzlCompareElements(unsigned char *eptr, unsigned char *cstr, unsigned int clen) {
+	unsigned char *vstr;
+	unsigned int vlen;
+	long long vlong;
+	unsigned char vbuf[32];
+	int minlen, cmp;
+
+	vstr = lpGetValue(eptr,&vlen,&vlong);
+	if (vstr == NULL) {
+		/* Store string representation of long long in buf. */
+		vlen = ll2string((char*)vbuf,sizeof(vbuf),vlong);
+		vstr = vbuf;
+	}
+
+	minlen = (vlen < clen) ? vlen : clen;
+	cmp = memcmp(vstr,cstr,minlen);
+	if (cmp == 0) return vlen-clen;
+	return cmp;
+}
+
+static unsigned int zzlLength(unsigned char *zl) {
+	return lpLength(zl)/2;
+}
+
+/* Move to next entry based on the values in eptr and sptr. Both are set to
+ * NULL when there is no next entry. */
+void zzlNext(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
+	unsigned char *_eptr, *_sptr;
+
+	_eptr = lpNext(zl,*sptr);
+	if (_eptr != NULL) {
+		_sptr = lpNext(zl,_eptr);
+	} else {
+		/* No next entry. */
+		_sptr = NULL;
+	}
+
+	*eptr = _eptr;
+	*sptr = _sptr;
+}
+
+/* Move to the previous entry based on the values in eptr and sptr. Both are
+ * set to NULL when there is no prev entry. */
+static void zzlPrev(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
+	unsigned char *_eptr, *_sptr;
+
+	_sptr = lpPrev(zl,*eptr);
+	if (_sptr != NULL) {
+		_eptr = lpPrev(zl,_sptr);
+	} else {
+		/* No previous entry. */
+		_eptr = NULL;
+	}
+
+	*eptr = _eptr;
+	*sptr = _sptr;
+}
+
+/* Returns if there is a part of the zset is in range. Should only be used
+ * internally by zzlFirstInRange and zzlLastInRange. */
+static int zzlIsInRange(unsigned char *zl, zrangespec *range) {
+	unsigned char *p;
+	double score;
+
+	/* Test for ranges that will always be empty. */
+	if (range->min > range->max ||
+			(range->min == range->max && (range->minex || range->maxex)))
+		return 0;
+
+	p = lpLast(zl); /* Last score. */
+	if (p == NULL) return 0; /* Empty sorted set */
+	score = zzlGetScore(p);
+	if (!zslValueGteMin(score,range))
+		return 0;
+
+	p = lpSeek(zl,1); /* First score. */
+	score = zzlGetScore(p);
+	if (!zslValueLteMax(score,range))
+		return 0;
+
+	return 1;
+}
+
+/* Find pointer to the first element contained in the specified range.
+ * Returns NULL when no element is contained in the range. */
+unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
+	unsigned char *eptr = lpFirst(zl), *sptr;
+	double score;
+
+	/* If everything is out of range, return early. */
+	if (!zzlIsInRange(zl,range)) return NULL;
+
+	while (eptr != NULL) {
+		sptr = lpNext(zl,eptr);
+		score = zzlGetScore(sptr);
+		if (zslValueGteMin(score,range)) {
+			/* Check if score <= max. */
+			if (zslValueLteMax(score,range))
+				return eptr;
+			return NULL;
+		}
+
+		/* Move to next element. */
+		eptr = lpNext(zl,sptr);
+	}
+
+	return NULL;
+}
+
+/* 返回元素在listpack中的位置，score保存在*score中，找不到时返回NULL */
+static unsigned char *zzlFind(unsigned char *lp, sds ele, double *score) {
+	unsigned char *eptr, *sptr;
+
+	if ((eptr = lpFirst(lp)) == NULL) return NULL;
+	eptr = lpFind(lp, eptr, (unsigned char*)ele, sdslen(ele), 1);
+	if (eptr) {
+		sptr = lpNext(lp,eptr);
+		/* Matching element, pull out score. */
+		if (score != NULL) *score = zzlGetScore(sptr);
+		return eptr;
+	}
+	return NULL;
+}
+
+/* Delete (element,score) pair from listpack. Use local copy of eptr because we
+ * don't want to modify the one given as argument. */
+static unsigned char *zzlDelete(unsigned char *zl, unsigned char *eptr) {
+	unsigned char *p = eptr;
+
+	zl = lpDelete(zl,p,&p);
+	zl = lpDelete(zl,p,&p);
+	return zl;
+}
+
+/* 在eptr之前插入元素和score，eptr为NULL时追加到末尾 */
+static unsigned char *zzlInsertAt(unsigned char *zl, unsigned char *eptr, sds ele, double score) {
+	unsigned char *sptr;
+	char scorebuf[MAX_D2STRING_CHARS];
+	int scorelen;
+
+	scorelen = d2string(scorebuf,sizeof(scorebuf),score);
+	if (eptr == NULL) {
+		zl = lpAppend(zl,(unsigned char*)ele,sdslen(ele));
+		zl = lpAppend(zl,(unsigned char*)scorebuf,scorelen);
+	} else {
+		/* Insert member before the element 'eptr'. */
+		zl = lpInsert(zl,(unsigned char*)ele,sdslen(ele),eptr,LP_BEFORE,&sptr);
+
+		/* Insert score after the member. */
+		zl = lpInsert(zl,(unsigned char*)scorebuf,scorelen,sptr,LP_AFTER,NULL);
+	}
+	return zl;
+}
+
+/* Insert (element,score) pair in listpack. This function assumes the element is
+ * not yet present in the list. */
+unsigned char *zzlInsert(unsigned char *zl, sds ele, double score) {
+	unsigned char *eptr = lpFirst(zl), *sptr;
+	double s;
+
+	while (eptr != NULL) {
+		sptr = lpNext(zl,eptr);
+		s = zzlGetScore(sptr);
+
+		if (s > score) {
+			/* First element with score larger than score for element to be
+			 * inserted. This means we should take its spot in the list to
+			 * maintain ordering. */
+			zl = zzlInsertAt(zl,eptr,ele,score);
+			break;
+		} else if (s == score) {
+			/* Ensure lexicographical ordering for elements. */
+			if (zzlCompareElements(eptr,(unsigned char*)ele,sdslen(ele)) > 0) {
+				zl = zzlInsertAt(zl,eptr,ele,score);
+				break;
+			}
+		}
+
+		/* Move to next element. */
+		eptr = lpNext(zl,sptr);
+	}
+
+	/* Push on tail of list when it was not yet inserted. */
+	if (eptr == NULL)
+		zl = zzlInsertAt(zl,NULL,ele,score);
+	return zl;
+}
+
+/*-----------------------------------------------------------------------------
+ * Common sorted set API
+ *----------------------------------------------------------------------------*/
+
+unsigned long zsetLength(const robj *zobj) {
+	unsigned long length = 0;
+	if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
+		length = zzlLength(zobj->ptr);
+	} else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+		length = ((const zset*)zobj->ptr)->zsl->length;
+	} else {
+		printf("Unknown sorted set encoding\n");
+		exit(1);
+	}
+	return length;
+}
+
+/*
+ * 把listpack编码的有序集合转换成跳跃表编码
+ */
+void zsetConvert(robj *zobj, int encoding) {
+	zset *zs;
+	zskiplistNode *node;
+	unsigned char *zl;
+	unsigned char *eptr, *sptr;
+	double score;
+
+	if (zobj->encoding == encoding) return;
+	if (zobj->encoding != OBJ_ENCODING_LISTPACK ||
+		encoding != OBJ_ENCODING_SKIPLIST)
+	{
+		printf("Unsupported sorted set conversion\n");
+		exit(1);
+	}
+
+	zl = zobj->ptr;
+	zs = zmalloc(sizeof(*zs));
+	zs->dict = dictCreate(&zsetDictType,NULL);
+	zs->zsl = zslCreate();
+	dictExpand(zs->dict,zzlLength(zl));
+
+	eptr = lpSeek(zl,0);
+	if (eptr != NULL) sptr = lpNext(zl,eptr);
+
+	while (eptr != NULL) {
+		sds ele = lpGetObject(eptr);
+
+		score = zzlGetScore(sptr);
+		node = zslInsert(zs->zsl,score,ele);
+		if (dictAdd(zs->dict,ele,&node->score) != DICT_OK) {
+			printf("Listpack corruption detected: duplicate zset element\n");
+			exit(1);
+		}
+		zzlNext(zl,&eptr,&sptr);
+	}
+
+	lpFree(zobj->ptr);
+	zobj->ptr = zs;
+	zobj->encoding = OBJ_ENCODING_SKIPLIST;
+}
+
+/* Return (by reference) the score of the specified member of the sorted set
+ * storing it into *score. If the element does not exist C_ERR is returned
+ * otherwise C_OK is returned and *score is correctly populated.
+ * If 'zobj' or 'member' is NULL, C_ERR is returned. */
+int zsetScore(robj *zobj, sds member, double *score) {
+	if (!zobj || !member) return C_ERR;
+
+	if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
+		if (zzlFind(zobj->ptr, member, score) == NULL) return C_ERR;
+	} else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+		zset *zs = zobj->ptr;
+		dictEntry *de = dictFind(zs->dict, member);
+		if (de == NULL) return C_ERR;
+		*score = *(double*)dictGetVal(de);
+	} else {
+		printf("Unknown sorted set encoding\n");
+		exit(1);
+	}
+	return C_OK;
+}
+
+/* Add a new element or update the score of an existing element in a sorted
+ * set, regardless of its encoding.
+ *
+ * The set of flags change the command behavior.
+ *
+ * The input flags are the following:
+ *
+ * ZADD_IN_INCR: Increment the current element score by 'score' instead of
+ *               updating the current element score. If the element does not
+ *               exist, we assume 0 as previous score.
+ * ZADD_IN_NX:   Perform the operation only if the element does not exist.
+ * ZADD_IN_XX:   Perform the operation only if the element already exist.
+ *
+ * When ZADD_IN_INCR is used, the new score of the element is stored in
+ * '*newscore' if 'newscore' is not NULL.
+ *
+ * The returned flags are the following:
+ *
+ * ZADD_OUT_NAN:     The resulting score is not a number.
+ * ZADD_OUT_ADDED:   The element was added (not present before the call).
+ * ZADD_OUT_UPDATED: The element score was updated.
+ * ZADD_OUT_NOP:     No operation was performed because of NX or XX.
+ *
+ * Return value:
+ *
+ * The function returns 1 on success, and sets the appropriate flags
+ * ADDED or UPDATED to signal what happened during the operation (note that
+ * none could be set if we re-added an element using the same score it used
+ * to have, or in the case a zero increment is used).
+ *
+ * The function returns 0 on error, currently only when the increment
+ * produces a NAN condition, or when the 'score' value is NAN since the
+ * start.
+ *
+ * The command as a side effect of adding a new element may convert the sorted
+ * set internal encoding from listpack to hashtable+skiplist.
+ *
+ * Memory management of 'ele':
+ *
+ * The function does not take ownership of the 'ele' SDS string, but copies
+ * it if needed. */
+int zsetAdd(robj *zobj, double score, sds ele, int in_flags, int *out_flags, double *newscore) {
+	/* Turn options into simple to check vars. */
+	int incr = (in_flags & ZADD_IN_INCR) != 0;
+	int nx = (in_flags & ZADD_IN_NX) != 0;
+	int xx = (in_flags & ZADD_IN_XX) != 0;
+	double curscore;
+
+	*out_flags = 0; /* We'll return our response flags. */
+
+	/* NaN as input is an error regardless of all the other parameters. */
+	if (isnan(score)) {
+		*out_flags = ZADD_OUT_NAN;
+		return 0;
+	}
+
+	/* Update the sorted set according to its encoding. */
+	if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
+		unsigned char *eptr;
+
+		if ((eptr = zzlFind(zobj->ptr,ele,&curscore)) != NULL) {
+			/* NX? Return, same element already exists. */
+			if (nx) {
+				*out_flags |= ZADD_OUT_NOP;
+				return 1;
+			}
+
+			/* Prepare the score for the increment if needed. */
+			if (incr) {
+				score += curscore;
+				if (isnan(score)) {
+					*out_flags |= ZADD_OUT_NAN;
+					return 0;
+				}
+			}
+
+			/* Remove and re-insert when score changed. */
+			if (score != curscore) {
+				zobj->ptr = zzlDelete(zobj->ptr,eptr);
+				zobj->ptr = zzlInsert(zobj->ptr,ele,score);
+				*out_flags |= ZADD_OUT_UPDATED;
+			}
+			if (newscore) *newscore = score;
+			return 1;
+		} else if (!xx) {
+			/* check if the element is too large or the list
+			 * becomes too long *before* executing zzlInsert. */
+			if (zzlLength(zobj->ptr)+1 > server.zset_max_ziplist_entries ||
+				sdslen(ele) > server.zset_max_ziplist_value)
+			{
+				zsetConvert(zobj,OBJ_ENCODING_SKIPLIST);
+			} else {
+				zobj->ptr = zzlInsert(zobj->ptr,ele,score);
+				if (newscore) *newscore = score;
+				*out_flags |= ZADD_OUT_ADDED;
+				return 1;
+			}
+		} else {
+			*out_flags |= ZADD_OUT_NOP;
+			return 1;
+		}
+	}
+
+	/* Note that the above block handling listpack would have either returned or
+	 * converted the key to skiplist. */
+	if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+		zset *zs = zobj->ptr;
+		zskiplistNode *znode;
+		dictEntry *de;
+
+		de = dictFind(zs->dict,ele);
+		if (de != NULL) {
+			/* NX? Return, same element already exists. */
+			if (nx) {
+				*out_flags |= ZADD_OUT_NOP;
+				return 1;
+			}
+
+			curscore = *(double*)dictGetVal(de);
+
+			/* Prepare the score for the increment if needed. */
+			if (incr) {
+				score += curscore;
+				if (isnan(score)) {
+					*out_flags |= ZADD_OUT_NAN;
+					return 0;
+				}
+			}
+
+			/* Remove and re-insert when score changes. */
+			if (score != curscore) {
+				znode = zslUpdateScore(zs->zsl,curscore,ele,score);
+				/* Note that we did not removed the original element from
+				 * the hash table representing the sorted set, so we just
+				 * update the score. */
+				dictGetVal(de) = &znode->score; /* Update score ptr. */
+				*out_flags |= ZADD_OUT_UPDATED;
+			}
+			if (newscore) *newscore = score;
+			return 1;
+		} else if (!xx) {
+			ele = sdsdup(ele);
+			znode = zslInsert(zs->zsl,score,ele);
+			dictAdd(zs->dict,ele,&znode->score);
+			*out_flags |= ZADD_OUT_ADDED;
+			if (newscore) *newscore = score;
+			return 1;
+		} else {
+			*out_flags |= ZADD_OUT_NOP;
+			return 1;
+		}
+	} else {
+		printf("Unknown sorted set encoding\n");
+		exit(1);
+	}
+	return 0; /* Never reached. */
+}
+
+/* Delete the element 'ele' from the sorted set encoded as a skiplist+dict,
+ * returning 1 if the element existed and was deleted, 0 otherwise (the
+ * element was not there). It does not resize the dict after deleting the
+ * element. */
+static int zsetRemoveFromSkiplist(zset *zs, sds ele) {
+	dictEntry *de;
+	double score;
+
+	de = dictUnlink(zs->dict,ele);
+	if (de != NULL) {
+		/* Get the score in order to delete from the skiplist later. */
+		score = *(double*)dictGetVal(de);
+
+		/* Delete from the hash table and later from the skiplist.
+		 * Note that the order is important: deleting from the skiplist
+		 * actually releases the SDS string representing the element,
+		 * which is shared between the skiplist and the hash table, so
+		 * we need to delete from the skiplist as the final step. */
+		dictFreeUnlinkedEntry(zs->dict,de);
+
+		/* Delete from skiplist. */
+		int retval = zslDelete(zs->zsl,score,ele,NULL);
+		if (!retval) {
+			printf("Panic: zset element missing from the skiplist\n");
+			exit(1);
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Delete the element 'ele' from the sorted set, returning 1 if the element
+ * existed and was deleted, 0 otherwise (the element was not there). */
+int zsetDel(robj *zobj, sds ele) {
+	if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
+		unsigned char *eptr;
+
+		if ((eptr = zzlFind(zobj->ptr,ele,NULL)) != NULL) {
+			zobj->ptr = zzlDelete(zobj->ptr,eptr);
+			return 1;
+		}
+	} else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+		zset *zs = zobj->ptr;
+		if (zsetRemoveFromSkiplist(zs, ele)) return 1;
+	} else {
+		printf("Unknown sorted set encoding\n");
+		exit(1);
+	}
+	return 0; /* No such element found. */
+}
+
+/* Given a sorted set object returns the 0-based rank of the object or
+ * -1 if the object does not exist.
+ *
+ * For rank we mean the position of the element in the sorted collection
+ * of elements. So the first element has rank 0, the second rank 1, and so
+ * forth up to length-1 elements.
+ *
+ * If 'reverse' is false, the rank is returned considering as first element
+ * the one with the lowest score. Otherwise if 'reverse' is non-zero
+ * the rank is computed considering as element with rank 0 the one with
+ * the highest score. */
+long zsetRank(robj *zobj, sds ele, int reverse) {
+	unsigned long llen;
+	unsigned long rank;
+
+	llen = zsetLength(zobj);
+
+	if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
+		unsigned char *zl = zobj->ptr;
+		unsigned char *eptr, *sptr;
+
+		eptr = lpSeek(zl,0);
+		sptr = lpNext(zl,eptr);
+
+		rank = 1;
+		while(eptr != NULL) {
+			if (zzlCompareElements(eptr,(unsigned char*)ele,sdslen(ele)) == 0)
+				break;
+			rank++;
+			zzlNext(zl,&eptr,&sptr);
+		}
+
+		if (eptr != NULL) {
+			if (reverse)
+				return llen-rank;
+			else
+				return rank-1;
+		} else {
+			return -1;
+		}
+	} else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+		zset *zs = zobj->ptr;
+		zskiplist *zsl = zs->zsl;
+		dictEntry *de;
+		double score;
+
+		de = dictFind(zs->dict,ele);
+		if (de != NULL) {
+			score = *(double*)dictGetVal(de);
+			rank = zslGetRank(zsl,score,ele);
+			/* Existing elements always have a rank. */
+			if (rank == 0) {
+				printf("Panic: zset element without rank\n");
+				exit(1);
+			}
+			if (reverse)
+				return llen-rank;
+			else
+				return rank-1;
+		} else {
+			return -1;
+		}
+	} else {
+		printf("Unknown sorted set encoding\n");
+		exit(1);
+	}
+}
+
+/*-----------------------------------------------------------------------------
+ * Sorted set commands
+ *----------------------------------------------------------------------------*/
+
+/* This generic command implements both ZADD and ZINCRBY. */
+static void zaddGenericCommand(client *c, int flags) {
+	static char *nanerr = "resulting score is not a number (NaN)";
+	robj *key = c->argv[1];
+	robj *zobj;
+	sds ele;
+	double score = 0, *scores = NULL;
+	int j, elements, ch = 0;
+	int scoreidx = 0;
+	/* The following vars are used in order to track what the command actually
+	 * did during the execution, to reply to the client and to trigger the
+	 * notification of keyspace change. */
+	int added = 0;      /* Number of new elements added. */
+	int updated = 0;    /* Number of elements with updated score. */
+	int processed = 0;  /* Number of elements processed, may remain zero with
+						   options like XX. */
+
+	/* Parse options. At the end 'scoreidx' is set to the argument position
+	 * of the score of the first score-element pair. */
+	scoreidx = 2;
+	while(scoreidx < c->argc) {
+		char *opt = c->argv[scoreidx]->ptr;
+		if (!strcasecmp(opt,"nx")) flags |= ZADD_IN_NX;
+		else if (!strcasecmp(opt,"xx")) flags |= ZADD_IN_XX;
+		else if (!strcasecmp(opt,"ch")) ch = 1; /* Return num of elements added or updated. */
+		else if (!strcasecmp(opt,"incr")) flags |= ZADD_IN_INCR;
+		else break;
+		scoreidx++;
+	}
+
+	/* Turn options into simple to check vars. */
+	int incr = (flags & ZADD_IN_INCR) != 0;
+	int nx = (flags & ZADD_IN_NX) != 0;
+	int xx = (flags & ZADD_IN_XX) != 0;
+
+	/* After the options, we expect to have an even number of args, since
+	 * we expect any number of score-element pairs. */
+	elements = c->argc-scoreidx;
+	if (elements % 2 || !elements) {
+		addReply(c,shared.syntaxerr);
+		return;
+	}
+	elements /= 2; /* Now this holds the number of score-element pairs. */
+
+	/* Check for incompatible options. */
+	if (nx && xx) {
+		addReplyError(c,
+			"XX and NX options at the same time are not compatible");
+		return;
+	}
+
+	if (incr && elements > 1) {
+		addReplyError(c,
+			"INCR option supports a single increment-element pair");
+		return;
+	}
+
+	/* Start parsing all the scores, we need to emit any syntax error
+	 * before executing additions to the sorted set, as the command should
+	 * either execute fully or nothing at all. */
+	scores = zmalloc(sizeof(double)*elements);
+	for (j = 0; j < elements; j++) {
+		if (getDoubleFromObjectOrReply(c,c->argv[scoreidx+j*2],&scores[j],NULL)
+			!= C_OK) goto cleanup;
+	}
+
+	/* Lookup the key and create the sorted set if does not exist. */
+	zobj = lookupKey(c->db,key);
+	if (zobj == NULL) {
+		if (xx) goto reply_to_client; /* No key + XX option: nothing to do. */
+		if (server.zset_max_ziplist_entries == 0 ||
+			server.zset_max_ziplist_value < sdslen(c->argv[scoreidx+1]->ptr))
+		{
+			zobj = createZsetObject();
+		} else {
+			zobj = createZsetListpackObject();
+		}
+		dbAdd(c->db,key,zobj);
+	} else {
+		if (zobj->type != OBJ_ZSET) {
+			addReply(c,shared.wrongtypeerr);
+			goto cleanup;
+		}
+	}
+
+	for (j = 0; j < elements; j++) {
+		double newscore;
+		int retflags = 0;
+		robj *eleobj;
+
+		score = scores[j];
+		eleobj = getDecodedObject(c->argv[scoreidx+1+j*2]);
+		ele = eleobj->ptr;
+		int retval = zsetAdd(zobj, score, ele, flags, &retflags, &newscore);
+		decrRefCount(eleobj);
+		if (retval == 0) {
+			addReplyError(c,nanerr);
+			goto cleanup;
+		}
+		if (retflags & ZADD_OUT_ADDED) added++;
+		if (retflags & ZADD_OUT_UPDATED) updated++;
+		if (!(retflags & ZADD_OUT_NOP)) processed++;
+		score = newscore;
+	}
+	server.dirty += (added+updated);
+
+reply_to_client:
+	if (incr) { /* ZINCRBY or INCR option. */
+		if (processed)
+			addReplyDouble(c,score);
+		else
+			addReply(c,shared.nullbulk);
+	} else { /* ZADD. */
+		addReplyLongLong(c,ch ? added+updated : added);
+	}
+
+cleanup:
+	zfree(scores);
+}
+
+/* ZADD key [NX|XX] [CH] [INCR] score member [score member ...] */
+void zaddCommand(client *c) {
+	zaddGenericCommand(c,ZADD_IN_NONE);
+}
+
+/* ZINCRBY key increment member */
+void zincrbyCommand(client *c) {
+	zaddGenericCommand(c,ZADD_IN_INCR);
+}
+
+/* ZREM key member [member ...] */
+void zremCommand(client *c) {
+	robj *key = c->argv[1];
+	robj *zobj;
+	int deleted = 0, j;
+
+	if ((zobj = lookupKeyWriteOrReply(c,key,shared.czero)) == NULL ||
+		checkType(c,zobj,OBJ_ZSET)) return;
+
+	for (j = 2; j < c->argc; j++) {
+		robj *ele = getDecodedObject(c->argv[j]);
+		int ok = zsetDel(zobj,ele->ptr);
+
+		decrRefCount(ele);
+		if (ok) deleted++;
+		// 有序集合为空时删除这个键
+		if (zsetLength(zobj) == 0) {
+			dbDelete(c->db,key);
+			break;
+		}
+	}
+
+	server.dirty += deleted;
+	addReplyLongLong(c,deleted);
+}
+
+/* ZCARD key */
+void zcardCommand(client *c) {
+	robj *zobj;
+
+	if ((zobj = lookupKeyReadOrReply(c,c->argv[1],shared.czero)) == NULL ||
+		checkType(c,zobj,OBJ_ZSET)) return;
+
+	addReplyLongLong(c,zsetLength(zobj));
+}
+
+/* ZSCORE key member */
+void zscoreCommand(client *c) {
+	robj *zobj, *ele;
+	double score;
+
+	if ((zobj = lookupKeyReadOrReply(c,c->argv[1],shared.nullbulk)) == NULL ||
+		checkType(c,zobj,OBJ_ZSET)) return;
+
+	ele = getDecodedObject(c->argv[2]);
+	if (zsetScore(zobj,ele->ptr,&score) == C_ERR) {
+		addReply(c,shared.nullbulk);
+	} else {
+		addReplyDouble(c,score);
+	}
+	decrRefCount(ele);
+}
+
+static void zrankGenericCommand(client *c, int reverse) {
+	robj *zobj, *ele;
+	long rank;
+
+	if ((zobj = lookupKeyReadOrReply(c,c->argv[1],shared.nullbulk)) == NULL ||
+		checkType(c,zobj,OBJ_ZSET)) return;
+
+	ele = getDecodedObject(c->argv[2]);
+	rank = zsetRank(zobj,ele->ptr,reverse);
+	decrRefCount(ele);
+	if (rank >= 0) {
+		addReplyLongLong(c,rank);
+	} else {
+		addReply(c,shared.nullbulk);
+	}
+}
+
+/* ZRANK key member */
+void zrankCommand(client *c) {
+	zrankGenericCommand(c, 0);
+}
+
+/* ZREVRANK key member */
+void zrevrankCommand(client *c) {
+	zrankGenericCommand(c, 1);
+}
+
+/* 回复listpack中的一个元素 */
+static void addReplyListpackEntry(client *c, unsigned char *p) {
+	unsigned char *vstr;
+	unsigned int vlen;
+	long long vlong;
+
+	vstr = lpGetValue(p,&vlen,&vlong);
+	if (vstr == NULL)
+		addReplyBulkLongLong(c,vlong);
+	else
+		addReplyBulkCBuffer(c,vstr,vlen);
+}
+
+static void zrangeGenericCommand(client *c, int reverse) {
+	robj *key = c->argv[1];
+	robj *zobj;
+	int withscores = 0;
+	long start;
+	long end;
+	long llen;
+	long rangelen;
+
+	if ((getLongFromObjectOrReply(c, c->argv[2], &start, NULL) != C_OK) ||
+		(getLongFromObjectOrReply(c, c->argv[3], &end, NULL) != C_OK)) return;
+
+	if (c->argc == 5 && !strcasecmp(c->argv[4]->ptr,"withscores")) {
+		withscores = 1;
+	} else if (c->argc >= 5) {
+		addReply(c,shared.syntaxerr);
+		return;
+	}
+
+	if ((zobj = lookupKeyReadOrReply(c,key,shared.emptymultibulk)) == NULL
+		 || checkType(c,zobj,OBJ_ZSET)) return;
+
+	/* Sanitize indexes. */
+	llen = zsetLength(zobj);
+	if (start < 0) start = llen+start;
+	if (end < 0) end = llen+end;
+	if (start < 0) start = 0;
+
+	/* Invariant: start >= 0, so this test will be true when end < 0.
+	 * The range is empty when start > end or start >= length. */
+	if (start > end || start >= llen) {
+		addReply(c,shared.emptymultibulk);
+		return;
+	}
+	if (end >= llen) end = llen-1;
+	rangelen = (end-start)+1;
+
+	/* Return the result in form of a multi-bulk reply */
+	addReplyMultiBulkLen(c, withscores ? (rangelen*2) : rangelen);
+
+	if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
+		unsigned char *zl = zobj->ptr;
+		unsigned char *eptr, *sptr;
+
+		if (reverse)
+			eptr = lpSeek(zl,-2-(2*start));
+		else
+			eptr = lpSeek(zl,2*start);
+
+		sptr = lpNext(zl,eptr);
+
+		while (rangelen--) {
+			addReplyListpackEntry(c,eptr);
+			if (withscores) addReplyDouble(c,zzlGetScore(sptr));
+
+			if (reverse)
+				zzlPrev(zl,&eptr,&sptr);
+			else
+				zzlNext(zl,&eptr,&sptr);
+		}
+
+	} else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+		zset *zs = zobj->ptr;
+		zskiplist *zsl = zs->zsl;
+		zskiplistNode *ln;
+		sds ele;
+
+		/* Check if starting point is trivial, before doing log(N) lookup. */
+		if (reverse) {
+			ln = zsl->tail;
+			if (start > 0)
+				ln = zslGetElementByRank(zsl,llen-start);
+		} else {
+			ln = zsl->header->level[0].forward;
+			if (start > 0)
+				ln = zslGetElementByRank(zsl,start+1);
+		}
+
+		while(rangelen--) {
+			ele = ln->ele;
+			addReplyBulkCBuffer(c,ele,sdslen(ele));
+			if (withscores) addReplyDouble(c,ln->score);
+			ln = reverse ? ln->backward : ln->level[0].forward;
+		}
+	} else {
+		printf("Unknown sorted set encoding\n");
+		exit(1);
+	}
+}
+
+/* ZRANGE key start stop [WITHSCORES] */
+void zrangeCommand(client *c) {
+	zrangeGenericCommand(c,0);
+}
+
+/* ZREVRANGE key start stop [WITHSCORES] */
+void zrevrangeCommand(client *c) {
+	zrangeGenericCommand(c,1);
+}
+
+/*
+ * ZRANGEBYSCORE key min max [WITHSCORES] [LIMIT offset count]
+ * 没有延迟回复长度的接口，先计算出范围内的元素个数再回复
+ */
+void zrangebyscoreCommand(client *c) {
+	zrangespec range;
+	robj *key = c->argv[1];
+	robj *zobj;
+	long offset = 0, limit = -1;
+	int withscores = 0;
+	unsigned long rangelen = 0;
+	int j;
+
+	if (zslParseRange(c->argv[2],c->argv[3],&range) != C_OK) {
+		addReplyError(c,"min or max is not a float");
+		return;
+	}
+
+	/* Parse optional extra arguments. Note that ZCOUNT will exactly have
+	 * 4 arguments, so we'll never enter the following code path. */
+	for (j = 4; j < c->argc; j++) {
+		int remaining = c->argc - j;
+		if (!strcasecmp(c->argv[j]->ptr,"withscores")) {
+			withscores = 1;
+		} else if (remaining >= 3 && !strcasecmp(c->argv[j]->ptr,"limit")) {
+			if ((getLongFromObjectOrReply(c, c->argv[j+1], &offset, NULL)
+					!= C_OK) ||
+				(getLongFromObjectOrReply(c, c->argv[j+2], &limit, NULL)
+					!= C_OK)) return;
+			j += 2;
+		} else {
+			addReply(c,shared.syntaxerr);
+			return;
+		}
+	}
+
+	/* Ok, lookup the key and get the range */
+	if ((zobj = lookupKeyReadOrReply(c,key,shared.emptymultibulk)) == NULL ||
+		checkType(c,zobj,OBJ_ZSET)) return;
+
+	if (offset < 0) {
+		addReply(c,shared.emptymultibulk);
+		return;
+	}
+
+	if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
+		unsigned char *zl = zobj->ptr;
+		unsigned char *eptr, *sptr, *first;
+		long skip = offset;
+
+		/* If there is an offset, just skip those elements that fall
+		 * in the range. */
+		first = eptr = zzlFirstInRange(zl,&range);
+		sptr = eptr ? lpNext(zl,eptr) : NULL;
+		while (eptr && skip) {
+			if (!zslValueLteMax(zzlGetScore(sptr),&range)) break;
+			zzlNext(zl,&eptr,&sptr);
+			skip--;
+		}
+		first = skip ? NULL : eptr;
+
+		/* 第一遍计算元素个数 */
+		eptr = first;
+		sptr = eptr ? lpNext(zl,eptr) : NULL;
+		while (eptr && limit != (long)rangelen &&
+			zslValueLteMax(zzlGetScore(sptr),&range))
+		{
+			rangelen++;
+			zzlNext(zl,&eptr,&sptr);
+		}
+
+		addReplyMultiBulkLen(c, withscores ? rangelen*2 : rangelen);
+		eptr = first;
+		sptr = eptr ? lpNext(zl,eptr) : NULL;
+		for (j = 0; (unsigned long)j < rangelen; j++) {
+			addReplyListpackEntry(c,eptr);
+			if (withscores) addReplyDouble(c,zzlGetScore(sptr));
+			zzlNext(zl,&eptr,&sptr);
+		}
+	} else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+		zset *zs = zobj->ptr;
+		zskiplist *zsl = zs->zsl;
+		zskiplistNode *ln, *first;
+		unsigned long rank;
+
+		ln = zslFirstInRange(zsl,&range);
+		if (ln && offset) {
+			/* 利用span直接按排名跳过offset个元素，不需要逐个遍历 */
+			rank = zslGetRank(zsl,ln->score,ln->ele);
+			ln = zslGetElementByRank(zsl,rank+offset);
+			if (ln && !zslValueLteMax(ln->score,&range)) ln = NULL;
+		}
+		first = ln;
+
+		/* 范围的末尾同样通过排名计算，元素个数是两个排名之差 */
+		if (first) {
+			zskiplistNode *last = zslLastInRange(zsl,&range);
+			unsigned long firstrank = zslGetRank(zsl,first->score,first->ele);
+			unsigned long lastrank = zslGetRank(zsl,last->score,last->ele);
+
+			rangelen = lastrank-firstrank+1;
+			if (limit >= 0 && (unsigned long)limit < rangelen) rangelen = limit;
+		}
+
+		addReplyMultiBulkLen(c, withscores ? rangelen*2 : rangelen);
+		for (ln = first; rangelen--; ln = ln->level[0].forward) {
+			addReplyBulkCBuffer(c,ln->ele,sdslen(ln->ele));
+			if (withscores) addReplyDouble(c,ln->score);
+		}
+	} else {
+		printf("Unknown sorted set encoding\n");
+		exit(1);
+	}
+}
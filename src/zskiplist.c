@@ -0,0 +1,671 @@
+/*
+ * Skiplist implementation for sorted sets.
+ * 有序集合的跳跃表实现
+ *
+ * This skiplist implementation is almost a C translation of the original
+ * algorithm described by William Pugh in "Skip Lists: A Probabilistic
+ * Alternative to Balanced Trees", modified in three ways:
+ * a) this implementation allows for repeated scores.
+ * b) the comparison is not just by key (our 'score') but by satellite data.
+ * c) there is a back pointer, so it's a doubly linked list with the back
+ * pointers being only at "level 1". This allows to traverse the list
+ * from tail to head, useful for ZREVRANGE.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "zskiplist.h"
+#include "zmalloc.h"
+
+/* Create a skiplist node with the specified number of levels.
+ * The SDS string 'ele' is referenced by the node after the call. */
+static zskiplistNode *zslCreateNode(int level, double score, sds ele) {
+	zskiplistNode *zn =
+		zmalloc(sizeof(*zn)+level*sizeof(struct zskiplistLevel));
+	zn->score = score;
+	zn->ele = ele;
+	return zn;
+}
+
+/* Create a new skiplist. */
+zskiplist *zslCreate(void) {
+	int j;
+	zskiplist *zsl;
+
+	zsl = zmalloc(sizeof(*zsl));
+	zsl->level = 1;
+	zsl->length = 0;
+	zsl->header = zslCreateNode(ZSKIPLIST_MAXLEVEL,0,NULL);
+	for (j = 0; j < ZSKIPLIST_MAXLEVEL; j++) {
+		zsl->header->level[j].forward = NULL;
+		zsl->header->level[j].span = 0;
+	}
+	zsl->header->backward = NULL;
+	zsl->tail = NULL;
+	return zsl;
+}
+
+/* Free the specified skiplist node. The referenced SDS string representation
+ * of the element is freed too, unless node->ele is set to NULL before calling
+ * this function. */
+void zslFreeNode(zskiplistNode *node) {
+	sdsfree(node->ele);
+	zfree(node);
+}
+
+/* Free a whole skiplist. */
+void zslFree(zskiplist *zsl) {
+	zskiplistNode *node = zsl->header->level[0].forward, *next;
+
+	zfree(zsl->header);
+	while(node) {
+		next = node->level[0].forward;
+		zslFreeNode(node);
+		node = next;
+	}
+	zfree(zsl);
+}
+
+/* Returns a random level for the new skiplist node we are going to create.
+ * The return value of this function is between 1 and ZSKIPLIST_MAXLEVEL
+ * (both inclusive), with a powerlaw-alike distribution where higher
+ * levels are less likely to be returned. */
+static int zslRandomLevel(void) {
+	int level = 1;
+	while ((random()&0xFFFF) < (ZSKIPLIST_P * 0xFFFF))
+		level += 1;
+	return (level<ZSKIPLIST_MAXLEVEL) ? level : ZSKIPLIST_MAXLEVEL;
+}
+
+/* Insert a new node in the skiplist. Assumes the element does not already
+ * exist (up to the caller to enforce that). The skiplist takes ownership
+ * of the passed SDS string 'ele'. */
+zskiplistNode *zslInsert(zskiplist *zsl, double score, sds ele) {
+	zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
+	unsigned int rank[ZSKIPLIST_MAXLEVEL];
+	int i, level;
+
+	x = zsl->header;
+	for (i = zsl->level-1; i >= 0; i--) {
+		/* store rank that is crossed to reach the insert position */
+		rank[i] = i == (zsl->level-1) ? 0 : rank[i+1];
+		while (x->level[i].forward &&
+				(x->level[i].forward->score < score ||
+					(x->level[i].forward->score == score &&
+					sdscmp(x->level[i].forward->ele,ele) < 0)))
+		{
+			rank[i] += x->level[i].span;
+			x = x->level[i].forward;
+		}
+		update[i] = x;
+	}
+	/* we assume the element is not already inside, since we allow duplicated
+	 * scores, reinserting the same element should never happen since the
+	 * caller of zslInsert() should test in the hash table if the element is
+	 * already inside or not. */
+	level = zslRandomLevel();
+	if (level > zsl->level) {
+		for (i = zsl->level; i < level; i++) {
+			rank[i] = 0;
+			update[i] = zsl->header;
+			update[i]->level[i].span = zsl->length;
+		}
+		zsl->level = level;
+	}
+	x = zslCreateNode(level,score,ele);
+	for (i = 0; i < level; i++) {
+		x->level[i].forward = update[i]->level[i].forward;
+		update[i]->level[i].forward = x;
+
+		/* update span covered by update[i] as x is inserted here */
+		x->level[i].span = update[i]->level[i].span - (rank[0] - rank[i]);
+		update[i]->level[i].span = (rank[0] - rank[i]) + 1;
+	}
+
+	/* increment span for untouched levels */
+	for (i = level; i < zsl->level; i++) {
+		update[i]->level[i].span++;
+	}
+
+	x->backward = (update[0] == zsl->header) ? NULL : update[0];
+	if (x->level[0].forward)
+		x->level[0].forward->backward = x;
+	else
+		zsl->tail = x;
+	zsl->length++;
+	return x;
+}
+
+/* Internal function used by zslDelete, zslDeleteRangeByScore and
+ * zslDeleteRangeByRank. */
+static void zslDeleteNode(zskiplist *zsl, zskiplistNode *x, zskiplistNode **update) {
+	int i;
+	for (i = 0; i < zsl->level; i++) {
+		if (update[i]->level[i].forward == x) {
+			update[i]->level[i].span += x->level[i].span - 1;
+			update[i]->level[i].forward = x->level[i].forward;
+		} else {
+			update[i]->level[i].span -= 1;
+		}
+	}
+	if (x->level[0].forward) {
+		x->level[0].forward->backward = x->backward;
+	} else {
+		zsl->tail = x->backward;
+	}
+	while(zsl->level > 1 && zsl->header->level[zsl->level-1].forward == NULL)
+		zsl->level--;
+	zsl->length--;
+}
+
+/* Delete an element with matching score/element from the skiplist.
+ * The function returns 1 if the node was found and deleted, otherwise
+ * 0 is returned.
+ *
+ * If 'node' is NULL the deleted node is freed by zslFreeNode(), otherwise
+ * it is not freed (but just unlinked) and *node is set to the node pointer,
+ * so that it is possible for the caller to reuse the node (including the
+ * referenced SDS string at node->ele). */
+int zslDelete(zskiplist *zsl, double score, sds ele, zskiplistNode **node) {
+	zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
+	int i;
+
+	x = zsl->header;
+	for (i = zsl->level-1; i >= 0; i--) {
+		while (x->level[i].forward &&
+				(x->level[i].forward->score < score ||
+					(x->level[i].forward->score == score &&
+					 sdscmp(x->level[i].forward->ele,ele) < 0)))
+		{
+			x = x->level[i].forward;
+		}
+		update[i] = x;
+	}
+	/* We may have multiple elements with the same score, what we need
+	 * is to find the element with both the right score and object. */
+	x = x->level[0].forward;
+	if (x && score == x->score && sdscmp(x->ele,ele) == 0) {
+		zslDeleteNode(zsl, x, update);
+		if (!node)
+			zslFreeNode(x);
+		else
+			*node = x;
+		return 1;
+	}
+	return 0; /* not found */
+}
+
+/* Update the score of an element inside the sorted set skiplist.
+ * Note that the element must exist and must match 'score'.
+ * This function does not update the score in the hash table side, the
+ * caller should take care of it.
+ *
+ * Note that this function attempts to just update the node, in case after
+ * the score update, the node would be exactly at the same position.
+ * Otherwise the skiplist is modified by removing and re-adding a new
+ * element, which is more costly.
+ *
+ * The function returns the updated element skiplist node pointer. */
+zskiplistNode *zslUpdateScore(zskiplist *zsl, double curscore, sds ele, double newscore) {
+	zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
+	int i;
+
+	/* We need to seek to element to update to start: this is useful anyway,
+	 * we'll have to update or remove it. */
+	x = zsl->header;
+	for (i = zsl->level-1; i >= 0; i--) {
+		while (x->level[i].forward &&
+				(x->level[i].forward->score < curscore ||
+					(x->level[i].forward->score == curscore &&
+					 sdscmp(x->level[i].forward->ele,ele) < 0)))
+		{
+			x = x->level[i].forward;
+		}
+		update[i] = x;
+	}
+
+	/* Jump to our element: note that this function assumes that the
+	 * element with the matching score exists. */
+	x = x->level[0].forward;
+
+	/* If the node, after the score update, would be still exactly
+	 * at the same position, we can just update the score without
+	 * actually removing and re-inserting the element in the skiplist. */
+	if ((x->backward == NULL || x->backward->score < newscore) &&
+		(x->level[0].forward == NULL || x->level[0].forward->score > newscore))
+	{
+		x->score = newscore;
+		return x;
+	}
+
+	/* No way to reuse the old node: we need to remove and insert a new
+	 * one at a different place. */
+	zslDeleteNode(zsl, x, update);
+	zskiplistNode *newnode = zslInsert(zsl,newscore,x->ele);
+	/* We reused the old node x->ele SDS string, free the node now
+	 * since zslInsert created a new one. */
+	x->ele = NULL;
+	zslFreeNode(x);
+	return newnode;
+}
+
+int zslValueGteMin(double value, zrangespec *spec) {
+	return spec->minex ? (value > spec->min) : (value >= spec->min);
+}
+
+int zslValueLteMax(double value, zrangespec *spec) {
+	return spec->maxex ? (value < spec->max) : (value <= spec->max);
+}
+
+/* Returns if there is a part of the zset is in range. */
+static int zslIsInRange(zskiplist *zsl, zrangespec *range) {
+	zskiplistNode *x;
+
+	/* Test for ranges that will always be empty. */
+	if (range->min > range->max ||
+			(range->min == range->max && (range->minex || range->maxex)))
+		return 0;
+	x = zsl->tail;
+	if (x == NULL || !zslValueGteMin(x->score,range))
+		return 0;
+	x = zsl->header->level[0].forward;
+	if (x == NULL || !zslValueLteMax(x->score,range))
+		return 0;
+	return 1;
+}
+
+/* Find the first node that is contained in the specified range.
+ * Returns NULL when no element is contained in the range. */
+zskiplistNode *zslFirstInRange(zskiplist *zsl, zrangespec *range) {
+	zskiplistNode *x;
+	int i;
+
+	/* If everything is out of range, return early. */
+	if (!zslIsInRange(zsl,range)) return NULL;
+
+	x = zsl->header;
+	for (i = zsl->level-1; i >= 0; i--) {
+		/* Go forward while *OUT* of range. */
+		while (x->level[i].forward &&
+			!zslValueGteMin(x->level[i].forward->score,range))
+				x = x->level[i].forward;
+	}
+
+	/* This is an inner range, so the next node cannot be NULL. */
+	x = x->level[0].forward;
+
+	/* Check if score <= max. */
+	if (!zslValueLteMax(x->score,range)) return NULL;
+	return x;
+}
+
+/* Find the last node that is contained in the specified range.
+ * Returns NULL when no element is contained in the range. */
+zskiplistNode *zslLastInRange(zskiplist *zsl, zrangespec *range) {
+	zskiplistNode *x;
+	int i;
+
+	/* If everything is out of range, return early. */
+	if (!zslIsInRange(zsl,range)) return NULL;
+
+	x = zsl->header;
+	for (i = zsl->level-1; i >= 0; i--) {
+		/* Go forward while *IN* range. */
+		while (x->level[i].forward &&
+			zslValueLteMax(x->level[i].forward->score,range))
+				x = x->level[i].forward;
+	}
+
+	/* Check if score >= min. */
+	if (!zslValueGteMin(x->score,range)) return NULL;
+	return x;
+}
+
+/* Find the rank for an element by both score and key.
+ * Returns 0 when the element cannot be found, rank otherwise.
+ * Note that the rank is 1-based due to the span of zsl->header to the
+ * first element. */
+unsigned long zslGetRank(zskiplist *zsl, double score, sds ele) {
+	zskiplistNode *x;
+	unsigned long rank = 0;
+	int i;
+
+	x = zsl->header;
+	for (i = zsl->level-1; i >= 0; i--) {
+		while (x->level[i].forward &&
+			(x->level[i].forward->score < score ||
+				(x->level[i].forward->score == score &&
+				sdscmp(x->level[i].forward->ele,ele) <= 0))) {
+			rank += x->level[i].span;
+			x = x->level[i].forward;
+		}
+
+		/* x might be equal to zsl->header, so test if obj is non-NULL */
+		if (x->ele && x->score == score && sdscmp(x->ele,ele) == 0) {
+			return rank;
+		}
+	}
+	return 0;
+}
+
+/* Finds an element by its rank. The rank argument needs to be 1-based. */
+zskiplistNode *zslGetElementByRank(zskiplist *zsl, unsigned long rank) {
+	zskiplistNode *x;
+	unsigned long traversed = 0;
+	int i;
+
+	x = zsl->header;
+	for (i = zsl->level-1; i >= 0; i--) {
+		while (x->level[i].forward && (traversed + x->level[i].span) <= rank)
+		{
+			traversed += x->level[i].span;
+			x = x->level[i].forward;
+		}
+		if (traversed == rank) {
+			return x;
+		}
+	}
+	return NULL;
+}
+
+#ifdef ZSKIPLIST_BENCHMARK_MAIN
+/*
+ * gcc -O2 -DZSKIPLIST_BENCHMARK_MAIN zskiplist.c sds.c zmalloc.c -lm
+ *
+ * 和B+树实现的顺序统计树比较：内部节点保存每个子树的元素个数，
+ * 叶子节点之间用next指针连接，范围查询定位之后沿着叶子顺序遍历。
+ * 这里只实现了测试需要的插入、按排名查找、按分值查找和计算排名。
+ */
+#include <string.h>
+#include <sys/time.h>
+
+#define OST_FANOUT 32
+
+typedef struct ostNode {
+	int leaf, n;
+	/* 叶子节点保存元素；内部节点保存每个子树中最小的元素 */
+	double score[OST_FANOUT];
+	sds ele[OST_FANOUT];
+	struct ostNode *child[OST_FANOUT];
+	unsigned long count[OST_FANOUT];
+	struct ostNode *next;
+} ostNode;
+
+typedef struct ost {
+	ostNode *root;
+	unsigned long length;
+} ost;
+
+static int ostCmp(double s1, sds e1, double s2, sds e2) {
+	if (s1 < s2) return -1;
+	if (s1 > s2) return 1;
+	return sdscmp(e1,e2);
+}
+
+static ostNode *ostCreateNode(int leaf) {
+	ostNode *n = zcalloc(sizeof(*n));
+	n->leaf = leaf;
+	return n;
+}
+
+static unsigned long ostNodeSize(ostNode *n) {
+	unsigned long size = 0;
+	int i;
+
+	if (n->leaf) return n->n;
+	for (i = 0; i < n->n; i++) size += n->count[i];
+	return size;
+}
+
+/* 内部节点中最后一个最小元素不大于(score,ele)的子树 */
+static int ostChildIndex(ostNode *n, double score, sds ele) {
+	int i = n->n-1;
+	while (i > 0 && ostCmp(n->score[i],n->ele[i],score,ele) > 0) i--;
+	return i;
+}
+
+/* 节点满了之后分裂成两半，返回新的右半部分 */
+static ostNode *ostSplit(ostNode *n) {
+	ostNode *r = ostCreateNode(n->leaf);
+	int half = n->n/2;
+
+	r->n = n->n-half;
+	memcpy(r->score,n->score+half,sizeof(double)*r->n);
+	memcpy(r->ele,n->ele+half,sizeof(sds)*r->n);
+	memcpy(r->child,n->child+half,sizeof(ostNode*)*r->n);
+	memcpy(r->count,n->count+half,sizeof(unsigned long)*r->n);
+	n->n = half;
+	if (n->leaf) {
+		r->next = n->next;
+		n->next = r;
+	}
+	return r;
+}
+
+static ostNode *ostInsertNode(ostNode *n, double score, sds ele) {
+	int i;
+
+	if (n->leaf) {
+		for (i = n->n; i > 0 && ostCmp(n->score[i-1],n->ele[i-1],score,ele) > 0; i--) {
+			n->score[i] = n->score[i-1];
+			n->ele[i] = n->ele[i-1];
+		}
+		n->score[i] = score;
+		n->ele[i] = ele;
+		n->n++;
+	} else {
+		ostNode *r;
+
+		i = ostChildIndex(n,score,ele);
+		if (i == 0 && ostCmp(n->score[0],n->ele[0],score,ele) > 0) {
+			n->score[0] = score;
+			n->ele[0] = ele;
+		}
+		r = ostInsertNode(n->child[i],score,ele);
+		n->count[i]++;
+		if (r) {
+			memmove(n->score+i+2,n->score+i+1,sizeof(double)*(n->n-i-1));
+			memmove(n->ele+i+2,n->ele+i+1,sizeof(sds)*(n->n-i-1));
+			memmove(n->child+i+2,n->child+i+1,sizeof(ostNode*)*(n->n-i-1));
+			memmove(n->count+i+2,n->count+i+1,sizeof(unsigned long)*(n->n-i-1));
+			n->score[i+1] = r->score[0];
+			n->ele[i+1] = r->ele[0];
+			n->child[i+1] = r;
+			n->count[i+1] = ostNodeSize(r);
+			n->count[i] -= n->count[i+1];
+			n->n++;
+		}
+	}
+	return (n->n == OST_FANOUT) ? ostSplit(n) : NULL;
+}
+
+static void ostInsert(ost *t, double score, sds ele) {
+	ostNode *r;
+
+	if (t->root == NULL) t->root = ostCreateNode(1);
+	if ((r = ostInsertNode(t->root,score,ele)) != NULL) {
+		ostNode *root = ostCreateNode(0);
+		ostNode *l = t->root;
+
+		root->n = 2;
+		root->child[0] = l;
+		root->child[1] = r;
+		root->score[0] = l->score[0];
+		root->ele[0] = l->ele[0];
+		root->score[1] = r->score[0];
+		root->ele[1] = r->ele[0];
+		root->count[0] = ostNodeSize(l);
+		root->count[1] = ostNodeSize(r);
+		t->root = root;
+	}
+	t->length++;
+}
+
+/* 0-based排名，找不到返回-1 */
+static long ostGetRank(ost *t, double score, sds ele) {
+	ostNode *n = t->root;
+	long rank = 0;
+	int i, j;
+
+	while (!n->leaf) {
+		i = ostChildIndex(n,score,ele);
+		for (j = 0; j < i; j++) rank += n->count[j];
+		n = n->child[i];
+	}
+	for (i = 0; i < n->n; i++)
+		if (n->score[i] == score && sdscmp(n->ele[i],ele) == 0) return rank+i;
+	return -1;
+}
+
+/* 按0-based排名定位，返回叶子节点和节点内的位置 */
+static ostNode *ostSeekRank(ost *t, unsigned long rank, int *pos) {
+	ostNode *n = t->root;
+	int i;
+
+	while (!n->leaf) {
+		for (i = 0; i < n->n-1 && rank >= n->count[i]; i++) rank -= n->count[i];
+		n = n->child[i];
+	}
+	*pos = rank;
+	return n;
+}
+
+/* 第一个score >= min的元素 */
+static ostNode *ostSeekScore(ost *t, double min, int *pos) {
+	ostNode *n = t->root;
+	int i;
+
+	while (!n->leaf) {
+		i = n->n-1;
+		while (i > 0 && n->score[i] >= min) i--;
+		n = n->child[i];
+	}
+	while (n) {
+		for (i = 0; i < n->n; i++) {
+			if (n->score[i] >= min) {
+				*pos = i;
+				return n;
+			}
+		}
+		n = n->next;
+	}
+	return NULL;
+}
+
+static long long ustime(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+#define BENCH(name,...) do { \
+	long long _start = ustime(); \
+	__VA_ARGS__; \
+	printf("  %-28s %8.1f ns/op\n", name, \
+		(double)(ustime()-_start)*1000/ops); \
+} while(0)
+
+int main(int argc, char **argv) {
+	long n = argc > 1 ? atol(argv[1]) : 1000000;
+	long ops = n, i, j;
+	const int range = 10;
+	sds *eles = zmalloc(sizeof(sds)*n);
+	double *scores = zmalloc(sizeof(double)*n);
+	volatile double sink = 0;
+	size_t mem;
+
+	srandom(1234);
+	for (i = 0; i < n; i++) {
+		eles[i] = sdscatprintf(sdsempty(),"member:%ld",i);
+		scores[i] = (double)(random()%(n*10));
+	}
+
+	printf("skiplist, %ld elements:\n", n);
+	zskiplist *zsl = zslCreate();
+	mem = zmalloc_used_memory();
+	BENCH("insert", for (i = 0; i < n; i++) zslInsert(zsl,scores[i],eles[i]));
+	printf("  %-28s %8.1f bytes/elem\n","memory (excl. sds)",
+		(double)(zmalloc_used_memory()-mem)/n);
+	BENCH("rank", for (i = 0; i < ops; i++) {
+		j = random()%n;
+		sink += zslGetRank(zsl,scores[j],eles[j]);
+	});
+	BENCH("range by rank (10)", for (i = 0; i < ops; i++) {
+		zskiplistNode *x = zslGetElementByRank(zsl,1+random()%(n-range));
+		for (j = 0; j < range && x; j++, x = x->level[0].forward) sink += x->score;
+	});
+	BENCH("range by score (10)", for (i = 0; i < ops; i++) {
+		zrangespec spec = {(double)(random()%(n*10)),1e300,0,0};
+		zskiplistNode *x = zslFirstInRange(zsl,&spec);
+		for (j = 0; j < range && x; j++, x = x->level[0].forward) sink += x->score;
+	});
+
+	printf("B+tree order statistic tree (fanout %d), %ld elements:\n",
+		OST_FANOUT, n);
+	ost t = {NULL, 0};
+	mem = zmalloc_used_memory();
+	BENCH("insert", for (i = 0; i < n; i++) ostInsert(&t,scores[i],eles[i]));
+	printf("  %-28s %8.1f bytes/elem\n","memory (excl. sds)",
+		(double)(zmalloc_used_memory()-mem)/n);
+	BENCH("rank", for (i = 0; i < ops; i++) {
+		j = random()%n;
+		sink += ostGetRank(&t,scores[j],eles[j]);
+	});
+	BENCH("range by rank (10)", for (i = 0; i < ops; i++) {
+		int pos;
+		ostNode *x = ostSeekRank(&t,random()%(n-range),&pos);
+		for (j = 0; j < range && x; j++) {
+			sink += x->score[pos];
+			if (++pos == x->n) { x = x->next; pos = 0; }
+		}
+	});
+	BENCH("range by score (10)", for (i = 0; i < ops; i++) {
+		int pos;
+		ostNode *x = ostSeekScore(&t,(double)(random()%(n*10)),&pos);
+		for (j = 0; j < range && x; j++) {
+			sink += x->score[pos];
+			if (++pos == x->n) { x = x->next; pos = 0; }
+		}
+	});
+
+	/* 交叉检查两种实现的排名是否一致 */
+	for (i = 0; i < 1000; i++) {
+		j = random()%n;
+		if ((long)zslGetRank(zsl,scores[j],eles[j])-1 != ostGetRank(&t,scores[j],eles[j])) {
+			printf("RANK MISMATCH for %s\n", eles[j]);
+			return 1;
+		}
+	}
+	return 0;
+}
+#endif